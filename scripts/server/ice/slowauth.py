@@ -0,0 +1,63 @@
+#!/usr/bin/env python
+# -*- coding: utf-8
+#
+# Stand-in external authenticator with a fixed latency, for measuring how
+# many joins per second murmur handles while waiting for one. It has no
+# opinion on anyone (-2), so murmur falls back to its own database.
+#
+# Usage: slowauth.py [latency ms] [threads] [fraction that never answers]
+#
+# Murmur keeps up to authqueue requests in flight; run with at least that
+# many threads, or this script becomes the bottleneck. Requests that never
+# answer are turned away by murmur after authtimeout seconds. Connect with
+# src/tests/LoadGen to see the join rate and time.
+import Ice, sys, time, random
+Ice.loadSlice('', ['-I' + Ice.getSliceDir(), 'Murmur.ice'])
+import Murmur
+
+latency = float(sys.argv[1]) / 1000.0 if len(sys.argv) > 1 else 0.01
+threads = int(sys.argv[2]) if len(sys.argv) > 2 else 64
+hang = float(sys.argv[3]) if len(sys.argv) > 3 else 0.0
+
+class ServerAuthenticatorI(Murmur.ServerAuthenticator):
+    def authenticate(self, name, pw, certlist, certhash, strong, current=None):
+      if random.random() < hang:
+        time.sleep(3600)
+      time.sleep(latency)
+      return (-2, None, None)
+
+    def getInfo(self, id, current=None):
+      return (False, {})
+
+    def nameToId(self, name, current=None):
+      return -2
+
+    def idToName(self, id, current=None):
+      return None
+
+    def idToTexture(self, id, current=None):
+      return ""
+
+if __name__ == "__main__":
+    props = Ice.createProperties(sys.argv)
+    props.setProperty("Ice.ThreadPool.Server.Size", str(threads))
+    props.setProperty("Ice.ThreadPool.Server.SizeMax", str(threads))
+    data = Ice.InitializationData()
+    data.properties = props
+    ice = Ice.initialize(data)
+
+    meta = Murmur.MetaPrx.checkedCast(ice.stringToProxy('Meta:tcp -h 127.0.0.1 -p 6502'))
+
+    adapter = ice.createObjectAdapterWithEndpoints("Callback.Client", "tcp -h 127.0.0.1")
+    adapter.activate()
+
+    for server in meta.getBootedServers():
+      serverR = Murmur.ServerAuthenticatorPrx.uncheckedCast(adapter.addWithUUID(ServerAuthenticatorI()))
+      server.setAuthenticator(serverR)
+
+    print 'Answering after %d ms with %d threads (press CTRL-C to abort)' % (latency * 1000, threads)
+    try:
+        ice.waitForShutdown()
+    except KeyboardInterrupt:
+        print 'CTRL-C caught, aborting'
+    ice.shutdown()
@@ -36,6 +36,7 @@
 #include "User.h"
 
 #ifdef MURMUR
+#include "ACLEngine.h"
 #include "ServerUser.h"
 #endif
 
@@ -51,6 +52,18 @@ ChanACL::ChanACL(Channel *chan) : QObject(chan) {
 		c->qlACL << this;
 }
 
+#ifdef MURMUR
+
+ChanACL::ACLCache::ACLCache() {
+	aeEngine = new ACLEngine();
+}
+
+ChanACL::ACLCache::~ACLCache() {
+	delete aeEngine;
+}
+
+#endif
+
 // Check permissions.
 // This will always return true for the superuser,
 // and will return false if a user isn't allowed to
@@ -83,66 +96,11 @@ QFlags<ChanACL::Perm> ChanACL::effectivePermissions(ServerUser *p, Channel *chan
 		return granted;
 	}
 
-	QStack<Channel *> chanstack;
-	Channel *ch = chan;
-
-	while (ch) {
-		chanstack.push(ch);
-		ch = ch->cParent;
-	}
-
-	// Default permissions
-	Permissions def = Traverse | Enter | Speak | Whisper | TextMessage;
-
-	granted = def;
-
-	bool traverse = true;
-	bool write = false;
-	ChanACL *acl;
-
-	while (! chanstack.isEmpty()) {
-		ch = chanstack.pop();
-		if (! ch->bInheritACL)
-			granted = def;
-
-		foreach(acl, ch->qlACL) {
-			bool matchUser = (acl->iUserId != -1) && (acl->iUserId == p->iId);
-			bool matchGroup = Group::isMember(chan, ch, acl->qsGroup, p);
-			if (matchUser || matchGroup) {
-				if (acl->pAllow & Traverse)
-					traverse = true;
-				if (acl->pDeny & Traverse)
-					traverse = false;
-				if (acl->pAllow & Write)
-					write = true;
-				if (acl->pDeny & Write)
-					write = false;
-				if (ch->iId == 0 && chan == ch && acl->bApplyHere) {
-					if (acl->pAllow & Kick)
-						granted |= Kick;
-					if (acl->pAllow & Ban)
-						granted |= Ban;
-					if (acl->pAllow & Register)
-						granted |= Register;
-					if (acl->pAllow & SelfRegister)
-						granted |= SelfRegister;
-				}
-				if ((ch==chan && acl->bApplyHere) || (ch!=chan && acl->bApplySubs)) {
-					granted |= (acl->pAllow & ~(Kick|Ban|Register|SelfRegister|Cached));
-					granted &= ~acl->pDeny;
-				}
-			}
-		}
-		if (! traverse && ! write) {
-			granted = None;
-			break;
-		}
-	}
-
-	if (granted & Write) {
-		granted |= Traverse|Enter|MuteDeafen|Move|MakeChannel|LinkChannel|TextMessage|MakeTempChannel;
-		if (chan->iId == 0)
-			granted |= Kick|Ban|Register|SelfRegister;
+	if (cache) {
+		granted = cache->aeEngine->effectivePermissions(p, p->bVerified, p->qslAccessTokens, chan);
+	} else {
+		ACLEngine ae;
+		granted = ae.effectivePermissions(p, p->bVerified, p->qslAccessTokens, chan);
 	}
 
 	if (cache) {
@@ -37,6 +37,7 @@
 class Channel;
 class User;
 class ServerUser;
+class ACLEngine;
 
 class ChanACL : public QObject {
 	private:
@@ -70,7 +71,19 @@ class ChanACL : public QObject {
 		Q_DECLARE_FLAGS(Permissions, Perm)
 
 		typedef QHash<Channel *, Permissions> ChanCache;
+#ifdef MURMUR
+		// Per user results, and the compiled channel tree they come from.
+		class ACLCache : public QHash<User *, ChanCache *> {
+			private:
+				Q_DISABLE_COPY(ACLCache)
+			public:
+				ACLEngine *aeEngine;
+				ACLCache();
+				~ACLCache();
+		};
+#else
 		typedef QHash<User *, ChanCache * > ACLCache;
+#endif
 
 		Channel *c;
 		bool bApplyHere;
@@ -40,16 +40,50 @@
 #include "Connection.h"
 #include "Message.h"
 #include "Mumble.pb.h"
+#ifdef MURMUR
+#include "NetworkThread.h"
+#endif
 
-
-#ifdef Q_OS_WIN
+#if defined(Q_OS_WIN) && !defined(MURMUR)
 HANDLE Connection::hQoS = NULL;
 #endif
 
+#ifdef MURMUR
+/* The socket is behind handler, which may be moved to a network thread
+ * once this returns. All its signals arrive here queued, and are dropped
+ * along with this object if it goes away first.
+ */
+Connection::Connection(QObject *p, SocketHandler *handler) : QObject(p) {
+	shSocket = handler;
+	bDisconnectedEmitted = false;
+
+	static bool bDeclared = false;
+	if (! bDeclared) {
+		bDeclared = true;
+		qRegisterMetaType<QAbstractSocket::SocketError>("QAbstractSocket::SocketError");
+	}
+
+	connect(shSocket, SIGNAL(connectionClosed(QAbstractSocket::SocketError, const QString &)), this, SIGNAL(connectionClosed(QAbstractSocket::SocketError, const QString &)));
+	connect(shSocket, SIGNAL(encrypted()), this, SIGNAL(encrypted()));
+	connect(shSocket, SIGNAL(message(unsigned int, const QByteArray &, const ParsedMessage &)), this, SIGNAL(message(unsigned int, const QByteArray &, const ParsedMessage &)));
+	connect(shSocket, SIGNAL(handleSslErrors(const QList<QSslError> &)), this, SIGNAL(handleSslErrors(const QList<QSslError> &)));
+	qtLastPacket.restart();
+}
+
+Connection::~Connection() {
+	shSocket->deleteLater();
+}
+
+void Connection::startServerEncryption() {
+	QMetaObject::invokeMethod(shSocket, "startServerEncryption", Qt::QueuedConnection);
+}
+#else
+
 Connection::Connection(QObject *p, QSslSocket *qtsSock) : QObject(p) {
 	qtsSocket = qtsSock;
 	qtsSocket->setParent(this);
 	iPacketLength = -1;
+	bNoDelay = false;
 	bDisconnectedEmitted = false;
 
 	static bool bDeclared = false;
@@ -108,6 +142,8 @@ void Connection::setToS() {
 #endif
 }
 
+#endif
+
 int Connection::activityTime() const {
 	return qtLastPacket.elapsed();
 }
@@ -116,6 +152,7 @@ void Connection::resetActivityTime() {
 	qtLastPacket.restart();
 }
 
+#ifndef MURMUR
 /**
  * This function waits until a complete package is received and then emits it as a message.
  * It gets called everytime new data is available and interprets the message prefix header
@@ -125,7 +162,7 @@ void Connection::resetActivityTime() {
  *
  * @see QSslSocket::readyRead()
  * @see void ServerHandler::message(unsigned int msgType, const QByteArray &qbaMsg)
- * @see void Server::message(unsigned int uiType, const QByteArray &qbaMsg, ServerUser *u)
+ * @see void SocketHandler::socketRead()
  */
 void Connection::socketRead() {
 	while (true) {
@@ -175,16 +212,10 @@ void Connection::socketDisconnected() {
 	emit connectionClosed(QAbstractSocket::UnknownSocketError, QString());
 }
 
-void Connection::messageToNetwork(const ::google::protobuf::Message &msg, unsigned int msgType, QByteArray &cache) {
-	int len = msg.ByteSize();
-	if (len > 0x7fffff)
-		return;
-	cache.resize(len + 6);
-	unsigned char *uc = reinterpret_cast<unsigned char *>(cache.data());
-	qToBigEndian<quint16>(msgType, & uc[0]);
-	qToBigEndian<quint32>(len, & uc[2]);
+#endif
 
-	msg.SerializeToArray(uc + 6, len);
+void Connection::messageToNetwork(const ::google::protobuf::Message &msg, unsigned int msgType, QByteArray &cache) {
+	::messageToNetwork(msg, msgType, cache);
 }
 
 void Connection::sendMessage(const ::google::protobuf::Message &msg, unsigned int msgType, QByteArray &cache) {
@@ -195,6 +226,41 @@ void Connection::sendMessage(const ::google::protobuf::Message &msg, unsigned in
 	sendMessage(cache);
 }
 
+#ifdef MURMUR
+void Connection::sendMessage(const QByteArray &qbaMsg) {
+	if (! qbaMsg.isEmpty())
+		QMetaObject::invokeMethod(shSocket, "write", Qt::AutoConnection, Q_ARG(QByteArray, qbaMsg));
+}
+
+void Connection::forceFlush() {
+	QMetaObject::invokeMethod(shSocket, "flush", Qt::AutoConnection, Q_ARG(bool, false));
+}
+
+void Connection::flushVoice() {
+	QMetaObject::invokeMethod(shSocket, "flush", Qt::AutoConnection, Q_ARG(bool, true));
+}
+
+// Closing is always reported through connectionClosed(), queued.
+void Connection::disconnectSocket(bool force) {
+	QMetaObject::invokeMethod(shSocket, "disconnectSocket", Qt::QueuedConnection, Q_ARG(bool, force));
+}
+
+QHostAddress Connection::peerAddress() const {
+	return shSocket->qhaPeerAddress;
+}
+
+quint16 Connection::peerPort() const {
+	return shSocket->usPeerPort;
+}
+
+QList<QSslCertificate> Connection::peerCertificateChain() const {
+	return shSocket->peerCertificateChain();
+}
+
+QSslCipher Connection::sessionCipher() const {
+	return shSocket->sessionCipher();
+}
+#else
 void Connection::sendMessage(const QByteArray &qbaMsg) {
 	if (! qbaMsg.isEmpty())
 		qtsSocket->write(qbaMsg);
@@ -217,6 +283,27 @@ void Connection::forceFlush() {
 	setsockopt(qtsSocket->socketDescriptor(), IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char *>(&nodelay), sizeof(nodelay));
 }
 
+/* Like forceFlush(), for a connection that carries voice from now on.
+ * Instead of toggling TCP_NODELAY around every flush it is turned on once
+ * and left on, which costs a little coalescing of other messages but no
+ * system calls per voice packet.
+ */
+void Connection::flushVoice() {
+	if (qtsSocket->state() != QAbstractSocket::ConnectedState)
+		return;
+
+	if (! qtsSocket->isEncrypted())
+		return;
+
+	if (! bNoDelay) {
+		int nodelay = 1;
+		setsockopt(qtsSocket->socketDescriptor(), IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char *>(&nodelay), sizeof(nodelay));
+		bNoDelay = true;
+	}
+
+	qtsSocket->flush();
+}
+
 void Connection::disconnectSocket(bool force) {
 	if (qtsSocket->state() == QAbstractSocket::UnconnectedState) {
 		emit connectionClosed(QAbstractSocket::UnknownSocketError, QString());
@@ -254,3 +341,4 @@ void Connection::setQoS(HANDLE hParentQoS) {
 	hQoS = hParentQoS;
 }
 #endif
+#endif
@@ -39,6 +39,9 @@
 #endif
 #include <QtCore/QList>
 #include <QtCore/QObject>
+#ifdef MURMUR
+#include <QtCore/QSharedPointer>
+#endif
 #include <QtNetwork/QSslSocket>
 #ifdef Q_OS_WIN
 #include <windows.h>
@@ -52,19 +55,30 @@ class Message;
 }
 }
 
+#ifdef MURMUR
+class SocketHandler;
+
+typedef QSharedPointer< ::google::protobuf::Message> ParsedMessage;
+#endif
+
 class Connection : public QObject {
 	private:
 		Q_OBJECT
 		Q_DISABLE_COPY(Connection)
 	protected:
-		QSslSocket *qtsSocket;
 #if QT_VERSION >= 0x040700
 		QElapsedTimer qtLastPacket;
 #else
 		QTime qtLastPacket;
 #endif
+#ifdef MURMUR
+		// Lives in a network thread; only talked to through queued calls.
+		SocketHandler *shSocket;
+#else
+		QSslSocket *qtsSocket;
 		unsigned int uiType;
 		int iPacketLength;
+		bool bNoDelay;
 #ifdef Q_OS_WIN
 		static HANDLE hQoS;
 		DWORD dwFlow;
@@ -76,23 +90,36 @@ class Connection : public QObject {
 		void socketSslErrors(const QList<QSslError> &errors);
 	public slots:
 		void proceedAnyway();
+#endif
 	signals:
 		void encrypted();
 		void connectionClosed(QAbstractSocket::SocketError, const QString &reason);
+#ifdef MURMUR
+		void message(unsigned int type, const QByteArray &, const ParsedMessage &);
+#else
 		void message(unsigned int type, const QByteArray &);
+#endif
 		void handleSslErrors(const QList<QSslError> &);
 	public:
+#ifdef MURMUR
+		Connection(QObject *parent, SocketHandler *handler);
+#else
 		Connection(QObject *parent, QSslSocket *qtsSocket);
+#endif
 		~Connection();
 		static void messageToNetwork(const ::google::protobuf::Message &msg, unsigned int msgType, QByteArray &cache);
 		void sendMessage(const ::google::protobuf::Message &msg, unsigned int msgType, QByteArray &cache);
 		void sendMessage(const QByteArray &qbaMsg);
 		void disconnectSocket(bool force=false);
 		void forceFlush();
+		void flushVoice();
 		int activityTime() const;
 		void resetActivityTime();
 
+#ifndef MURMUR
+		// The server keeps this in ServerUser::veEndpoint.
 		CryptState csCrypt;
+#endif
 
 		QList<QSslCertificate> peerCertificateChain() const;
 		QSslCipher sessionCipher() const;
@@ -100,14 +127,22 @@ class Connection : public QObject {
 		quint16 peerPort() const;
 		bool bDisconnectedEmitted;
 
+#ifdef MURMUR
+		void startServerEncryption();
+#else
 		void setToS();
 #ifdef Q_OS_WIN
 		static void setQoS(HANDLE hParentQoS);
 #endif
+#endif
 };
 
 #if QT_VERSION < QT_VERSION_CHECK(5, 0, 0)
 Q_DECLARE_METATYPE(QAbstractSocket::SocketError)
 #endif
 
+#ifdef MURMUR
+Q_DECLARE_METATYPE(ParsedMessage)
+#endif
+
 #endif
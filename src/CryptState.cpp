@@ -43,10 +43,36 @@
 
 #include "Net.h"
 
+/*
+ * On x86 the OCB mode below is also implemented with AES-NI, selected at
+ * runtime. Both implementations produce identical output.
+ */
+#if !defined(NO_AESNI) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+# if defined(_MSC_VER)
+#  define USE_AESNI
+#  define AESNI_TARGET
+# elif defined(__clang__) || (defined(__GNUC__) && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9))))
+#  define USE_AESNI
+#  define AESNI_TARGET __attribute__((target("aes,sse2,ssse3")))
+# endif
+#endif
+
+#ifdef USE_AESNI
+# include <emmintrin.h>
+# include <tmmintrin.h>
+# include <wmmintrin.h>
+# ifdef _MSC_VER
+#  include <intrin.h>
+# else
+#  include <cpuid.h>
+# endif
+#endif
+
 CryptState::CryptState() {
 	for (int i=0;i<0x100;i++)
 		decrypt_history[i] = 0;
 	bInit = false;
+	bAESNI = false;
 	uiGood=uiLate=uiLost=uiResync=0;
 	uiRemoteGood=uiRemoteLate=uiRemoteLost=uiRemoteResync=0;
 }
@@ -59,18 +85,14 @@ void CryptState::genKey() {
 	RAND_bytes(raw_key, AES_BLOCK_SIZE);
 	RAND_bytes(encrypt_iv, AES_BLOCK_SIZE);
 	RAND_bytes(decrypt_iv, AES_BLOCK_SIZE);
-	AES_set_encrypt_key(raw_key, 128, &encrypt_key);
-	AES_set_decrypt_key(raw_key, 128, &decrypt_key);
-	bInit = true;
+	setupKeys();
 }
 
 void CryptState::setKey(const unsigned char *rkey, const unsigned char *eiv, const unsigned char *div) {
 	memcpy(raw_key, rkey, AES_BLOCK_SIZE);
 	memcpy(encrypt_iv, eiv, AES_BLOCK_SIZE);
 	memcpy(decrypt_iv, div, AES_BLOCK_SIZE);
-	AES_set_encrypt_key(raw_key, 128, &encrypt_key);
-	AES_set_decrypt_key(raw_key, 128, &decrypt_key);
-	bInit = true;
+	setupKeys();
 }
 
 void CryptState::setDecryptIV(const unsigned char *iv) {
@@ -181,7 +203,8 @@ bool CryptState::decrypt(const unsigned char *source, unsigned char *dst, unsign
 	uiLate += late;
 	uiLost += lost;
 
-	tLastGood.restart();
+	// Voice threads decrypt a whole batch at the same cached time.
+	tLastGood.restart(Timer::cached());
 	return true;
 }
 
@@ -233,9 +256,245 @@ static void inline ZERO(keyblock &block) {
 #define AESencrypt(src,dst,key) AES_encrypt(reinterpret_cast<const unsigned char *>(src),reinterpret_cast<unsigned char *>(dst), key);
 #define AESdecrypt(src,dst,key) AES_decrypt(reinterpret_cast<const unsigned char *>(src),reinterpret_cast<unsigned char *>(dst), key);
 
+#ifdef USE_AESNI
+/*
+ * The AES-NI implementation keeps the OCB offset in integer order (byte
+ * reversed), so doubling it is a plain 128-bit shift. Four full blocks are
+ * encrypted at a time, as their offsets don't depend on the cipher output.
+ */
+
+#define AESNI_BSWAP _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)
+
+AESNI_TARGET static inline __m128i aesni_double(__m128i v) {
+	__m128i carry = _mm_srli_epi64(v, 63);
+	v = _mm_slli_epi64(v, 1);
+	v = _mm_or_si128(v, _mm_slli_si128(carry, 8));
+	__m128i top = _mm_sub_epi32(_mm_setzero_si128(), _mm_srli_si128(carry, 8));
+	return _mm_xor_si128(v, _mm_and_si128(top, _mm_cvtsi32_si128(0x87)));
+}
+
+AESNI_TARGET static inline __m128i aesni_expand(__m128i key, __m128i assist) {
+	assist = _mm_shuffle_epi32(assist, _MM_SHUFFLE(3, 3, 3, 3));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	return _mm_xor_si128(key, assist);
+}
+
+#define AESNI_EXPAND(i, rcon) rk[i] = aesni_expand(rk[i-1], _mm_aeskeygenassist_si128(rk[i-1], rcon))
+
+AESNI_TARGET static void aesni_set_keys(const unsigned char *raw, unsigned char *enc, unsigned char *dec) {
+	__m128i rk[11];
+
+	rk[0] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(raw));
+	AESNI_EXPAND(1, 0x01);
+	AESNI_EXPAND(2, 0x02);
+	AESNI_EXPAND(3, 0x04);
+	AESNI_EXPAND(4, 0x08);
+	AESNI_EXPAND(5, 0x10);
+	AESNI_EXPAND(6, 0x20);
+	AESNI_EXPAND(7, 0x40);
+	AESNI_EXPAND(8, 0x80);
+	AESNI_EXPAND(9, 0x1b);
+	AESNI_EXPAND(10, 0x36);
+
+	for (int i=0;i<11;i++)
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(enc + i * AES_BLOCK_SIZE), rk[i]);
+
+	// Equivalent inverse cipher round keys.
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(dec), rk[10]);
+	for (int i=1;i<10;i++)
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dec + i * AES_BLOCK_SIZE), _mm_aesimc_si128(rk[10-i]));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(dec + 10 * AES_BLOCK_SIZE), rk[0]);
+}
+
+AESNI_TARGET static inline void aesni_load_keys(__m128i *rk, const unsigned char *key) {
+	for (int i=0;i<11;i++)
+		rk[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(key + i * AES_BLOCK_SIZE));
+}
+
+AESNI_TARGET static inline __m128i aesni_encrypt(__m128i b, const __m128i *rk) {
+	b = _mm_xor_si128(b, rk[0]);
+	for (int i=1;i<10;i++)
+		b = _mm_aesenc_si128(b, rk[i]);
+	return _mm_aesenclast_si128(b, rk[10]);
+}
+
+AESNI_TARGET static inline void aesni_encrypt4(__m128i *b, const __m128i *rk) {
+	for (int j=0;j<4;j++)
+		b[j] = _mm_xor_si128(b[j], rk[0]);
+	for (int i=1;i<10;i++)
+		for (int j=0;j<4;j++)
+			b[j] = _mm_aesenc_si128(b[j], rk[i]);
+	for (int j=0;j<4;j++)
+		b[j] = _mm_aesenclast_si128(b[j], rk[10]);
+}
+
+AESNI_TARGET static inline __m128i aesni_decrypt(__m128i b, const __m128i *rk) {
+	b = _mm_xor_si128(b, rk[0]);
+	for (int i=1;i<10;i++)
+		b = _mm_aesdec_si128(b, rk[i]);
+	return _mm_aesdeclast_si128(b, rk[10]);
+}
+
+AESNI_TARGET static inline void aesni_decrypt4(__m128i *b, const __m128i *rk) {
+	for (int j=0;j<4;j++)
+		b[j] = _mm_xor_si128(b[j], rk[0]);
+	for (int i=1;i<10;i++)
+		for (int j=0;j<4;j++)
+			b[j] = _mm_aesdec_si128(b[j], rk[i]);
+	for (int j=0;j<4;j++)
+		b[j] = _mm_aesdeclast_si128(b[j], rk[10]);
+}
+
+AESNI_TARGET static void aesni_ocb_encrypt(const unsigned char *key, const unsigned char *plain, unsigned char *encrypted, unsigned int len, const unsigned char *nonce, unsigned char *tag) {
+	const __m128i bswap = AESNI_BSWAP;
+	__m128i rk[11];
+	__m128i offset[4], block[4];
+
+	aesni_load_keys(rk, key);
+
+	__m128i delta = _mm_shuffle_epi8(aesni_encrypt(_mm_loadu_si128(reinterpret_cast<const __m128i *>(nonce)), rk), bswap);
+	__m128i checksum = _mm_setzero_si128();
+
+	while (len > 4 * AES_BLOCK_SIZE) {
+		for (int j=0;j<4;j++) {
+			delta = aesni_double(delta);
+			offset[j] = _mm_shuffle_epi8(delta, bswap);
+			__m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(plain + j * AES_BLOCK_SIZE));
+			checksum = _mm_xor_si128(checksum, p);
+			block[j] = _mm_xor_si128(p, offset[j]);
+		}
+		aesni_encrypt4(block, rk);
+		for (int j=0;j<4;j++)
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(encrypted + j * AES_BLOCK_SIZE), _mm_xor_si128(block[j], offset[j]));
+		len -= 4 * AES_BLOCK_SIZE;
+		plain += 4 * AES_BLOCK_SIZE;
+		encrypted += 4 * AES_BLOCK_SIZE;
+	}
+
+	while (len > AES_BLOCK_SIZE) {
+		delta = aesni_double(delta);
+		__m128i o = _mm_shuffle_epi8(delta, bswap);
+		__m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(plain));
+		checksum = _mm_xor_si128(checksum, p);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(encrypted), _mm_xor_si128(aesni_encrypt(_mm_xor_si128(p, o), rk), o));
+		len -= AES_BLOCK_SIZE;
+		plain += AES_BLOCK_SIZE;
+		encrypted += AES_BLOCK_SIZE;
+	}
+
+	delta = aesni_double(delta);
+	__m128i pad = aesni_encrypt(_mm_shuffle_epi8(_mm_xor_si128(delta, _mm_cvtsi32_si128(len * 8)), bswap), rk);
+	__m128i tmp = pad;
+	memcpy(&tmp, plain, len);
+	checksum = _mm_xor_si128(checksum, tmp);
+	tmp = _mm_xor_si128(tmp, pad);
+	memcpy(encrypted, &tmp, len);
+
+	delta = _mm_xor_si128(delta, aesni_double(delta));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(tag), aesni_encrypt(_mm_xor_si128(_mm_shuffle_epi8(delta, bswap), checksum), rk));
+}
+
+AESNI_TARGET static void aesni_ocb_decrypt(const unsigned char *ekey, const unsigned char *dkey, const unsigned char *encrypted, unsigned char *plain, unsigned int len, const unsigned char *nonce, unsigned char *tag) {
+	const __m128i bswap = AESNI_BSWAP;
+	__m128i rk[11], drk[11];
+	__m128i offset[4], block[4];
+
+	aesni_load_keys(rk, ekey);
+	aesni_load_keys(drk, dkey);
+
+	__m128i delta = _mm_shuffle_epi8(aesni_encrypt(_mm_loadu_si128(reinterpret_cast<const __m128i *>(nonce)), rk), bswap);
+	__m128i checksum = _mm_setzero_si128();
+
+	while (len > 4 * AES_BLOCK_SIZE) {
+		for (int j=0;j<4;j++) {
+			delta = aesni_double(delta);
+			offset[j] = _mm_shuffle_epi8(delta, bswap);
+			block[j] = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(encrypted + j * AES_BLOCK_SIZE)), offset[j]);
+		}
+		aesni_decrypt4(block, drk);
+		for (int j=0;j<4;j++) {
+			__m128i p = _mm_xor_si128(block[j], offset[j]);
+			checksum = _mm_xor_si128(checksum, p);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(plain + j * AES_BLOCK_SIZE), p);
+		}
+		len -= 4 * AES_BLOCK_SIZE;
+		plain += 4 * AES_BLOCK_SIZE;
+		encrypted += 4 * AES_BLOCK_SIZE;
+	}
+
+	while (len > AES_BLOCK_SIZE) {
+		delta = aesni_double(delta);
+		__m128i o = _mm_shuffle_epi8(delta, bswap);
+		__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(encrypted));
+		__m128i p = _mm_xor_si128(aesni_decrypt(_mm_xor_si128(c, o), drk), o);
+		checksum = _mm_xor_si128(checksum, p);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(plain), p);
+		len -= AES_BLOCK_SIZE;
+		plain += AES_BLOCK_SIZE;
+		encrypted += AES_BLOCK_SIZE;
+	}
+
+	delta = aesni_double(delta);
+	__m128i pad = aesni_encrypt(_mm_shuffle_epi8(_mm_xor_si128(delta, _mm_cvtsi32_si128(len * 8)), bswap), rk);
+	__m128i tmp = _mm_setzero_si128();
+	memcpy(&tmp, encrypted, len);
+	tmp = _mm_xor_si128(tmp, pad);
+	checksum = _mm_xor_si128(checksum, tmp);
+	memcpy(plain, &tmp, len);
+
+	delta = _mm_xor_si128(delta, aesni_double(delta));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(tag), aesni_encrypt(_mm_xor_si128(_mm_shuffle_epi8(delta, bswap), checksum), rk));
+}
+#endif
+
+bool CryptState::hasAESNI() {
+#ifdef USE_AESNI
+	static int supported = -1;
+
+	if (supported < 0) {
+		unsigned int ecx = 0, edx = 0;
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+		ecx = static_cast<unsigned int>(info[2]);
+		edx = static_cast<unsigned int>(info[3]);
+#else
+		unsigned int eax, ebx;
+		if (! __get_cpuid(1, &eax, &ebx, &ecx, &edx))
+			ecx = edx = 0;
+#endif
+		// AES-NI, SSSE3 and SSE2
+		supported = ((ecx & (1 << 25)) && (ecx & (1 << 9)) && (edx & (1 << 26))) ? 1 : 0;
+	}
+	return (supported == 1);
+#else
+	return false;
+#endif
+}
+
+void CryptState::setupKeys() {
+	AES_set_encrypt_key(raw_key, 128, &encrypt_key);
+	AES_set_decrypt_key(raw_key, 128, &decrypt_key);
+	bAESNI = hasAESNI();
+#ifdef USE_AESNI
+	if (bAESNI)
+		aesni_set_keys(raw_key, ni_encrypt_key, ni_decrypt_key);
+#endif
+	bInit = true;
+}
+
 void CryptState::ocb_encrypt(const unsigned char *plain, unsigned char *encrypted, unsigned int len, const unsigned char *nonce, unsigned char *tag) {
 	keyblock checksum, delta, tmp, pad;
 
+#ifdef USE_AESNI
+	if (bAESNI) {
+		aesni_ocb_encrypt(ni_encrypt_key, plain, encrypted, len, nonce, tag);
+		return;
+	}
+#endif
+
 	// Initialize
 	AESencrypt(nonce, delta, &encrypt_key);
 	ZERO(checksum);
@@ -270,6 +529,13 @@ void CryptState::ocb_encrypt(const unsigned char *plain, unsigned char *encrypte
 void CryptState::ocb_decrypt(const unsigned char *encrypted, unsigned char *plain, unsigned int len, const unsigned char *nonce, unsigned char *tag) {
 	keyblock checksum, delta, tmp, pad;
 
+#ifdef USE_AESNI
+	if (bAESNI) {
+		aesni_ocb_decrypt(ni_encrypt_key, ni_decrypt_key, encrypted, plain, len, nonce, tag);
+		return;
+	}
+#endif
+
 	// Initialize
 	AESencrypt(nonce, delta, &encrypt_key);
 	ZERO(checksum);
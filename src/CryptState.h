@@ -38,6 +38,7 @@
 class CryptState {
 	private:
 		Q_DISABLE_COPY(CryptState)
+		void setupKeys();
 	public:
 		unsigned char raw_key[AES_BLOCK_SIZE];
 		unsigned char encrypt_iv[AES_BLOCK_SIZE];
@@ -56,11 +57,16 @@ class CryptState {
 
 		AES_KEY	encrypt_key;
 		AES_KEY decrypt_key;
+		// Round keys for the AES-NI implementation, used when bAESNI is set.
+		unsigned char ni_encrypt_key[11 * AES_BLOCK_SIZE];
+		unsigned char ni_decrypt_key[11 * AES_BLOCK_SIZE];
+		bool bAESNI;
 		Timer tLastGood;
 		Timer tLastRequest;
 		bool bInit;
 		CryptState();
 
+		static bool hasAESNI();
 		bool isValid() const;
 		void genKey();
 		void setKey(const unsigned char *rkey, const unsigned char *eiv, const unsigned char *div);
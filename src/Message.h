@@ -32,8 +32,10 @@
 #define MUMBLE_MESSAGE_H_
 
 #include <string>
+#include <QtCore/QByteArray>
 #include <QtCore/QCryptographicHash>
 #include <QtCore/QString>
+#include <QtCore/QtEndian>
 
 /**
   Protobuf packet type enumeration for message handler generation.
@@ -108,4 +110,21 @@ inline QByteArray sha1(const QString &str) {
 	return QCryptographicHash::hash(str.toUtf8(), QCryptographicHash::Sha1);
 }
 
+/* A protobuf message as sent over TLS: type, length, then the message.
+ * cache is left alone if the message is too large. A template only so
+ * this header needn't include protobuf.
+ */
+template <class T>
+inline void messageToNetwork(const T &msg, unsigned int msgType, QByteArray &cache) {
+	int len = msg.ByteSize();
+	if (len > 0x7fffff)
+		return;
+	cache.resize(len + 6);
+	unsigned char *uc = reinterpret_cast<unsigned char *>(cache.data());
+	qToBigEndian<quint16>(msgType, & uc[0]);
+	qToBigEndian<quint32>(len, & uc[2]);
+
+	msg.SerializeToArray(uc + 6, len);
+}
+
 #endif
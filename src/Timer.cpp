@@ -32,6 +32,44 @@
 
 #include "Timer.h"
 
+#if defined(Q_CC_MSVC)
+static __declspec(thread) quint64 uiCachedNow = 0;
+#ifdef TIMER_COUNT_READS
+static __declspec(thread) quint64 uiReads = 0;
+#endif
+#else
+static __thread quint64 uiCachedNow = 0;
+#ifdef TIMER_COUNT_READS
+static __thread quint64 uiReads = 0;
+#endif
+#endif
+
+static quint64 readClock();
+
+quint64 Timer::now() {
+#ifdef TIMER_COUNT_READS
+	++uiReads;
+#endif
+	return readClock();
+}
+
+#ifdef TIMER_COUNT_READS
+quint64 Timer::reads() {
+	return uiReads;
+}
+#endif
+
+quint64 Timer::update() {
+	uiCachedNow = now();
+	return uiCachedNow;
+}
+
+quint64 Timer::cached() {
+	if (uiCachedNow)
+		return uiCachedNow;
+	return now();
+}
+
 Timer::Timer(bool start) {
 	uiStart = start ? now() : 0;
 }
@@ -51,7 +89,10 @@ bool Timer::isElapsed(quint64 us) {
 }
 
 quint64 Timer::restart() {
-	quint64 n = now();
+	return restart(now());
+}
+
+quint64 Timer::restart(quint64 n) {
 	quint64 e = n - uiStart;
 	uiStart = n;
 	return e;
@@ -72,7 +113,7 @@ bool Timer::operator>(const Timer &other) const {
 #if defined(Q_OS_WIN)
 #include <windows.h>
 
-quint64 Timer::now() {
+static quint64 readClock() {
 	static double scale = 0;
 
 	if (scale == 0) {
@@ -87,17 +128,31 @@ quint64 Timer::now() {
 
 	return static_cast<quint64>(e * scale);
 }
+#elif defined(Q_OS_MAC)
+#include <mach/mach_time.h>
+
+static quint64 readClock() {
+	static mach_timebase_info_data_t info;
+
+	if (info.denom == 0)
+		mach_timebase_info(&info);
+
+	quint64 e = mach_absolute_time() / 1000ULL;
+	return (e * info.numer) / info.denom;
+}
 #elif defined(Q_OS_UNIX)
-#include <sys/time.h>
-quint64 Timer::now() {
-	struct timeval tv;
-	gettimeofday(&tv, NULL);
-	quint64 e= tv.tv_sec * 1000000LL;
-	e += tv.tv_usec;
+#include <time.h>
+
+// Unlike gettimeofday(), this is not stepped when the system time is set.
+static quint64 readClock() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	quint64 e = ts.tv_sec * 1000000LL;
+	e += ts.tv_nsec / 1000LL;
 	return e;
 }
 #else
-quint64 Timer::now() {
+static quint64 readClock() {
 	static QTime ticker;
 	quint64 elapsed = ticker.elapsed();
 	return elapsed * 1000LL;
@@ -33,17 +33,40 @@
 
 #include <QtCore/QtGlobal>
 
-// All timer resolutions are in microseconds.
+// All timer resolutions are in microseconds, measured on a monotonic clock.
 
 class Timer {
 	protected:
 		quint64 uiStart;
-		static quint64 now();
 	public:
+		static quint64 now();
+
+		/**
+		 * Reads the clock and keeps the result as this thread's cached time.
+		 * Meant for loops that handle many events at once, like the voice
+		 * threads, which call it once per iteration.
+		 */
+		static quint64 update();
+
+		/**
+		 * The time of this thread's last update(), or now() if it never
+		 * called it.
+		 */
+		static quint64 cached();
+
+#ifdef TIMER_COUNT_READS
+		/**
+		 * How often this thread read the clock. Only built into tests
+		 * that define TIMER_COUNT_READS.
+		 */
+		static quint64 reads();
+#endif
+
 		Timer(bool start = true);
 		bool isElapsed(quint64 us);
 		quint64 elapsed() const;
 		quint64 restart();
+		quint64 restart(quint64 now);
 		bool isStarted() const;
 
 		/**
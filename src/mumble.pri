@@ -59,6 +59,11 @@ unix {
 	} else {
 		PKGCONFIG *= openssl
 	}
+
+	# clock_gettime() for Timer on older glibc.
+	contains(UNAME, Linux) {
+		LIBS *= -lrt
+	}
 }
 
 QMAKE_EXTRA_COMPILERS *= pb pbh
@@ -112,11 +112,20 @@ AudioOutput::AudioOutput() {
 	iMixerFreq = 0;
 	eSampleFormat = SampleFloat;
 	iSampleSize = 0;
+
+	bDecoding = true;
+	iDecodeAhead = 0;
+	for (int i=0;i<g.s.iDecodeThreads;++i) {
+		AudioOutputDecoder *aod = new AudioOutputDecoder(this);
+		aod->start(QThread::HighestPriority);
+		qlDecoders << aod;
+	}
 }
 
 AudioOutput::~AudioOutput() {
 	bRunning = false;
 	wait();
+	stopDecoders();
 	wipe();
 
 	delete [] fSpeakers;
@@ -124,6 +133,60 @@ AudioOutput::~AudioOutput() {
 	delete [] bSpeakerPositional;
 }
 
+void AudioOutput::stopDecoders() {
+	bDecoding = false;
+	{
+		QMutexLocker lock(&qmDecoders);
+		qwcDecoders.wakeAll();
+	}
+	foreach(AudioOutputDecoder *aod, qlDecoders) {
+		aod->wait();
+		delete aod;
+	}
+	qlDecoders.clear();
+}
+
+AudioOutputDecoder::AudioOutputDecoder(AudioOutput *output) : ao(output) {
+}
+
+/* Woken after every mix(), and every 20 ms regardless. Goes over the
+ * speakers one frame at a time until all of them are ahead by
+ * iDecodeAhead, taking qrwlOutputs only around each frame so the mixer and
+ * removeBuffer() never wait on more than one decode.
+ */
+void AudioOutputDecoder::run() {
+	typedef QPair<const ClientUser *, AudioOutputUser *> Output;
+
+	while (ao->bDecoding) {
+		ao->qmDecoders.lock();
+		ao->qwcDecoders.wait(&ao->qmDecoders, 20);
+		ao->qmDecoders.unlock();
+
+		bool busy = true;
+		while (busy && ao->bDecoding) {
+			busy = false;
+
+			QList<Output> outputs;
+			{
+				QReadLocker lock(&ao->qrwlOutputs);
+				QMultiHash<const ClientUser *, AudioOutputUser *>::const_iterator i;
+				for (i = ao->qmOutputs.constBegin(); i != ao->qmOutputs.constEnd(); ++i)
+					outputs << Output(i.key(), i.value());
+			}
+
+			foreach(const Output &o, outputs) {
+				QReadLocker lock(&ao->qrwlOutputs);
+				// Removed since the list was taken.
+				if (! ao->qmOutputs.contains(o.first, o.second))
+					continue;
+				AudioOutputSpeech *aos = qobject_cast<AudioOutputSpeech *>(o.second);
+				if (aos && aos->decodeAhead(ao->iDecodeAhead))
+					busy = true;
+			}
+		}
+	}
+}
+
 // Here's the theory.
 // We support sound "bloom"ing. That is, if sound comes directly from the left, if it is sufficiently
 // close, we'll hear it full intensity from the left side, and "bloom" intensity from the right side.
@@ -193,7 +256,7 @@ void AudioOutput::addFrameToBuffer(ClientUser *user, const QByteArray &qbaPacket
 			return;
 
 		qrwlOutputs.lockForWrite();
-		aop = new AudioOutputSpeech(user, iMixerFreq, type);
+		aop = new AudioOutputSpeech(user, iMixerFreq, type, ! qlDecoders.isEmpty());
 		qmOutputs.replace(user, aop);
 	}
 
@@ -362,6 +425,8 @@ bool AudioOutput::mix(void *outbuff, unsigned int nsamp) {
 	if (g.s.fVolume < 0.01f)
 		return false;
 
+	iDecodeAhead = nsamp + iMixerFreq / 100;
+
 	const float adjustFactor = std::pow(10, -18.f / 20);
 	const float mul = g.s.fVolume;
 	const unsigned int nchan = iChannels;
@@ -567,6 +632,11 @@ bool AudioOutput::mix(void *outbuff, unsigned int nsamp) {
 
 	qrwlOutputs.unlock();
 
+	if (! qlDecoders.isEmpty()) {
+		QMutexLocker lock(&qmDecoders);
+		qwcDecoders.wakeAll();
+	}
+
 	foreach(AudioOutputUser *aop, qlDel)
 		removeBuffer(aop);
 
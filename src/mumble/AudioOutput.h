@@ -33,8 +33,10 @@
 #define MUMBLE_MUMBLE_AUDIOOUTPUT_H_
 
 #include <boost/shared_ptr.hpp>
+#include <QtCore/QMutex>
 #include <QtCore/QObject>
 #include <QtCore/QThread>
+#include <QtCore/QWaitCondition>
 
 // AudioOutput depends on User being valid. This means it's important
 // to removeBuffer from here BEFORE MainWindow gets any UserLeft
@@ -73,6 +75,18 @@ class AudioOutputSample;
 
 typedef boost::shared_ptr<AudioOutput> AudioOutputPtr;
 
+// Decodes speech ahead of the mixer, so the sound backend's callback only
+// has to mix what is already decoded. See Settings::iDecodeThreads.
+class AudioOutputDecoder : public QThread {
+	private:
+		Q_DISABLE_COPY(AudioOutputDecoder)
+	protected:
+		AudioOutput *ao;
+	public:
+		AudioOutputDecoder(AudioOutput *);
+		void run();
+};
+
 class AudioOutputRegistrar {
 	private:
 		Q_DISABLE_COPY(AudioOutputRegistrar)
@@ -95,6 +109,7 @@ class AudioOutputRegistrar {
 };
 
 class AudioOutput : public QThread {
+		friend class AudioOutputDecoder;
 	private:
 		Q_OBJECT
 		Q_DISABLE_COPY(AudioOutput)
@@ -112,6 +127,15 @@ class AudioOutput : public QThread {
 		QReadWriteLock qrwlOutputs;
 		QMultiHash<const ClientUser *, AudioOutputUser *> qmOutputs;
 
+		QList<AudioOutputDecoder *> qlDecoders;
+		QMutex qmDecoders;
+		QWaitCondition qwcDecoders;
+		volatile bool bDecoding;
+		// How many samples of each speaker to have decoded before the
+		// next mix(): its last period and a frame.
+		volatile unsigned int iDecodeAhead;
+		void stopDecoders();
+
 		virtual void removeBuffer(AudioOutputUser *);
 		void initializeMixer(const unsigned int *chanmasks, bool forceheadphone = false);
 		bool mix(void *output, unsigned int nsamp);
@@ -43,7 +43,7 @@
 #include "opus.h"
 #endif
 
-AudioOutputSpeech::AudioOutputSpeech(ClientUser *user, unsigned int freq, MessageHandler::UDPMessageType type) : AudioOutputUser(user->qsName) {
+AudioOutputSpeech::AudioOutputSpeech(ClientUser *user, unsigned int freq, MessageHandler::UDPMessageType type, bool decodeahead) : AudioOutputUser(user->qsName) {
 	int err;
 	p = user;
 	umtType = type;
@@ -108,6 +108,21 @@ AudioOutputSpeech::AudioOutputSpeech(ClientUser *user, unsigned int freq, Messag
 	float mul = static_cast<float>(M_PI / (2.0 * static_cast<double>(iFrameSize)));
 	for (unsigned int i=0;i<iFrameSize;++i)
 		fFadeIn[i] = fFadeOut[iFrameSize-i-1] = sinf(static_cast<float>(i) * mul);
+
+	bDecodeAhead = decodeahead;
+	bDecodeDone = false;
+	pfRing = NULL;
+	pfDecodeBuffer = NULL;
+	iRingSize = 0;
+	if (bDecodeAhead) {
+		// Room for the largest packet on top of any sane device period,
+		// rounded up to a power of two to wrap with a mask.
+		iRingSize = 1;
+		while (iRingSize < 2 * iOutputSize + 16384)
+			iRingSize <<= 1;
+		pfRing = new float[iRingSize];
+		pfDecodeBuffer = new float[iOutputSize];
+	}
 }
 
 AudioOutputSpeech::~AudioOutputSpeech() {
@@ -130,6 +145,8 @@ AudioOutputSpeech::~AudioOutputSpeech() {
 	delete [] fFadeIn;
 	delete [] fFadeOut;
 	delete [] fResamplerBuffer;
+	delete [] pfRing;
+	delete [] pfDecodeBuffer;
 }
 
 void AudioOutputSpeech::addFrameToBuffer(const QByteArray &qbaPacket, unsigned int iSeq) {
@@ -202,216 +219,206 @@ void AudioOutputSpeech::addFrameToBuffer(const QByteArray &qbaPacket, unsigned i
 	}
 }
 
-bool AudioOutputSpeech::needSamples(unsigned int snum) {
-	for (unsigned int i=iLastConsume;i<iBufferFilled;++i)
-		pfBuffer[i-iLastConsume]=pfBuffer[i];
-	iBufferFilled -= iLastConsume;
-
-	iLastConsume = snum;
-
-	if (iBufferFilled >= snum)
-		return bLastAlive;
+/* Decodes the next frame, or a packet's worth for Opus, into out, which
+ * must have room for iOutputSize samples, and returns how many samples at
+ * the mixer's rate it holds. nextalive is cleared at the end of speech.
+ */
+unsigned int AudioOutputSpeech::decodeFrame(float *out, bool &nextalive) {
+	float *pOut = (srs) ? fResamplerBuffer : out;
+	int decodedSamples = iFrameSize;
 
-	float *pOut;
-	bool nextalive = bLastAlive;
-
-	while (iBufferFilled < snum) {
-		int decodedSamples = iFrameSize;
-		resizeBuffer(iBufferFilled + iOutputSize);
-
-		pOut = (srs) ? fResamplerBuffer : (pfBuffer + iBufferFilled);
-
-		if (! bLastAlive) {
-			memset(pOut, 0, iFrameSize * sizeof(float));
-		} else {
-			if (p == &LoopUser::lpLoopy) {
-				LoopUser::lpLoopy.fetchFrames();
-			}
+	if (! bLastAlive) {
+		memset(pOut, 0, iFrameSize * sizeof(float));
+	} else {
+		if (p == &LoopUser::lpLoopy) {
+			LoopUser::lpLoopy.fetchFrames();
+		}
 
-			int avail = 0;
-			int ts = jitter_buffer_get_pointer_timestamp(jbJitter);
-			jitter_buffer_ctl(jbJitter, JITTER_BUFFER_GET_AVAILABLE_COUNT, &avail);
-
-			if (p && (ts == 0)) {
-				int want = iroundf(p->fAverageAvailable);
-				if (avail < want) {
-					++iMissCount;
-					if (iMissCount < 20) {
-						memset(pOut, 0, iFrameSize * sizeof(float));
-						goto nextframe;
-					}
+		int avail = 0;
+		int ts = jitter_buffer_get_pointer_timestamp(jbJitter);
+		jitter_buffer_ctl(jbJitter, JITTER_BUFFER_GET_AVAILABLE_COUNT, &avail);
+
+		if (p && (ts == 0)) {
+			int want = iroundf(p->fAverageAvailable);
+			if (avail < want) {
+				++iMissCount;
+				if (iMissCount < 20) {
+					memset(pOut, 0, iFrameSize * sizeof(float));
+					goto nextframe;
 				}
 			}
+		}
 
-			if (qlFrames.isEmpty()) {
-				QMutexLocker lock(&qmJitter);
-
-				char data[4096];
-				JitterBufferPacket jbp;
-				jbp.data = data;
-				jbp.len = 4096;
-
-				spx_int32_t startofs = 0;
+		if (qlFrames.isEmpty()) {
+			QMutexLocker lock(&qmJitter);
 
-				if (jitter_buffer_get(jbJitter, &jbp, iFrameSize, &startofs) == JITTER_BUFFER_OK) {
-					PacketDataStream pds(jbp.data, jbp.len);
+			char data[4096];
+			JitterBufferPacket jbp;
+			jbp.data = data;
+			jbp.len = 4096;
 
-					iMissCount = 0;
-					ucFlags = static_cast<unsigned char>(pds.next());
+			spx_int32_t startofs = 0;
 
-					bHasTerminator = false;
-					if (umtType == MessageHandler::UDPVoiceOpus) {
-						int size;
-						pds >> size;
+			if (jitter_buffer_get(jbJitter, &jbp, iFrameSize, &startofs) == JITTER_BUFFER_OK) {
+				PacketDataStream pds(jbp.data, jbp.len);
 
-						bHasTerminator = size & 0x2000;
-						qlFrames << pds.dataBlock(size & 0x1fff);
-					} else {
-						unsigned int header = 0;
-						do {
-							header = static_cast<unsigned int>(pds.next());
-							if (header)
-								qlFrames << pds.dataBlock(header & 0x7f);
-							else
-								bHasTerminator = true;
-						} while ((header & 0x80) && pds.isValid());
-					}
+				iMissCount = 0;
+				ucFlags = static_cast<unsigned char>(pds.next());
 
-					if (pds.left()) {
-						pds >> fPos[0];
-						pds >> fPos[1];
-						pds >> fPos[2];
-					} else {
-						fPos[0] = fPos[1] = fPos[2] = 0.0f;
-					}
+				bHasTerminator = false;
+				if (umtType == MessageHandler::UDPVoiceOpus) {
+					int size;
+					pds >> size;
 
-					if (p) {
-						float a = static_cast<float>(avail);
-						if (avail >= p->fAverageAvailable)
-							p->fAverageAvailable = a;
+					bHasTerminator = size & 0x2000;
+					qlFrames << pds.dataBlock(size & 0x1fff);
+				} else {
+					unsigned int header = 0;
+					do {
+						header = static_cast<unsigned int>(pds.next());
+						if (header)
+							qlFrames << pds.dataBlock(header & 0x7f);
 						else
-							p->fAverageAvailable *= 0.99f;
-					}
+							bHasTerminator = true;
+					} while ((header & 0x80) && pds.isValid());
+				}
+
+				if (pds.left()) {
+					pds >> fPos[0];
+					pds >> fPos[1];
+					pds >> fPos[2];
 				} else {
-					jitter_buffer_update_delay(jbJitter, &jbp, NULL);
+					fPos[0] = fPos[1] = fPos[2] = 0.0f;
+				}
 
-					iMissCount++;
-					if (iMissCount > 10)
-						nextalive = false;
+				if (p) {
+					float a = static_cast<float>(avail);
+					if (avail >= p->fAverageAvailable)
+						p->fAverageAvailable = a;
+					else
+						p->fAverageAvailable *= 0.99f;
 				}
+			} else {
+				jitter_buffer_update_delay(jbJitter, &jbp, NULL);
+
+				iMissCount++;
+				if (iMissCount > 10)
+					nextalive = false;
 			}
+		}
 
-			if (! qlFrames.isEmpty()) {
-				QByteArray qba = qlFrames.takeFirst();
+		if (! qlFrames.isEmpty()) {
+			QByteArray qba = qlFrames.takeFirst();
 
-				if (umtType == MessageHandler::UDPVoiceCELTAlpha || umtType == MessageHandler::UDPVoiceCELTBeta) {
-					int wantversion = (umtType == MessageHandler::UDPVoiceCELTAlpha) ? g.iCodecAlpha : g.iCodecBeta;
-					if ((p == &LoopUser::lpLoopy) && (! g.qmCodecs.isEmpty())) {
-						QMap<int, CELTCodec *>::const_iterator i = g.qmCodecs.constEnd();
-						--i;
-						wantversion = i.key();
-					}
-					if (cCodec && (cCodec->bitstreamVersion() != wantversion)) {
-						cCodec->celt_decoder_destroy(cdDecoder);
-						cdDecoder = NULL;
-					}
-					if (! cCodec) {
-						cCodec = g.qmCodecs.value(wantversion);
-						if (cCodec) {
-							cdDecoder = cCodec->decoderCreate();
-						}
+			if (umtType == MessageHandler::UDPVoiceCELTAlpha || umtType == MessageHandler::UDPVoiceCELTBeta) {
+				int wantversion = (umtType == MessageHandler::UDPVoiceCELTAlpha) ? g.iCodecAlpha : g.iCodecBeta;
+				if ((p == &LoopUser::lpLoopy) && (! g.qmCodecs.isEmpty())) {
+					QMap<int, CELTCodec *>::const_iterator i = g.qmCodecs.constEnd();
+					--i;
+					wantversion = i.key();
+				}
+				if (cCodec && (cCodec->bitstreamVersion() != wantversion)) {
+					cCodec->celt_decoder_destroy(cdDecoder);
+					cdDecoder = NULL;
+				}
+				if (! cCodec) {
+					cCodec = g.qmCodecs.value(wantversion);
+					if (cCodec) {
+						cdDecoder = cCodec->decoderCreate();
 					}
-					if (cdDecoder)
-						cCodec->decode_float(cdDecoder, qba.isEmpty() ? NULL : reinterpret_cast<const unsigned char *>(qba.constData()), qba.size(), pOut);
-					else
-						memset(pOut, 0, sizeof(float) * iFrameSize);
-				} else if (umtType == MessageHandler::UDPVoiceOpus) {
+				}
+				if (cdDecoder)
+					cCodec->decode_float(cdDecoder, qba.isEmpty() ? NULL : reinterpret_cast<const unsigned char *>(qba.constData()), qba.size(), pOut);
+				else
+					memset(pOut, 0, sizeof(float) * iFrameSize);
+			} else if (umtType == MessageHandler::UDPVoiceOpus) {
 #ifdef USE_OPUS
-					decodedSamples = opus_decode_float(opusState,
-					                                   qba.isEmpty() ?
-					                                       NULL :
-					                                       reinterpret_cast<const unsigned char *>(qba.constData()),
-					                                   qba.size(),
-					                                   pOut,
-					                                   iAudioBufferSize,
-					                                   0);
+				decodedSamples = opus_decode_float(opusState,
+				                                   qba.isEmpty() ?
+				                                       NULL :
+				                                       reinterpret_cast<const unsigned char *>(qba.constData()),
+				                                   qba.size(),
+				                                   pOut,
+				                                   iAudioBufferSize,
+				                                   0);
 #endif
+			} else {
+				if (qba.isEmpty()) {
+					speex_decode(dsSpeex, NULL, pOut);
 				} else {
-					if (qba.isEmpty()) {
-						speex_decode(dsSpeex, NULL, pOut);
-					} else {
-						speex_bits_read_from(&sbBits, qba.data(), qba.size());
-						speex_decode(dsSpeex, &sbBits, pOut);
-					}
-					for (unsigned int i=0;i<iFrameSize;++i)
-						pOut[i] *= (1.0f / 32767.f);
+					speex_bits_read_from(&sbBits, qba.data(), qba.size());
+					speex_decode(dsSpeex, &sbBits, pOut);
 				}
+				for (unsigned int i=0;i<iFrameSize;++i)
+					pOut[i] *= (1.0f / 32767.f);
+			}
 
-				bool update = true;
-				if (p) {
-					float &fPowerMax = p->fPowerMax;
-					float &fPowerMin = p->fPowerMin;
+			bool update = true;
+			if (p) {
+				float &fPowerMax = p->fPowerMax;
+				float &fPowerMin = p->fPowerMin;
 
-					float pow = 0.0f;
-					for (int i = 0; i < decodedSamples; ++i)
-						pow += pOut[i] * pOut[i];
-					pow = sqrtf(pow / static_cast<float>(decodedSamples));
+				float pow = 0.0f;
+				for (int i = 0; i < decodedSamples; ++i)
+					pow += pOut[i] * pOut[i];
+				pow = sqrtf(pow / static_cast<float>(decodedSamples));
 
-					if (pow >= fPowerMax) {
-						fPowerMax = pow;
+				if (pow >= fPowerMax) {
+					fPowerMax = pow;
+				} else {
+					if (pow <= fPowerMin) {
+						fPowerMin = pow;
 					} else {
-						if (pow <= fPowerMin) {
-							fPowerMin = pow;
-						} else {
-							fPowerMax = 0.99f * fPowerMax;
-							fPowerMin += 0.0001f * pow;
-						}
+						fPowerMax = 0.99f * fPowerMax;
+						fPowerMin += 0.0001f * pow;
 					}
-
-					update = (pow < (fPowerMin + 0.01f * (fPowerMax - fPowerMin)));
 				}
-				if (qlFrames.isEmpty() && update)
-					jitter_buffer_update_delay(jbJitter, NULL, NULL);
 
-				if (qlFrames.isEmpty() && bHasTerminator)
-					nextalive = false;
-			} else {
-				if (umtType == MessageHandler::UDPVoiceCELTAlpha || umtType == MessageHandler::UDPVoiceCELTBeta) {
-					if (cdDecoder)
-						cCodec->decode_float(cdDecoder, NULL, 0, pOut);
-					else
-						memset(pOut, 0, sizeof(float) * iFrameSize);
-				} else if (umtType == MessageHandler::UDPVoiceOpus) {
-#ifdef USE_OPUS
-					decodedSamples = opus_decode_float(opusState, NULL, 0, pOut, iFrameSize, 0);
-#endif
-				} else {
-					speex_decode(dsSpeex, NULL, pOut);
-					for (unsigned int i=0;i<iFrameSize;++i)
-						pOut[i] *= (1.0f / 32767.f);
-				}
+				update = (pow < (fPowerMin + 0.01f * (fPowerMax - fPowerMin)));
 			}
+			if (qlFrames.isEmpty() && update)
+				jitter_buffer_update_delay(jbJitter, NULL, NULL);
 
-			if (! nextalive) {
-				for (unsigned int i=0;i<iFrameSize;++i)
-					pOut[i] *= fFadeOut[i];
-			} else if (ts == 0) {
+			if (qlFrames.isEmpty() && bHasTerminator)
+				nextalive = false;
+		} else {
+			if (umtType == MessageHandler::UDPVoiceCELTAlpha || umtType == MessageHandler::UDPVoiceCELTBeta) {
+				if (cdDecoder)
+					cCodec->decode_float(cdDecoder, NULL, 0, pOut);
+				else
+					memset(pOut, 0, sizeof(float) * iFrameSize);
+			} else if (umtType == MessageHandler::UDPVoiceOpus) {
+#ifdef USE_OPUS
+				decodedSamples = opus_decode_float(opusState, NULL, 0, pOut, iFrameSize, 0);
+#endif
+			} else {
+				speex_decode(dsSpeex, NULL, pOut);
 				for (unsigned int i=0;i<iFrameSize;++i)
-					pOut[i] *= fFadeIn[i];
+					pOut[i] *= (1.0f / 32767.f);
 			}
+		}
 
-			for (int i = decodedSamples / iFrameSize; i > 0; --i) {
-				jitter_buffer_tick(jbJitter);
-			}
+		if (! nextalive) {
+			for (unsigned int i=0;i<iFrameSize;++i)
+				pOut[i] *= fFadeOut[i];
+		} else if (ts == 0) {
+			for (unsigned int i=0;i<iFrameSize;++i)
+				pOut[i] *= fFadeIn[i];
+		}
+
+		for (int i = decodedSamples / iFrameSize; i > 0; --i) {
+			jitter_buffer_tick(jbJitter);
 		}
-nextframe:
-		spx_uint32_t inlen = decodedSamples;
-		spx_uint32_t outlen = static_cast<unsigned int>(ceilf(static_cast<float>(decodedSamples * iMixerFreq) / static_cast<float>(iSampleRate)));
-		if (srs && bLastAlive)
-			speex_resampler_process_float(srs, 0, fResamplerBuffer, &inlen, pfBuffer + iBufferFilled, &outlen);
-		iBufferFilled += outlen;
 	}
+nextframe:
+	spx_uint32_t inlen = decodedSamples;
+	spx_uint32_t outlen = static_cast<unsigned int>(ceilf(static_cast<float>(decodedSamples * iMixerFreq) / static_cast<float>(iSampleRate)));
+	if (srs && bLastAlive)
+		speex_resampler_process_float(srs, 0, fResamplerBuffer, &inlen, out, &outlen);
+	return outlen;
+}
 
+void AudioOutputSpeech::updateTalkState(bool nextalive) {
 	if (p) {
 		Settings::TalkState ts;
 		if (! nextalive)
@@ -432,8 +439,102 @@ nextframe:
 		}
 		p->setTalking(ts);
 	}
+}
+
+bool AudioOutputSpeech::needSamples(unsigned int snum) {
+	if (bDecodeAhead)
+		return readRing(snum);
+
+	for (unsigned int i=iLastConsume;i<iBufferFilled;++i)
+		pfBuffer[i-iLastConsume]=pfBuffer[i];
+	iBufferFilled -= iLastConsume;
+
+	iLastConsume = snum;
+
+	if (iBufferFilled >= snum)
+		return bLastAlive;
+
+	bool nextalive = bLastAlive;
+
+	while (iBufferFilled < snum) {
+		resizeBuffer(iBufferFilled + iOutputSize);
+		iBufferFilled += decodeFrame(pfBuffer + iBufferFilled, nextalive);
+	}
+
+	updateTalkState(nextalive);
 
 	bool tmp = bLastAlive;
 	bLastAlive = nextalive;
 	return tmp;
 }
+
+/* Decodes into the ring until it holds target samples, the speech has
+ * ended or maxframes were decoded. Call with qmDecode held. Returns true if
+ * anything was decoded.
+ */
+bool AudioOutputSpeech::fillRing(unsigned int target, int maxframes) {
+	bool decoded = false;
+
+	while (! bDecodeDone && (maxframes-- > 0)) {
+		const unsigned int write = static_cast<unsigned int>(qaiRingWrite.fetchAndAddAcquire(0));
+		const unsigned int filled = write - static_cast<unsigned int>(qaiRingRead.fetchAndAddAcquire(0));
+		if ((filled >= target) || (iRingSize - filled < iOutputSize))
+			break;
+
+		bool nextalive = bLastAlive;
+		const unsigned int len = decodeFrame(pfDecodeBuffer, nextalive);
+
+		const unsigned int offset = write & (iRingSize - 1);
+		const unsigned int first = qMin(len, iRingSize - offset);
+		memcpy(pfRing + offset, pfDecodeBuffer, first * sizeof(float));
+		memcpy(pfRing, pfDecodeBuffer + first, (len - first) * sizeof(float));
+		qaiRingWrite.fetchAndStoreRelease(static_cast<int>(write + len));
+
+		updateTalkState(nextalive);
+		bLastAlive = nextalive;
+		// The faded out frame is the last one the mixer gets.
+		if (! nextalive)
+			bDecodeDone = true;
+		decoded = true;
+	}
+	return decoded;
+}
+
+/* Called by the decoder threads. Decodes at most one frame, so a pass over
+ * all speakers stays short, and skips speakers someone else is decoding.
+ */
+bool AudioOutputSpeech::decodeAhead(unsigned int target) {
+	if (! qmDecode.tryLock())
+		return false;
+	bool decoded = fillRing(target, 1);
+	qmDecode.unlock();
+	return decoded;
+}
+
+bool AudioOutputSpeech::readRing(unsigned int snum) {
+	const unsigned int read = static_cast<unsigned int>(qaiRingRead.fetchAndAddAcquire(0));
+	unsigned int filled = static_cast<unsigned int>(qaiRingWrite.fetchAndAddAcquire(0)) - read;
+
+	if ((filled < snum) && ! bDecodeDone) {
+		// The decoders fell behind; rather wait for them to finish the
+		// frame they are on and catch up here than play a gap.
+		QMutexLocker lock(&qmDecode);
+		fillRing(snum, INT_MAX);
+		filled = static_cast<unsigned int>(qaiRingWrite.fetchAndAddAcquire(0)) - read;
+	}
+
+	if (filled == 0)
+		return false;
+
+	const unsigned int len = qMin(filled, snum);
+	const unsigned int offset = read & (iRingSize - 1);
+	const unsigned int first = qMin(len, iRingSize - offset);
+
+	resizeBuffer(snum);
+	memcpy(pfBuffer, pfRing + offset, first * sizeof(float));
+	memcpy(pfBuffer + first, pfRing, (len - first) * sizeof(float));
+	memset(pfBuffer + len, 0, (snum - len) * sizeof(float));
+	qaiRingRead.fetchAndStoreRelease(static_cast<int>(read + len));
+
+	return true;
+}
@@ -38,6 +38,7 @@
 #include <speex/speex_jitter.h>
 #include <celt.h>
 
+#include <QtCore/QAtomicInt>
 #include <QtCore/QMutex>
 
 #include "AudioOutputUser.h"
@@ -85,15 +86,35 @@ class AudioOutputSpeech : public AudioOutputUser {
 		QList<QByteArray> qlFrames;
 
 		unsigned char ucFlags;
+
+		// With decoding ahead, speech is decoded by AudioOutputDecoders into
+		// pfRing, at the mixer's rate, and needSamples() only copies it out.
+		// Whoever holds qmDecode writes the ring and qaiRingWrite; the mixer
+		// reads it and moves qaiRingRead without locking.
+		bool bDecodeAhead;
+		float *pfRing;
+		float *pfDecodeBuffer;
+		unsigned int iRingSize;
+		QAtomicInt qaiRingRead;
+		QAtomicInt qaiRingWrite;
+		QMutex qmDecode;
+		// Set by the decoder once the last frame of the speech is in the ring.
+		volatile bool bDecodeDone;
+
+		unsigned int decodeFrame(float *out, bool &nextalive);
+		void updateTalkState(bool nextalive);
+		bool fillRing(unsigned int target, int maxframes);
+		bool readRing(unsigned int snum);
 	public:
 		MessageHandler::UDPMessageType umtType;
 		int iMissedFrames;
 		ClientUser *p;
 
 		virtual bool needSamples(unsigned int snum);
+		bool decodeAhead(unsigned int target);
 
 		void addFrameToBuffer(const QByteArray &, unsigned int iBaseSeq);
-		AudioOutputSpeech(ClientUser *, unsigned int freq, MessageHandler::UDPMessageType type);
+		AudioOutputSpeech(ClientUser *, unsigned int freq, MessageHandler::UDPMessageType type, bool decodeahead = false);
 		~AudioOutputSpeech();
 };
 
@@ -331,6 +331,7 @@ Settings::Settings() {
 	ssFilter = ShowReachable;
 
 	iOutputDelay = 5;
+	iDecodeThreads = qBound(1, QThread::idealThreadCount() / 2, 4);
 
 	qsALSAInput=QLatin1String("default");
 	qsALSAOutput=QLatin1String("default");
@@ -569,6 +570,7 @@ void Settings::load(QSettings* settings_ptr) {
 	SAVELOAD(iNoiseSuppress, "audio/noisesupress");
 	SAVELOAD(iVoiceHold, "audio/voicehold");
 	SAVELOAD(iOutputDelay, "audio/outputdelay");
+	SAVELOAD(iDecodeThreads, "audio/decodethreads");
 
 	// Idle auto actions
 	SAVELOAD(iIdleTime, "audio/idletime");
@@ -858,6 +860,7 @@ void Settings::save() {
 	SAVELOAD(iNoiseSuppress, "audio/noisesupress");
 	SAVELOAD(iVoiceHold, "audio/voicehold");
 	SAVELOAD(iOutputDelay, "audio/outputdelay");
+	SAVELOAD(iDecodeThreads, "audio/decodethreads");
 
 	// Idle auto actions
 	SAVELOAD(iIdleTime, "audio/idletime");
@@ -204,6 +204,9 @@ struct Settings {
 	bool bAttenuateOthersOnTalk;
 	bool bAttenuateOthers;
 	int iOutputDelay;
+	// Threads decoding speech ahead of the audio callback; with 0 it is
+	// decoded in the callback.
+	int iDecodeThreads;
 
 	QString qsALSAInput, qsALSAOutput;
 	QString qsPulseAudioInput, qsPulseAudioOutput;
@@ -0,0 +1,410 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "murmur_pch.h"
+
+#include "ACLEngine.h"
+
+#include "Channel.h"
+#include "Group.h"
+#include "User.h"
+
+// State of one effectivePermissions() call. Named group membership only
+// depends on the group and the channel it is looked up from, so it is kept
+// for the rest of the walk down the chain in two bitsets indexed by depth
+// and interned group id: whether it was looked up yet, and the result.
+class ACLEvaluation {
+	private:
+		Q_DISABLE_COPY(ACLEvaluation)
+	protected:
+		ACLEngine *aeEngine;
+		const User *p;
+		bool bVerified;
+		const QStringList &qslTokens;
+		const QVector<ACLProgram *> &qvChain;
+		const ACLProgram *apHome;
+		bool bHomeKnown;
+		int iGroups;
+		QVarLengthArray<quint32, 32> qvaKnown;
+		QVarLengthArray<quint32, 32> qvaMember;
+
+		bool namedMember(int group, int depth);
+		bool subMember(const ACLGroupRef &ref, int depth);
+	public:
+		ACLEvaluation(ACLEngine *engine, const User *p, bool verified, const QStringList &tokens, const ACLProgram *prog);
+		bool isMember(const ACLGroupRef &ref, int depth);
+};
+
+ACLEvaluation::ACLEvaluation(ACLEngine *engine, const User *user, bool verified, const QStringList &tokens, const ACLProgram *prog) : qslTokens(tokens), qvChain(prog->qvChain) {
+	aeEngine = engine;
+	p = user;
+	bVerified = verified;
+	apHome = NULL;
+	bHomeKnown = false;
+
+	// Groups interned later, while compiling the user's own channel, are
+	// never referred to by the chain's rules.
+	iGroups = engine->groupCount();
+	const int words = (qvChain.count() * iGroups + 31) / 32;
+	qvaKnown.resize(words);
+	qvaMember.resize(words);
+	memset(qvaKnown.data(), 0, words * sizeof(quint32));
+	memset(qvaMember.data(), 0, words * sizeof(quint32));
+}
+
+// Same as the group walk in Group::isMember(), from the channel at depth up.
+bool ACLEvaluation::namedMember(int group, int depth) {
+	Q_ASSERT(group < iGroups);
+	const int bit = depth * iGroups + group;
+	const quint32 mask = 1U << (bit & 31);
+	if (qvaKnown[bit >> 5] & mask)
+		return (qvaMember[bit >> 5] & mask) != 0;
+
+	QVarLengthArray<Group *, 8> stack;
+	for (int i=depth;i>=0;--i) {
+		Group *g = qvChain.at(i)->qhGroups.value(group);
+		if (g) {
+			if ((i != depth) && ! g->bInheritable)
+				break;
+			stack.append(g);
+			if (! g->bInherit)
+				break;
+		}
+	}
+
+	bool m = false;
+	const int session = - static_cast<int>(p->uiSession);
+	for (int i=stack.count()-1;i>=0;--i) {
+		const Group *g = stack.at(i);
+		if (g->qsAdd.contains(p->iId) || g->qsTemporary.contains(p->iId) || g->qsTemporary.contains(session))
+			m = true;
+		if (g->qsRemove.contains(p->iId))
+			m = false;
+	}
+
+	qvaKnown[bit >> 5] |= mask;
+	if (m)
+		qvaMember[bit >> 5] |= mask;
+	return m;
+}
+
+// Same as the "sub" case in Group::isMember(), with both channel chains
+// already at hand as programs.
+bool ACLEvaluation::subMember(const ACLGroupRef &ref, int depth) {
+	int cofs = depth + ref.iMinPath;
+
+	if (cofs >= qvChain.count())
+		return false;
+	else if (cofs < 0)
+		cofs = 0;
+
+	if (! bHomeKnown) {
+		apHome = p->cChannel ? aeEngine->program(p->cChannel) : NULL;
+		bHomeKnown = true;
+	}
+
+	if (! apHome || (apHome->qvChain.count() <= cofs) || (apHome->qvChain.at(cofs) != qvChain.at(cofs)))
+		return false;
+
+	int pdepth = apHome->qvChain.count() - 1;
+	return (pdepth >= cofs + ref.iMinDesc) && (pdepth <= cofs + ref.iMaxDesc);
+}
+
+bool ACLEvaluation::isMember(const ACLGroupRef &ref, int depth) {
+	if (! ref.bAclChannel)
+		depth = qvChain.count() - 1;
+
+	bool m = false;
+
+	switch (ref.tType) {
+		case ACLGroupRef::Empty:
+			return false;
+		case ACLGroupRef::None:
+			m = false;
+			break;
+		case ACLGroupRef::All:
+			m = true;
+			break;
+		case ACLGroupRef::Auth:
+			m = (p->iId >= 0);
+			break;
+		case ACLGroupRef::Strong:
+			m = bVerified;
+			break;
+		case ACLGroupRef::In:
+			m = (p->cChannel == qvChain.at(depth)->c);
+			break;
+		case ACLGroupRef::Out:
+			m = (p->cChannel != qvChain.at(depth)->c);
+			break;
+		case ACLGroupRef::Sub:
+			m = subMember(ref, depth);
+			break;
+		case ACLGroupRef::Token:
+			m = qslTokens.contains(ref.qsName, Qt::CaseInsensitive);
+			break;
+		case ACLGroupRef::Hash:
+			m = (p->qsHash == ref.qsName);
+			break;
+		case ACLGroupRef::Named:
+			m = namedMember(ref.iGroup, depth);
+			break;
+	}
+	return ref.bInvert ? !m : m;
+}
+
+ACLEngine::ACLEngine() {
+}
+
+ACLEngine::~ACLEngine() {
+	clear();
+}
+
+int ACLEngine::groupCount() const {
+	return qhGroupIds.count();
+}
+
+int ACLEngine::groupId(const QString &name) {
+	QHash<QString, int>::const_iterator i = qhGroupIds.constFind(name);
+	if (i != qhGroupIds.constEnd())
+		return i.value();
+
+	int id = qhGroupIds.count();
+	qhGroupIds.insert(name, id);
+	return id;
+}
+
+// Takes a group name apart the way Group::isMember() does.
+void ACLEngine::compile(QString name, ACLGroupRef &ref) {
+	bool token = false;
+	bool hash = false;
+
+	ref.tType = ACLGroupRef::Empty;
+	ref.bInvert = false;
+	ref.bAclChannel = false;
+	ref.iMinPath = 0;
+	ref.iMinDesc = 1;
+	ref.iMaxDesc = 1000;
+	ref.iGroup = -1;
+
+	while (true) {
+		if (name.isEmpty()) {
+			ref.bInvert = false;
+			return;
+		}
+
+		if (name.startsWith(QChar::fromLatin1('!'))) {
+			ref.bInvert = true;
+			name = name.remove(0,1);
+			continue;
+		}
+
+		if (name.startsWith(QChar::fromLatin1('~'))) {
+			ref.bAclChannel = true;
+			name = name.remove(0,1);
+			continue;
+		}
+
+		if (name.startsWith(QChar::fromLatin1('#'))) {
+			token = true;
+			name = name.remove(0,1);
+			continue;
+		}
+		if (name.startsWith(QChar::fromLatin1('$'))) {
+			hash = true;
+			name = name.remove(0,1);
+			continue;
+		}
+
+		break;
+	}
+
+	if (token) {
+		ref.tType = ACLGroupRef::Token;
+		ref.qsName = name;
+	} else if (hash) {
+		ref.tType = ACLGroupRef::Hash;
+		ref.qsName = name;
+	} else if (name == QLatin1String("none")) {
+		ref.tType = ACLGroupRef::None;
+	} else if (name == QLatin1String("all")) {
+		ref.tType = ACLGroupRef::All;
+	} else if (name == QLatin1String("auth")) {
+		ref.tType = ACLGroupRef::Auth;
+	} else if (name == QLatin1String("strong")) {
+		ref.tType = ACLGroupRef::Strong;
+	} else if (name == QLatin1String("in")) {
+		ref.tType = ACLGroupRef::In;
+	} else if (name == QLatin1String("out")) {
+		ref.tType = ACLGroupRef::Out;
+	} else if (name.startsWith(QLatin1String("sub"))) {
+		ref.tType = ACLGroupRef::Sub;
+		name = name.remove(0,4);
+		QStringList args = name.split(QLatin1String(","));
+		switch (args.count()) {
+			default:
+			case 3:
+				ref.iMaxDesc = args[2].isEmpty() ? ref.iMaxDesc : args[2].toInt();
+			case 2:
+				ref.iMinDesc = args[1].isEmpty() ? ref.iMinDesc : args[1].toInt();
+			case 1:
+				ref.iMinPath = args[0].isEmpty() ? ref.iMinPath : args[0].toInt();
+			case 0:
+				break;
+		}
+	} else {
+		ref.tType = ACLGroupRef::Named;
+		ref.qsName = name;
+		ref.iGroup = groupId(name);
+	}
+}
+
+ACLProgram *ACLEngine::program(Channel *c) {
+	ACLProgram *prog = qhPrograms.value(c);
+	if (prog)
+		return prog;
+
+	prog = new ACLProgram();
+	prog->c = c;
+	if (c->cParent)
+		prog->qvChain = program(c->cParent)->qvChain;
+	prog->qvChain.append(prog);
+
+	QHash<QString, Group *>::const_iterator i;
+	for (i = c->qhGroups.constBegin(); i != c->qhGroups.constEnd(); ++i)
+		prog->qhGroups.insert(groupId(i.key()), i.value());
+
+	prog->qvRules.reserve(c->qlACL.count());
+	foreach(const ChanACL *acl, c->qlACL) {
+		ACLRule r;
+		r.iUserId = acl->iUserId;
+		r.bApplyHere = acl->bApplyHere;
+		r.bApplySubs = acl->bApplySubs;
+		r.pAllow = acl->pAllow;
+		r.pDeny = acl->pDeny;
+		compile(acl->qsGroup, r.grGroup);
+		prog->qvRules.append(r);
+	}
+
+	qhPrograms.insert(c, prog);
+	return prog;
+}
+
+// Same rules as ChanACL::effectivePermissions() used to apply on the
+// channel tree itself.
+ChanACL::Permissions ACLEngine::effectivePermissions(const User *p, bool verified, const QStringList &tokens, Channel *chan) {
+	// Superuser
+	if (p->iId == 0)
+		return static_cast<ChanACL::Permissions>(ChanACL::All &~ (ChanACL::Speak|ChanACL::Whisper));
+
+	const ACLProgram *prog = program(chan);
+	const int depth = prog->qvChain.count();
+	ACLEvaluation ev(this, p, verified, tokens, prog);
+
+	// Default permissions
+	const ChanACL::Permissions def = ChanACL::Traverse | ChanACL::Enter | ChanACL::Speak | ChanACL::Whisper | ChanACL::TextMessage;
+
+	ChanACL::Permissions granted = def;
+
+	bool traverse = true;
+	bool write = false;
+
+	for (int d=0;d<depth;++d) {
+		const ACLProgram *ap = prog->qvChain.at(d);
+		const bool here = (d == depth - 1);
+
+		if (! ap->c->bInheritACL)
+			granted = def;
+
+		for (int i=0;i<ap->qvRules.count();++i) {
+			const ACLRule &r = ap->qvRules.at(i);
+			bool matchUser = (r.iUserId != -1) && (r.iUserId == p->iId);
+			if (matchUser || ev.isMember(r.grGroup, d)) {
+				if (r.pAllow & ChanACL::Traverse)
+					traverse = true;
+				if (r.pDeny & ChanACL::Traverse)
+					traverse = false;
+				if (r.pAllow & ChanACL::Write)
+					write = true;
+				if (r.pDeny & ChanACL::Write)
+					write = false;
+				if (here && ap->c->iId == 0 && r.bApplyHere)
+					granted |= (r.pAllow & (ChanACL::Kick|ChanACL::Ban|ChanACL::Register|ChanACL::SelfRegister));
+				if ((here && r.bApplyHere) || (! here && r.bApplySubs)) {
+					granted |= (r.pAllow & ~(ChanACL::Kick|ChanACL::Ban|ChanACL::Register|ChanACL::SelfRegister|ChanACL::Cached));
+					granted &= ~r.pDeny;
+				}
+			}
+		}
+		if (! traverse && ! write) {
+			granted = ChanACL::None;
+			break;
+		}
+	}
+
+	if (granted & ChanACL::Write) {
+		granted |= ChanACL::Traverse|ChanACL::Enter|ChanACL::MuteDeafen|ChanACL::Move|ChanACL::MakeChannel|ChanACL::LinkChannel|ChanACL::TextMessage|ChanACL::MakeTempChannel;
+		if (chan->iId == 0)
+			granted |= ChanACL::Kick|ChanACL::Ban|ChanACL::Register|ChanACL::SelfRegister;
+	}
+
+	return granted;
+}
+
+// Drops the programs of c and everything below it.
+void ACLEngine::invalidate(Channel *c) {
+	QList<ACLProgram *> stale;
+
+	QHash<Channel *, ACLProgram *>::iterator i = qhPrograms.begin();
+	while (i != qhPrograms.end()) {
+		ACLProgram *prog = i.value();
+		bool below = false;
+		foreach(const ACLProgram *ap, prog->qvChain) {
+			if (ap->c == c) {
+				below = true;
+				break;
+			}
+		}
+		if (below) {
+			stale << prog;
+			i = qhPrograms.erase(i);
+		} else {
+			++i;
+		}
+	}
+
+	qDeleteAll(stale);
+}
+
+void ACLEngine::clear() {
+	qDeleteAll(qhPrograms);
+	qhPrograms.clear();
+	qhGroupIds.clear();
+}
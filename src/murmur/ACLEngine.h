@@ -0,0 +1,102 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MURMUR_ACLENGINE_H_
+#define MUMBLE_MURMUR_ACLENGINE_H_
+
+#include <QtCore/QHash>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+#include "ACL.h"
+
+class Channel;
+class Group;
+class User;
+
+// A group name from an ACL entry, with its prefixes and arguments taken
+// apart once instead of on every evaluation.
+struct ACLGroupRef {
+	enum Type { Empty, None, All, Auth, Strong, In, Out, Sub, Token, Hash, Named };
+	Type tType;
+	bool bInvert;
+	// Evaluate against the channel the ACL is defined on ("~").
+	bool bAclChannel;
+	int iMinPath, iMinDesc, iMaxDesc;
+	// Interned id of a named group.
+	int iGroup;
+	QString qsName;
+};
+
+struct ACLRule {
+	int iUserId;
+	bool bApplyHere, bApplySubs;
+	ChanACL::Permissions pAllow, pDeny;
+	ACLGroupRef grGroup;
+};
+
+// The ACLs and groups of one channel, plus the programs of the channels
+// above it.
+struct ACLProgram {
+	Channel *c;
+	// From the root channel down to and including this one.
+	QVector<ACLProgram *> qvChain;
+	QVector<ACLRule> qvRules;
+	QHash<int, Group *> qhGroups;
+};
+
+/* Evaluates ChanACL permissions from a compiled form of the channel tree.
+ * Programs are built the first time a channel is asked about and hold on
+ * to the ACL entries as they were then, and to the Group pointers; anything
+ * that changes the ACLs, groups or parent of a channel must invalidate() it.
+ * Group memberships are read live.
+ */
+class ACLEngine {
+	private:
+		Q_DISABLE_COPY(ACLEngine)
+	protected:
+		QHash<Channel *, ACLProgram *> qhPrograms;
+		QHash<QString, int> qhGroupIds;
+
+		int groupId(const QString &name);
+		void compile(QString name, ACLGroupRef &ref);
+	public:
+		ACLEngine();
+		~ACLEngine();
+
+		ACLProgram *program(Channel *c);
+		int groupCount() const;
+		ChanACL::Permissions effectivePermissions(const User *p, bool verified, const QStringList &tokens, Channel *chan);
+		void invalidate(Channel *c);
+		void clear();
+};
+
+#endif
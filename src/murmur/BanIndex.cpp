@@ -0,0 +1,212 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "murmur_pch.h"
+
+#include "BanIndex.h"
+
+static inline int bitAt(const HostAddress &address, int bit) {
+	return (address.qip6.c[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+BanIndex::BanIndex() {
+	clear();
+}
+
+void BanIndex::clear() {
+	qvNodes.clear();
+	qvEntries.clear();
+	qvWheel.clear();
+	qvWheel.resize(iSlots);
+	uiTick = 0;
+
+	newNode(HostAddress(), 0);
+}
+
+// Same masks as HostAddress::match().
+HostAddress BanIndex::masked(const HostAddress &address, int bits) {
+	HostAddress ha;
+
+	if (bits >= 128) {
+		ha = address;
+	} else if (bits > 64) {
+		ha.addr[0] = address.addr[0];
+		ha.addr[1] = address.addr[1] & SWAP64(~((1ULL << (128-bits)) - 1));
+	} else if (bits > 0) {
+		ha.addr[0] = address.addr[0] & SWAP64(~((1ULL << (64-bits)) - 1));
+	}
+	return ha;
+}
+
+// Number of leading bits the two addresses have in common.
+int BanIndex::commonBits(const HostAddress &a, const HostAddress &b) {
+	for (int i=0;i<2;++i) {
+		quint64 diff = SWAP64(a.addr[i] ^ b.addr[i]);
+		if (diff) {
+			int bits = i * 64;
+			while (! (diff & 0x8000000000000000ULL)) {
+				diff <<= 1;
+				++bits;
+			}
+			return bits;
+		}
+	}
+	return 128;
+}
+
+quint32 BanIndex::expiry(const Ban &ban) {
+	if (ban.iDuration == 0)
+		return 0;
+	return ban.qdtStart.toTime_t() + ban.iDuration;
+}
+
+int BanIndex::newNode(const HostAddress &prefix, int bits) {
+	Node n;
+	n.haPrefix = prefix;
+	n.iBits = bits;
+	n.iChild[0] = n.iChild[1] = -1;
+	n.iEntry = -1;
+	qvNodes.append(n);
+	return qvNodes.count() - 1;
+}
+
+// Nodes are referred to by index, as newNode() may move them.
+void BanIndex::insert(const HostAddress &address, int bits, int entry) {
+	const HostAddress prefix = masked(address, bits);
+	int node = 0;
+
+	forever {
+		if (qvNodes.at(node).iBits == bits)
+			break;
+
+		const int side = bitAt(prefix, qvNodes.at(node).iBits);
+		const int child = qvNodes.at(node).iChild[side];
+		if (child == -1) {
+			const int leaf = newNode(prefix, bits);
+			qvNodes[node].iChild[side] = leaf;
+			node = leaf;
+			break;
+		}
+
+		const int childbits = qvNodes.at(child).iBits;
+		const int common = qMin(qMin(bits, childbits), commonBits(prefix, qvNodes.at(child).haPrefix));
+		if (common == childbits) {
+			node = child;
+			continue;
+		}
+
+		// Split the edge to the child where the prefixes part.
+		const int split = newNode(masked(prefix, common), common);
+		qvNodes[node].iChild[side] = split;
+		qvNodes[split].iChild[bitAt(qvNodes.at(child).haPrefix, common)] = child;
+		node = split;
+	}
+
+	qvEntries[entry].iNext = qvNodes.at(node).iEntry;
+	qvNodes[node].iEntry = entry;
+}
+
+void BanIndex::rebuild(const QList<Ban> &bans, quint32 now) {
+	clear();
+	uiTick = now / iResolution;
+
+	qvEntries.reserve(bans.count());
+	for (int i=0;i<bans.count();++i) {
+		const Ban &ban = bans.at(i);
+		if (! ban.isValid())
+			continue;
+
+		Entry e;
+		e.iBan = i;
+		e.uiExpires = expiry(ban);
+		e.iNext = -1;
+		qvEntries.append(e);
+
+		const int entry = qvEntries.count() - 1;
+		insert(ban.haAddress, ban.iMask, entry);
+
+		// Already expired ones go in the current slot, for the next
+		// expire() to pick up.
+		if (e.uiExpires)
+			qvWheel[(qMax(e.uiExpires, now) / iResolution) % iSlots] << entry;
+	}
+}
+
+// The most specific ban in effect for the address, or -1.
+int BanIndex::match(const HostAddress &address, quint32 now) const {
+	int best = -1;
+	int node = 0;
+
+	forever {
+		const Node &n = qvNodes.at(node);
+		for (int entry = n.iEntry; entry != -1; entry = qvEntries.at(entry).iNext) {
+			const Entry &e = qvEntries.at(entry);
+			if ((e.uiExpires == 0) || (e.uiExpires >= now)) {
+				best = e.iBan;
+				break;
+			}
+		}
+
+		if (n.iBits == 128)
+			break;
+		node = n.iChild[bitAt(address, n.iBits)];
+		if ((node == -1) || (commonBits(address, qvNodes.at(node).haPrefix) < qvNodes.at(node).iBits))
+			break;
+	}
+	return best;
+}
+
+// Bans that have run out since the last call.
+QList<int> BanIndex::expire(quint32 now) {
+	QList<int> expired;
+	const quint32 tick = now / iResolution;
+
+	// Revisit the slot of the last call; it may hold bans that ran out
+	// after it.
+	quint32 first = uiTick;
+	if (tick - first >= static_cast<quint32>(iSlots))
+		first = tick - iSlots + 1;
+
+	for (quint32 t = first; t <= tick; ++t) {
+		QList<int> &slot = qvWheel[t % iSlots];
+		QList<int>::iterator i = slot.begin();
+		while (i != slot.end()) {
+			const Entry &e = qvEntries.at(*i);
+			if (e.uiExpires < now) {
+				expired << e.iBan;
+				i = slot.erase(i);
+			} else {
+				++i;
+			}
+		}
+	}
+	uiTick = tick;
+	return expired;
+}
@@ -0,0 +1,91 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MURMUR_BANINDEX_H_
+#define MUMBLE_MURMUR_BANINDEX_H_
+
+#include <QtCore/QList>
+#include <QtCore/QVector>
+
+#include "Net.h"
+
+/* Address bans of a server, in a path compressed binary trie over the 128
+ * bit HostAddress (IPv4 bans live under ::ffff:0:0/96), so a connection is
+ * checked in at most 128 steps no matter how many bans there are. Bans
+ * with a duration are also put on a timer wheel; expire() hands back the
+ * ones that ran out, so they can be removed in one go instead of scanning
+ * the list on every connection. match() already ignores expired bans.
+ *
+ * Indexes refer to the list given to rebuild(), which has to be called
+ * again whenever that list changes.
+ */
+class BanIndex {
+	private:
+		Q_DISABLE_COPY(BanIndex)
+	protected:
+		struct Node {
+			HostAddress haPrefix;
+			int iBits;
+			int iChild[2];
+			// First entry with exactly this prefix, or -1.
+			int iEntry;
+		};
+		struct Entry {
+			int iBan;
+			// Seconds since the epoch, or 0 for never.
+			quint32 uiExpires;
+			int iNext;
+		};
+
+		QVector<Node> qvNodes;
+		QVector<Entry> qvEntries;
+		QVector<QList<int> > qvWheel;
+		quint32 uiTick;
+
+		int newNode(const HostAddress &prefix, int bits);
+		void insert(const HostAddress &address, int bits, int entry);
+	public:
+		// Seconds covered by a slot of the wheel, and how often expire()
+		// is worth calling.
+		static const int iResolution = 10;
+		static const int iSlots = 360;
+
+		BanIndex();
+		void clear();
+		void rebuild(const QList<Ban> &bans, quint32 now);
+		int match(const HostAddress &address, quint32 now) const;
+		QList<int> expire(quint32 now);
+
+		static HostAddress masked(const HostAddress &address, int bits);
+		static int commonBits(const HostAddress &a, const HostAddress &b);
+		static quint32 expiry(const Ban &ban);
+};
+
+#endif
@@ -0,0 +1,101 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "murmur_pch.h"
+
+#include "BandwidthRecord.h"
+
+BandwidthRecord::BandwidthRecord(quint64 now) {
+	// Like a new connection used to, start without any saved up credit.
+	uiBudget = now;
+	uiLastFrame = now;
+	uiWindow = now;
+	iWindowBytes = 0;
+	iLastWindowBytes = 0;
+}
+
+bool BandwidthRecord::addFrame(int size, int maxpersec, quint64 now) {
+	if (maxpersec <= 0)
+		return false;
+
+	quint64 start = uiBudget;
+	if ((now > BANDWIDTH_BURST_USEC) && (start < now - BANDWIDTH_BURST_USEC))
+		start = now - BANDWIDTH_BURST_USEC;
+
+	quint64 budget = start + (static_cast<quint64>(size) * 1000000ULL) / static_cast<quint64>(maxpersec);
+	if (budget > now)
+		return false;
+
+	uiBudget = budget;
+	uiLastFrame = now;
+
+	if (now - uiWindow >= 1000000ULL) {
+		quint64 windows = (now - uiWindow) / 1000000ULL;
+		iLastWindowBytes = (windows == 1) ? iWindowBytes : 0;
+		iWindowBytes = 0;
+		uiWindow += windows * 1000000ULL;
+	}
+	iWindowBytes += size;
+
+	return true;
+}
+
+int BandwidthRecord::onlineSeconds() const {
+	return static_cast<int>(tFirst.elapsed() / 1000000LL);
+}
+
+int BandwidthRecord::idleSeconds() const {
+	quint64 now = Timer::now();
+	quint64 iIdle = (now > uiLastFrame) ? now - uiLastFrame : 0;
+	if (tIdleControl.elapsed() < iIdle)
+		iIdle = tIdleControl.elapsed();
+
+	return static_cast<int>(iIdle / 1000000LL);
+}
+
+void BandwidthRecord::resetIdleSeconds() {
+	tIdleControl.restart();
+}
+
+/* Estimates the bytes per second used over the last second, weighing the
+ * previous window by how much of it is still within that second.
+ */
+int BandwidthRecord::bandwidth(quint64 now) const {
+	if (now < uiWindow)
+		return iWindowBytes;
+
+	quint64 elapsed = now - uiWindow;
+	if (elapsed >= 2000000ULL)
+		return 0;
+	if (elapsed >= 1000000ULL)
+		return static_cast<int>((iWindowBytes * (2000000ULL - elapsed)) / 1000000ULL);
+
+	return iWindowBytes + static_cast<int>((iLastWindowBytes * (1000000ULL - elapsed)) / 1000000ULL);
+}
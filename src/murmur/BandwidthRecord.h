@@ -0,0 +1,68 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MURMUR_BANDWIDTHRECORD_H_
+#define MUMBLE_MURMUR_BANDWIDTHRECORD_H_
+
+#include <QtCore/QtGlobal>
+
+#include "Timer.h"
+
+// Credit for at most this long is saved up while a user is silent. The
+// limiter used to average over the last 360 frames, which is 3.6 seconds at
+// the shortest frame length clients send.
+#define BANDWIDTH_BURST_USEC 3600000ULL
+
+// Voice rate limiter and usage statistics for a user. All times are
+// Timer::now() values; the voice threads read the clock once per batch of
+// datagrams and pass it in.
+struct BandwidthRecord {
+	// Token bucket, kept as the time at which the bytes accepted so far
+	// would have been paid off at the allowed rate.
+	quint64 uiBudget;
+	quint64 uiLastFrame;
+
+	// Bytes accepted in the current and the previous second, for bandwidth().
+	quint64 uiWindow;
+	int iWindowBytes;
+	int iLastWindowBytes;
+
+	Timer tFirst;
+	Timer tIdleControl;
+
+	BandwidthRecord(quint64 now = Timer::now());
+	bool addFrame(int size, int maxpersec, quint64 now);
+	int onlineSeconds() const;
+	int idleSeconds() const;
+	void resetIdleSeconds();
+	int bandwidth(quint64 now = Timer::now()) const;
+};
+
+#endif
@@ -0,0 +1,61 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MURMUR_BLOBCACHE_H_
+#define MUMBLE_MURMUR_BLOBCACHE_H_
+
+#include <QtCore/QByteArray>
+#include <QtCore/QCache>
+
+/* Textures, comments and descriptions by the SHA1 of their contents,
+ * shared by all virtual servers. What is least recently used goes first
+ * once the data adds up to more than the budget. Entries are implicitly
+ * shared QByteArrays, so handing one out or sending it copies nothing.
+ * Main thread only.
+ */
+class BlobCache {
+	private:
+		Q_DISABLE_COPY(BlobCache)
+	protected:
+		QCache<QByteArray, QByteArray> qcBlobs;
+		quint64 uiHits, uiMisses;
+	public:
+		BlobCache(int bytes);
+		QByteArray find(const QByteArray &key);
+		void insert(const QByteArray &key, const QByteArray &data);
+		void remove(const QByteArray &key);
+
+		quint64 hits() const;
+		quint64 misses() const;
+		int count() const;
+		int bytes() const;
+};
+
+#endif
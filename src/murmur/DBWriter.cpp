@@ -0,0 +1,227 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "murmur_pch.h"
+
+#include "DBWriter.h"
+
+// Queued log lines that wake the writer before the delay is up.
+#define DBWRITER_LOG_BATCH 512
+
+DBWriter::DBWriter(const QSqlDatabase &db, const QString &prefix, int delay, int logdays) : QThread(), qsdSource(db), qsPrefix(prefix) {
+	iDelay = delay;
+	iLogDays = logdays;
+	bStop = false;
+	uiQueued = uiWritten = uiFlush = 0;
+	start();
+}
+
+// Writes what is still queued before returning.
+DBWriter::~DBWriter() {
+	{
+		QMutexLocker l(&qmQueue);
+		bStop = true;
+		qwcWork.wakeAll();
+	}
+	wait();
+}
+
+// Call with qmQueue held.
+void DBWriter::queued(bool urgent) {
+	// The writer only needs waking when it is idle; otherwise it is
+	// already waiting out the delay to pick up more.
+	if ((uiQueued++ == uiWritten) || urgent)
+		qwcWork.wakeAll();
+}
+
+void DBWriter::setLastChannel(int server_id, int user_id, int channel_id) {
+	QMutexLocker l(&qmQueue);
+	qhLastChannel.insert(UserKey(server_id, user_id), channel_id);
+	queued();
+}
+
+// The last channel of the user if it is not written yet.
+bool DBWriter::lastChannel(int server_id, int user_id, int &channel_id) const {
+	QMutexLocker l(&qmQueue);
+	const UserKey key(server_id, user_id);
+	QHash<UserKey, int>::const_iterator i = qhLastChannel.constFind(key);
+	if (i == qhLastChannel.constEnd()) {
+		i = qhLastChannelWriting.constFind(key);
+		if (i == qhLastChannelWriting.constEnd())
+			return false;
+	}
+	channel_id = i.value();
+	return true;
+}
+
+void DBWriter::setInfo(int server_id, int user_id, int key, const QString &value) {
+	QMutexLocker l(&qmQueue);
+	qhUserInfo[UserKey(server_id, user_id)].insert(key, value);
+	queued();
+}
+
+void DBWriter::log(int server_id, const QString &msg) {
+	QMutexLocker l(&qmQueue);
+	qlLog << QPair<int, QString>(server_id, msg);
+	queued(qlLog.count() == DBWRITER_LOG_BATCH);
+}
+
+void DBWriter::flush() {
+	QMutexLocker l(&qmQueue);
+	const quint64 target = uiQueued;
+	if (uiWritten >= target)
+		return;
+	uiFlush = qMax(uiFlush, target);
+	qwcWork.wakeAll();
+	while (uiWritten < target)
+		qwcWritten.wait(&qmQueue);
+}
+
+void DBWriter::run() {
+	const QString name = QLatin1String("DBWriter");
+	{
+		QSqlDatabase wdb = QSqlDatabase::cloneDatabase(qsdSource, name);
+		if (! wdb.open())
+			qFatal("DBWriter: Failed to open database: %s", qPrintable(wdb.lastError().text()));
+
+		QMutexLocker l(&qmQueue);
+		forever {
+			while (! bStop && (uiQueued == uiWritten))
+				qwcWork.wait(&qmQueue);
+
+			// Give more writes the chance to pile up, unless someone
+			// is waiting for them.
+			if (! bStop && (uiFlush <= uiWritten))
+				qwcWork.wait(&qmQueue, iDelay);
+
+			const quint64 seq = uiQueued;
+			QHash<UserKey, QMap<int, QString> > info = qhUserInfo;
+			QList<QPair<int, QString> > log = qlLog;
+			qhLastChannelWriting = qhLastChannel;
+			qhLastChannel.clear();
+			qhUserInfo.clear();
+			qlLog.clear();
+
+			l.unlock();
+			write(wdb, qhLastChannelWriting, info, log);
+			l.relock();
+
+			qhLastChannelWriting.clear();
+			uiWritten = seq;
+			qwcWritten.wakeAll();
+
+			if (bStop && (uiQueued == uiWritten))
+				break;
+		}
+	}
+	QSqlDatabase::removeDatabase(name);
+}
+
+static void writerPrepare(QSqlQuery &query, const char *str, const QString &prefix) {
+	if (! query.prepare(QString::fromLatin1(str).arg(prefix)))
+		qWarning("DBWriter: SQL Error [%s]: %s", qPrintable(query.lastQuery()), qPrintable(query.lastError().text()));
+}
+
+static void writerExecBatch(QSqlQuery &query) {
+	if (! query.execBatch())
+		qWarning("DBWriter: SQL Error [%s]: %s", qPrintable(query.lastQuery()), qPrintable(query.lastError().text()));
+}
+
+/* One transaction for the whole batch. A statement that fails is logged
+ * and its rows dropped; the others are still written.
+ */
+void DBWriter::write(QSqlDatabase &wdb, const QHash<UserKey, int> &lastchannel, const QHash<UserKey, QMap<int, QString> > &info, const QList<QPair<int, QString> > &log) {
+	const bool sqlite = (wdb.driverName() == QLatin1String("QSQLITE"));
+
+	wdb.transaction();
+	QSqlQuery query(wdb);
+
+	if (! lastchannel.isEmpty()) {
+		QVariantList channels, servers, users;
+		QHash<UserKey, int>::const_iterator i;
+		for (i = lastchannel.constBegin(); i != lastchannel.constEnd(); ++i) {
+			channels << i.value();
+			servers << i.key().first;
+			users << i.key().second;
+		}
+		writerPrepare(query, sqlite ? "UPDATE `%1users` SET `lastchannel`=? WHERE `server_id` = ? AND `user_id` = ?" : "UPDATE `%1users` SET `lastchannel`=?, `last_active` = now() WHERE `server_id` = ? AND `user_id` = ?", qsPrefix);
+		query.addBindValue(channels);
+		query.addBindValue(servers);
+		query.addBindValue(users);
+		writerExecBatch(query);
+	}
+
+	if (! info.isEmpty()) {
+		QVariantList servers, users, keys, values;
+		QHash<UserKey, QMap<int, QString> >::const_iterator i;
+		for (i = info.constBegin(); i != info.constEnd(); ++i) {
+			QMap<int, QString>::const_iterator j;
+			for (j = i.value().constBegin(); j != i.value().constEnd(); ++j) {
+				servers << i.key().first;
+				users << i.key().second;
+				keys << j.key();
+				values << j.value();
+			}
+		}
+		writerPrepare(query, "REPLACE INTO `%1user_info` (`server_id`, `user_id`, `key`, `value`) VALUES (?, ?, ?, ?)", qsPrefix);
+		query.addBindValue(servers);
+		query.addBindValue(users);
+		query.addBindValue(keys);
+		query.addBindValue(values);
+		writerExecBatch(query);
+	}
+
+	if (! log.isEmpty()) {
+		// Once per hour, like Server::dblog().
+		if ((iLogDays > 0) && tLogClean.isElapsed(3600ULL * 1000000ULL)) {
+			QString qstr;
+			if (sqlite)
+				qstr = QString::fromLatin1("DELETE FROM %1slog WHERE msgtime < datetime('now','-%2 days')");
+			else
+				qstr = QString::fromLatin1("DELETE FROM %1slog WHERE msgtime < now() - INTERVAL %2 day");
+			if (! query.exec(qstr.arg(qsPrefix).arg(iLogDays)))
+				qWarning("DBWriter: SQL Error [%s]: %s", qPrintable(query.lastQuery()), qPrintable(query.lastError().text()));
+		}
+
+		QVariantList servers, msgs;
+		for (int i=0;i<log.count();++i) {
+			servers << log.at(i).first;
+			msgs << log.at(i).second;
+		}
+		writerPrepare(query, "INSERT INTO `%1slog` (`server_id`, `msg`) VALUES(?,?)", qsPrefix);
+		query.addBindValue(servers);
+		query.addBindValue(msgs);
+		writerExecBatch(query);
+	}
+
+	query.clear();
+	wdb.commit();
+}
+
@@ -0,0 +1,91 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MURMUR_DBWRITER_H_
+#define MUMBLE_MURMUR_DBWRITER_H_
+
+#include <QtCore/QHash>
+#include <QtCore/QMap>
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+#include <QtCore/QWaitCondition>
+#include <QtSql/QSqlDatabase>
+
+#include "Timer.h"
+
+/* Writes that are allowed to lag behind by up to iDelay msec
+ * (MetaParams::iDBWriteDelay in murmur): the last channel of users, log lines and the e-mail of certificate
+ * logins. They are queued here from any thread, coalesced, and written in a
+ * single transaction by this thread, which has its own database connection.
+ * Whatever is queued when murmur dies is lost.
+ */
+class DBWriter : public QThread {
+	private:
+		Q_DISABLE_COPY(DBWriter);
+	protected:
+		typedef QPair<int, int> UserKey;
+
+		mutable QMutex qmQueue;
+		QWaitCondition qwcWork;
+		QWaitCondition qwcWritten;
+		bool bStop;
+		// Sequence numbers of the last queued and the last written
+		// change, and the last one flush() waits for.
+		quint64 uiQueued, uiWritten, uiFlush;
+
+		// Last write wins.
+		QHash<UserKey, int> qhLastChannel;
+		QHash<UserKey, QMap<int, QString> > qhUserInfo;
+		QList<QPair<int, QString> > qlLog;
+		// Taken off the queue but not committed yet.
+		QHash<UserKey, int> qhLastChannelWriting;
+
+		// Copied from the main connection, opened on this thread.
+		QSqlDatabase qsdSource;
+		QString qsPrefix;
+		int iDelay;
+		int iLogDays;
+		Timer tLogClean;
+
+		void queued(bool urgent = false);
+		void write(QSqlDatabase &db, const QHash<UserKey, int> &lastchannel, const QHash<UserKey, QMap<int, QString> > &info, const QList<QPair<int, QString> > &log);
+		void run();
+	public:
+		DBWriter(const QSqlDatabase &db, const QString &prefix, int delay, int logdays);
+		~DBWriter();
+
+		void setLastChannel(int server_id, int user_id, int channel_id);
+		bool lastChannel(int server_id, int user_id, int &channel_id) const;
+		void setInfo(int server_id, int user_id, int key, const QString &value);
+		void log(int server_id, const QString &msg);
+		void flush();
+};
+
+#endif
@@ -358,6 +358,12 @@ void MurmurDBus::getChannels(QList<ChannelInfo> &a) {
 	}
 }
 
+void MurmurDBus::getMetrics(QString &metrics) {
+	QMap<int, VoiceMetrics> servers;
+	server->getMetrics(servers[server->iServerNum]);
+	metrics = QString::fromLatin1(VoiceMetrics::text(servers));
+}
+
 void MurmurDBus::kickPlayer(unsigned int session, const QString &reason, const QDBusMessage &msg) {
 	PLAYER_SETUP;
 	Connection *c = server->qhUsers.value(session);
@@ -536,7 +542,7 @@ void MurmurDBus::setACL(int id, const QList<ACLInfo> &acls, const QList<GroupInf
 		a->pAllow = static_cast<ChanACL::Permissions>(ai.allow) & ChanACL::All;
 	}
 
-	server->clearACLCache();
+	server->clearACLCache(cChannel);
 	server->updateChannel(cChannel);
 }
 
@@ -911,3 +917,11 @@ void MetaDBus::quit() {
 void MetaDBus::getVersion(int &major, int &minor, int &patch, QString &text) {
 	Meta::getVersion(major, minor, patch, text);
 }
+
+void MetaDBus::getBlobCacheStats(qlonglong &hits, qlonglong &misses, int &entries, int &bytes) {
+	const BlobCache &bc = meta->bcBlobs;
+	hits = static_cast<qlonglong>(bc.hits());
+	misses = static_cast<qlonglong>(bc.misses());
+	entries = bc.count();
+	bytes = bc.bytes();
+}
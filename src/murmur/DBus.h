@@ -177,6 +177,7 @@ class MurmurDBus : public QDBusAbstractAdaptor {
 
 		void getPlayers(QList<PlayerInfoExtended> &player_list);
 		void getChannels(QList<ChannelInfo> &channel_list);
+		void getMetrics(QString &metrics);
 
 		void getACL(int channel, const QDBusMessage &, QList<ACLInfo> &acls,QList<GroupInfo> &groups, bool &inherit);
 		void setACL(int channel, const QList<ACLInfo> &acls, const QList<GroupInfo> &groups, bool inherit, const QDBusMessage &);
@@ -251,6 +252,7 @@ class MetaDBus : public QDBusAbstractAdaptor {
 		void setSuperUserPassword(int server_id, const QString &pw, const QDBusMessage &);
 		void getLog(int server_id, int min_offset, int max_offset, const QDBusMessage &, QList<LogEntry> &entries);
 		void getVersion(int &major, int &minor, int &patch, QString &string);
+		void getBlobCacheStats(qlonglong &hits, qlonglong &misses, int &entries, int &bytes);
 		void quit();
 	signals:
 		void started(int server_id);
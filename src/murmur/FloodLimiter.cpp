@@ -0,0 +1,182 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "murmur_pch.h"
+
+#include "FloodLimiter.h"
+
+static inline quint64 mix(quint64 h) {
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+FloodLimiter::FloodLimiter(quint64 seed) : uiSeed(seed) {
+	iTries = iSubnetTries = iTimeframe = iBanTime = 0;
+
+	for (int i=0;i<2;++i)
+		for (int j=0;j<2;++j)
+			qvCount[i][j].resize(iRows * iWidth);
+	qvBans.resize(iRows * iWidth);
+	clear();
+}
+
+void FloodLimiter::configure(int tries, int subnettries, int timeframe, int bantime) {
+	iTries = tries;
+	iSubnetTries = subnettries;
+	iTimeframe = qMax(timeframe, 1);
+	iBanTime = bantime;
+}
+
+void FloodLimiter::clear() {
+	for (int i=0;i<2;++i)
+		for (int j=0;j<2;++j)
+			qvCount[i][j].fill(0);
+	qvBans.fill(0);
+	uiWindow = 0;
+}
+
+HostAddress FloodLimiter::subnet(const HostAddress &ha) {
+	HostAddress net = ha;
+	if (ha.isV6())
+		net.addr[1] = 0ULL;
+	else
+		net.qip6.c[15] = 0;
+	return net;
+}
+
+// One cell per row; the rows take different bits of the same hash.
+void FloodLimiter::hash(Key kind, const HostAddress &ha, int *cells) const {
+	quint64 h = mix(uiSeed ^ static_cast<quint64>(kind));
+	h = mix(h ^ ha.addr[0]);
+	h = mix(h ^ ha.addr[1]);
+
+	for (int i=0;i<iRows;++i)
+		cells[i] = i * iWidth + static_cast<int>((h >> (i * 16)) & (iWidth - 1));
+}
+
+void FloodLimiter::rotate(quint32 now) {
+	const quint32 frame = static_cast<quint32>(iTimeframe);
+	if (now - uiWindow < frame)
+		return;
+
+	for (int i=0;i<2;++i) {
+		qSwap(qvCount[i][0], qvCount[i][1]);
+		if (now - uiWindow >= 2 * frame)
+			qvCount[i][1].fill(0);
+		qvCount[i][0].fill(0);
+	}
+	uiWindow = now - ((now - uiWindow) % frame);
+}
+
+// Attempts in the last timeframe, counting the part of the previous
+// one that still overlaps it.
+int FloodLimiter::count(Key kind, const int *cells, quint32 now) const {
+	int cur = 0xffff, prev = 0xffff;
+	for (int i=0;i<iRows;++i) {
+		cur = qMin(cur, static_cast<int>(qvCount[kind][0].at(cells[i])));
+		prev = qMin(prev, static_cast<int>(qvCount[kind][1].at(cells[i])));
+	}
+	const int left = iTimeframe - static_cast<int>(now - uiWindow);
+	return cur + (prev * left) / iTimeframe;
+}
+
+// Only the cells holding the minimum are raised, which keeps collisions
+// from adding up.
+void FloodLimiter::add(Key kind, const int *cells) {
+	QVector<quint16> &counters = qvCount[kind][0];
+	quint16 least = 0xffff;
+	for (int i=0;i<iRows;++i)
+		least = qMin(least, counters.at(cells[i]));
+	if (least == 0xffff)
+		return;
+	for (int i=0;i<iRows;++i)
+		if (counters.at(cells[i]) == least)
+			++counters[cells[i]];
+}
+
+bool FloodLimiter::banned(const int *cells, quint32 now) const {
+	for (int i=0;i<iRows;++i)
+		if (qvBans.at(cells[i]) <= now + 1)
+			return false;
+	return true;
+}
+
+void FloodLimiter::ban(const int *cells, quint32 now) {
+	const quint32 until = now + static_cast<quint32>(iBanTime) + 1;
+	for (int i=0;i<iRows;++i)
+		qvBans[cells[i]] = qMax(qvBans.at(cells[i]), until);
+}
+
+/* Records a connection attempt at now (in seconds) and tells whether it
+ * should be dropped. NewBan is returned only for the attempt that caused
+ * the ban, so it can be logged once.
+ */
+FloodLimiter::Result FloodLimiter::check(const HostAddress &ha, quint32 now) {
+	if ((iTries == 0) && (iSubnetTries == 0))
+		return Allowed;
+
+	int addr[iRows], net[iRows];
+	hash(Address, ha, addr);
+	hash(Subnet, subnet(ha), net);
+
+	if (banned(addr, now) || ((iSubnetTries > 0) && banned(net, now)))
+		return Banned;
+
+	rotate(now);
+
+	Result res = Allowed;
+	if (iTries > 0) {
+		add(Address, addr);
+		if (count(Address, addr, now) > iTries) {
+			ban(addr, now);
+			res = NewBan;
+		}
+	}
+	if (iSubnetTries > 0) {
+		add(Subnet, net);
+		if (count(Subnet, net, now) > iSubnetTries) {
+			ban(net, now);
+			res = NewBan;
+		}
+	}
+	return res;
+}
+
+int FloodLimiter::memoryUsage() const {
+	int bytes = qvBans.capacity() * static_cast<int>(sizeof(quint32));
+	for (int i=0;i<2;++i)
+		for (int j=0;j<2;++j)
+			bytes += qvCount[i][j].capacity() * static_cast<int>(sizeof(quint16));
+	return bytes;
+}
@@ -0,0 +1,86 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MURMUR_FLOODLIMITER_H_
+#define MUMBLE_MURMUR_FLOODLIMITER_H_
+
+#include <QtCore/QVector>
+
+#include "Net.h"
+
+/* Counts connection attempts per address and per subnet (/24 for IPv4,
+ * /64 for IPv6) in count-min sketches of a fixed size, so a flood from
+ * many addresses costs no more memory than one from a single address.
+ * Each sketch covers one timeframe; the previous one is kept and weighed
+ * in by how much of it still overlaps, and anything older is forgotten.
+ * Bans are kept the same way, as the time they run out.
+ *
+ * A sketch never undercounts. Collisions can only make an address look
+ * busier than it is, which takes far more distinct addresses in one
+ * timeframe than there are counters in a row.
+ */
+class FloodLimiter {
+	private:
+		Q_DISABLE_COPY(FloodLimiter)
+	public:
+		enum Result { Allowed, Banned, NewBan };
+
+		static const int iRows = 4;
+		static const int iWidth = 16384;
+	protected:
+		enum Key { Address, Subnet };
+
+		quint64 uiSeed;
+		int iTries, iSubnetTries, iTimeframe, iBanTime;
+
+		// Counters of the current and the previous timeframe, for
+		// addresses and for subnets.
+		QVector<quint16> qvCount[2][2];
+		quint32 uiWindow;
+		// When the bans of each cell run out, in seconds plus one.
+		QVector<quint32> qvBans;
+
+		void hash(Key kind, const HostAddress &ha, int *cells) const;
+		void rotate(quint32 now);
+		int count(Key kind, const int *cells, quint32 now) const;
+		void add(Key kind, const int *cells);
+		bool banned(const int *cells, quint32 now) const;
+		void ban(const int *cells, quint32 now);
+	public:
+		FloodLimiter(quint64 seed);
+		void configure(int tries, int subnettries, int timeframe, int bantime);
+		void clear();
+		Result check(const HostAddress &ha, quint32 now);
+		int memoryUsage() const;
+
+		static HostAddress subnet(const HostAddress &ha);
+};
+
+#endif
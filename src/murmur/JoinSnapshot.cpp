@@ -0,0 +1,177 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "murmur_pch.h"
+
+#include "JoinSnapshot.h"
+
+#include "Channel.h"
+#include "Message.h"
+#include "Mumble.pb.h"
+#include "User.h"
+
+JoinSnapshot::JoinSnapshot() {
+}
+
+/* The ChannelState a joining user is sent for c; rootname replaces the
+ * name of the root channel if set. hashes is for clients from 1.2.2 on,
+ * which fetch descriptions by hash.
+ */
+void JoinSnapshot::channelState(const Channel *c, const QString &rootname, bool hashes, MumbleProto::ChannelState &mpcs) {
+	mpcs.set_channel_id(c->iId);
+	if (c->cParent)
+		mpcs.set_parent(c->cParent->iId);
+	if (c->iId == 0)
+		mpcs.set_name(u8(rootname.isEmpty() ? QLatin1String("Root") : rootname));
+	else
+		mpcs.set_name(u8(c->qsName));
+
+	mpcs.set_position(c->iPosition);
+
+	if (hashes && ! c->qbaDescHash.isEmpty())
+		mpcs.set_description_hash(blob(c->qbaDescHash));
+	else if (! c->qsDesc.isEmpty())
+		mpcs.set_description(u8(c->qsDesc));
+}
+
+/* The UserState a joining user is sent for u. Older clients get textures
+ * only if texture is set, as they only take them in one format.
+ */
+void JoinSnapshot::userState(const User *u, bool hashes, bool texture, MumbleProto::UserState &mpus) {
+	mpus.set_session(u->uiSession);
+	mpus.set_name(u8(u->qsName));
+	if (u->iId >= 0)
+		mpus.set_user_id(u->iId);
+	if (hashes) {
+		if (! u->qbaTextureHash.isEmpty())
+			mpus.set_texture_hash(blob(u->qbaTextureHash));
+		else if (! u->qbaTexture.isEmpty())
+			mpus.set_texture(blob(u->qbaTexture));
+	} else if (texture) {
+		mpus.set_texture(blob(u->qbaTexture));
+	}
+	if (u->cChannel->iId != 0)
+		mpus.set_channel_id(u->cChannel->iId);
+	if (u->bDeaf)
+		mpus.set_deaf(true);
+	else if (u->bMute)
+		mpus.set_mute(true);
+	if (u->bSuppress)
+		mpus.set_suppress(true);
+	if (u->bPrioritySpeaker)
+		mpus.set_priority_speaker(true);
+	if (u->bRecording)
+		mpus.set_recording(true);
+	if (u->bSelfDeaf)
+		mpus.set_self_deaf(true);
+	else if (u->bSelfMute)
+		mpus.set_self_mute(true);
+	if (hashes && ! u->qbaCommentHash.isEmpty())
+		mpus.set_comment_hash(blob(u->qbaCommentHash));
+	else if (! u->qsComment.isEmpty())
+		mpus.set_comment(u8(u->qsComment));
+	if (! u->qsHash.isEmpty())
+		mpus.set_hash(u8(u->qsHash));
+}
+
+// Forgets the serialised state a broadcast makes out of date.
+void JoinSnapshot::changed(const ::google::protobuf::Message &msg, unsigned int msgType) {
+	switch (msgType) {
+		case MessageHandler::ChannelState:
+			channelChanged(static_cast<const MumbleProto::ChannelState &>(msg).channel_id());
+			break;
+		case MessageHandler::ChannelRemove:
+			channelChanged(static_cast<const MumbleProto::ChannelRemove &>(msg).channel_id());
+			break;
+		case MessageHandler::UserState:
+			qhUserFrames.remove(static_cast<const MumbleProto::UserState &>(msg).session());
+			break;
+		case MessageHandler::UserRemove:
+			qhUserFrames.remove(static_cast<const MumbleProto::UserRemove &>(msg).session());
+			break;
+		default:
+			break;
+	}
+}
+
+void JoinSnapshot::channelChanged(int id) {
+	qhChannelFrames.remove(id);
+	qbaChannels.clear();
+}
+
+/* All channels from the root down, then their links. Only channels that
+ * changed are serialised again; links are few and always redone.
+ */
+const QByteArray &JoinSnapshot::channels(const Channel *root, const QString &rootname) {
+	if (! qbaChannels.isEmpty())
+		return qbaChannels;
+
+	QQueue<const Channel *> q;
+	QList<const Channel *> linked;
+	q << root;
+	while (! q.isEmpty()) {
+		const Channel *c = q.dequeue();
+
+		QByteArray &frame = qhChannelFrames[c->iId];
+		if (frame.isEmpty()) {
+			MumbleProto::ChannelState mpcs;
+			channelState(c, rootname, true, mpcs);
+			messageToNetwork(mpcs, MessageHandler::ChannelState, frame);
+		}
+		qbaChannels.append(frame);
+
+		if (! c->qhLinks.isEmpty())
+			linked << c;
+		foreach(Channel *sub, c->qlChannels)
+			q.enqueue(sub);
+	}
+
+	foreach(const Channel *c, linked) {
+		MumbleProto::ChannelState mpcs;
+		mpcs.set_channel_id(c->iId);
+		foreach(Channel *l, c->qhLinks.keys())
+			mpcs.add_links(l->iId);
+
+		QByteArray frame;
+		messageToNetwork(mpcs, MessageHandler::ChannelState, frame);
+		qbaChannels.append(frame);
+	}
+	return qbaChannels;
+}
+
+void JoinSnapshot::appendUser(const User *u, QByteArray &snapshot) {
+	QByteArray &frame = qhUserFrames[u->uiSession];
+	if (frame.isEmpty()) {
+		MumbleProto::UserState mpus;
+		userState(u, true, false, mpus);
+		messageToNetwork(mpus, MessageHandler::UserState, frame);
+	}
+	snapshot.append(frame);
+}
@@ -0,0 +1,76 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MURMUR_JOINSNAPSHOT_H_
+#define MUMBLE_MURMUR_JOINSNAPSHOT_H_
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QString>
+
+class Channel;
+class User;
+
+namespace google {
+namespace protobuf {
+class Message;
+}
+}
+
+namespace MumbleProto {
+class ChannelState;
+class UserState;
+}
+
+/* What a client from 1.2.2 on is sent about the channels and the other
+ * users when it joins, kept as serialised messages between joins. Server
+ * broadcasts everything that changes them, and passes each broadcast to
+ * changed() to drop the frames it is about.
+ */
+class JoinSnapshot {
+	private:
+		Q_DISABLE_COPY(JoinSnapshot)
+	protected:
+		QHash<int, QByteArray> qhChannelFrames;
+		QHash<unsigned int, QByteArray> qhUserFrames;
+		QByteArray qbaChannels;
+	public:
+		JoinSnapshot();
+
+		static void channelState(const Channel *c, const QString &rootname, bool hashes, MumbleProto::ChannelState &mpcs);
+		static void userState(const User *u, bool hashes, bool texture, MumbleProto::UserState &mpus);
+
+		void changed(const ::google::protobuf::Message &msg, unsigned int msgType);
+		void channelChanged(int id);
+		const QByteArray &channels(const Channel *root, const QString &rootname);
+		void appendUser(const User *u, QByteArray &snapshot);
+};
+
+#endif
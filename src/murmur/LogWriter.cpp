@@ -0,0 +1,253 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "murmur_pch.h"
+
+#include "LogWriter.h"
+
+// Lines written to the file at once, at most.
+#define LOG_BATCH 1024
+
+LogEmitter::LogEmitter(QObject *p) : QObject(p) {
+}
+
+void LogEmitter::addLogEntry(const QString &msg) {
+	emit newLogEntry(msg);
+}
+
+LogRing::LogRing(int size) {
+	unsigned int n = 2;
+	while (n < static_cast<unsigned int>(size))
+		n <<= 1;
+
+	sSlots = new Slot[n];
+	for (unsigned int i=0;i<n;++i)
+		sSlots[i].qaiSequence.fetchAndStoreOrdered(static_cast<int>(i));
+	uiMask = n - 1;
+	uiTail = 0;
+}
+
+LogRing::~LogRing() {
+	delete [] sSlots;
+}
+
+int LogRing::size() const {
+	return static_cast<int>(uiMask + 1);
+}
+
+// Positions and sequence numbers wrap around; only their distance counts.
+static inline int distance(const QAtomicInt &sequence, unsigned int pos) {
+	const int seq = const_cast<QAtomicInt &>(sequence).fetchAndAddOrdered(0);
+	return static_cast<int>(static_cast<unsigned int>(seq) - pos);
+}
+
+bool LogRing::isEmpty() const {
+	return distance(sSlots[uiTail & uiMask].qaiSequence, uiTail + 1) < 0;
+}
+
+bool LogRing::push(const Entry &e) {
+	unsigned int pos = static_cast<unsigned int>(qaiHead.fetchAndAddOrdered(0));
+	Slot *s;
+
+	forever {
+		s = & sSlots[pos & uiMask];
+		const int d = distance(s->qaiSequence, pos);
+		if (d == 0) {
+			if (qaiHead.testAndSetOrdered(static_cast<int>(pos), static_cast<int>(pos + 1)))
+				break;
+		} else if (d < 0) {
+			// The consumer hasn't freed this slot from the last lap yet.
+			return false;
+		}
+		pos = static_cast<unsigned int>(qaiHead.fetchAndAddOrdered(0));
+	}
+
+	s->e = e;
+	s->qaiSequence.fetchAndStoreOrdered(static_cast<int>(pos + 1));
+	return true;
+}
+
+bool LogRing::pop(Entry &e) {
+	Slot *s = & sSlots[uiTail & uiMask];
+	if (distance(s->qaiSequence, uiTail + 1) < 0)
+		return false;
+
+	e = s->e;
+	// Let go of the message here rather than in the next producer.
+	s->e.qsMsg = QString();
+	s->qaiSequence.fetchAndStoreOrdered(static_cast<int>(uiTail + uiMask + 1));
+	++uiTail;
+	return true;
+}
+
+LogWriter::LogWriter(QFile *f, LogEmitter *le, int size, bool drop) : QThread(), lrRing(size), leEmitter(le), bDrop(drop), qfFile(f) {
+	bStop = false;
+}
+
+LogWriter::~LogWriter() {
+	qmWork.lock();
+	bStop = true;
+	qwcWork.wakeAll();
+	qmWork.unlock();
+
+	wait();
+}
+
+QString LogWriter::format(char type, qint64 msecs, const QString &msg) {
+	return QString::fromLatin1("<%1>%2 %3").arg(QChar::fromLatin1(type)).arg(QDateTime::fromMSecsSinceEpoch(msecs).toString("yyyy-MM-dd hh:mm:ss.zzz")).arg(msg);
+}
+
+// For log rotation; the caller may close the old file once this returns.
+void LogWriter::setFile(QFile *f) {
+	QMutexLocker lock(&qmFile);
+	qfFile = f;
+}
+
+int LogWriter::dropped() {
+	return qaiDropped.fetchAndAddOrdered(0);
+}
+
+int LogWriter::blocked() {
+	return qaiBlocked.fetchAndAddOrdered(0);
+}
+
+// dropped() and blocked() in the Prometheus text format, for MetricsServer.
+QByteArray LogWriter::text() {
+	QByteArray out;
+	out += "# HELP murmur_log_dropped_total Log lines dropped because the log queue was full.\n";
+	out += "# TYPE murmur_log_dropped_total counter\n";
+	out += "murmur_log_dropped_total " + QByteArray::number(dropped()) + '\n';
+	out += "# HELP murmur_log_blocked_total Log lines whose caller had to wait for room in the log queue.\n";
+	out += "# TYPE murmur_log_blocked_total counter\n";
+	out += "murmur_log_blocked_total " + QByteArray::number(blocked()) + '\n';
+	return out;
+}
+
+void LogWriter::wake() {
+	if (qaiSleeping.fetchAndAddOrdered(0)) {
+		QMutexLocker lock(&qmWork);
+		qwcWork.wakeAll();
+	}
+}
+
+void LogWriter::add(char type, const QString &msg) {
+	LogRing::Entry e;
+	e.cType = type;
+	e.iTime = QDateTime::currentMSecsSinceEpoch();
+	e.qsMsg = msg;
+
+	if (! lrRing.push(e)) {
+		if (bDrop && (type != 'C') && (type != 'F')) {
+			qaiDropped.fetchAndAddOrdered(1);
+			return;
+		}
+
+		qaiBlocked.fetchAndAddOrdered(1);
+		QMutexLocker lock(&qmWork);
+		qaiWaiting.fetchAndAddOrdered(1);
+		while (! lrRing.push(e)) {
+			qwcWork.wakeAll();
+			qwcSpace.wait(&qmWork, 10);
+		}
+		qaiWaiting.fetchAndAddOrdered(-1);
+	}
+	qaiAdded.fetchAndAddOrdered(1);
+	wake();
+}
+
+// Waits until everything added so far has been written.
+void LogWriter::flush() {
+	const int added = qaiAdded.fetchAndAddOrdered(0);
+
+	QMutexLocker lock(&qmWork);
+	while (static_cast<int>(static_cast<unsigned int>(qaiWritten.fetchAndAddOrdered(0)) - static_cast<unsigned int>(added)) < 0) {
+		qwcWork.wakeAll();
+		qwcWritten.wait(&qmWork, 100);
+	}
+}
+
+void LogWriter::run() {
+	LogRing::Entry e;
+	QByteArray qba;
+	QStringList qsl;
+	int reported = 0;
+
+	forever {
+		const int dropped = qaiDropped.fetchAndAddOrdered(0);
+		if (dropped != reported) {
+			qsl << format('W', QDateTime::currentMSecsSinceEpoch(), QString::fromLatin1("%1 log messages were dropped, the log file could not keep up").arg(dropped - reported));
+			reported = dropped;
+		}
+
+		int n = 0;
+		while ((n < LOG_BATCH) && lrRing.pop(e)) {
+			qsl << format(e.cType, e.iTime, e.qsMsg);
+			++n;
+		}
+
+		if (! qsl.isEmpty()) {
+			if (qaiWaiting.fetchAndAddOrdered(0)) {
+				QMutexLocker lock(&qmWork);
+				qwcSpace.wakeAll();
+			}
+
+			foreach(const QString &m, qsl) {
+				qba += m.toUtf8();
+				qba += '\n';
+			}
+			{
+				QMutexLocker lock(&qmFile);
+				if (qfFile) {
+					qfFile->write(qba);
+					qfFile->flush();
+				}
+			}
+			qba.clear();
+
+			if (leEmitter)
+				foreach(const QString &m, qsl)
+					leEmitter->addLogEntry(m);
+			qsl.clear();
+
+			qaiWritten.fetchAndAddOrdered(n);
+			QMutexLocker lock(&qmWork);
+			qwcWritten.wakeAll();
+			continue;
+		}
+
+		QMutexLocker lock(&qmWork);
+		if (bStop)
+			break;
+		qaiSleeping.fetchAndStoreOrdered(1);
+		if (lrRing.isEmpty())
+			qwcWork.wait(&qmWork);
+		qaiSleeping.fetchAndStoreOrdered(0);
+	}
+}
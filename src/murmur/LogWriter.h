@@ -0,0 +1,136 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MURMUR_LOGWRITER_H_
+#define MUMBLE_MURMUR_LOGWRITER_H_
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QByteArray>
+#include <QtCore/QMutex>
+#include <QtCore/QObject>
+#include <QtCore/QString>
+#include <QtCore/QThread>
+#include <QtCore/QWaitCondition>
+
+class QFile;
+
+// Hands every log line to the tray and its log window.
+class LogEmitter : public QObject {
+	private:
+		Q_OBJECT
+		Q_DISABLE_COPY(LogEmitter)
+	signals:
+		void newLogEntry(const QString &msg);
+	public:
+		LogEmitter(QObject *parent = NULL);
+		void addLogEntry(const QString &msg);
+};
+
+/* Bounded queue of log lines that any number of threads can add to
+ * without taking a lock, emptied by a single thread. Every slot carries a
+ * sequence number that tells whose turn it is: a producer claims a
+ * position by moving iHead forward and publishes the slot by bumping its
+ * sequence; the consumer hands the slot back a full lap ahead.
+ */
+class LogRing {
+	private:
+		Q_DISABLE_COPY(LogRing)
+	public:
+		struct Entry {
+			char cType;
+			qint64 iTime;
+			QString qsMsg;
+		};
+	protected:
+		struct Slot {
+			QAtomicInt qaiSequence;
+			Entry e;
+		};
+
+		Slot *sSlots;
+		unsigned int uiMask;
+		QAtomicInt qaiHead;
+		// Only touched by the consumer.
+		unsigned int uiTail;
+	public:
+		LogRing(int size);
+		~LogRing();
+		int size() const;
+		bool isEmpty() const;
+		bool push(const Entry &e);
+		bool pop(Entry &e);
+};
+
+/* Formats queued log lines and writes them to the log file in batches,
+ * with one flush per batch, and hands them to the LogEmitter. When the
+ * disk can't keep up and the ring is full, lines are dropped or the
+ * caller waits, depending on MetaParams::bLogQueueDrop. Critical and
+ * fatal messages always wait.
+ */
+class LogWriter : public QThread {
+	private:
+		Q_DISABLE_COPY(LogWriter)
+	protected:
+		LogRing lrRing;
+		LogEmitter *leEmitter;
+		bool bDrop;
+
+		QMutex qmFile;
+		QFile *qfFile;
+
+		// The writer sleeps under qmWork, when it has nothing to do.
+		QMutex qmWork;
+		QWaitCondition qwcWork;
+		QAtomicInt qaiSleeping;
+		QWaitCondition qwcSpace;
+		QWaitCondition qwcWritten;
+		QAtomicInt qaiWaiting;
+		bool bStop;
+
+		QAtomicInt qaiAdded, qaiWritten;
+		QAtomicInt qaiDropped, qaiBlocked;
+
+		void wake();
+		void run();
+	public:
+		LogWriter(QFile *f, LogEmitter *le, int size, bool drop);
+		~LogWriter();
+		void setFile(QFile *f);
+		void add(char type, const QString &msg);
+		void flush();
+
+		int dropped();
+		int blocked();
+		QByteArray text();
+
+		static QString format(char type, qint64 msecs, const QString &msg);
+};
+
+#endif
@@ -109,20 +109,51 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 	}
 	MSG_SETUP(ServerUser::Connected);
 
-	Channel *root = qhChannels.value(0);
-	Channel *c;
-
 	uSource->qsName = u8(msg.username());
 
-	bool ok = false;
-	bool nameok = validateUserName(uSource->qsName);
 	QString pw = u8(msg.password());
 
+	if (qhAuthRequests.count() >= Meta::mp.iAuthQueue) {
+		// The external authenticator is not keeping up.
+		finishAuthenticate(uSource, msg, -3);
+		return;
+	}
+
+	// Give an external authenticator the chance to answer later, so
+	// everyone else is not kept waiting for it.
+	unsigned int request = ++uiAuthSerial;
+	bool pending = false;
+	emit authenticateAsyncSig(pending, request, uSource->qsName, uSource->uiSession, uSource->peerCertificateChain(), uSource->qsHash, uSource->bVerified, pw);
+	if (pending) {
+		AuthRequest *ar = new AuthRequest();
+		ar->uiSession = uSource->uiSession;
+		ar->mpaMessage = msg;
+		qhAuthRequests.insert(request, ar);
+		uSource->sState = ServerUser::Authenticating;
+		if (! qtAuthTimeout->isActive())
+			qtAuthTimeout->start(1000);
+		return;
+	}
+
 	// Fetch ID and stored username.
 	// Since this may call DBus, which may recall our dbus messages, this function needs
 	// to support re-entrancy, and also to support the fact that sessions may go away.
 	int id = authenticate(uSource->qsName, pw, uSource->uiSession, uSource->qslEmail, uSource->qsHash, uSource->bVerified, uSource->peerCertificateChain());
 
+	finishAuthenticate(uSource, msg, id);
+}
+
+/* The rest of msgAuthenticate(), once the user id is known, either right
+ * away or from authenticateDone().
+ */
+void Server::finishAuthenticate(ServerUser *uSource, const MumbleProto::Authenticate &msg, int id) {
+	Channel *root = qhChannels.value(0);
+	Channel *c;
+
+	bool ok = false;
+	bool nameok = validateUserName(uSource->qsName);
+	QString pw = u8(msg.password());
+
 	uSource->iId = id >= 0 ? id : -1;
 
 	QString reason;
@@ -225,41 +256,28 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 		sendTextMessage(NULL, uSource, false, QLatin1String("<strong>WARNING:</strong> Your client doesn't support the CELT codec, you won't be able to talk to or hear most clients. Please make sure your client was built with CELT support."));
 	}
 
-	// Transmit channel tree
-	QQueue<Channel *> q;
-	QSet<Channel *> chans;
-	q << root;
-	MumbleProto::ChannelState mpcs;
-	while (! q.isEmpty()) {
-		c = q.dequeue();
-		chans.insert(c);
-
-		mpcs.Clear();
-
-		mpcs.set_channel_id(c->iId);
-		if (c->cParent)
-			mpcs.set_parent(c->cParent->iId);
-		if (c->iId == 0)
-			mpcs.set_name(u8(qsRegName.isEmpty() ? QLatin1String("Root") : qsRegName));
-		else
-			mpcs.set_name(u8(c->qsName));
-
-		mpcs.set_position(c->iPosition);
-
-		if ((uSource->uiVersion >= 0x010202) && ! c->qbaDescHash.isEmpty())
-			mpcs.set_description_hash(blob(c->qbaDescHash));
-		else if (! c->qsDesc.isEmpty())
-			mpcs.set_description(u8(c->qsDesc));
+	// Transmit channel tree and links
+	if (uSource->uiVersion >= 0x010202) {
+		uSource->sendMessage(channelSnapshot());
+	} else {
+		QQueue<Channel *> q;
+		QList<Channel *> linked;
+		q << root;
+		MumbleProto::ChannelState mpcs;
+		while (! q.isEmpty()) {
+			c = q.dequeue();
+			if (c->qhLinks.count() > 0)
+				linked << c;
 
-		sendMessage(uSource, mpcs);
+			mpcs.Clear();
+			channelState(c, false, mpcs);
+			sendMessage(uSource, mpcs);
 
-		foreach(c, c->qlChannels)
-			q.enqueue(c);
-	}
+			foreach(c, c->qlChannels)
+				q.enqueue(c);
+		}
 
-	// Transmit links
-	foreach(c, chans) {
-		if (c->qhLinks.count() > 0) {
+		foreach(c, linked) {
 			mpcs.Clear();
 			mpcs.set_channel_id(c->iId);
 
@@ -300,9 +318,9 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 		else if (! uSource->qbaTexture.isEmpty())
 			mpus.set_texture(blob(uSource->qbaTexture));
 
-		const QMap<int, QString> &info = getRegistration(uSource->iId);
-		if (info.contains(ServerDB::User_Comment)) {
-			hashAssign(uSource->qsComment, uSource->qbaCommentHash, info.value(ServerDB::User_Comment));
+		const QString &comment = getUserComment(uSource->iId);
+		if (! comment.isNull()) {
+			hashAssign(uSource->qsComment, uSource->qbaCommentHash, comment);
 			if (! uSource->qbaCommentHash.isEmpty())
 				mpus.set_comment_hash(blob(uSource->qbaCommentHash));
 			else if (! uSource->qsComment.isEmpty())
@@ -323,50 +341,21 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 	sendAll(mpus, ~ 0x010202);
 
 	// Transmit other users profiles
-	foreach(ServerUser *u, qhUsers) {
-		if (u->sState != ServerUser::Authenticated)
-			continue;
+	if (uSource->uiVersion >= 0x010202) {
+		uSource->sendMessage(userSnapshot(uSource));
+	} else {
+		const bool texture = (uSource->qbaTexture.length() >= 4) && (qFromBigEndian<unsigned int>(reinterpret_cast<const unsigned char *>(uSource->qbaTexture.constData())) == 600 * 60 * 4);
+		foreach(ServerUser *u, qhUsers) {
+			if (u->sState != ServerUser::Authenticated)
+				continue;
 
-		if (u == uSource)
-			continue;
+			if (u == uSource)
+				continue;
 
-		mpus.Clear();
-		mpus.set_session(u->uiSession);
-		mpus.set_name(u8(u->qsName));
-		if (u->iId >= 0)
-			mpus.set_user_id(u->iId);
-		if (uSource->uiVersion >= 0x010202) {
-			if (! u->qbaTextureHash.isEmpty())
-				mpus.set_texture_hash(blob(u->qbaTextureHash));
-			else if (! u->qbaTexture.isEmpty())
-				mpus.set_texture(blob(u->qbaTexture));
-		} else if ((uSource->qbaTexture.length() >= 4) && (qFromBigEndian<unsigned int>(reinterpret_cast<const unsigned char *>(uSource->qbaTexture.constData())) == 600 * 60 * 4)) {
-			mpus.set_texture(blob(u->qbaTexture));
-		}
-		if (u->cChannel->iId != 0)
-			mpus.set_channel_id(u->cChannel->iId);
-		if (u->bDeaf)
-			mpus.set_deaf(true);
-		else if (u->bMute)
-			mpus.set_mute(true);
-		if (u->bSuppress)
-			mpus.set_suppress(true);
-		if (u->bPrioritySpeaker)
-			mpus.set_priority_speaker(true);
-		if (u->bRecording)
-			mpus.set_recording(true);
-		if (u->bSelfDeaf)
-			mpus.set_self_deaf(true);
-		else if (u->bSelfMute)
-			mpus.set_self_mute(true);
-		if ((uSource->uiVersion >= 0x010202) && ! u->qbaCommentHash.isEmpty())
-			mpus.set_comment_hash(blob(u->qbaCommentHash));
-		else if (! u->qsComment.isEmpty())
-			mpus.set_comment(u8(u->qsComment));
-		if (! u->qsHash.isEmpty())
-			mpus.set_hash(u8(u->qsHash));
-
-		sendMessage(uSource, mpus);
+			mpus.Clear();
+			userState(u, false, texture, mpus);
+			sendMessage(uSource, mpus);
+		}
 	}
 
 	// Send syncronisation packet
@@ -471,8 +460,9 @@ void Server::msgUDPTunnel(ServerUser *uSource, MumbleProto::UDPTunnel &msg) {
 	int len = static_cast<int>(str.length());
 	if (len < 1)
 		return;
-	QReadLocker rl(&qrwlUsers);
-	processMsg(uSource, str.data(), len);
+	++vmMain.uiPacketsIn;
+	vmMain.uiBytesIn += len;
+	processMsg(currentRoutes(), uSource, str.data(), len, Timer::now(), &vmMain);
 }
 
 void Server::msgUserState(ServerUser *uSource, MumbleProto::UserState &msg) {
@@ -544,12 +534,12 @@ void Server::msgUserState(ServerUser *uSource, MumbleProto::UserState &msg) {
 		}
 
 
-		if (! isTextAllowed(comment, changed)) {
+		if (! isTextAllowed(*msg.mutable_comment(), changed)) {
 			PERM_DENIED_TYPE(TextTooLong);
 			return;
 		}
 		if (changed)
-			msg.set_comment(u8(comment));
+			comment = u8(msg.comment());
 	}
 
 	if (msg.has_texture()) {
@@ -618,6 +608,8 @@ void Server::msgUserState(ServerUser *uSource, MumbleProto::UserState &msg) {
 		msg.clear_plugin_context();
 	}
 
+	uSource->syncEndpoint();
+
 	if (msg.has_plugin_identity()) {
 		uSource->qsIdentity = u8(msg.plugin_identity());
 		// Make sure to clear this from the packet so we don't broadcast it
@@ -656,6 +648,8 @@ void Server::msgUserState(ServerUser *uSource, MumbleProto::UserState &msg) {
 		if (msg.has_priority_speaker())
 			pDstServerUser->bPrioritySpeaker = msg.priority_speaker();
 
+		pDstServerUser->syncEndpoint();
+
 		log(uSource, QString("Changed speak-state of %1 (%2 %3 %4 %5)").arg(QString(*pDstServerUser),
 		        QString::number(pDstServerUser->bMute),
 		        QString::number(pDstServerUser->bDeaf),
@@ -806,14 +800,12 @@ void Server::msgChannelState(ServerUser *uSource, MumbleProto::ChannelState &msg
 	QString qsName;
 	QString qsDesc;
 	if (msg.has_description()) {
-		qsDesc = u8(msg.description());
 		bool changed = false;
-		if (! isTextAllowed(qsDesc, changed)) {
+		if (! isTextAllowed(*msg.mutable_description(), changed)) {
 			PERM_DENIED_TYPE(TextTooLong);
 			return;
 		}
-		if (changed)
-			msg.set_description(u8(qsDesc));
+		qsDesc = u8(msg.description());
 	}
 
 	if (msg.has_name()) {
@@ -894,7 +886,7 @@ void Server::msgChannelState(ServerUser *uSource, MumbleProto::ChannelState &msg
 			a->pDeny=ChanACL::None;
 			a->pAllow=ChanACL::Write | ChanACL::Traverse;
 
-			clearACLCache();
+			clearACLCache(c);
 		}
 		updateChannel(c);
 
@@ -1018,6 +1010,9 @@ void Server::msgChannelState(ServerUser *uSource, MumbleProto::ChannelState &msg
 
 			c->cParent->removeChannel(c);
 			p->addChannel(c);
+
+			// Everything below c now inherits from somewhere else.
+			clearACLCache(c);
 		}
 		if (! qsName.isNull()) {
 			log(uSource, QString("Renamed channel %1 to %2").arg(QString(*c),
@@ -1075,17 +1070,16 @@ void Server::msgTextMessage(ServerUser *uSource, MumbleProto::TextMessage &msg)
 	QSet<ServerUser *> users;
 	QQueue<Channel *> q;
 
-	QString text = u8(msg.message());
 	bool changed = false;
 
-	if (! isTextAllowed(text, changed)) {
+	if (! isTextAllowed(*msg.mutable_message(), changed)) {
 		PERM_DENIED_TYPE(TextTooLong);
 		return;
 	}
-	if (text.isEmpty())
+	if (msg.message().empty())
 		return;
-	if (changed)
-		msg.set_message(u8(text));
+
+	const QString &text = u8(msg.message());
 
 	tm.qsText = text;
 
@@ -1307,7 +1301,7 @@ void Server::msgACL(ServerUser *uSource, MumbleProto::ACL &msg) {
 			a->pAllow=static_cast<ChanACL::Permissions>(mpacl.grant()) & ChanACL::All;
 		}
 
-		clearACLCache();
+		clearACLCache(c);
 
 		if (! hasPermission(uSource, c, ChanACL::Write) && ((uSource->iId >= 0) || !uSource->qsHash.isEmpty())) {
 			a = new ChanACL(c);
@@ -1321,7 +1315,7 @@ void Server::msgACL(ServerUser *uSource, MumbleProto::ACL &msg) {
 			a->pDeny=ChanACL::None;
 			a->pAllow=ChanACL::Write | ChanACL::Traverse;
 
-			clearACLCache();
+			clearACLCache(c);
 		}
 
 		updateChannel(c);
@@ -1395,6 +1389,7 @@ void Server::msgCryptSetup(ServerUser *uSource, MumbleProto::CryptSetup &msg) {
 	} else {
 		const std::string &str = msg.client_nonce();
 		if (str.size()  == AES_BLOCK_SIZE) {
+			QMutexLocker l(&uSource->qmCrypt);
 			uSource->csCrypt.uiResync++;
 			memcpy(uSource->csCrypt.decrypt_iv, str.data(), AES_BLOCK_SIZE);
 		}
@@ -1500,7 +1495,7 @@ void Server::msgVoiceTarget(ServerUser *uSource, MumbleProto::VoiceTarget &msg)
 
 	QWriteLocker lock(&qrwlUsers);
 
-	uSource->qmTargetCache.remove(target);
+	removeTargetCache(uSource, target);
 
 	int count = msg.targets_size();
 	if (count == 0) {
@@ -1638,38 +1633,58 @@ void Server::msgRequestBlob(ServerUser *uSource, MumbleProto::RequestBlob &msg)
 	int ncomments = msg.session_comment_size();
 	int ndescriptions = msg.channel_description_size();
 
+	// Blobs that have a hash are big; their part of the reply is
+	// serialised once and shared from Meta::bcBlobs.
 	if (ndescriptions) {
-		MumbleProto::ChannelState mpcs;
+		MumbleProto::ChannelState mpcs, field;
 		for (int i=0;i<ndescriptions;++i) {
 			int id = msg.channel_description(i);
 			Channel *c = qhChannels.value(id);
 			if (c && ! c->qsDesc.isEmpty()) {
 				mpcs.set_channel_id(id);
-				mpcs.set_description(u8(c->qsDesc));
-				sendMessage(uSource, mpcs);
+				if (c->qbaDescHash.isEmpty()) {
+					mpcs.set_description(u8(c->qsDesc));
+					sendMessage(uSource, mpcs);
+					mpcs.clear_description();
+				} else {
+					field.set_description(u8(c->qsDesc));
+					sendBlobMessage(uSource, mpcs, MessageHandler::ChannelState, "description" + c->qbaDescHash, field);
+				}
 			}
 		}
 	}
 	if (ntextures || ncomments) {
-		MumbleProto::UserState mpus;
+		MumbleProto::UserState mpus, field;
 		for (int i=0;i<ntextures;++i) {
 			int session = msg.session_texture(i);
 			ServerUser *su = qhUsers.value(session);
 			if (su && ! su->qbaTexture.isEmpty()) {
 				mpus.set_session(session);
-				mpus.set_texture(blob(su->qbaTexture));
-				sendMessage(uSource, mpus);
+				if (su->qbaTextureHash.isEmpty()) {
+					mpus.set_texture(blob(su->qbaTexture));
+					sendMessage(uSource, mpus);
+					mpus.clear_texture();
+				} else {
+					field.set_texture(blob(su->qbaTexture));
+					sendBlobMessage(uSource, mpus, MessageHandler::UserState, "texture" + su->qbaTextureHash, field);
+					field.clear_texture();
+				}
 			}
 		}
-		if (ntextures)
-			mpus.clear_texture();
 		for (int i=0;i<ncomments;++i) {
 			int session = msg.session_comment(i);
 			ServerUser *su = qhUsers.value(session);
 			if (su && ! su->qsComment.isEmpty()) {
 				mpus.set_session(session);
-				mpus.set_comment(u8(su->qsComment));
-				sendMessage(uSource, mpus);
+				if (su->qbaCommentHash.isEmpty()) {
+					mpus.set_comment(u8(su->qsComment));
+					sendMessage(uSource, mpus);
+					mpus.clear_comment();
+				} else {
+					field.set_comment(u8(su->qsComment));
+					sendBlobMessage(uSource, mpus, MessageHandler::UserState, "comment" + su->qbaCommentHash, field);
+					field.clear_comment();
+				}
 			}
 		}
 	}
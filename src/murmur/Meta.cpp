@@ -33,12 +33,17 @@
 #include "Meta.h"
 
 #include "Connection.h"
+#include "LogWriter.h"
+#include "Metrics.h"
 #include "Net.h"
+#include "NetworkThread.h"
 #include "ServerDB.h"
 #include "Server.h"
 #include "OSInfo.h"
 #include "Version.h"
 
+extern LogWriter *lwLog;
+
 MetaParams Meta::mp;
 
 #ifdef Q_OS_WIN
@@ -60,12 +65,22 @@ MetaParams::MetaParams() {
 	qsWelcomeText = QString("Welcome to this server");
 	qsDatabase = QString();
 	iDBPort = 0;
+	iDBWriteDelay = 1000;
+	iBlobCache = 16;
+	iLogQueue = 4096;
+	bLogQueueDrop = true;
+	qhaMetrics = QHostAddress(QHostAddress::LocalHost);
+	usMetricsPort = 0;
 	qsDBusService = "net.sourceforge.mumble.murmur";
 	qsDBDriver = "QSQLITE";
 	qsLogfile = "murmur.log";
 
 	iLogDays = 31;
 
+	iUdpBatch = 0;
+	iVoiceThreads = 1;
+	iNetworkThreads = 2;
+
 	iObfuscate = 0;
 	bSendVersion = true;
 	bBonjour = true;
@@ -73,9 +88,13 @@ MetaParams::MetaParams() {
 	bCertRequired = false;
 
 	iBanTries = 10;
+	iBanSubnetTries = 0;
 	iBanTimeframe = 120;
 	iBanTime = 300;
 
+	iAuthQueue = 32;
+	iAuthTimeout = 10;
+
 #ifdef Q_OS_UNIX
 	uiUid = uiGid = 0;
 #endif
@@ -279,6 +298,14 @@ void MetaParams::read(QString fname) {
 	qsDBPrefix = typeCheckedFromSettings("dbPrefix", qsDBPrefix);
 	qsDBOpts = typeCheckedFromSettings("dbOpts", qsDBOpts);
 	iDBPort = typeCheckedFromSettings("dbPort", iDBPort);
+	iDBWriteDelay = qMax(0, typeCheckedFromSettings("dbwritedelay", iDBWriteDelay));
+	iBlobCache = qBound(0, typeCheckedFromSettings("blobcache", iBlobCache), 1024);
+	iLogQueue = qBound(0, typeCheckedFromSettings("logqueue", iLogQueue), 1 << 20);
+	bLogQueueDrop = typeCheckedFromSettings("logqueuedrop", bLogQueueDrop);
+	usMetricsPort = static_cast<unsigned short>(typeCheckedFromSettings("metricsport", static_cast<uint>(usMetricsPort)));
+	const QString qsMetricsAddress = typeCheckedFromSettings("metricsaddress", qhaMetrics.toString());
+	if (! qhaMetrics.setAddress(qsMetricsAddress))
+		qFatal("Invalid metricsaddress %s", qPrintable(qsMetricsAddress));
 
 	qsIceEndpoint = typeCheckedFromSettings("ice", qsIceEndpoint);
 	qsIceSecretRead = typeCheckedFromSettings("icesecret", qsIceSecretRead);
@@ -287,10 +314,15 @@ void MetaParams::read(QString fname) {
 
 	iLogDays = typeCheckedFromSettings("logdays", iLogDays);
 
+	iUdpBatch = qBound(0, typeCheckedFromSettings("udpbatch", iUdpBatch), 1024);
+	iVoiceThreads = qBound(1, typeCheckedFromSettings("voicethreads", iVoiceThreads), 64);
+	iNetworkThreads = qBound(0, typeCheckedFromSettings("networkthreads", iNetworkThreads), 64);
+
 	qsDBus = typeCheckedFromSettings("dbus", qsDBus);
 	qsDBusService = typeCheckedFromSettings("dbusservice", qsDBusService);
 	qsLogfile = typeCheckedFromSettings("logfile", qsLogfile);
 	qsPid = typeCheckedFromSettings("pidfile", qsPid);
+	qsVoiceTraceDir = typeCheckedFromSettings("voicetracedir", qsVoiceTraceDir);
 
 	qsRegName = typeCheckedFromSettings("registerName", qsRegName);
 	qsRegPassword = typeCheckedFromSettings("registerPassword", qsRegPassword);
@@ -300,9 +332,13 @@ void MetaParams::read(QString fname) {
 	bBonjour = typeCheckedFromSettings("bonjour", bBonjour);
 
 	iBanTries = typeCheckedFromSettings("autobanAttempts", iBanTries);
+	iBanSubnetTries = typeCheckedFromSettings("autobanSubnetAttempts", iBanSubnetTries);
 	iBanTimeframe = typeCheckedFromSettings("autobanTimeframe", iBanTimeframe);
 	iBanTime = typeCheckedFromSettings("autobanTime", iBanTime);
 
+	iAuthQueue = qMax(1, typeCheckedFromSettings("authqueue", iAuthQueue));
+	iAuthTimeout = qMax(1, typeCheckedFromSettings("authtimeout", iAuthTimeout));
+
 	qvSuggestVersion = MumbleVersion::getRaw(qsSettings->value("suggestVersion").toString());
 	if (qvSuggestVersion.toUInt() == 0)
 		qvSuggestVersion = QVariant();
@@ -481,7 +517,31 @@ void MetaParams::read(QString fname) {
 	qmConfig.insert(QLatin1String("channelnestinglimit"), QString::number(iChannelNestingLimit));
 }
 
-Meta::Meta() {
+// Keeps anyone from picking addresses that collide in the flood limiter.
+static quint64 randomSeed() {
+	quint64 seed = 0;
+	RAND_bytes(reinterpret_cast<unsigned char *>(&seed), sizeof(seed));
+	return seed;
+}
+
+Meta::Meta() : flFlood(randomSeed()), bcBlobs(mp.iBlobCache * 1024 * 1024) {
+	iNextNetworkThread = 0;
+	flFlood.configure(mp.iBanTries, mp.iBanSubnetTries, mp.iBanTimeframe, mp.iBanTime);
+	for (int i=0;i<mp.iNetworkThreads;++i) {
+		NetworkThread *nt = new NetworkThread();
+		nt->start();
+		qlNetworkThreads << nt;
+	}
+
+	msMetrics = NULL;
+	if (mp.usMetricsPort) {
+		msMetrics = new MetricsServer(this);
+		if (msMetrics->listen(mp.qhaMetrics, mp.usMetricsPort))
+			qWarning("Meta: Serving metrics on http://%s:%d/", qPrintable(mp.qhaMetrics.toString()), mp.usMetricsPort);
+		else
+			qWarning("Meta: Failed to serve metrics on port %d: %s", mp.usMetricsPort, qPrintable(msMetrics->errorString()));
+	}
+
 #ifdef Q_OS_WIN
 	QOS_VERSION qvVer;
 	qvVer.MajorVersion = 1;
@@ -497,20 +557,78 @@ Meta::Meta() {
 		if (! QOSCreateHandle(&qvVer, &hQoS))
 			qWarning("Meta: Failed to create QOS2 handle");
 		else
-			Connection::setQoS(hQoS);
+			SocketHandler::setQoS(hQoS);
 	}
 #endif
 }
 
 Meta::~Meta() {
+	qDeleteAll(qlNetworkThreads);
+
 #ifdef Q_OS_WIN
 	if (hQoS) {
 		QOSCloseHandle(hQoS);
-		Connection::setQoS(NULL);
+		SocketHandler::setQoS(NULL);
 	}
 #endif
 }
 
+MetricsServer::MetricsServer(QObject *p) : QTcpServer(p) {
+	connect(this, SIGNAL(newConnection()), this, SLOT(handleConnection()));
+}
+
+void MetricsServer::handleConnection() {
+	while (QTcpSocket *sock = nextPendingConnection()) {
+		connect(sock, SIGNAL(readyRead()), this, SLOT(readRequest()));
+		connect(sock, SIGNAL(disconnected()), sock, SLOT(deleteLater()));
+		// Don't let idle scrapers pile up.
+		QTimer::singleShot(5000, sock, SLOT(deleteLater()));
+	}
+}
+
+void MetricsServer::readRequest() {
+	QTcpSocket *sock = qobject_cast<QTcpSocket *>(sender());
+	if (! sock)
+		return;
+
+	if (! sock->canReadLine()) {
+		if (sock->bytesAvailable() > 4096)
+			sock->abort();
+		return;
+	}
+
+	// Only the request line matters; anything else the client sends is ignored.
+	const QByteArray request = sock->readLine(4096);
+	disconnect(sock, SIGNAL(readyRead()), this, SLOT(readRequest()));
+
+	QByteArray body;
+	QByteArray status;
+	if (request.startsWith("GET ")) {
+		QMap<int, VoiceMetrics> servers;
+		foreach(Server *s, meta->qhServers)
+			s->getMetrics(servers[s->iServerNum]);
+		body = VoiceMetrics::text(servers);
+		if (lwLog)
+			body += lwLog->text();
+		status = "200 OK";
+	} else {
+		status = "405 Method Not Allowed";
+	}
+
+	sock->write("HTTP/1.0 " + status + "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + QByteArray::number(body.size()) + "\r\nConnection: close\r\n\r\n");
+	sock->write(body);
+	sock->disconnectFromHost();
+}
+
+// The thread to put the next client socket in, or NULL to keep it in the
+// main thread.
+QThread *Meta::networkThread() {
+	if (qlNetworkThreads.isEmpty())
+		return NULL;
+	iNextNetworkThread = (iNextNetworkThread + 1) % qlNetworkThreads.count();
+	return qlNetworkThreads.at(iNextNetworkThread);
+}
+
 void Meta::getOSInfo() {
 	qsOS = OSInfo::getOS();
 	qsOSVersion = OSInfo::getOSVersion();
@@ -581,29 +699,12 @@ void Meta::killAll() {
 	qhServers.clear();
 }
 
-bool Meta::banCheck(const QHostAddress &addr) {
-	if ((mp.iBanTries == 0) || (mp.iBanTimeframe == 0))
-		return false;
+FloodLimiter::Result Meta::banCheck(const HostAddress &addr) {
+	if (mp.iBanTimeframe == 0)
+		return FloodLimiter::Allowed;
 
-	if (addr.toIPv4Address() == ((128U << 24) | (39U << 16) | (114U << 8) | 1U))
-		return false;
+	if (! addr.isV6() && (ntohl(addr.hash[3]) == ((128U << 24) | (39U << 16) | (114U << 8) | 1U)))
+		return FloodLimiter::Allowed;
 
-	if (qhBans.contains(addr)) {
-		Timer t = qhBans.value(addr);
-		if (t.elapsed() < (1000000ULL * mp.iBanTime))
-			return true;
-		qhBans.remove(addr);
-	}
-
-	QList<Timer> &ql = qhAttempts[addr];
-
-	ql.append(Timer());
-	while (! ql.isEmpty() && (ql.at(0).elapsed() > (1000000ULL * mp.iBanTimeframe)))
-		ql.removeFirst();
-
-	if (ql.count() > mp.iBanTries) {
-		qhBans.insert(addr, Timer());
-		return true;
-	}
-	return false;
+	return flFlood.check(addr, static_cast<quint32>(Timer::now() / 1000000ULL));
 }
@@ -38,12 +38,17 @@
 #include <QtNetwork/QHostAddress>
 #include <QtNetwork/QSslCertificate>
 #include <QtNetwork/QSslKey>
+#include <QtNetwork/QTcpServer>
 #ifdef Q_OS_WIN
 #include <windows.h>
 #endif
 
+#include "BlobCache.h"
+#include "FloodLimiter.h"
 #include "Timer.h"
 
+class NetworkThread;
+class QThread;
 class Server;
 class QSettings;
 
@@ -69,9 +74,13 @@ public:
 	bool bCertRequired;
 
 	int iBanTries;
+	int iBanSubnetTries;
 	int iBanTimeframe;
 	int iBanTime;
 
+	int iAuthQueue;
+	int iAuthTimeout;
+
 	QString qsDatabase;
 	QString qsDBDriver;
 	QString qsDBUserName;
@@ -80,9 +89,20 @@ public:
 	QString qsDBPrefix;
 	QString qsDBOpts;
 	int iDBPort;
+	int iDBWriteDelay;
+	int iBlobCache;
+	int iLogQueue;
+	bool bLogQueueDrop;
+
+	QHostAddress qhaMetrics;
+	unsigned short usMetricsPort;
 
 	int iLogDays;
 
+	int iUdpBatch;
+	int iVoiceThreads;
+	int iNetworkThreads;
+
 	int iObfuscate;
 	bool bSendVersion;
 	bool bAllowPing;
@@ -91,6 +111,7 @@ public:
 	QString qsDBusService;
 	QString qsLogfile;
 	QString qsPid;
+	QString qsVoiceTraceDir;
 	QString qsIceEndpoint;
 	QString qsIceSecretRead, qsIceSecretWrite;
 
@@ -131,6 +152,21 @@ private:
 		T typeCheckedFromSettings(const QString &name, const T &variable);
 };
 
+/* Serves VoiceMetrics::text() of all running servers, and the counters
+ * of the log queue, over HTTP to whoever connects to
+ * MetaParams::usMetricsPort and sends a GET.
+ */
+class MetricsServer : public QTcpServer {
+	private:
+		Q_OBJECT
+		Q_DISABLE_COPY(MetricsServer)
+	public:
+		MetricsServer(QObject *parent = NULL);
+	public slots:
+		void handleConnection();
+		void readRequest();
+};
+
 class Meta : public QObject {
 	private:
 		Q_OBJECT;
@@ -138,10 +174,13 @@ class Meta : public QObject {
 	public:
 		static MetaParams mp;
 		QHash<int, Server *> qhServers;
-		QHash<QHostAddress, QList<Timer> > qhAttempts;
-		QHash<QHostAddress, Timer> qhBans;
+		FloodLimiter flFlood;
+		BlobCache bcBlobs;
 		QString qsOS, qsOSVersion;
 		Timer tUptime;
+		QList<NetworkThread *> qlNetworkThreads;
+		int iNextNetworkThread;
+		MetricsServer *msMetrics;
 
 #ifdef Q_OS_WIN
 		static HANDLE hQoS;
@@ -151,7 +190,8 @@ class Meta : public QObject {
 		~Meta();
 		void bootAll();
 		bool boot(int);
-		bool banCheck(const QHostAddress &);
+		FloodLimiter::Result banCheck(const HostAddress &);
+		QThread *networkThread();
 		void kill(int);
 		void killAll();
 		void getOSInfo();
@@ -0,0 +1,259 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "murmur_pch.h"
+
+#include "Metrics.h"
+
+#include "Timer.h"
+
+LatencyHistogram::LatencyHistogram() {
+	memset(uiCounts, 0, sizeof(uiCounts));
+	uiCount = uiSum = 0;
+}
+
+/* 0 to 3 have their own buckets. Above that, a value with its highest bit
+ * at position msb goes to one of four buckets, picked by the next two bits.
+ */
+int LatencyHistogram::bucket(quint64 ns) {
+	if (ns < 4)
+		return static_cast<int>(ns);
+
+	int msb = 0;
+	for (int shift = 32; shift > 0; shift >>= 1)
+		if ((ns >> (msb + shift)) != 0)
+			msb += shift;
+
+	const int b = (msb - 1) * 4 + static_cast<int>((ns >> (msb - 2)) & 3);
+	return qMin(b, iBuckets - 1);
+}
+
+quint64 LatencyHistogram::upperBound(int b) {
+	if (b < 4)
+		return static_cast<quint64>(b + 1);
+	const int msb = b / 4 + 1;
+	return static_cast<quint64>(4 + (b % 4) + 1) << (msb - 2);
+}
+
+void LatencyHistogram::add(quint64 ns) {
+	++uiCounts[bucket(ns)];
+	++uiCount;
+	uiSum += ns;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other) {
+	for (int i=0;i<iBuckets;++i)
+		uiCounts[i] += other.uiCounts[i];
+	uiCount += other.uiCount;
+	uiSum += other.uiSum;
+}
+
+// The upper bound of the bucket the p-th fraction of values falls in.
+quint64 LatencyHistogram::percentile(double p) const {
+	if (uiCount == 0)
+		return 0;
+
+	const quint64 rank = qMax(Q_UINT64_C(1), static_cast<quint64>(p * static_cast<double>(uiCount) + 0.5));
+	quint64 seen = 0;
+	for (int i=0;i<iBuckets;++i) {
+		seen += uiCounts[i];
+		if (seen >= rank)
+			return upperBound(i);
+	}
+	return upperBound(iBuckets - 1);
+}
+
+// How many values are known to be at most ns; exact when ns is a bucket bound.
+quint64 LatencyHistogram::countBelow(quint64 ns) const {
+	quint64 n = 0;
+	for (int i=0;(i<iBuckets) && (upperBound(i) <= ns);++i)
+		n += uiCounts[i];
+	return n;
+}
+
+VoiceMetrics::VoiceMetrics() {
+	uiPacketsIn = uiBytesIn = 0;
+	uiPacketsOut = uiBytesOut = 0;
+	uiTunnelOut = uiTunnelBytesOut = 0;
+	for (int i=0;i<DropCount;++i)
+		uiDrops[i] = 0;
+	iTunnelUsers = iTunnelBytes = 0;
+}
+
+void VoiceMetrics::merge(const VoiceMetrics &other) {
+	uiPacketsIn += other.uiPacketsIn;
+	uiBytesIn += other.uiBytesIn;
+	uiPacketsOut += other.uiPacketsOut;
+	uiBytesOut += other.uiBytesOut;
+	uiTunnelOut += other.uiTunnelOut;
+	uiTunnelBytesOut += other.uiTunnelBytesOut;
+	for (int i=0;i<DropCount;++i)
+		uiDrops[i] += other.uiDrops[i];
+	for (int i=0;i<StageCount;++i)
+		lhStages[i].merge(other.lhStages[i]);
+	iTunnelUsers += other.iTunnelUsers;
+	iTunnelBytes += other.iTunnelBytes;
+}
+
+static const char *stageNames[VoiceMetrics::StageCount] = { "receive", "decrypt", "route", "encrypt", "send", "users_lock" };
+static const char *dropNames[VoiceMetrics::DropCount] = { "malformed", "unknown_peer", "decrypt", "bandwidth", "tunnel_queue" };
+
+static QByteArray seconds(quint64 ns) {
+	return QByteArray::number(static_cast<double>(ns) / 1e9, 'g', 6);
+}
+
+static void family(QByteArray &out, const char *name, const char *type, const char *help) {
+	out += "# HELP ";
+	out += name;
+	out += ' ';
+	out += help;
+	out += "\n# TYPE ";
+	out += name;
+	out += ' ';
+	out += type;
+	out += '\n';
+}
+
+static void sample(QByteArray &out, const char *name, int server_id, const QByteArray &labels, const QByteArray &value) {
+	out += name;
+	out += "{server=\"";
+	out += QByteArray::number(server_id);
+	out += '"';
+	out += labels;
+	out += "} ";
+	out += value;
+	out += '\n';
+}
+
+#define COUNTER(name, help, member) \
+	family(out, name, "counter", help); \
+	for (i = servers.constBegin(); i != servers.constEnd(); ++i) \
+		sample(out, name, i.key(), QByteArray(), QByteArray::number(i.value().member));
+
+#define GAUGE(name, help, member) \
+	family(out, name, "gauge", help); \
+	for (i = servers.constBegin(); i != servers.constEnd(); ++i) \
+		sample(out, name, i.key(), QByteArray(), QByteArray::number(i.value().member));
+
+/* The Prometheus text exposition format, with every metric family listed
+ * once for all servers.
+ */
+QByteArray VoiceMetrics::text(const QMap<int, VoiceMetrics> &servers) {
+	QByteArray out;
+	QMap<int, VoiceMetrics>::const_iterator i;
+
+	COUNTER("murmur_voice_packets_received_total", "Voice datagrams received.", uiPacketsIn);
+	COUNTER("murmur_voice_bytes_received_total", "Bytes of voice datagrams received.", uiBytesIn);
+	COUNTER("murmur_voice_packets_sent_total", "Voice datagrams sent over UDP.", uiPacketsOut);
+	COUNTER("murmur_voice_bytes_sent_total", "Bytes of voice datagrams sent over UDP.", uiBytesOut);
+	COUNTER("murmur_voice_tunnel_packets_sent_total", "Voice packets queued for users without UDP.", uiTunnelOut);
+	COUNTER("murmur_voice_tunnel_bytes_sent_total", "Bytes of voice packets queued for users without UDP.", uiTunnelBytesOut);
+
+	family(out, "murmur_voice_dropped_total", "counter", "Voice packets dropped, by reason.");
+	for (i = servers.constBegin(); i != servers.constEnd(); ++i)
+		for (int d=0;d<DropCount;++d)
+			sample(out, "murmur_voice_dropped_total", i.key(), QByteArray(",reason=\"") + dropNames[d] + '"', QByteArray::number(i.value().uiDrops[d]));
+
+	GAUGE("murmur_voice_tunnel_queue_users", "Users with voice waiting to be tunnelled.", iTunnelUsers);
+	GAUGE("murmur_voice_tunnel_queue_bytes", "Bytes of voice waiting to be tunnelled.", iTunnelBytes);
+
+	// Powers of two from 128 ns to about a second.
+	family(out, "murmur_voice_stage_seconds", "histogram", "Time spent per voice packet in each stage; route includes encrypt and send.");
+	for (i = servers.constBegin(); i != servers.constEnd(); ++i) {
+		for (int s=0;s<StageCount;++s) {
+			const LatencyHistogram &lh = i.value().lhStages[s];
+			const QByteArray stage = QByteArray(",stage=\"") + stageNames[s] + '"';
+			for (int bit=7;bit<=30;++bit) {
+				const quint64 bound = Q_UINT64_C(1) << bit;
+				sample(out, "murmur_voice_stage_seconds_bucket", i.key(), stage + ",le=\"" + seconds(bound) + '"', QByteArray::number(lh.countBelow(bound)));
+			}
+			sample(out, "murmur_voice_stage_seconds_bucket", i.key(), stage + ",le=\"+Inf\"", QByteArray::number(lh.uiCount));
+			sample(out, "murmur_voice_stage_seconds_sum", i.key(), stage, seconds(lh.uiSum));
+			sample(out, "murmur_voice_stage_seconds_count", i.key(), stage, QByteArray::number(lh.uiCount));
+		}
+	}
+
+	family(out, "murmur_voice_stage_quantile_seconds", "gauge", "Quantiles of murmur_voice_stage_seconds, to within 25%.");
+	for (i = servers.constBegin(); i != servers.constEnd(); ++i) {
+		for (int s=0;s<StageCount;++s) {
+			const LatencyHistogram &lh = i.value().lhStages[s];
+			const QByteArray stage = QByteArray(",stage=\"") + stageNames[s] + '"';
+			sample(out, "murmur_voice_stage_quantile_seconds", i.key(), stage + ",quantile=\"0.5\"", seconds(lh.percentile(0.5)));
+			sample(out, "murmur_voice_stage_quantile_seconds", i.key(), stage + ",quantile=\"0.99\"", seconds(lh.percentile(0.99)));
+			sample(out, "murmur_voice_stage_quantile_seconds", i.key(), stage + ",quantile=\"0.999\"", seconds(lh.percentile(0.999)));
+		}
+	}
+
+	return out;
+}
+
+#undef COUNTER
+#undef GAUGE
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+
+quint64 VoiceMetrics::ticks() {
+	static double scale = 0;
+
+	if (scale == 0) {
+		LARGE_INTEGER freq;
+		QueryPerformanceFrequency(&freq);
+		scale = 1000000000. / freq.QuadPart;
+	}
+
+	LARGE_INTEGER li;
+	QueryPerformanceCounter(&li);
+	return static_cast<quint64>(li.QuadPart * scale);
+}
+#elif defined(Q_OS_MAC)
+#include <mach/mach_time.h>
+
+quint64 VoiceMetrics::ticks() {
+	static mach_timebase_info_data_t info;
+
+	if (info.denom == 0)
+		mach_timebase_info(&info);
+
+	return (mach_absolute_time() * info.numer) / info.denom;
+}
+#elif defined(Q_OS_UNIX)
+#include <time.h>
+
+quint64 VoiceMetrics::ticks() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<quint64>(ts.tv_sec) * 1000000000ULL + static_cast<quint64>(ts.tv_nsec);
+}
+#else
+quint64 VoiceMetrics::ticks() {
+	return Timer::now() * 1000ULL;
+}
+#endif
@@ -0,0 +1,98 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MURMUR_METRICS_H_
+#define MUMBLE_MURMUR_METRICS_H_
+
+#include <QtCore/QByteArray>
+#include <QtCore/QMap>
+
+/* Latencies in nanoseconds, in buckets that are a quarter of a power of
+ * two wide, so the relative error stays below 25% from a few nanoseconds
+ * up to over half an hour, in a fixed 1.3 kB.
+ */
+class LatencyHistogram {
+	public:
+		static const int iBuckets = 160;
+
+		quint64 uiCounts[iBuckets];
+		quint64 uiCount;
+		quint64 uiSum;
+
+		LatencyHistogram();
+		void add(quint64 ns);
+		void merge(const LatencyHistogram &other);
+		quint64 percentile(double p) const;
+		quint64 countBelow(quint64 ns) const;
+
+		static int bucket(quint64 ns);
+		static quint64 upperBound(int bucket);
+};
+
+/* Counters of the voice path. Each thread that handles voice counts into
+ * its own, without locking; they are read and added up from the main
+ * thread, so a reading may be a few packets behind.
+ */
+class VoiceMetrics {
+	public:
+		enum Stage { Receive, Decrypt, Route, Encrypt, Send, UsersLock, StageCount };
+		enum Drop { DropMalformed, DropUnknownPeer, DropDecrypt, DropBandwidth, DropTunnelQueue, DropCount };
+
+		quint64 uiPacketsIn, uiBytesIn;
+		quint64 uiPacketsOut, uiBytesOut;
+		quint64 uiTunnelOut, uiTunnelBytesOut;
+		quint64 uiDrops[DropCount];
+		LatencyHistogram lhStages[StageCount];
+
+		// Gauges, only filled in by Server::getMetrics().
+		int iTunnelUsers, iTunnelBytes;
+
+		VoiceMetrics();
+		void merge(const VoiceMetrics &other);
+
+		static quint64 ticks();
+		static QByteArray text(const QMap<int, VoiceMetrics> &servers);
+};
+
+// Adds the time from its construction to its destruction to a stage.
+class StageTimer {
+	private:
+		Q_DISABLE_COPY(StageTimer)
+	protected:
+		LatencyHistogram *lhStage;
+		quint64 uiStart;
+	public:
+		StageTimer(VoiceMetrics *vm, VoiceMetrics::Stage stage) : lhStage(& vm->lhStages[stage]), uiStart(VoiceMetrics::ticks()) {}
+		~StageTimer() {
+			lhStage->add(VoiceMetrics::ticks() - uiStart);
+		}
+};
+
+#endif
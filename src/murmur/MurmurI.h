@@ -182,6 +182,9 @@ namespace Murmur {
 			virtual void getUptime_async(const ::Murmur::AMD_Server_getUptimePtr&,
 			                             const Ice::Current&);
 
+			virtual void getMetrics_async(const ::Murmur::AMD_Server_getMetricsPtr&,
+			                              const Ice::Current&);
+
 			virtual void ice_ping(const Ice::Current&) const;
 	};
 
@@ -216,6 +219,9 @@ namespace Murmur {
 			virtual void getUptime_async(const ::Murmur::AMD_Meta_getUptimePtr&,
 			                             const Ice::Current&);
 
+			virtual void getBlobCacheStats_async(const ::Murmur::AMD_Meta_getBlobCacheStatsPtr&,
+			                                     const Ice::Current&);
+
 			virtual void getSlice_async(const ::Murmur::AMD_Meta_getSlicePtr&,
 			                            const Ice::Current&);
 	};
@@ -635,14 +635,7 @@ void MurmurIce::nameToIdSlot(int &id, const QString &name) {
 	}
 }
 
-void MurmurIce::authenticateSlot(int &res, QString &uname, int sessionId, const QList<QSslCertificate> &certlist, const QString &certhash, bool certstrong, const QString &pw) {
-	::Server *server = qobject_cast< ::Server *> (sender());
-
-	const ServerAuthenticatorPrx prx = getServerAuthenticator(server);
-	::std::string newname;
-	::Murmur::GroupNameList groups;
-	::Murmur::CertificateList certs;
-
+static void certificatesToCertificates(const QList<QSslCertificate> &certlist, ::Murmur::CertificateList &certs) {
 	certs.resize(certlist.size());
 	for (int i=0;i<certlist.size();++i) {
 		::Murmur::CertificateDer der;
@@ -653,6 +646,17 @@ void MurmurIce::authenticateSlot(int &res, QString &uname, int sessionId, const
 			der[j] = ptr[j];
 		certs[i] = der;
 	}
+}
+
+void MurmurIce::authenticateSlot(int &res, QString &uname, int sessionId, const QList<QSslCertificate> &certlist, const QString &certhash, bool certstrong, const QString &pw) {
+	::Server *server = qobject_cast< ::Server *> (sender());
+
+	const ServerAuthenticatorPrx prx = getServerAuthenticator(server);
+	::std::string newname;
+	::Murmur::GroupNameList groups;
+	::Murmur::CertificateList certs;
+
+	certificatesToCertificates(certlist, certs);
 
 	try {
 		res = prx->authenticate(u8(uname), u8(pw), certs, u8(certhash), certstrong, newname, groups);
@@ -671,6 +675,77 @@ void MurmurIce::authenticateSlot(int &res, QString &uname, int sessionId, const
 	}
 }
 
+#if ICE_INT_VERSION >= 30400
+// Receives the answer to an asynchronous authenticate() in an Ice thread and
+// passes it on to the main thread.
+class AuthenticateCallback : public IceUtil::Shared {
+	protected:
+		int iServerNum;
+		unsigned int uiRequest;
+	public:
+		AuthenticateCallback(int server_id, unsigned int request) : iServerNum(server_id), uiRequest(request) { }
+
+		void response(::Ice::Int res, const ::std::string &newname, const ::Murmur::GroupNameList &groups) {
+			QStringList qsl;
+			foreach(const ::std::string &str, groups)
+				qsl << u8(str);
+			if (mi)
+				QCoreApplication::instance()->postEvent(mi, new ExecEvent(boost::bind(&MurmurIce::authenticateDone, mi, iServerNum, uiRequest, res, u8(newname), qsl, false)));
+		}
+
+		void exception(const ::Ice::Exception &) {
+			if (mi)
+				QCoreApplication::instance()->postEvent(mi, new ExecEvent(boost::bind(&MurmurIce::authenticateDone, mi, iServerNum, uiRequest, -2, QString(), QStringList(), true)));
+		}
+};
+
+typedef IceUtil::Handle<AuthenticateCallback> AuthenticateCallbackPtr;
+#endif
+
+/* Starts the call to the authenticator without waiting for it. Needs Ice 3.4
+ * for asynchronous invocation; with older versions the request is left to
+ * authenticateSlot().
+ */
+void MurmurIce::authenticateAsyncSlot(bool &pending, unsigned int request, const QString &uname, int, const QList<QSslCertificate> &certlist, const QString &certhash, bool certstrong, const QString &pw) {
+#if ICE_INT_VERSION >= 30400
+	::Server *server = qobject_cast< ::Server *> (sender());
+
+	const ServerAuthenticatorPrx prx = getServerAuthenticator(server);
+	if (! prx)
+		return;
+
+	::Murmur::CertificateList certs;
+	certificatesToCertificates(certlist, certs);
+
+	AuthenticateCallbackPtr cb = new AuthenticateCallback(server->iServerNum, request);
+	try {
+		prx->begin_authenticate(u8(uname), u8(pw), certs, u8(certhash), certstrong, newCallback_ServerAuthenticator_authenticate(cb, &AuthenticateCallback::response, &AuthenticateCallback::exception));
+		pending = true;
+	} catch (...) {
+		badAuthenticator(server);
+	}
+#else
+	Q_UNUSED(pending);
+	Q_UNUSED(request);
+	Q_UNUSED(uname);
+	Q_UNUSED(certlist);
+	Q_UNUSED(certhash);
+	Q_UNUSED(certstrong);
+	Q_UNUSED(pw);
+#endif
+}
+
+void MurmurIce::authenticateDone(int server_id, unsigned int request, int res, const QString &uname, const QStringList &groups, bool failed) {
+	::Server *server = meta->qhServers.value(server_id);
+	if (! server)
+		return;
+
+	if (failed)
+		badAuthenticator(server);
+
+	server->authenticateDone(request, res, uname, groups);
+}
+
 void MurmurIce::registerUserSlot(int &res, const QMap<int, QString> &info) {
 	::Server *server = qobject_cast< ::Server *> (sender());
 
@@ -1385,7 +1460,7 @@ static void impl_Server_setACL(const ::Murmur::AMD_Server_setACLPtr cb, int serv
 		acl->pAllow = static_cast<ChanACL::Permissions>(ai.allow) & ChanACL::All;
 	}
 
-	server->clearACLCache();
+	server->clearACLCache(channel);
 	server->updateChannel(channel);
 	cb->ice_response();
 }
@@ -1554,6 +1629,15 @@ static void impl_Server_getUptime(const ::Murmur::AMD_Server_getUptimePtr cb, in
 	cb->ice_response(static_cast<int>(server->tUptime.elapsed()/1000000LL));
 }
 
+#define ACCESS_Server_getMetrics_READ
+static void impl_Server_getMetrics(const ::Murmur::AMD_Server_getMetricsPtr cb, int server_id) {
+	NEED_SERVER;
+	QMap<int, VoiceMetrics> servers;
+	server->getMetrics(servers[server->iServerNum]);
+	const QByteArray text = VoiceMetrics::text(servers);
+	cb->ice_response(std::string(text.constData(), text.size()));
+}
+
 static void impl_Server_addUserToGroup(const ::Murmur::AMD_Server_addUserToGroupPtr cb, int server_id, ::Ice::Int channelid,  ::Ice::Int session,  const ::std::string& group) {
 	NEED_SERVER;
 	NEED_PLAYER;
@@ -1566,8 +1650,10 @@ static void impl_Server_addUserToGroup(const ::Murmur::AMD_Server_addUserToGroup
 	}
 
 	::Group *g = channel->qhGroups.value(qsgroup);
-	if (! g)
+	if (! g) {
 		g = new ::Group(channel, qsgroup);
+		server->clearACLCache(channel);
+	}
 
 	g->qsTemporary.insert(- session);
 	server->clearACLCache(user);
@@ -1587,8 +1673,10 @@ static void impl_Server_removeUserFromGroup(const ::Murmur::AMD_Server_removeUse
 	}
 
 	::Group *g = channel->qhGroups.value(qsgroup);
-	if (! g)
+	if (! g) {
 		g = new ::Group(channel, qsgroup);
+		server->clearACLCache(channel);
+	}
 
 	g->qsTemporary.remove(- session);
 	server->clearACLCache(user);
@@ -1691,4 +1779,10 @@ static void impl_Meta_getUptime(const ::Murmur::AMD_Meta_getUptimePtr cb, const
 	cb->ice_response(static_cast<int>(meta->tUptime.elapsed()/1000000LL));
 }
 
+#define ACCESS_Meta_getBlobCacheStats_READ
+static void impl_Meta_getBlobCacheStats(const ::Murmur::AMD_Meta_getBlobCacheStatsPtr cb, const Ice::ObjectAdapterPtr) {
+	const BlobCache &bc = meta->bcBlobs;
+	cb->ice_response(static_cast<Ice::Long>(bc.hits()), static_cast<Ice::Long>(bc.misses()), bc.count(), bc.bytes());
+}
+
 #include "MurmurIceWrapper.cpp"
@@ -82,12 +82,14 @@ class MurmurIce : public QObject {
 		void setServerUpdatingAuthenticator(const ::Server* server, const ::Murmur::ServerUpdatingAuthenticatorPrx& prx);
 		const ::Murmur::ServerUpdatingAuthenticatorPrx getServerUpdatingAuthenticator(const ::Server* server) const;
 		void removeServerUpdatingAuthenticator(const ::Server* server);
+		void authenticateDone(int server_id, unsigned int request, int res, const QString &uname, const QStringList &groups, bool failed);
 
 	public slots:
 		void started(Server *);
 		void stopped(Server *);
 
 		void authenticateSlot(int &res, QString &uname, int sessionId, const QList<QSslCertificate> &certlist, const QString &certhash, bool certstrong, const QString &pw);
+		void authenticateAsyncSlot(bool &pending, unsigned int request, const QString &uname, int sessionId, const QList<QSslCertificate> &certlist, const QString &certhash, bool certstrong, const QString &pw);
 		void registerUserSlot(int &res, const QMap<int, QString> &);
 		void unregisterUserSlot(int &res, int id);
 		void getRegisteredUsersSlot(const QString &filter, QMap<int, QString> &res);
@@ -0,0 +1,317 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "murmur_pch.h"
+
+#ifdef Q_OS_UNIX
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#include "NetworkThread.h"
+
+#include "Message.h"
+#include "Mumble.pb.h"
+
+#ifdef Q_OS_WIN
+HANDLE SocketHandler::hQoS = NULL;
+#endif
+
+NetworkThread::NetworkThread(QObject *p) : QThread(p) {
+}
+
+NetworkThread::~NetworkThread() {
+	quit();
+	wait();
+}
+
+void NetworkThread::run() {
+	exec();
+}
+
+/* Takes ownership of socket. The peer and local addresses are read here, so
+ * the main thread never has to touch the socket once the handler is moved
+ * to its NetworkThread.
+ */
+SocketHandler::SocketHandler(QSslSocket *socket) : QObject(), qtsSocket(socket), qhaPeerAddress(socket->peerAddress()), usPeerPort(socket->peerPort()), qhaLocalAddress(socket->localAddress()) {
+	qtsSocket->setParent(this);
+	iPacketLength = -1;
+	bNoDelay = false;
+#ifdef Q_OS_WIN
+	dwFlow = 0;
+#endif
+
+	static bool bDeclared = false;
+	if (! bDeclared) {
+		bDeclared = true;
+		qRegisterMetaType<ParsedMessage>("ParsedMessage");
+		qRegisterMetaType<QList<QSslError> >("QList<QSslError>");
+	}
+
+	connect(qtsSocket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(socketError(QAbstractSocket::SocketError)));
+	connect(qtsSocket, SIGNAL(encrypted()), this, SLOT(socketEncrypted()));
+	connect(qtsSocket, SIGNAL(readyRead()), this, SLOT(socketRead()));
+	connect(qtsSocket, SIGNAL(disconnected()), this, SLOT(socketDisconnected()));
+	connect(qtsSocket, SIGNAL(sslErrors(const QList<QSslError> &)), this, SLOT(socketSslErrors(const QList<QSslError> &)));
+}
+
+SocketHandler::~SocketHandler() {
+#ifdef Q_OS_WIN
+	if (dwFlow && hQoS) {
+		if (! QOSRemoveSocketFromFlow(hQoS, 0, dwFlow, 0))
+			qWarning("SocketHandler: Failed to remove flow from QoS");
+	}
+#endif
+}
+
+#ifdef Q_OS_WIN
+void SocketHandler::setQoS(HANDLE hParentQoS) {
+	hQoS = hParentQoS;
+}
+#endif
+
+void SocketHandler::startServerEncryption() {
+#if defined(Q_OS_WIN)
+	if (! dwFlow && hQoS) {
+		if (! QOSAddSocketToFlow(hQoS, qtsSocket->socketDescriptor(), NULL, QOSTrafficTypeAudioVideo, QOS_NON_ADAPTIVE_FLOW, &dwFlow))
+			qWarning("SocketHandler: Failed to add flow to QOS");
+	}
+#elif defined(Q_OS_UNIX)
+	int val = 0xa0;
+	if (setsockopt(qtsSocket->socketDescriptor(), IPPROTO_IP, IP_TOS, &val, sizeof(val))) {
+		val = 0x60;
+		if (setsockopt(qtsSocket->socketDescriptor(), IPPROTO_IP, IP_TOS, &val, sizeof(val)))
+			qWarning("SocketHandler: Failed to set TOS for TCP Socket");
+	}
+#if defined(SO_PRIORITY)
+	socklen_t optlen = sizeof(val);
+	if (getsockopt(qtsSocket->socketDescriptor(), SOL_SOCKET, SO_PRIORITY, &val, &optlen) == 0) {
+		if (val == 0) {
+			val = 6;
+			setsockopt(qtsSocket->socketDescriptor(), SOL_SOCKET, SO_PRIORITY, &val, sizeof(val));
+		}
+	}
+#endif
+#endif
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+	qtsSocket->setProtocol(QSsl::TlsV1_0);
+#else
+	qtsSocket->setProtocol(QSsl::TlsV1);
+#endif
+	qtsSocket->startServerEncryption();
+}
+
+/* Same framing as Connection::socketRead(), but the payload is also parsed
+ * here, so the main thread only gets to run the message handler.
+ */
+void SocketHandler::socketRead() {
+	while (true) {
+		qint64 iAvailable = qtsSocket->bytesAvailable();
+		if (iPacketLength == -1) {
+			if (iAvailable < 6)
+				return;
+
+			unsigned char a_ucBuffer[6];
+
+			qtsSocket->read(reinterpret_cast<char *>(a_ucBuffer), 6);
+			uiType = qFromBigEndian<quint16>(&a_ucBuffer[0]);
+			iPacketLength = qFromBigEndian<quint32>(&a_ucBuffer[2]);
+			iAvailable -= 6;
+		}
+
+		if ((iPacketLength == -1) || (iAvailable < iPacketLength))
+			return;
+
+		if (iPacketLength > 0x7fffff) {
+			qWarning() << "Host tried to send huge packet";
+			disconnectSocket(true);
+			return;
+		}
+
+		QByteArray qbaBuffer = qtsSocket->read(iPacketLength);
+		iPacketLength = -1;
+
+		// Tunnelled voice is not protobuf.
+		if (uiType == MessageHandler::UDPTunnel)
+			emit message(uiType, qbaBuffer, ParsedMessage());
+		else
+			emit message(uiType, qbaBuffer, parse(uiType, qbaBuffer));
+	}
+}
+
+// Returns a null pointer for unknown types and messages that fail to parse.
+ParsedMessage SocketHandler::parse(unsigned int type, const QByteArray &qbaMsg) {
+	ParsedMessage msg;
+
+#define MUMBLE_MH_MSG(x) case MessageHandler:: x : \
+		msg = ParsedMessage(new MumbleProto:: x()); \
+		break;
+
+	switch (type) {
+			MUMBLE_MH_ALL
+		default:
+			return msg;
+	}
+
+#undef MUMBLE_MH_MSG
+
+	if (! msg->ParseFromArray(qbaMsg.constData(), qbaMsg.size()))
+		return ParsedMessage();
+
+#ifndef QT_NO_DEBUG
+	if (type != MessageHandler::Ping) {
+		printf("== %s:\n", msg->GetDescriptor()->name().c_str());
+		msg->PrintDebugString();
+	}
+#endif
+	msg->DiscardUnknownFields();
+	return msg;
+}
+
+void SocketHandler::socketError(QAbstractSocket::SocketError err) {
+	emit connectionClosed(err, qtsSocket->errorString());
+}
+
+void SocketHandler::socketDisconnected() {
+	emit connectionClosed(QAbstractSocket::UnknownSocketError, QString());
+}
+
+/* Errors a client certificate may have and still be let in. Some of them
+ * mean it can not count as verified, which clears verified. Called from the
+ * network threads and from Server::sslError().
+ */
+bool SocketHandler::sslErrorAllowed(const QSslError &e, bool &verified) {
+	switch (e.error()) {
+		case QSslError::InvalidPurpose:
+			// Allow email certificates.
+			return true;
+		case QSslError::NoPeerCertificate:
+		case QSslError::SelfSignedCertificate:
+		case QSslError::SelfSignedCertificateInChain:
+		case QSslError::UnableToGetLocalIssuerCertificate:
+		case QSslError::HostNameMismatch:
+		case QSslError::CertificateNotYetValid:
+		case QSslError::CertificateExpired:
+			verified = false;
+			return true;
+		default:
+			return false;
+	}
+}
+
+/* The errors have to be ignored before this returns for the handshake to go
+ * on, so there is no waiting for the main thread. It is told afterwards, to
+ * log them and note an unverified certificate.
+ */
+void SocketHandler::socketSslErrors(const QList<QSslError> &errors) {
+	bool ok = true;
+	bool verified = true;
+	foreach(const QSslError &e, errors)
+		ok = sslErrorAllowed(e, verified) && ok;
+
+	if (ok)
+		qtsSocket->ignoreSslErrors();
+
+	emit handleSslErrors(errors);
+}
+
+void SocketHandler::socketEncrypted() {
+	{
+		QMutexLocker l(&qmPeer);
+		const QSslCertificate cert = qtsSocket->peerCertificate();
+		if (! cert.isNull())
+			qlPeerCertificateChain = qtsSocket->peerCertificateChain() << cert;
+		qscCipher = qtsSocket->sessionCipher();
+	}
+	emit encrypted();
+}
+
+QList<QSslCertificate> SocketHandler::peerCertificateChain() const {
+	QMutexLocker l(&qmPeer);
+	return qlPeerCertificateChain;
+}
+
+QSslCipher SocketHandler::sessionCipher() const {
+	QMutexLocker l(&qmPeer);
+	return qscCipher;
+}
+
+void SocketHandler::write(const QByteArray &qbaMsg) {
+	qtsSocket->write(qbaMsg);
+}
+
+/* With voice set, the connection carries voice from now on and TCP_NODELAY
+ * is turned on once and left on; see Connection::flushVoice(). Otherwise it
+ * is toggled around the flush, like Connection::forceFlush().
+ */
+void SocketHandler::flush(bool voice) {
+	if (qtsSocket->state() != QAbstractSocket::ConnectedState)
+		return;
+
+	if (! qtsSocket->isEncrypted())
+		return;
+
+	int nodelay;
+
+	if (voice) {
+		if (! bNoDelay) {
+			nodelay = 1;
+			setsockopt(qtsSocket->socketDescriptor(), IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char *>(&nodelay), sizeof(nodelay));
+			bNoDelay = true;
+		}
+		qtsSocket->flush();
+		return;
+	}
+
+	qtsSocket->flush();
+
+	if (bNoDelay)
+		return;
+
+	nodelay = 1;
+	setsockopt(qtsSocket->socketDescriptor(), IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char *>(&nodelay), sizeof(nodelay));
+	nodelay = 0;
+	setsockopt(qtsSocket->socketDescriptor(), IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char *>(&nodelay), sizeof(nodelay));
+}
+
+void SocketHandler::disconnectSocket(bool force) {
+	if (qtsSocket->state() == QAbstractSocket::UnconnectedState) {
+		emit connectionClosed(QAbstractSocket::UnknownSocketError, QString());
+		return;
+	}
+
+	if (force)
+		qtsSocket->abort();
+	else
+		qtsSocket->disconnectFromHost();
+}
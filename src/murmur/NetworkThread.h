@@ -0,0 +1,117 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MURMUR_NETWORKTHREAD_H_
+#define MUMBLE_MURMUR_NETWORKTHREAD_H_
+
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QObject>
+#include <QtCore/QThread>
+#include <QtNetwork/QSslSocket>
+#ifdef Q_OS_WIN
+#include <windows.h>
+#endif
+
+#include "Connection.h"
+
+// Runs the event loop the sockets of some of the clients live in.
+class NetworkThread : public QThread {
+	private:
+		Q_OBJECT;
+		Q_DISABLE_COPY(NetworkThread);
+	protected:
+		void run();
+	public:
+		NetworkThread(QObject *parent = NULL);
+		~NetworkThread();
+};
+
+/* The socket side of a client connection. It owns the QSslSocket and lives
+ * in a NetworkThread, or in the main thread when there are none. It runs the
+ * TLS handshake, frames and parses incoming messages and hands them to its
+ * Connection, which stays in the main thread with the rest of the server
+ * state. Everything but the static members must be called from the thread
+ * the handler lives in.
+ */
+class SocketHandler : public QObject {
+	private:
+		Q_OBJECT;
+		Q_DISABLE_COPY(SocketHandler);
+	protected:
+		QSslSocket *qtsSocket;
+		unsigned int uiType;
+		int iPacketLength;
+		bool bNoDelay;
+#ifdef Q_OS_WIN
+		static HANDLE hQoS;
+		DWORD dwFlow;
+#endif
+		// What the main thread may ask about the socket. Filled in
+		// once the handshake is done.
+		mutable QMutex qmPeer;
+		QList<QSslCertificate> qlPeerCertificateChain;
+		QSslCipher qscCipher;
+
+		static ParsedMessage parse(unsigned int type, const QByteArray &qbaMsg);
+	protected slots:
+		void socketRead();
+		void socketError(QAbstractSocket::SocketError);
+		void socketDisconnected();
+		void socketSslErrors(const QList<QSslError> &errors);
+		void socketEncrypted();
+	public slots:
+		void startServerEncryption();
+		void write(const QByteArray &qbaMsg);
+		void flush(bool voice);
+		void disconnectSocket(bool force);
+	signals:
+		void encrypted();
+		void connectionClosed(QAbstractSocket::SocketError, const QString &reason);
+		void message(unsigned int type, const QByteArray &, const ParsedMessage &);
+		void handleSslErrors(const QList<QSslError> &);
+	public:
+		const QHostAddress qhaPeerAddress;
+		const quint16 usPeerPort;
+		const QHostAddress qhaLocalAddress;
+
+		SocketHandler(QSslSocket *socket);
+		~SocketHandler();
+
+		static bool sslErrorAllowed(const QSslError &error, bool &verified);
+
+		QList<QSslCertificate> peerCertificateChain() const;
+		QSslCipher sessionCipher() const;
+#ifdef Q_OS_WIN
+		static void setQoS(HANDLE hParentQoS);
+#endif
+};
+
+#endif
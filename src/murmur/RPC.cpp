@@ -83,6 +83,7 @@ void Server::setUserState(User *pUser, Channel *cChannel, bool mute, bool deaf,
 	pUser->bSuppress = suppressed;
 	pUser->bPrioritySpeaker = prioritySpeaker;
 	pUser->qsName = name;
+	pUser->syncEndpoint();
 	hashAssign(pUser->qsComment, pUser->qbaCommentHash, comment);
 
 	if (cChannel != pUser->cChannel) {
@@ -132,6 +133,9 @@ bool Server::setChannelState(Channel *cChannel, Channel *cParent, const QString
 		cChannel->cParent->removeChannel(cChannel);
 		cParent->addChannel(cChannel);
 
+		// Everything below cChannel now inherits from somewhere else.
+		clearACLCache(cChannel);
+
 		mpcs.set_parent(cParent->iId);
 
 		updated = true;
@@ -245,6 +249,7 @@ void Server::setTempGroups(int userid, int sessionId, Channel *cChannel, const Q
 		g = cChannel->qhGroups.value(gname);
 		if (! g) {
 			g = new Group(cChannel, gname);
+			clearACLCache(cChannel);
 		}
 		g->qsTemporary.insert(userid);
 		if (sessionId != 0)
@@ -293,6 +298,8 @@ void Server::connectAuthenticator(QObject *obj) {
 	connect(this, SIGNAL(idToNameSig(QString &, int)), obj, SLOT(idToNameSlot(QString &, int)));
 	connect(this, SIGNAL(nameToIdSig(int &, const QString &)), obj, SLOT(nameToIdSlot(int &, const QString &)));
 	connect(this, SIGNAL(idToTextureSig(QByteArray &, int)), obj, SLOT(idToTextureSlot(QByteArray &, int)));
+	if (obj->metaObject()->indexOfSlot("authenticateAsyncSlot(bool&,uint,QString,int,QList<QSslCertificate>,QString,bool,QString)") != -1)
+		connect(this, SIGNAL(authenticateAsyncSig(bool &, unsigned int, const QString &, int, const QList<QSslCertificate> &, const QString &, bool, const QString &)), obj, SLOT(authenticateAsyncSlot(bool &, unsigned int, const QString &, int, const QList<QSslCertificate> &, const QString &, bool, const QString &)));
 }
 
 void Server::disconnectAuthenticator(QObject *obj) {
@@ -306,6 +313,7 @@ void Server::disconnectAuthenticator(QObject *obj) {
 	disconnect(this, SIGNAL(idToNameSig(QString &, int)), obj, SLOT(idToNameSlot(QString &, int)));
 	disconnect(this, SIGNAL(nameToIdSig(int &, const QString &)), obj, SLOT(nameToIdSlot(int &, const QString &)));
 	disconnect(this, SIGNAL(idToTextureSig(QByteArray &, int)), obj, SLOT(idToTextureSlot(QByteArray &, int)));
+	disconnect(this, SIGNAL(authenticateAsyncSig(bool &, unsigned int, const QString &, int, const QList<QSslCertificate> &, const QString &, bool, const QString &)), obj, NULL);
 }
 
 void Server::connectListener(QObject *obj) {
@@ -40,9 +40,11 @@
 #include "Channel.h"
 #include "Message.h"
 #include "Meta.h"
+#include "NetworkThread.h"
 #include "PacketDataStream.h"
 #include "ServerDB.h"
 #include "ServerUser.h"
+#include "TextFilter.h"
 
 #ifdef USE_BONJOUR
 #include "BonjourServer.h"
@@ -53,14 +55,12 @@
 #define MAX(a,b) ((a)>(b) ? (a):(b))
 #endif
 
-#define UDP_PACKET_SIZE 1024
+// Tunnelled voice waiting for one user beyond this is dropped.
+#define TUNNEL_QUEUE_SIZE 65536
 
-LogEmitter::LogEmitter(QObject *p) : QObject(p) {
-};
-
-void LogEmitter::addLogEntry(const QString &msg) {
-	emit newLogEntry(msg);
-};
+#if defined(Q_OS_LINUX) && !defined(SO_REUSEPORT)
+#define SO_REUSEPORT 15
+#endif
 
 ExecEvent::ExecEvent(boost::function<void ()> f) : QEvent(static_cast<QEvent::Type>(EXEC_QEVENT)) {
 	func = f;
@@ -70,10 +70,39 @@ void ExecEvent::execute() {
 	func();
 }
 
+// Shared by all servers; only touched by the main thread.
+unsigned int Server::uiAuthSerial = 0;
+
 SslServer::SslServer(QObject *p) : QTcpServer(p) {
 }
 
+/* Floods are dropped here, before anything is allocated for them. Only
+ * the attempt that gets an address banned is logged.
+ */
 void SslServer::incomingConnection(int v) {
+	struct sockaddr_storage addr;
+#ifdef Q_OS_WIN
+	int len = sizeof(addr);
+#else
+	socklen_t len = sizeof(addr);
+#endif
+	memset(&addr, 0, sizeof(addr));
+	if (::getpeername(v, reinterpret_cast<struct sockaddr *>(&addr), &len) == 0) {
+		HostAddress ha(addr);
+		FloodLimiter::Result res = meta->banCheck(ha);
+		if (res != FloodLimiter::Allowed) {
+			Server *server = qobject_cast<Server *>(parent());
+			if (server && (res == FloodLimiter::NewBan))
+				server->log(QString("Ignoring connections from %1 (Global ban)").arg(ha.toString()));
+#ifdef Q_OS_WIN
+			::closesocket(v);
+#else
+			::close(v);
+#endif
+			return;
+		}
+	}
+
 	QSslSocket *s = new QSslSocket(this);
 	s->setSocketDescriptor(v);
 	qlSockets.append(s);
@@ -98,6 +127,8 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 	hNotify = NULL;
 #endif
 	qtTimeout = new QTimer(this);
+	qtAuthTimeout = new QTimer(this);
+	qtBanExpiry = new QTimer(this);
 
 	iCodecAlpha = iCodecBeta = 0;
 	bPreferAlpha = false;
@@ -105,6 +136,16 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 
 	qnamNetwork = NULL;
 
+#ifdef USE_MMSG
+	ubSend = NULL;
+#endif
+
+	qaiRoutesEpoch.fetchAndStoreOrdered(1);
+	bRoutesPending = false;
+	bTunnelPending = false;
+	vtTrace = NULL;
+	uiTargetChanges = 0;
+
 	readParams();
 	initialize();
 
@@ -145,6 +186,9 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 		sockopt = 1;
 		if (setsockopt(sock, IPPROTO_IPV6, IPV6_RECVPKTINFO, &sockopt, sizeof(sockopt)))
 			log(QString("Failed to set IPV6_RECVPKTINFO for %1").arg(addressToString(ss->serverAddress(), usPort)));
+		sockopt = 1;
+		if ((Meta::mp.iVoiceThreads > 1) && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &sockopt, sizeof(sockopt)))
+			log(QString("Failed to set SO_REUSEPORT for %1").arg(addressToString(ss->serverAddress(), usPort)));
 #endif
 #else
 #ifndef SIO_UDP_CONNRESET
@@ -194,6 +238,34 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 	if (! bValid)
 		return;
 
+#ifdef Q_OS_LINUX
+	for (int i=1;i<Meta::mp.iVoiceThreads;++i) {
+		VoiceWorker *vw = new VoiceWorker(this);
+		QList<QSocketNotifier *> notifiers;
+		foreach(int sock, qlUdpSocket) {
+			int wsock = cloneUdpSocket(sock);
+			if (wsock == INVALID_SOCKET)
+				continue;
+			QSocketNotifier *qsn = new QSocketNotifier(wsock, QSocketNotifier::Read, this);
+			connect(qsn, SIGNAL(activated(int)), this, SLOT(udpActivated(int)));
+			vw->qlUdpSocket << wsock;
+			notifiers << qsn;
+		}
+		if ((vw->qlUdpSocket.count() != qlUdpSocket.count()) || (socketpair(AF_UNIX, SOCK_STREAM, 0, vw->aiNotify) != 0)) {
+			log("Failed to set up voice worker thread");
+			// The notifiers go before their sockets are closed, so they
+			// never watch a descriptor that has been reused.
+			qDeleteAll(notifiers);
+			delete vw;
+			break;
+		}
+		qlUdpNotifier << notifiers;
+		qlVoiceWorkers << vw;
+	}
+	if (! qlVoiceWorkers.isEmpty())
+		log(QString("Using %1 voice threads").arg(qlVoiceWorkers.count() + 1));
+#endif
+
 #ifdef Q_OS_UNIX
 	if (socketpair(AF_UNIX, SOCK_STREAM, 0, aiNotify) != 0) {
 		log("Failed to create notify socket");
@@ -204,19 +276,30 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 	hNotify = CreateEvent(NULL, FALSE, FALSE, NULL);
 #endif
 
-	connect(this, SIGNAL(tcpTransmit(QByteArray, unsigned int)), this, SLOT(tcpTransmitData(QByteArray, unsigned int)), Qt::QueuedConnection);
 	connect(this, SIGNAL(reqSync(unsigned int)), this, SLOT(doSync(unsigned int)));
 
 	for (int i=1;i<iMaxUsers*2;++i)
 		qqIds.enqueue(i);
 
 	connect(qtTimeout, SIGNAL(timeout()), this, SLOT(checkTimeout()));
+	connect(qtAuthTimeout, SIGNAL(timeout()), this, SLOT(checkAuthTimeout()));
+	connect(qtBanExpiry, SIGNAL(timeout()), this, SLOT(checkBanExpiry()));
+	qtBanExpiry->start(BanIndex::iResolution * 1000);
 
 	getBans();
 	readChannels();
 	readLinks();
 	initializeCert();
 
+	{
+		QWriteLocker wl(&qrwlUsers);
+		publishRoutes();
+	}
+	// Traces are started at run time only; a name left over from the last
+	// run would just fail to open again.
+	if (! getConf("voicetrace", QString()).toString().isEmpty())
+		setConf("voicetrace", QVariant());
+
 	int major, minor, patch;
 	QString release;
 	Meta::getVersion(major, minor, patch, release);
@@ -241,6 +324,10 @@ void Server::startThread() {
 		foreach(QSocketNotifier *qsn, qlUdpNotifier)
 			qsn->setEnabled(false);
 		start(QThread::HighestPriority);
+#ifdef Q_OS_LINUX
+		foreach(VoiceWorker *vw, qlVoiceWorkers)
+			vw->start(QThread::HighestPriority);
+#endif
 #ifdef Q_OS_LINUX
 		// QThread::HighestPriority == Same as everything else...
 		int policy;
@@ -267,15 +354,26 @@ void Server::stopThread() {
 		unsigned char val = 0;
 		if (::write(aiNotify[1], &val, 1) != 1)
 			log("Failed to signal voice thread");
+#ifdef Q_OS_LINUX
+		foreach(VoiceWorker *vw, qlVoiceWorkers)
+			if (::write(vw->aiNotify[1], &val, 1) != 1)
+				log("Failed to signal voice worker thread");
+#endif
 #else
 		SetEvent(hNotify);
 #endif
 		wait();
+#ifdef Q_OS_LINUX
+		foreach(VoiceWorker *vw, qlVoiceWorkers)
+			vw->wait();
+#endif
 
 		foreach(QSocketNotifier *qsn, qlUdpNotifier)
 			qsn->setEnabled(true);
 	}
 	qtTimeout->stop();
+
+	reclaimRoutes();
 }
 
 Server::~Server() {
@@ -288,6 +386,11 @@ Server::~Server() {
 	foreach(QSocketNotifier *qsn, qlUdpNotifier)
 		delete qsn;
 
+#ifdef Q_OS_LINUX
+	foreach(VoiceWorker *vw, qlVoiceWorkers)
+		delete vw;
+#endif
+
 #ifdef Q_OS_UNIX
 	foreach(int s, qlUdpSocket)
 		close(s);
@@ -303,6 +406,22 @@ Server::~Server() {
 		CloseHandle(hNotify);
 #endif
 	clearACLCache();
+	qDeleteAll(qhAuthRequests);
+
+	// The voice threads are stopped, so no table is in use any more. Users
+	// removed with them are still children and go below.
+	delete qapRoutes.fetchAndStoreOrdered(NULL);
+	foreach(RoutingTable *rt, qlRetiredRoutes)
+		delete rt->vtClose;
+	qDeleteAll(qlRetiredRoutes);
+	qlRetiredRoutes.clear();
+	qlRemovedUsers.clear();
+	delete vtTrace;
+
+	// Users still connected release their endpoints before the chunks go.
+	qDeleteAll(findChildren<ServerUser *>());
+	foreach(VoiceEndpoint *chunk, qlEndpointChunks)
+		qFreeAligned(chunk);
 
 	log("Stopped");
 }
@@ -449,6 +568,8 @@ void Server::setLiveConf(const QString &key, const QString &value) {
 			mpsc.set_image_message_length(length);
 			sendAll(mpsc);
 		}
+	} else if (key == "voicetrace") {
+		setVoiceTrace(v);
 	} else if (key == "allowhtml") {
 		bool allow = !v.isNull() ? QVariant(v).toBool() : Meta::mp.bAllowHTML;
 		if (allow != bAllowHTML) {
@@ -475,6 +596,7 @@ void Server::setLiveConf(const QString &key, const QString &value) {
 		QString text = !v.isNull() ? v : Meta::mp.qsRegName;
 		if (text != qsRegName) {
 			qsRegName = text;
+			jsSnapshot.channelChanged(0);
 			if (! qsRegName.isEmpty()) {
 				MumbleProto::ChannelState mpcs;
 				mpcs.set_channel_id(0);
@@ -542,6 +664,67 @@ void Server::customEvent(QEvent *evt) {
 		static_cast<ExecEvent *>(evt)->execute();
 }
 
+#ifdef Q_OS_LINUX
+VoiceWorker::VoiceWorker(Server *p) : QThread(p), s(p) {
+	aiNotify[0] = aiNotify[1] = -1;
+#ifdef USE_MMSG
+	ubSend = NULL;
+#endif
+}
+
+VoiceWorker::~VoiceWorker() {
+	foreach(int sock, qlUdpSocket)
+		close(sock);
+	if (aiNotify[0] >= 0)
+		close(aiNotify[0]);
+	if (aiNotify[1] >= 0)
+		close(aiNotify[1]);
+}
+
+void VoiceWorker::run() {
+	s->run();
+}
+
+/* Creates another UDP socket bound to the same address as sock, with the
+ * same options. Both must have SO_REUSEPORT set, so the kernel hashes
+ * incoming datagrams over all of them.
+ */
+int Server::cloneUdpSocket(int sock) {
+	sockaddr_storage addr;
+	socklen_t len = sizeof(addr);
+
+	memset(&addr, 0, sizeof(addr));
+	if (getsockname(sock, reinterpret_cast<struct sockaddr *>(&addr), &len) != 0)
+		return INVALID_SOCKET;
+
+	int wsock = ::socket(addr.ss_family, SOCK_DGRAM, 0);
+	if (wsock == INVALID_SOCKET)
+		return INVALID_SOCKET;
+
+	int sockopt = 1;
+	setsockopt(wsock, IPPROTO_IP, IP_PKTINFO, &sockopt, sizeof(sockopt));
+	sockopt = 1;
+	setsockopt(wsock, IPPROTO_IPV6, IPV6_RECVPKTINFO, &sockopt, sizeof(sockopt));
+	sockopt = 1;
+	if (setsockopt(wsock, SOL_SOCKET, SO_REUSEPORT, &sockopt, sizeof(sockopt)) || (::bind(wsock, reinterpret_cast<sockaddr *>(&addr), len) == SOCKET_ERROR)) {
+		log(QString("Failed to bind voice worker UDP socket: %1").arg(QString::fromLocal8Bit(strerror(errno))));
+		close(wsock);
+		return INVALID_SOCKET;
+	}
+
+	int val;
+	socklen_t optlen = sizeof(val);
+	if (getsockopt(sock, IPPROTO_IP, IP_TOS, &val, &optlen) == 0)
+		setsockopt(wsock, IPPROTO_IP, IP_TOS, &val, sizeof(val));
+#if defined(SO_PRIORITY)
+	optlen = sizeof(val);
+	if (getsockopt(sock, SOL_SOCKET, SO_PRIORITY, &val, &optlen) == 0)
+		setsockopt(wsock, SOL_SOCKET, SO_PRIORITY, &val, sizeof(val));
+#endif
+	return wsock;
+}
+#endif
+
 void Server::udpActivated(int socket) {
 	qint32 len;
 	char encrypt[UDP_PACKET_SIZE];
@@ -596,6 +779,342 @@ void Server::udpActivated(int socket) {
 	}
 }
 
+// The calling thread's counters.
+VoiceMetrics *Server::voiceMetrics() {
+	QThread *t = QThread::currentThread();
+	if (t == this)
+		return &vmServer;
+#ifdef Q_OS_LINUX
+	foreach(VoiceWorker *vw, qlVoiceWorkers)
+		if (t == vw)
+			return &vw->vmMetrics;
+#endif
+	return &vmMain;
+}
+
+void Server::getMetrics(VoiceMetrics &vm) {
+	vm = vmServer;
+	vm.merge(vmMain);
+#ifdef Q_OS_LINUX
+	foreach(VoiceWorker *vw, qlVoiceWorkers)
+		vm.merge(vw->vmMetrics);
+#endif
+
+	QMutexLocker l(&qmTunnel);
+	vm.iTunnelUsers = qhTunnel.count();
+	foreach(const QByteArray &qba, qhTunnel)
+		vm.iTunnelBytes += qba.size();
+}
+
+#ifdef USE_MMSG
+// Each slot holds one datagram; the extra 8 bytes keep the OCB payload that
+// follows the 4 byte crypt header 8-byte aligned, like the stack buffers below.
+#define UDP_SLOT_SIZE (UDP_PACKET_SIZE + 8)
+#define UDP_SEND_BATCH 1024
+
+UDPBatch::UDPBatch(int size) {
+	iSize = size;
+	iUsed = 0;
+	uiPackets = uiCalls = 0ULL;
+
+	mmsg = new struct mmsghdr[size];
+	iov = new struct iovec[size];
+	addr = new struct sockaddr_storage[size];
+	sock = new int[size];
+	data = new char[size * UDP_SLOT_SIZE];
+	control = new unsigned char[size * UDP_CONTROL_SIZE];
+
+	memset(mmsg, 0, sizeof(struct mmsghdr) * size);
+	memset(addr, 0, sizeof(struct sockaddr_storage) * size);
+	memset(control, 0, size * UDP_CONTROL_SIZE);
+
+	for (int i=0;i<size;++i) {
+		iov[i].iov_base = buffer(i);
+		iov[i].iov_len = UDP_PACKET_SIZE;
+		sock[i] = INVALID_SOCKET;
+
+		mmsg[i].msg_hdr.msg_name = &addr[i];
+		mmsg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+		mmsg[i].msg_hdr.msg_iov = &iov[i];
+		mmsg[i].msg_hdr.msg_iovlen = 1;
+		mmsg[i].msg_hdr.msg_control = controlData(i);
+		mmsg[i].msg_hdr.msg_controllen = UDP_CONTROL_SIZE;
+	}
+}
+
+UDPBatch::~UDPBatch() {
+	delete [] mmsg;
+	delete [] iov;
+	delete [] addr;
+	delete [] sock;
+	delete [] data;
+	delete [] control;
+}
+
+char *UDPBatch::buffer(int idx) const {
+	return data + idx * UDP_SLOT_SIZE + 4;
+}
+
+unsigned char *UDPBatch::controlData(int idx) const {
+	return control + idx * UDP_CONTROL_SIZE;
+}
+
+void UDPBatch::prepareReceive() {
+	for (int i=0;i<iSize;++i) {
+		iov[i].iov_len = UDP_PACKET_SIZE;
+		mmsg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+		mmsg[i].msg_hdr.msg_controllen = UDP_CONTROL_SIZE;
+		mmsg[i].msg_hdr.msg_flags = 0;
+		mmsg[i].msg_len = 0;
+	}
+}
+
+/* Returns the send queue of the calling voice thread, or NULL when called
+ * from any other thread (or when batching is disabled).
+ */
+UDPBatch *Server::sendBatch() const {
+	QThread *t = QThread::currentThread();
+	if (t == this)
+		return ubSend;
+	foreach(VoiceWorker *vw, qlVoiceWorkers)
+		if (t == vw)
+			return vw->ubSend;
+	return NULL;
+}
+
+void Server::flushUDPBatch(UDPBatch *ub, VoiceMetrics *vm) {
+	int start = 0;
+
+	while (start < ub->iUsed) {
+		int sock = ub->sock[start];
+		int end = start + 1;
+		while ((end < ub->iUsed) && (ub->sock[end] == sock))
+			++end;
+
+		int i = start;
+		while (i < end) {
+			const quint64 t = VoiceMetrics::ticks();
+			int ret = ::sendmmsg(sock, ub->mmsg + i, end - i, 0);
+			vm->lhStages[VoiceMetrics::Send].add(VoiceMetrics::ticks() - t);
+			++ub->uiCalls;
+			if (ret > 0) {
+				i += ret;
+			} else if ((ret < 0) && (errno == ENOSYS)) {
+				// Kernel without sendmmsg; fall back to one call per datagram.
+				for (;i<end;++i) {
+					::sendmsg(sock, &ub->mmsg[i].msg_hdr, 0);
+					++ub->uiCalls;
+				}
+			} else {
+				// Skip the datagram that failed, just like a failed sendmsg() would.
+				++i;
+			}
+		}
+		start = end;
+	}
+
+	ub->uiPackets += ub->iUsed;
+	ub->iUsed = 0;
+}
+#endif
+
+/* Marks the calling voice thread as active in the current epoch and returns
+ * the routing table it may use until it calls releaseRoutes().
+ */
+const RoutingTable *Server::acquireRoutes(QAtomicInt &epoch) {
+	epoch.fetchAndStoreOrdered(qaiRoutesEpoch.fetchAndAddOrdered(0));
+	return qapRoutes.fetchAndAddOrdered(0);
+}
+
+void Server::releaseRoutes(QAtomicInt &epoch) {
+	epoch.fetchAndStoreOrdered(0);
+}
+
+/* Only safe on the main thread (or with qrwlUsers held), as tables are
+ * freed nowhere else.
+ */
+const RoutingTable *Server::currentRoutes() {
+	return qapRoutes.fetchAndAddOrdered(0);
+}
+
+/* Hands out a VoiceEndpoint for u. Endpoints are allocated in cache line
+ * aligned chunks and reused most recently freed first, so the endpoints of a
+ * busy server stay packed together in a few pages.
+ */
+VoiceEndpoint *Server::allocEndpoint(ServerUser *u) {
+	if (qlFreeEndpoints.isEmpty()) {
+		const int count = 64;
+		const size_t size = (sizeof(VoiceEndpoint) + 63) & ~static_cast<size_t>(63);
+		char *chunk = reinterpret_cast<char *>(qMallocAligned(size * count, 64));
+		if (! chunk)
+			qFatal("Server: Failed to allocate voice endpoints");
+		qlEndpointChunks << reinterpret_cast<VoiceEndpoint *>(chunk);
+		for (int i=count-1;i>=0;--i)
+			qlFreeEndpoints << reinterpret_cast<VoiceEndpoint *>(chunk + i * size);
+	}
+	return new(qlFreeEndpoints.takeLast()) VoiceEndpoint(u, &u->ssContext);
+}
+
+void Server::freeEndpoint(VoiceEndpoint *ep) {
+	ep->~VoiceEndpoint();
+	qlFreeEndpoints << ep;
+}
+
+/* Builds a new routing table from the live user and channel state and
+ * publishes it. The caller must hold qrwlUsers for writing.
+ */
+void Server::publishRoutes() {
+	RoutingTable *rt = new RoutingTable();
+
+	// Implicitly shared; the copy only happens on the next change.
+	rt->qhUsers = qhUsers;
+	rt->qhPeerUsers = qhPeerUsers;
+	rt->qhHostUsers = qhHostUsers;
+
+	foreach(Channel *c, qhChannels) {
+		if (! c->qlUsers.isEmpty()) {
+			QVector<VoiceEndpoint *> &listeners = rt->qhListeners[c->iId];
+			listeners.reserve(c->qlUsers.count());
+			foreach(User *p, c->qlUsers) {
+				ServerUser *u = static_cast<ServerUser *>(p);
+				listeners.append(u->veEndpoint);
+				rt->qhUserChannel.insert(u->uiSession, c->iId);
+			}
+		}
+		if (! c->qhLinks.isEmpty())
+			rt->qsLinked.insert(c->iId);
+	}
+
+	rt->vtTrace = vtTrace;
+	if (vtTrace) {
+		QHash<int, QVector<VoiceTrace::User> > channels;
+		QHash<int, QVector<VoiceEndpoint *> >::const_iterator i;
+		for (i = rt->qhListeners.constBegin(); i != rt->qhListeners.constEnd(); ++i) {
+			QVector<VoiceTrace::User> &users = channels[i.key()];
+			foreach(VoiceEndpoint *ve, i.value()) {
+				VoiceTrace::User user;
+				user.uiSession = ve->uiSession;
+				user.uiFlags = (ve->bDeaf ? VoiceTrace::UserDeaf : 0) | (ve->bUdp ? VoiceTrace::UserUdp : 0);
+				user.uiContext = ve->uiContext;
+				users << user;
+			}
+		}
+		vtTrace->addRoutes(Timer::now(), channels);
+	}
+
+	RoutingTable *old = qapRoutes.fetchAndStoreOrdered(rt);
+	if (old) {
+		QMutexLocker l(&qmRetired);
+		old->iEpoch = qaiRoutesEpoch.fetchAndAddOrdered(1) + 1;
+		// Voice threads may still be recording to the old trace.
+		old->vtClose = (old->vtTrace != vtTrace) ? old->vtTrace : NULL;
+		old->qlRemoved = qlRemovedUsers;
+		qlRemovedUsers.clear();
+		qlRetiredRoutes << old;
+	}
+}
+
+/* Starts recording voice routing to a new file called name in
+ * MetaParams::qsVoiceTraceDir, or stops if name is empty. name comes from
+ * RPC, so it can't be a path, and an existing file is never overwritten. A
+ * name that can't be used leaves a running trace alone. Main thread only.
+ */
+void Server::setVoiceTrace(const QString &name) {
+	VoiceTrace *vt = NULL;
+	if (name.isEmpty()) {
+		if (! vtTrace)
+			return;
+		log(QString("Stopped voice trace, %1 records dropped").arg(vtTrace->dropped()));
+	} else if (Meta::mp.qsVoiceTraceDir.isEmpty()) {
+		log(QString("Not recording voice trace %1: voicetracedir is not set").arg(name));
+		return;
+	} else if (name.startsWith(QLatin1Char('.')) || name.contains(QLatin1Char('/')) || name.contains(QLatin1Char('\\'))) {
+		log(QString("Not recording voice trace %1: not a plain file name").arg(name));
+		return;
+	} else {
+		const QString fname = QDir(Meta::mp.qsVoiceTraceDir).absoluteFilePath(name);
+		vt = new VoiceTrace(fname);
+		if (! vt->isOpen()) {
+			log(QString("Failed to open voice trace %1: %2").arg(fname, vt->errorString()));
+			delete vt;
+			return;
+		}
+		log(QString("Recording voice trace to %1").arg(fname));
+	}
+
+	vtTrace = vt;
+	{
+		QWriteLocker wl(&qrwlUsers);
+		publishRoutes();
+	}
+	reclaimRoutes();
+}
+
+/* Called on the main thread after changing users, channel membership or
+ * links. Changes are coalesced into one new table per event loop pass.
+ */
+void Server::scheduleRoutes() {
+	if (bRoutesPending)
+		return;
+	bRoutesPending = true;
+	QCoreApplication::instance()->postEvent(this, new ExecEvent(boost::bind(&Server::updateRoutes, this)));
+}
+
+void Server::updateRoutes() {
+	bRoutesPending = false;
+	{
+		QWriteLocker wl(&qrwlUsers);
+		publishRoutes();
+	}
+	reclaimRoutes();
+}
+
+/* Frees the retired tables no voice thread can still hold, along with the
+ * users that were removed before they were retired. Main thread only.
+ */
+void Server::reclaimRoutes() {
+	QList<QAtomicInt *> epochs;
+	epochs << &qaiEpoch;
+#ifdef Q_OS_LINUX
+	foreach(VoiceWorker *vw, qlVoiceWorkers)
+		epochs << &vw->qaiEpoch;
+#endif
+
+	// A voice thread that entered epoch e can only see tables retired after e.
+	int oldest = 0;
+	foreach(QAtomicInt *epoch, epochs) {
+		int e = epoch->fetchAndAddOrdered(0);
+		if (e && (! oldest || (e < oldest)))
+			oldest = e;
+	}
+
+	QMutexLocker l(&qmRetired);
+	while (! qlRetiredRoutes.isEmpty()) {
+		RoutingTable *rt = qlRetiredRoutes.first();
+		if (oldest && (rt->iEpoch > oldest))
+			break;
+		qlRetiredRoutes.removeFirst();
+		foreach(ServerUser *u, rt->qlRemoved)
+			u->deleteLater();
+		delete rt->vtClose;
+		delete rt;
+	}
+}
+
+bool Server::fillPingReply(const RoutingTable *rt, char *data, int len) const {
+	quint32 *ping = reinterpret_cast<quint32 *>(data);
+
+	if ((len != 12) || (*ping != 0) || ! bAllowPing)
+		return false;
+
+	ping[0] = uiVersionBlob;
+	// 1 and 2 will be the timestamp, which we return unmodified.
+	ping[3] = qToBigEndian(static_cast<quint32>(rt->qhUsers.count()));
+	ping[4] = qToBigEndian(static_cast<quint32>(iMaxUsers));
+	ping[5] = qToBigEndian(static_cast<quint32>(iMaxBandwidth));
+	return true;
+}
+
 void Server::run() {
 	qint32 len;
 #if defined(__LP64__)
@@ -607,19 +1126,53 @@ void Server::run() {
 	char buffer[UDP_PACKET_SIZE];
 
 	sockaddr_storage from;
+
+	QAtomicInt *epoch = &qaiEpoch;
+	VoiceMetrics *vm = &vmServer;
+#ifdef Q_OS_UNIX
+	// run() is shared by the server's own thread and any voice workers.
+	const QList<int> *sockets = &qlUdpSocket;
+	int notify = aiNotify[0];
+#ifdef USE_MMSG
+	UDPBatch **batch = &ubSend;
+#endif
+#ifdef Q_OS_LINUX
+	foreach(VoiceWorker *vw, qlVoiceWorkers) {
+		if (QThread::currentThread() == vw) {
+			sockets = &vw->qlUdpSocket;
+			notify = vw->aiNotify[0];
+			epoch = &vw->qaiEpoch;
+			vm = &vw->vmMetrics;
+#ifdef USE_MMSG
+			batch = &vw->ubSend;
+#endif
+		}
+	}
+#endif
+	int nfds = sockets->count();
+#else
 	int nfds = qlUdpSocket.count();
+#endif
+
+#ifdef USE_MMSG
+	UDPBatch *ubRecv = NULL;
+	if (Meta::mp.iUdpBatch > 1) {
+		ubRecv = new UDPBatch(Meta::mp.iUdpBatch);
+		*batch = new UDPBatch(UDP_SEND_BATCH);
+	}
+#endif
 
 #ifdef Q_OS_UNIX
 	socklen_t fromlen;
 	STACKVAR(struct pollfd, fds, nfds+1);
 
 	for (int i=0;i<nfds;++i) {
-		fds[i].fd = qlUdpSocket.at(i);
+		fds[i].fd = sockets->at(i);
 		fds[i].events = POLLIN;
 		fds[i].revents = 0;
 	}
 
-	fds[nfds].fd=aiNotify[0];
+	fds[nfds].fd=notify;
 	fds[nfds].events = POLLIN;
 	fds[nfds].revents = 0;
 #else
@@ -647,10 +1200,14 @@ void Server::run() {
 			break;
 		}
 
+		// The clock is read once per wakeup; everything handled until the
+		// next poll shares this time.
+		const quint64 now = Timer::update();
+
 		if (fds[nfds - 1].revents) {
 			// Drain pipe
 			unsigned char val;
-			while (::recv(aiNotify[0], &val, 1, MSG_DONTWAIT) == 1) {};
+			while (::recv(notify, &val, 1, MSG_DONTWAIT) == 1) {};
 			break;
 		}
 
@@ -675,9 +1232,61 @@ void Server::run() {
 					bRunning = false;
 					break;
 				}
+				const quint64 now = Timer::update();
 				SOCKET sock = fds[ret - WAIT_OBJECT_0];
 #endif
 
+#ifdef USE_MMSG
+				if (ubRecv) {
+					ubRecv->prepareReceive();
+					const quint64 t = VoiceMetrics::ticks();
+					int count = ::recvmmsg(sock, ubRecv->mmsg, ubRecv->iSize, MSG_DONTWAIT | MSG_TRUNC, NULL);
+					vm->lhStages[VoiceMetrics::Receive].add(VoiceMetrics::ticks() - t);
+					if (count < 0) {
+						if (errno == ENOSYS) {
+							qWarning("%d => recvmmsg not supported by kernel, disabling UDP batching", iServerNum);
+							delete ubRecv;
+							ubRecv = NULL;
+							delete *batch;
+							*batch = NULL;
+						}
+						fds[i].revents = 0;
+						continue;
+					}
+
+					++ubRecv->uiCalls;
+					ubRecv->uiPackets += count;
+
+					const RoutingTable *rt = acquireRoutes(*epoch);
+
+					for (int j=0;j<count;++j) {
+						len = static_cast<qint32>(ubRecv->mmsg[j].msg_len);
+						++vm->uiPacketsIn;
+						vm->uiBytesIn += len;
+						if ((len < 5) || (len > UDP_PACKET_SIZE)) {
+							++vm->uiDrops[VoiceMetrics::DropMalformed];
+							continue;
+						}
+
+						char *data = ubRecv->buffer(j);
+						if (fillPingReply(rt, data, len)) {
+							ubRecv->iov[j].iov_len = 6 * sizeof(quint32);
+							::sendmsg(sock, &ubRecv->mmsg[j].msg_hdr, 0);
+							continue;
+						}
+
+						processDatagram(rt, sock, ubRecv->addr[j], data, buffer, len, now, vm);
+					}
+
+					releaseRoutes(*epoch);
+					if ((*batch)->iUsed)
+						flushUDPBatch(*batch, vm);
+
+					fds[i].revents = 0;
+					continue;
+				}
+#endif
+
 				fromlen = sizeof(from);
 #ifdef Q_OS_WIN
 				len=::recvfrom(sock, encrypt, UDP_PACKET_SIZE, 0, reinterpret_cast<struct sockaddr *>(&from), &fromlen);
@@ -699,7 +1308,9 @@ void Server::run() {
 				msg.msg_control = controldata;
 				msg.msg_controllen = sizeof(controldata);
 
+				const quint64 t = VoiceMetrics::ticks();
 				len=static_cast<quint32>(::recvmsg(sock, &msg, MSG_TRUNC));
+				vm->lhStages[VoiceMetrics::Receive].add(VoiceMetrics::ticks() - t);
 #else
 				len=static_cast<qint32>(::recvfrom(sock, encrypt, UDP_PACKET_SIZE, MSG_TRUNC, reinterpret_cast<struct sockaddr *>(&from), &fromlen));
 #endif
@@ -708,24 +1319,20 @@ void Server::run() {
 					break;
 				} else if (len == SOCKET_ERROR) {
 					break;
-				} else if (len < 5) {
+				}
+
+				++vm->uiPacketsIn;
+				vm->uiBytesIn += len;
+				if ((len < 5) || (len > UDP_PACKET_SIZE)) {
 					// 4 bytes crypt header + type + session
-					continue;
-				} else if (len > UDP_PACKET_SIZE) {
+					++vm->uiDrops[VoiceMetrics::DropMalformed];
 					continue;
 				}
 
-				QReadLocker rl(&qrwlUsers);
-
-				quint32 *ping = reinterpret_cast<quint32 *>(encrypt);
-
-				if ((len == 12) && (*ping == 0) && bAllowPing) {
-					ping[0] = uiVersionBlob;
-					// 1 and 2 will be the timestamp, which we return unmodified.
-					ping[3] = qToBigEndian(static_cast<quint32>(qhUsers.count()));
-					ping[4] = qToBigEndian(static_cast<quint32>(iMaxUsers));
-					ping[5] = qToBigEndian(static_cast<quint32>(iMaxBandwidth));
+				const RoutingTable *rt = acquireRoutes(*epoch);
 
+				if (fillPingReply(rt, encrypt, len)) {
+					releaseRoutes(*epoch);
 #ifdef Q_OS_LINUX
 					iov[0].iov_len = 6 * sizeof(quint32);
 					::sendmsg(sock, &msg, 0);
@@ -735,64 +1342,8 @@ void Server::run() {
 					continue;
 				}
 
-
-				quint16 port = (from.ss_family == AF_INET6) ? (reinterpret_cast<sockaddr_in6 *>(&from)->sin6_port) : (reinterpret_cast<sockaddr_in *>(&from)->sin_port);
-				const HostAddress &ha = HostAddress(from);
-
-				const QPair<HostAddress, quint16> &key = QPair<HostAddress, quint16>(ha, port);
-
-				ServerUser *u = qhPeerUsers.value(key);
-				if (u) {
-					if (! checkDecrypt(u, encrypt, buffer, len)) {
-						continue;
-					}
-				} else {
-					// Unknown peer
-					foreach(ServerUser *usr, qhHostUsers.value(ha)) {
-						if (usr->csCrypt.isValid() && checkDecrypt(usr, encrypt, buffer, len)) {
-							// Every time we relock, reverify users' existance.
-							// The main thread might delete the user while the lock isn't held.
-							unsigned int uiSession = usr->uiSession;
-							rl.unlock();
-							qrwlUsers.lockForWrite();
-							if (qhUsers.contains(uiSession)) {
-								u = usr;
-								u->sUdpSocket = sock;
-								memcpy(& u->saiUdpAddress, &from, sizeof(from));
-								qhHostUsers[from].remove(u);
-								qhPeerUsers.insert(key, u);
-								qrwlUsers.unlock();
-								rl.relock();
-								if (! qhUsers.contains(uiSession))
-									u = NULL;
-							}
-							break;
-						}
-					}
-					if (! u) {
-						continue;
-					}
-				}
-				len -= 4;
-
-				MessageHandler::UDPMessageType msgType = static_cast<MessageHandler::UDPMessageType>((buffer[0] >> 5) & 0x7);
-
-				switch (msgType) {
-					case MessageHandler::UDPVoiceSpeex:
-					case MessageHandler::UDPVoiceCELTAlpha:
-					case MessageHandler::UDPVoiceCELTBeta:
-						if (bOpus)
-							break;
-					case MessageHandler::UDPVoiceOpus: {
-							u->bUdp = true;
-							processMsg(u, buffer, len);
-							break;
-						}
-					case MessageHandler::UDPPing: {
-							QByteArray qba;
-							sendMessage(u, buffer, len, qba, true);
-						}
-				}
+				processDatagram(rt, sock, from, encrypt, buffer, len, now, vm);
+				releaseRoutes(*epoch);
 #ifdef Q_OS_UNIX
 				fds[i].revents = 0;
 #endif
@@ -805,9 +1356,86 @@ void Server::run() {
 		CloseHandle(events[i]);
 	}
 #endif
+#ifdef USE_MMSG
+	if (ubRecv) {
+		qWarning("%d => UDP batching: received %llu datagrams in %llu calls, sent %llu datagrams in %llu calls", iServerNum,
+		         ubRecv->uiPackets, ubRecv->uiCalls, (*batch)->uiPackets, (*batch)->uiCalls);
+		delete ubRecv;
+		delete *batch;
+		*batch = NULL;
+	}
+#endif
+}
+
+#ifdef Q_OS_UNIX
+void Server::processDatagram(const RoutingTable *&rt, int sock, const sockaddr_storage &from, const char *encrypt, char *buffer, int len, quint64 now, VoiceMetrics *vm) {
+#else
+void Server::processDatagram(const RoutingTable *&rt, SOCKET sock, const sockaddr_storage &from, const char *encrypt, char *buffer, int len, quint64 now, VoiceMetrics *vm) {
+#endif
+	quint16 port = (from.ss_family == AF_INET6) ? (reinterpret_cast<const sockaddr_in6 *>(&from)->sin6_port) : (reinterpret_cast<const sockaddr_in *>(&from)->sin_port);
+	const HostAddress &ha = HostAddress(from);
+
+	const QPair<HostAddress, quint16> &key = QPair<HostAddress, quint16>(ha, port);
+
+	ServerUser *u = rt->qhPeerUsers.value(key);
+	if (u) {
+		const quint64 t = VoiceMetrics::ticks();
+		const bool ok = checkDecrypt(u, encrypt, buffer, len);
+		vm->lhStages[VoiceMetrics::Decrypt].add(VoiceMetrics::ticks() - t);
+		if (! ok) {
+			++vm->uiDrops[VoiceMetrics::DropDecrypt];
+			return;
+		}
+	} else {
+		// Unknown peer
+		foreach(ServerUser *usr, rt->qhHostUsers.value(ha)) {
+			if (usr->csCrypt.isValid() && checkDecrypt(usr, encrypt, buffer, len)) {
+				// usr stays allocated while we hold rt, but it may have
+				// disconnected since rt was published.
+				const quint64 t = VoiceMetrics::ticks();
+				QWriteLocker wl(&qrwlUsers);
+				vm->lhStages[VoiceMetrics::UsersLock].add(VoiceMetrics::ticks() - t);
+				if (qhUsers.value(usr->uiSession) == usr) {
+					u = usr;
+					u->setUdpAddress(sock, from);
+					qhHostUsers[from].remove(u);
+					qhPeerUsers.insert(key, u);
+					publishRoutes();
+					rt = currentRoutes();
+				}
+				break;
+			}
+		}
+		if (! u) {
+			++vm->uiDrops[VoiceMetrics::DropUnknownPeer];
+			return;
+		}
+	}
+	len -= 4;
+
+	MessageHandler::UDPMessageType msgType = static_cast<MessageHandler::UDPMessageType>((buffer[0] >> 5) & 0x7);
+
+	switch (msgType) {
+		case MessageHandler::UDPVoiceSpeex:
+		case MessageHandler::UDPVoiceCELTAlpha:
+		case MessageHandler::UDPVoiceCELTBeta:
+			if (bOpus)
+				break;
+		case MessageHandler::UDPVoiceOpus: {
+				u->bUdp = true;
+				processMsg(rt, u, buffer, len, now, vm);
+				break;
+			}
+		case MessageHandler::UDPPing: {
+				QByteArray qba;
+				sendMessage(u, buffer, len, qba, true);
+			}
+	}
 }
 
 bool Server::checkDecrypt(ServerUser *u, const char *encrypt, char *plain, unsigned int len) {
+	QMutexLocker l(&u->qmCrypt);
+
 	if (u->csCrypt.isValid() && u->csCrypt.decrypt(reinterpret_cast<const unsigned char *>(encrypt), reinterpret_cast<unsigned char *>(plain), len))
 		return true;
 
@@ -820,202 +1448,336 @@ bool Server::checkDecrypt(ServerUser *u, const char *encrypt, char *plain, unsig
 	return false;
 }
 
+#ifdef USE_MMSG
+/* Encrypts a datagram for ep straight into the next slot of a send batch,
+ * along with its prepared destination and source address.
+ */
+void Server::queueDatagram(UDPBatch *ub, VoiceEndpoint *ep, const char *data, int len, VoiceMetrics *vm) {
+	if (ub->iUsed == ub->iSize)
+		flushUDPBatch(ub, vm);
+
+	int idx = ub->iUsed;
+	struct msghdr *bmsg = &ub->mmsg[idx].msg_hdr;
+
+	{
+		StageTimer st(vm, VoiceMetrics::Encrypt);
+		QMutexLocker l(&ep->qmCrypt);
+		if (! ep->szUdpControl)
+			return;
+
+		memcpy(&ub->addr[idx], & ep->saiUdpAddress, ep->iUdpAddressLen);
+		bmsg->msg_namelen = ep->iUdpAddressLen;
+		memcpy(ub->controlData(idx), ep->acUdpControl, ep->szUdpControl);
+		bmsg->msg_controllen = ep->szUdpControl;
+		ub->sock[idx] = ep->sUdpSocket;
+
+		ep->csCrypt.encrypt(reinterpret_cast<const unsigned char *>(data), reinterpret_cast<unsigned char *>(ub->buffer(idx)), len);
+	}
+	++vm->uiPacketsOut;
+	vm->uiBytesOut += len + 4;
+	ub->iov[idx].iov_len = len + 4;
+	++ub->iUsed;
+}
+#endif
+
 void Server::sendMessage(ServerUser *u, const char *data, int len, QByteArray &cache, bool force) {
-	if ((u->bUdp || force) && (u->sUdpSocket != INVALID_SOCKET) && u->csCrypt.isValid()) {
+	sendMessage(u->veEndpoint, data, len, cache, force);
+}
+
+void Server::sendMessage(VoiceEndpoint *ep, const char *data, int len, QByteArray &cache, bool force) {
+	VoiceMetrics *vm = voiceMetrics();
+	if ((ep->bUdp || force) && ep->hasUdpAddress() && ep->csCrypt.isValid()) {
+#ifdef USE_MMSG
+		// Only voice threads own a send queue; tunnelled voice processed on
+		// the main thread is sent directly.
+		UDPBatch *ub = sendBatch();
+		if (ub) {
+			queueDatagram(ub, ep, data, len, vm);
+			return;
+		}
+#endif
 #if defined(__LP64__)
 		STACKVAR(char, ebuffer, len+4+16);
 		char *buffer = reinterpret_cast<char *>(((reinterpret_cast<quint64>(ebuffer) + 8) & ~7) + 4);
 #else
 		STACKVAR(char, buffer, len+4);
 #endif
-		u->csCrypt.encrypt(reinterpret_cast<const unsigned char *>(data), reinterpret_cast<unsigned char *>(buffer), len);
+		sendDatagram(ep, data, len, buffer, vm);
+	} else {
+		queueTunnel(ep, data, len, cache, vm);
+	}
+}
+
+/* Encrypts and sends a single datagram to ep, using buffer (len + 4 bytes)
+ * for the ciphertext. The address is copied under qmCrypt along with the
+ * encryption, as setUdpAddress() may change it meanwhile.
+ */
+void Server::sendDatagram(VoiceEndpoint *ep, const char *data, int len, char *buffer, VoiceMetrics *vm) {
+#ifdef Q_OS_UNIX
+	int sock;
+#else
+	SOCKET sock;
+#endif
+	struct sockaddr_storage addr;
+	int addrlen;
+#ifdef Q_OS_LINUX
+	unsigned char control[UDP_CONTROL_SIZE];
+	size_t controllen;
+#endif
+	{
+		StageTimer st(vm, VoiceMetrics::Encrypt);
+		QMutexLocker l(&ep->qmCrypt);
+#ifdef Q_OS_LINUX
+		if (! ep->szUdpControl)
+			return;
+		controllen = ep->szUdpControl;
+		memcpy(control, ep->acUdpControl, controllen);
+#endif
+		sock = ep->sUdpSocket;
+		addrlen = ep->iUdpAddressLen;
+		memcpy(&addr, &ep->saiUdpAddress, addrlen);
+		ep->csCrypt.encrypt(reinterpret_cast<const unsigned char *>(data), reinterpret_cast<unsigned char *>(buffer), len);
+	}
 #ifdef Q_OS_WIN
-		DWORD dwFlow = 0;
-		if (Meta::hQoS)
-			QOSAddSocketToFlow(Meta::hQoS, u->sUdpSocket, reinterpret_cast<struct sockaddr *>(& u->saiUdpAddress), QOSTrafficTypeVoice, QOS_NON_ADAPTIVE_FLOW, &dwFlow);
+	DWORD dwFlow = 0;
+	if (Meta::hQoS)
+		QOSAddSocketToFlow(Meta::hQoS, sock, reinterpret_cast<struct sockaddr *>(& addr), QOSTrafficTypeVoice, QOS_NON_ADAPTIVE_FLOW, &dwFlow);
 #endif
 #ifdef Q_OS_LINUX
-		struct msghdr msg;
-		struct iovec iov[1];
-
-		iov[0].iov_base = buffer;
-		iov[0].iov_len = len+4;
-
-		u_char controldata[CMSG_SPACE(MAX(sizeof(struct in6_pktinfo),sizeof(struct in_pktinfo)))];
-		memset(controldata, 0, sizeof(controldata));
-
-		memset(&msg, 0, sizeof(msg));
-		msg.msg_name = reinterpret_cast<struct sockaddr *>(& u->saiUdpAddress);
-		msg.msg_namelen = (u->saiUdpAddress.ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
-		msg.msg_iov = iov;
-		msg.msg_iovlen = 1;
-		msg.msg_control = controldata;
-		msg.msg_controllen = CMSG_SPACE((u->saiUdpAddress.ss_family == AF_INET6) ? sizeof(struct in6_pktinfo) : sizeof(struct in_pktinfo));
-
-		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
-		HostAddress tcpha(u->saiTcpLocalAddress);
-		if (u->saiUdpAddress.ss_family == AF_INET6) {
-			cmsg->cmsg_level = IPPROTO_IPV6;
-			cmsg->cmsg_type = IPV6_PKTINFO;
-			cmsg->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
-			struct in6_pktinfo *pktinfo = reinterpret_cast<struct in6_pktinfo *>(CMSG_DATA(cmsg));
-			memset(pktinfo, 0, sizeof(*pktinfo));
-			memcpy(&pktinfo->ipi6_addr.s6_addr[0], &tcpha.qip6.c[0], sizeof(pktinfo->ipi6_addr.s6_addr));
-		} else {
-			cmsg->cmsg_level = IPPROTO_IP;
-			cmsg->cmsg_type = IP_PKTINFO;
-			cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
-			struct in_pktinfo *pktinfo = reinterpret_cast<struct in_pktinfo *>(CMSG_DATA(cmsg));
-			memset(pktinfo, 0, sizeof(*pktinfo));
-			if (tcpha.isV6())
-				return;
-			pktinfo->ipi_spec_dst.s_addr = tcpha.hash[3];
-		}
+	struct msghdr msg;
+	struct iovec iov[1];
 
+	iov[0].iov_base = buffer;
+	iov[0].iov_len = len+4;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = reinterpret_cast<struct sockaddr *>(& addr);
+	msg.msg_namelen = addrlen;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = controllen;
 
-		::sendmsg(u->sUdpSocket, &msg, 0);
+	{
+		StageTimer st(vm, VoiceMetrics::Send);
+		::sendmsg(sock, &msg, 0);
+	}
 #else
-		::sendto(u->sUdpSocket, buffer, len+4, 0, reinterpret_cast<struct sockaddr *>(& u->saiUdpAddress), (u->saiUdpAddress.ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+	{
+		StageTimer st(vm, VoiceMetrics::Send);
+		::sendto(sock, buffer, len+4, 0, reinterpret_cast<struct sockaddr *>(& addr), addrlen);
+	}
 #endif
+	++vm->uiPacketsOut;
+	vm->uiBytesOut += len + 4;
 #ifdef Q_OS_WIN
-		if (Meta::hQoS && dwFlow)
-			QOSRemoveSocketFromFlow(Meta::hQoS, 0, dwFlow, 0);
-#else
+	if (Meta::hQoS && dwFlow)
+		QOSRemoveSocketFromFlow(Meta::hQoS, 0, dwFlow, 0);
 #endif
-	} else {
-		if (cache.isEmpty())
-			cache = QByteArray(data, len);
-		emit tcpTransmit(cache,u->uiSession);
+}
+
+/* Sends what VoiceRouter routed from a voice thread or the main thread.
+ * Voice threads queue their datagrams for one sendmmsg(); tunnelled voice
+ * processed on the main thread is sent directly.
+ */
+class Server::RouteSink : public VoiceSink {
+	public:
+		Server *s;
+		VoiceMetrics *vm;
+#ifdef USE_MMSG
+		UDPBatch *ub;
+#endif
+
+		RouteSink(Server *server, VoiceMetrics *metrics) : s(server), vm(metrics) {
+#ifdef USE_MMSG
+			ub = s->sendBatch();
+#endif
+		}
+		void datagram(VoiceEndpoint *ep, const char *data, int len, char *buffer) {
+#ifdef USE_MMSG
+			if (ub) {
+				s->queueDatagram(ub, ep, data, len, vm);
+				return;
+			}
+#endif
+			s->sendDatagram(ep, data, len, buffer, vm);
+		}
+		void tunnel(VoiceEndpoint *ep, const char *data, int len, QByteArray &cache) {
+			s->queueTunnel(ep, data, len, cache, vm);
+		}
+};
+
+/* Queues a voice packet for a user without working UDP. The UDPTunnel
+ * message is built once into cache and shared by all TCP recipients of the
+ * packet. Packets for the same user are appended to each other, and the
+ * main thread is only woken when the queue was empty, so a busy channel
+ * costs one write and one flush per user per event loop pass.
+ */
+void Server::queueTunnel(VoiceEndpoint *ep, const char *data, int len, QByteArray &cache, VoiceMetrics *vm) {
+	VoiceRouter::tunnelMessage(cache, data, len);
+
+	QMutexLocker l(&qmTunnel);
+
+	QByteArray &pending = qhTunnel[ep->uiSession];
+	// Someone this far behind won't miss a bit more audio.
+	if (pending.size() + cache.size() > TUNNEL_QUEUE_SIZE) {
+		++vm->uiDrops[VoiceMetrics::DropTunnelQueue];
+		return;
+	}
+	++vm->uiTunnelOut;
+	vm->uiTunnelBytesOut += cache.size();
+
+	if (pending.isEmpty())
+		pending = cache;
+	else
+		pending.append(cache);
+
+	if (! bTunnelPending) {
+		bTunnelPending = true;
+		QCoreApplication::instance()->postEvent(this, new ExecEvent(boost::bind(&Server::flushTunnel, this)));
 	}
 }
 
-#define SENDTO \
-		if ((!pDst->bDeaf) && (!pDst->bSelfDeaf) && (pDst != u)) { \
-			if ((poslen > 0) && (pDst->ssContext == u->ssContext)) \
-				sendMessage(pDst, buffer, len, qba); \
-			else \
-				sendMessage(pDst, buffer, len - poslen, qba_npos); \
+void Server::flushTunnel() {
+	QHash<unsigned int, QByteArray> pending;
+	{
+		QMutexLocker l(&qmTunnel);
+		pending = qhTunnel;
+		qhTunnel.clear();
+		bTunnelPending = false;
+	}
+
+	QHash<unsigned int, QByteArray>::const_iterator i;
+	for (i = pending.constBegin(); i != pending.constEnd(); ++i) {
+		ServerUser *u = qhUsers.value(i.key());
+		if (u) {
+			u->sendMessage(i.value());
+			u->flushVoice();
 		}
+	}
+}
 
-void Server::processMsg(ServerUser *u, const char *data, int len) {
+/* Routes a voice packet from u. Voice threads pass the table they acquired;
+ * the main thread passes currentRoutes(). qrwlUsers must not be held, as it
+ * is only taken for links and whisper targets, which need the channel tree.
+ * now is the Timer::now() the packet is rate limited against.
+ */
+void Server::processMsg(const RoutingTable *rt, ServerUser *u, const char *data, int len, quint64 now, VoiceMetrics *vm) {
 	if (u->sState != ServerUser::Authenticated || u->bMute || u->bSuppress || u->bSelfMute)
 		return;
 
+	StageTimer st(vm, VoiceMetrics::Route);
+
 	User *p;
-	BandwidthRecord *bw = & u->bwr;
-	Channel *c = u->cChannel;
-	QByteArray qba, qba_npos;
-	unsigned int counter;
-	char buffer[UDP_PACKET_SIZE];
-	PacketDataStream pdi(data + 1, len - 1);
-	PacketDataStream pds(buffer+1, UDP_PACKET_SIZE-1);
-	unsigned int type = data[0] & 0xe0;
-	unsigned int target = data[0] & 0x1f;
-	unsigned int poslen;
 
-	// IP + UDP + Crypt + Data
-	int packetsize = 20 + 8 + 4 + len;
+	// Recorded as it arrived, with the recipients only resolved below.
+	TracePacket tp(rt->vtTrace, now, u->uiSession, data, len);
 
 	// Check the voice data rate limit.
-	if (! bw->addFrame(packetsize, iMaxBandwidth/8)) {
+	if (! VoiceRouter::admit(& u->bwr, len, iMaxBandwidth, now)) {
 		// Suppress packet.
+		++vm->uiDrops[VoiceMetrics::DropBandwidth];
 		return;
 	}
 
-	// Read the sequence number.
-	pdi >> counter;
-
-	// Skip to the end of the voice data.
-	if ((type >> 5) != MessageHandler::UDPVoiceOpus) {
-		do {
-			counter = pdi.next8();
-			pdi.skip(counter & 0x7f);
-		} while ((counter & 0x80) && pdi.isValid());
-	} else {
-		int size;
-		pdi >> size;
-		pdi.skip(size & 0x1fff);
-	}
-
-	// Save location of the positional audio data.
-	poslen = pdi.left();
-
-	// Append session id to the new output stream.
-	pds << u->uiSession;
-	// Copy all voice and positional audio data to the output stream.
-	pds.append(data + 1, len - 1);
-
-	len = pds.size() + 1;
+	VoiceRouter vr(u->veEndpoint, data, len);
+	RouteSink sink(this, vm);
+	const unsigned int target = vr.uiTarget;
+	tp.iPosLength = vr.iPosLength;
 
 	if (target == 0x1f) { // Server loopback
-		buffer[0] = static_cast<char>(type | 0);
-		sendMessage(u, buffer, len, qba);
+		vr.loopback(&sink);
 		return;
 	} else if (target == 0) { // Normal speech
-		buffer[0] = static_cast<char>(type | 0);
-		foreach(p, c->qlUsers) {
-			ServerUser *pDst = static_cast<ServerUser *>(p);
-			SENDTO;
-		}
+		int chanid = rt->qhUserChannel.value(u->uiSession, -1);
+
+		vr.addListeners(rt, chanid);
+
+		if (rt->qsLinked.contains(chanid)) {
+			const quint64 t = VoiceMetrics::ticks();
+			QReadLocker rl(&qrwlUsers);
+			vm->lhStages[VoiceMetrics::UsersLock].add(VoiceMetrics::ticks() - t);
+			Channel *c = qhChannels.value(chanid);
 
-		if (! c->qhLinks.isEmpty()) {
-			QSet<Channel *> chans = c->allLinks();
-			chans.remove(c);
+			if (c && ! c->qhLinks.isEmpty()) {
+				QSet<Channel *> chans = c->allLinks();
+				chans.remove(c);
 
-			QMutexLocker qml(&qmCache);
+				QMutexLocker qml(&qmCache);
 
-			foreach(Channel *l, chans) {
-				if (ChanACL::hasPermission(u, l, ChanACL::Speak, &acCache)) {
-					foreach(p, l->qlUsers) {
-						ServerUser *pDst = static_cast<ServerUser *>(p);
-						SENDTO;
+				foreach(Channel *l, chans) {
+					if (ChanACL::hasPermission(u, l, ChanACL::Speak, &acCache)) {
+						foreach(p, l->qlUsers) {
+							vr.add(static_cast<ServerUser *>(p)->veEndpoint);
+							if (tp.vtTrace)
+								tp.qvlLinked.append(p->uiSession);
+						}
 					}
 				}
 			}
 		}
-	} else if (u->qmTargets.contains(target)) { // Whisper
-		QSet<ServerUser *> channel;
-		QSet<ServerUser *> direct;
+
+		vr.send(&sink, 0);
+	} else { // Whisper
+		const quint64 t = VoiceMetrics::ticks();
+		QReadLocker rl(&qrwlUsers);
+		vm->lhStages[VoiceMetrics::UsersLock].add(VoiceMetrics::ticks() - t);
+		// msgVoiceTarget() changes qmTargets under the write lock.
+		if (! u->qmTargets.contains(target))
+			return;
+		QVector<VoiceEndpoint *> channel;
+		QVector<VoiceEndpoint *> direct;
 
 		if (u->qmTargetCache.contains(target)) {
 			const ServerUser::TargetCache &cache = u->qmTargetCache.value(target);
-			channel = cache.first;
-			direct = cache.second;
+			channel = cache.qvChannel;
+			direct = cache.qvDirect;
 		} else {
 			const WhisperTarget &wt = u->qmTargets.value(target);
+			const unsigned int changes = uiTargetChanges;
+			ServerUser::TargetCache cache;
+			QSet<ServerUser *> recipients;
+
 			if (! wt.qlChannels.isEmpty()) {
 				QMutexLocker qml(&qmCache);
 
 				foreach(const WhisperTarget::Channel &wtc, wt.qlChannels) {
 					Channel *wc = qhChannels.value(wtc.iId);
-					if (wc) {
-						bool link = wtc.bLinks && ! wc->qhLinks.isEmpty();
-						bool dochildren = wtc.bChildren && ! wc->qlChannels.isEmpty();
-						bool group = ! wtc.qsGroup.isEmpty();
-						if (!link && !dochildren && ! group) {
-							// Common case
-							if (ChanACL::hasPermission(u, wc, ChanACL::Whisper, &acCache)) {
-								foreach(p, wc->qlUsers) {
-									channel.insert(static_cast<ServerUser *>(p));
-								}
+					if (! wc) {
+						// Indexed anyway, so a channel created with this
+						// id later drops the cache.
+						cache.qhChannels[wtc.iId];
+						continue;
+					}
+
+					bool link = wtc.bLinks && ! wc->qhLinks.isEmpty();
+					bool dochildren = wtc.bChildren && ! wc->qlChannels.isEmpty();
+					bool group = ! wtc.qsGroup.isEmpty();
+					if (!link && !dochildren && ! group) {
+						// Common case
+						cache.qhChannels[wc->iId] << QString();
+						if (ChanACL::hasPermission(u, wc, ChanACL::Whisper, &acCache)) {
+							foreach(p, wc->qlUsers) {
+								recipients.insert(static_cast<ServerUser *>(p));
 							}
-						} else {
-							QSet<Channel *> channels;
-							if (link)
-								channels = wc->allLinks();
-							else
-								channels.insert(wc);
-							if (dochildren)
-								channels.unite(wc->allChildren());
-							const QString &redirect = u->qmWhisperRedirect.value(wtc.qsGroup);
-							const QString &qsg = redirect.isEmpty() ? wtc.qsGroup : redirect;
-							foreach(Channel *tc, channels) {
-								if (ChanACL::hasPermission(u, tc, ChanACL::Whisper, &acCache)) {
-									foreach(p, tc->qlUsers) {
-										ServerUser *su = static_cast<ServerUser *>(p);
-										if (! group || Group::isMember(tc, tc, qsg, su)) {
-											channel.insert(su);
-										}
+						}
+					} else {
+						QSet<Channel *> channels;
+						if (link)
+							channels = wc->allLinks();
+						else
+							channels.insert(wc);
+						if (dochildren)
+							channels.unite(wc->allChildren());
+						const QString &redirect = u->qmWhisperRedirect.value(wtc.qsGroup);
+						const QString &qsg = redirect.isEmpty() ? wtc.qsGroup : redirect;
+						foreach(Channel *tc, channels) {
+							cache.qhChannels[tc->iId] << (group ? qsg : QString());
+							if (ChanACL::hasPermission(u, tc, ChanACL::Whisper, &acCache)) {
+								foreach(p, tc->qlUsers) {
+									ServerUser *su = static_cast<ServerUser *>(p);
+									if (! group || Group::isMember(tc, tc, qsg, su)) {
+										recipients.insert(su);
 									}
 								}
 							}
@@ -1024,38 +1786,52 @@ void Server::processMsg(ServerUser *u, const char *data, int len) {
 				}
 			}
 
+			foreach(ServerUser *su, recipients)
+				cache.qvChannel.append(su->veEndpoint);
+
+			cache.qlSessions = wt.qlSessions;
 			foreach(unsigned int id, wt.qlSessions) {
 				ServerUser *pDst = qhUsers.value(id);
-				if (pDst && ChanACL::hasPermission(u, pDst->cChannel, ChanACL::Whisper, &acCache) && ! channel.contains(pDst))
-					direct.insert(pDst);
+				if (pDst && ! recipients.contains(pDst) && ChanACL::hasPermission(u, pDst->cChannel, ChanACL::Whisper, &acCache)) {
+					recipients.insert(pDst);
+					cache.qvDirect.append(pDst->veEndpoint);
+				}
 			}
 
+			channel = cache.qvChannel;
+			direct = cache.qvDirect;
+
 			int uiSession = u->uiSession;
-			qrwlUsers.unlock();
+			rl.unlock();
 			qrwlUsers.lockForWrite();
 
-			if (qhUsers.contains(uiSession))
-				u->qmTargetCache.insert(target, ServerUser::TargetCache(channel, direct));
+			// Only keep the result if nothing was patched in the meantime;
+			// it would have missed the change.
+			if (qhUsers.contains(uiSession) && (uiTargetChanges == changes) && u->qmTargets.contains(target)) {
+				removeTargetCache(u, target);
+				u->qmTargetCache.insert(target, cache);
+				indexTargetCache(u, target);
+			}
 			qrwlUsers.unlock();
-			qrwlUsers.lockForRead();
+			rl.relock();
 			if (! qhUsers.contains(uiSession))
 				return;
 		}
+		if (tp.vtTrace) {
+			foreach(VoiceEndpoint *ve, channel)
+				tp.qvlLinked.append(ve->uiSession);
+			foreach(VoiceEndpoint *ve, direct)
+				tp.qvlDirect.append(ve->uiSession);
+		}
 		if (! channel.isEmpty()) {
-			buffer[0] = static_cast<char>(type | 1);
-			foreach(ServerUser *pDst, channel) {
-				SENDTO;
-			}
-			if (! direct.isEmpty()) {
-				qba.clear();
-				qba_npos.clear();
-			}
+			for (int i=0;i<channel.count();++i)
+				vr.add(channel.at(i));
+			vr.send(&sink, 1);
 		}
 		if (! direct.isEmpty()) {
-			buffer[0] = static_cast<char>(type | 2);
-			foreach(ServerUser *pDst, direct) {
-				SENDTO;
-			}
+			for (int i=0;i<direct.count();++i)
+				vr.add(direct.at(i));
+			vr.send(&sink, 2);
 		}
 	}
 }
@@ -1083,35 +1859,16 @@ void Server::newClient() {
 			return;
 
 		QHostAddress adr = sock->peerAddress();
+		HostAddress ha(adr);
 
-		if (meta->banCheck(adr)) {
-			log(QString("Ignoring connection: %1 (Global ban)").arg(addressToString(sock->peerAddress(), sock->peerPort())));
+		// Expired bans are removed by checkBanExpiry().
+		if (biBans.match(ha, QDateTime::currentDateTime().toUTC().toTime_t()) >= 0) {
+			log(QString("Ignoring connection: %1 (Server ban)").arg(addressToString(sock->peerAddress(), sock->peerPort())));
 			sock->disconnectFromHost();
 			sock->deleteLater();
 			return;
 		}
 
-		HostAddress ha(adr);
-
-		QList<Ban> tmpBans = qlBans;
-		foreach(const Ban &ban, qlBans) {
-			if (ban.isExpired())
-				tmpBans.removeOne(ban);
-		}
-		if (qlBans.count() != tmpBans.count()) {
-			qlBans = tmpBans;
-			saveBans();
-		}
-
-		foreach(const Ban &ban, qlBans) {
-			if (ban.haAddress.match(ha, ban.iMask)) {
-				log(QString("Ignoring connection: %1 (Server ban)").arg(addressToString(sock->peerAddress(), sock->peerPort())));
-				sock->disconnectFromHost();
-				sock->deleteLater();
-				return;
-			}
-		}
-
 		sock->setPrivateKey(qskKey);
 		sock->setLocalCertificate(qscCert);
 		sock->addCaCertificate(qscCert);
@@ -1124,32 +1881,33 @@ void Server::newClient() {
 			return;
 		}
 
-		ServerUser *u = new ServerUser(this, sock);
+		// Handshake, reads and writes happen in a network thread from
+		// here on.
+		SocketHandler *sh = new SocketHandler(sock);
+		ServerUser *u = new ServerUser(this, sh);
 		u->uiSession = qqIds.dequeue();
+		u->syncEndpoint();
 		u->haAddress = ha;
-		HostAddress(sock->localAddress()).toSockaddr(& u->saiTcpLocalAddress);
+		HostAddress(sh->qhaLocalAddress).toSockaddr(& u->saiTcpLocalAddress);
 
 		{
 			QWriteLocker wl(&qrwlUsers);
 			qhUsers.insert(u->uiSession, u);
 			qhHostUsers[ha].insert(u);
 		}
+		scheduleRoutes();
 
 		connect(u, SIGNAL(connectionClosed(QAbstractSocket::SocketError, const QString &)), this, SLOT(connectionClosed(QAbstractSocket::SocketError, const QString &)));
-		connect(u, SIGNAL(message(unsigned int, const QByteArray &)), this, SLOT(message(unsigned int, const QByteArray &)));
+		connect(u, SIGNAL(message(unsigned int, const QByteArray &, const ParsedMessage &)), this, SLOT(message(unsigned int, const QByteArray &, const ParsedMessage &)));
 		connect(u, SIGNAL(handleSslErrors(const QList<QSslError> &)), this, SLOT(sslError(const QList<QSslError> &)));
 		connect(u, SIGNAL(encrypted()), this, SLOT(encrypted()));
 
-		log(u, QString("New connection: %1").arg(addressToString(sock->peerAddress(), sock->peerPort())));
+		log(u, QString("New connection: %1").arg(addressToString(sh->qhaPeerAddress, sh->usPeerPort)));
 
-		u->setToS();
-
-#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
-		sock->setProtocol(QSsl::TlsV1_0);
-#else
-		sock->setProtocol(QSsl::TlsV1);
-#endif
-		sock->startServerEncryption();
+		QThread *thread = meta->networkThread();
+		if (thread)
+			sh->moveToThread(thread);
+		u->startServerEncryption();
 	}
 }
 
@@ -1199,8 +1957,9 @@ void Server::encrypted() {
 			log(uSource, QString::fromUtf8("Strong certificate for %1 <%2> (signed by %3)").arg(subject).arg(uSource->qslEmail.join(", ")).arg(issuer));
 		}
 
+		// checkBanExpiry() only runs every BanIndex::iResolution seconds.
 		foreach(const Ban &ban, qlBans) {
-			if (ban.qsHash == uSource->qsHash) {
+			if ((ban.qsHash == uSource->qsHash) && ! ban.isExpired()) {
 				log(uSource, QString("Certificate hash is banned."));
 				uSource->disconnectSocket();
 			}
@@ -1208,6 +1967,9 @@ void Server::encrypted() {
 	}
 }
 
+/* The network thread has already let the handshake go on or not, with the
+ * same SocketHandler::sslErrorAllowed(); this only logs and remembers it.
+ */
 void Server::sslError(const QList<QSslError> &errors) {
 	ServerUser *u = qobject_cast<ServerUser *>(sender());
 	if (!u)
@@ -1215,28 +1977,13 @@ void Server::sslError(const QList<QSslError> &errors) {
 
 	bool ok = true;
 	foreach(QSslError e, errors) {
-		switch (e.error()) {
-			case QSslError::InvalidPurpose:
-				// Allow email certificates.
-				break;
-			case QSslError::NoPeerCertificate:
-			case QSslError::SelfSignedCertificate:
-			case QSslError::SelfSignedCertificateInChain:
-			case QSslError::UnableToGetLocalIssuerCertificate:
-			case QSslError::HostNameMismatch:
-			case QSslError::CertificateNotYetValid:
-			case QSslError::CertificateExpired:
-				u->bVerified = false;
-				break;
-			default:
-				log(u, QString("SSL Error: %1").arg(e.errorString()));
-				ok = false;
+		if (! SocketHandler::sslErrorAllowed(e, u->bVerified)) {
+			log(u, QString("SSL Error: %1").arg(e.errorString()));
+			ok = false;
 		}
 	}
 
-	if (ok)
-		u->proceedAnyway();
-	else
+	if (! ok)
 		u->disconnectSocket(true);
 }
 
@@ -1274,11 +2021,34 @@ void Server::connectionClosed(QAbstractSocket::SocketError err, const QString &r
 
 		if (old)
 			old->removeUser(u);
+
+		// Freed by reclaimRoutes() once no voice thread can reach it.
+		QMutexLocker l(&qmRetired);
+		qlRemovedUsers << u;
 	}
+	scheduleRoutes();
 
 	if (old && old->bTemporary && old->qlUsers.isEmpty())
 		QCoreApplication::instance()->postEvent(this, new ExecEvent(boost::bind(&Server::removeChannel, this, old->iId)));
 
+	{
+		// Not for whoever gets the session id next.
+		QMutexLocker l(&qmTunnel);
+		qhTunnel.remove(u->uiSession);
+	}
+
+	if (u->sState == ServerUser::Authenticating) {
+		// An answer for it arriving later is ignored.
+		QMutableHashIterator<unsigned int, AuthRequest *> i(qhAuthRequests);
+		while (i.hasNext()) {
+			i.next();
+			if (i.value()->uiSession == u->uiSession) {
+				delete i.value();
+				i.remove();
+			}
+		}
+	}
+
 	if (static_cast<int>(u->uiSession) < iMaxUsers * 2)
 		qqIds.enqueue(u->uiSession); // Reinsert session id into pool
 
@@ -1287,16 +2057,16 @@ void Server::connectionClosed(QAbstractSocket::SocketError err, const QString &r
 		recheckCodecVersions(); // Maybe can choose a better codec now
 	}
 
-	u->deleteLater();
-
 	if (qhUsers.isEmpty())
 		stopThread();
 }
 
-void Server::message(unsigned int uiType, const QByteArray &qbaMsg, ServerUser *u) {
-	if (u == NULL) {
-		u = static_cast<ServerUser *>(sender());
-	}
+/* Called with what SocketHandler::socketRead() framed and parsed. msg is
+ * null for tunnelled voice, and for messages that failed to parse, which are
+ * dropped.
+ */
+void Server::message(unsigned int uiType, const QByteArray &qbaMsg, const ParsedMessage &msg) {
+	ServerUser *u = static_cast<ServerUser *>(sender());
 
 	if (u->sState == ServerUser::Authenticated) {
 		u->resetActivityTime();
@@ -1307,8 +2077,6 @@ void Server::message(unsigned int uiType, const QByteArray &qbaMsg, ServerUser *
 		if (l < 2)
 			return;
 
-		QReadLocker rl(&qrwlUsers);
-
 		u->bUdp = false;
 
 		const char *buffer = qbaMsg.constData();
@@ -1322,7 +2090,9 @@ void Server::message(unsigned int uiType, const QByteArray &qbaMsg, ServerUser *
 				if (bOpus)
 					break;
 			case MessageHandler::UDPVoiceOpus:
-				processMsg(u, buffer, l);
+				++vmMain.uiPacketsIn;
+				vmMain.uiBytesIn += l;
+				processMsg(currentRoutes(), u, buffer, l, Timer::now(), &vmMain);
 				break;
 			default:
 				break;
@@ -1331,33 +2101,18 @@ void Server::message(unsigned int uiType, const QByteArray &qbaMsg, ServerUser *
 		return;
 	}
 
-#ifdef QT_NO_DEBUG
-#define MUMBLE_MH_MSG(x) case MessageHandler:: x : { \
-		MumbleProto:: x msg; \
-		if (msg.ParseFromArray(qbaMsg.constData(), qbaMsg.size())) { \
-			msg.DiscardUnknownFields(); \
-			msg##x(u, msg); \
-		} \
-		break; \
-	}
-#else
-#define MUMBLE_MH_MSG(x) case MessageHandler:: x : { \
-		MumbleProto:: x msg; \
-		if (msg.ParseFromArray(qbaMsg.constData(), qbaMsg.size())) { \
-			if (uiType != MessageHandler::Ping) { \
-				printf("== %s:\n", #x); \
-				msg.PrintDebugString(); \
-			} \
-			msg.DiscardUnknownFields(); \
-			msg##x(u, msg); \
-		} \
-		break; \
-	}
-#endif
+	if (! msg)
+		return;
+
+#define MUMBLE_MH_MSG(x) case MessageHandler:: x : \
+		msg##x(u, *static_cast<MumbleProto:: x *>(msg.data())); \
+		break;
 
 	switch (uiType) {
 			MUMBLE_MH_ALL
 	}
+
+#undef MUMBLE_MH_MSG
 }
 
 void Server::checkTimeout() {
@@ -1373,23 +2128,71 @@ void Server::checkTimeout() {
 	qrwlUsers.unlock();
 	foreach(ServerUser *u, qlClose)
 		u->disconnectSocket(true);
+
+	reclaimRoutes();
 }
 
-void Server::tcpTransmitData(QByteArray a, unsigned int id) {
-	Connection *c = qhUsers.value(id);
-	if (c) {
-		QByteArray qba;
-		int len = a.size();
+/* Answer from an external authenticator to authenticateAsyncSig, in the
+ * main thread. res is -2 if it had no opinion, in which case the database
+ * decides like it would have in authenticate().
+ */
+void Server::authenticateDone(unsigned int request, int res, const QString &name, const QStringList &groups) {
+	AuthRequest *ar = qhAuthRequests.take(request);
+	if (! ar)
+		return;
+
+	ServerUser *u = qhUsers.value(ar->uiSession);
+	if (u) {
+		u->sState = ServerUser::Connected;
+
+		if (res == -2) {
+			res = authenticateLocal(u->qsName, u8(ar->mpaMessage.password()), u->qslEmail, u->qsHash, u->bVerified);
+		} else {
+			if ((res >= 0) && ! name.isEmpty())
+				u->qsName = name;
+			if ((res >= 0) && ! groups.isEmpty())
+				setTempGroups(res, u->uiSession, NULL, groups);
+			externalAuthenticated(res, u->qsName);
+		}
+
+		finishAuthenticate(u, ar->mpaMessage, res);
+	}
+	delete ar;
+}
 
-		qba.resize(len + 6);
-		unsigned char *uc = reinterpret_cast<unsigned char *>(qba.data());
-		* reinterpret_cast<quint16 *>(& uc[0]) = qToBigEndian(static_cast<quint16>(MessageHandler::UDPTunnel));
-		* reinterpret_cast<quint32 *>(& uc[2]) = qToBigEndian(static_cast<quint32>(len));
-		memcpy(uc + 6, a.constData(), len);
+// Turns away users the external authenticator has not answered for in time.
+void Server::checkAuthTimeout() {
+	QList<unsigned int> expired;
+	QHash<unsigned int, AuthRequest *>::const_iterator i;
+	for (i = qhAuthRequests.constBegin(); i != qhAuthRequests.constEnd(); ++i) {
+		if (i.value()->tStarted.elapsed() > 1000000ULL * Meta::mp.iAuthTimeout)
+			expired << i.key();
+	}
 
-		c->sendMessage(qba);
-		c->forceFlush();
+	foreach(unsigned int request, expired) {
+		AuthRequest *ar = qhAuthRequests.take(request);
+		ServerUser *u = qhUsers.value(ar->uiSession);
+		if (u) {
+			log(u, "Authenticator timed out");
+			u->sState = ServerUser::Connected;
+			finishAuthenticate(u, ar->mpaMessage, -3);
+		}
+		delete ar;
 	}
+
+	if (qhAuthRequests.isEmpty())
+		qtAuthTimeout->stop();
+}
+
+void Server::checkBanExpiry() {
+	QList<int> expired = biBans.expire(QDateTime::currentDateTime().toUTC().toTime_t());
+	if (expired.isEmpty())
+		return;
+
+	qSort(expired);
+	for (int i=expired.count()-1;i>=0;--i)
+		qlBans.removeAt(expired.at(i));
+	saveBans();
 }
 
 void Server::doSync(unsigned int id) {
@@ -1406,11 +2209,39 @@ void Server::sendProtoMessage(ServerUser *u, const ::google::protobuf::Message &
 	u->sendMessage(msg, msgType, cache);
 }
 
+/* Sends head and field as one message. Serialised protobuf fields can be
+ * concatenated in any order, so field is serialised on its own and kept in
+ * Meta::bcBlobs under key; it goes out as a second write that shares the
+ * cached QByteArray instead of copying it. Only field is built when it is
+ * not cached.
+ */
+void Server::sendBlobMessage(ServerUser *u, const ::google::protobuf::Message &head, unsigned int msgType, const QByteArray &key, const ::google::protobuf::Message &field) {
+	QByteArray data = meta->bcBlobs.find(key);
+	if (data.isNull()) {
+		data.resize(field.ByteSize());
+		field.SerializeToArray(data.data(), data.size());
+		meta->bcBlobs.insert(key, data);
+	}
+
+	const int headlen = head.ByteSize();
+	QByteArray prefix;
+	prefix.resize(headlen + 6);
+	unsigned char *uc = reinterpret_cast<unsigned char *>(prefix.data());
+	qToBigEndian<quint16>(msgType, & uc[0]);
+	qToBigEndian<quint32>(headlen + data.size(), & uc[2]);
+	head.SerializeToArray(uc + 6, headlen);
+
+	u->sendMessage(prefix);
+	u->sendMessage(data);
+}
+
 void Server::sendProtoAll(const ::google::protobuf::Message &msg, unsigned int msgType, unsigned int version) {
 	sendProtoExcept(NULL, msg, msgType, version);
 }
 
 void Server::sendProtoExcept(ServerUser *u, const ::google::protobuf::Message &msg, unsigned int msgType, unsigned int version) {
+	snapshotChanged(msg, msgType);
+
 	QByteArray cache;
 	foreach(ServerUser *usr, qhUsers)
 		if ((usr != u) && (usr->sState == ServerUser::Authenticated))
@@ -1418,6 +2249,33 @@ void Server::sendProtoExcept(ServerUser *u, const ::google::protobuf::Message &m
 				usr->sendMessage(msg, msgType, cache);
 }
 
+void Server::channelState(const Channel *c, bool hashes, MumbleProto::ChannelState &mpcs) const {
+	JoinSnapshot::channelState(c, qsRegName, hashes, mpcs);
+}
+
+void Server::userState(const ServerUser *u, bool hashes, bool texture, MumbleProto::UserState &mpus) const {
+	JoinSnapshot::userState(u, hashes, texture, mpus);
+}
+
+void Server::snapshotChanged(const ::google::protobuf::Message &msg, unsigned int msgType) {
+	jsSnapshot.changed(msg, msgType);
+}
+
+const QByteArray &Server::channelSnapshot() {
+	return jsSnapshot.channels(qhChannels.value(0), qsRegName);
+}
+
+// The other authenticated users, as sent to a client from 1.2.2 on.
+QByteArray Server::userSnapshot(const ServerUser *skip) {
+	QByteArray snapshot;
+	foreach(ServerUser *u, qhUsers) {
+		if ((u == skip) || (u->sState != ServerUser::Authenticated))
+			continue;
+		jsSnapshot.appendUser(u, snapshot);
+	}
+	return snapshot;
+}
+
 void Server::removeChannel(int id) {
 	Channel *c = qhChannels.value(id);
 	if (c)
@@ -1432,6 +2290,7 @@ void Server::removeChannel(Channel *chan, Channel *dest) {
 		dest = chan->cParent;
 
 	chan->unlink(NULL);
+	scheduleRoutes();
 
 	foreach(c, chan->qlChannels) {
 		removeChannel(c, dest);
@@ -1464,6 +2323,10 @@ void Server::removeChannel(Channel *chan, Channel *dest) {
 		chan->cParent->removeChannel(chan);
 	}
 
+	// Its subchannels are gone already; don't leave entries keyed on a
+	// pointer a new channel may get.
+	clearACLCache(chan);
+
 	delete chan;
 }
 
@@ -1489,8 +2352,10 @@ bool Server::unregisterUser(int id) {
 				bool remrem = g->qsRemove.remove(id);
 				write = write || addrem || remrem;
 			}
-			if (write)
+			if (write) {
+				acCache.aeEngine->invalidate(c);
 				updateChannel(c);
+			}
 		}
 	}
 
@@ -1518,6 +2383,7 @@ void Server::userEnterChannel(User *p, Channel *c, MumbleProto::UserState &mpus)
 	{
 		QWriteLocker wl(&qrwlUsers);
 		c->addUser(p);
+		scheduleRoutes();
 
 		bool mayspeak = ChanACL::hasPermission(static_cast<ServerUser *>(p), c, ChanACL::Speak, NULL);
 		bool sup = p->bSuppress;
@@ -1623,6 +2489,10 @@ void Server::flushClientPermissionCache(ServerUser *u, MumbleProto::PermissionQu
 	sendMessage(u, mppq);
 }
 
+/* Drops what depends on p: its cached permissions and its own whisper
+ * targets. The whisper targets of others are patched to add or remove p.
+ * Without p, everything is dropped.
+ */
 void Server::clearACLCache(User *p) {
 	MumbleProto::PermissionQuery mppq;
 
@@ -1638,6 +2508,7 @@ void Server::clearACLCache(User *p) {
 			foreach(ChanACL::ChanCache *h, acCache)
 				delete h;
 			acCache.clear();
+			acCache.aeEngine->clear();
 
 			foreach(ServerUser *u, qhUsers)
 				if (u->sState == ServerUser::Authenticated)
@@ -1648,8 +2519,214 @@ void Server::clearACLCache(User *p) {
 	{
 		QWriteLocker lock(&qrwlUsers);
 
-		foreach(ServerUser *u, qhUsers)
-			u->qmTargetCache.clear();
+		if (! p) {
+			foreach(ServerUser *u, qhUsers)
+				u->qmTargetCache.clear();
+			qhChannelTargets.clear();
+			qhSessionTargets.clear();
+			qhRecipientTargets.clear();
+			++uiTargetChanges;
+			return;
+		}
+
+		ServerUser *su = static_cast<ServerUser *>(p);
+
+		removeTargetCaches(su);
+		patchTargetCaches(su);
+	}
+}
+
+/* Drops what depends on the ACLs and groups of chan, which is everything
+ * about chan and its subchannels: their compiled ACLs, cached permissions
+ * there and whisper targets resolved through them. Only users who were
+ * sent permissions for one of these channels get a new PermissionQuery.
+ */
+void Server::clearACLCache(Channel *chan) {
+	MumbleProto::PermissionQuery mppq;
+
+	QSet<Channel *> chans = chan->allChildren();
+	chans.insert(chan);
+
+	QSet<int> ids;
+	foreach(Channel *c, chans)
+		ids.insert(c->iId);
+
+	{
+		QMutexLocker qml(&qmCache);
+
+		acCache.aeEngine->invalidate(chan);
+
+		foreach(ChanACL::ChanCache *h, acCache) {
+			if (h->count() > chans.count()) {
+				foreach(Channel *c, chans)
+					h->remove(c);
+			} else {
+				ChanACL::ChanCache::iterator i = h->begin();
+				while (i != h->end()) {
+					if (chans.contains(i.key()))
+						i = h->erase(i);
+					else
+						++i;
+				}
+			}
+		}
+
+		foreach(ServerUser *u, qhUsers) {
+			if (u->sState != ServerUser::Authenticated)
+				continue;
+			QMap<int, unsigned int>::const_iterator i;
+			for (i = u->qmPermissionSent.constBegin(); i != u->qmPermissionSent.constEnd(); ++i) {
+				if (ids.contains(i.key())) {
+					flushClientPermissionCache(u, mppq);
+					break;
+				}
+			}
+		}
+	}
+
+	{
+		QWriteLocker lock(&qrwlUsers);
+
+		removeTargetCaches(ids);
+
+		// Whisper targets that include the children of a channel above
+		// chan reach a different tree now.
+		QList<TargetRef> trees;
+		for (Channel *c = chan->cParent; c; c = c->cParent) {
+			foreach(const TargetRef &tr, qhChannelTargets.value(c->iId)) {
+				foreach(const WhisperTarget::Channel &wtc, tr.first->qmTargets.value(tr.second).qlChannels) {
+					if (wtc.bChildren && (wtc.iId == c->iId))
+						trees << tr;
+				}
+			}
+		}
+		foreach(const TargetRef &tr, trees)
+			removeTargetCache(tr.first, tr.second);
+	}
+}
+
+/* Adds the cached whisper target of u to the indexes. The caller must hold
+ * qrwlUsers for writing, as for all of the target cache functions.
+ */
+void Server::indexTargetCache(ServerUser *u, int target) {
+	const ServerUser::TargetCache &cache = u->qmTargetCache.value(target);
+	const TargetRef tr(u, target);
+
+	foreach(int id, cache.qhChannels.keys())
+		qhChannelTargets[id].insert(tr);
+	foreach(unsigned int session, cache.qlSessions)
+		qhSessionTargets[session].insert(tr);
+	foreach(VoiceEndpoint *ep, cache.qvChannel)
+		qhRecipientTargets[ep->u].insert(tr);
+	foreach(VoiceEndpoint *ep, cache.qvDirect)
+		qhRecipientTargets[ep->u].insert(tr);
+}
+
+template <class K>
+static void unindexTarget(QHash<K, QSet<Server::TargetRef> > &index, const K &key, const Server::TargetRef &tr) {
+	typename QHash<K, QSet<Server::TargetRef> >::iterator i = index.find(key);
+	if (i != index.end()) {
+		i.value().remove(tr);
+		if (i.value().isEmpty())
+			index.erase(i);
+	}
+}
+
+void Server::removeTargetCache(ServerUser *u, int target) {
+	QMap<int, ServerUser::TargetCache>::iterator i = u->qmTargetCache.find(target);
+	if (i == u->qmTargetCache.end())
+		return;
+
+	const ServerUser::TargetCache &cache = i.value();
+	const TargetRef tr(u, target);
+
+	foreach(int id, cache.qhChannels.keys())
+		unindexTarget(qhChannelTargets, id, tr);
+	foreach(unsigned int session, cache.qlSessions)
+		unindexTarget(qhSessionTargets, session, tr);
+	foreach(VoiceEndpoint *ep, cache.qvChannel)
+		unindexTarget(qhRecipientTargets, ep->u, tr);
+	foreach(VoiceEndpoint *ep, cache.qvDirect)
+		unindexTarget(qhRecipientTargets, ep->u, tr);
+
+	u->qmTargetCache.erase(i);
+	++uiTargetChanges;
+}
+
+void Server::removeTargetCaches(ServerUser *u) {
+	foreach(int target, u->qmTargetCache.keys())
+		removeTargetCache(u, target);
+}
+
+// Drops the whisper targets resolved through any of the channels in ids.
+void Server::removeTargetCaches(const QSet<int> &ids) {
+	QSet<TargetRef> stale;
+	foreach(int id, ids)
+		stale.unite(qhChannelTargets.value(id));
+	foreach(const TargetRef &tr, stale)
+		removeTargetCache(tr.first, tr.second);
+}
+
+/* Brings p up to date in the whisper targets of others: those it is in now,
+ * those resolved through its current channel and those naming its session.
+ * Each is checked for p alone, the same way processMsg() resolves them.
+ */
+void Server::patchTargetCaches(ServerUser *p) {
+	const bool present = (qhUsers.value(p->uiSession) == p) && p->cChannel;
+	const int chanid = present ? p->cChannel->iId : -1;
+
+	QSet<TargetRef> affected = qhRecipientTargets.take(p);
+	if (present) {
+		affected.unite(qhChannelTargets.value(chanid));
+		affected.unite(qhSessionTargets.value(p->uiSession));
+	}
+
+	if (affected.isEmpty())
+		return;
+
+	++uiTargetChanges;
+
+	QMutexLocker qml(&qmCache);
+
+	foreach(const TargetRef &tr, affected) {
+		ServerUser *u = tr.first;
+		QMap<int, ServerUser::TargetCache>::iterator i = u->qmTargetCache.find(tr.second);
+		if (i == u->qmTargetCache.end())
+			continue;
+		ServerUser::TargetCache &cache = i.value();
+
+		int idx = cache.qvChannel.indexOf(p->veEndpoint);
+		if (idx != -1) {
+			cache.qvChannel[idx] = cache.qvChannel.last();
+			cache.qvChannel.pop_back();
+		}
+		idx = cache.qvDirect.indexOf(p->veEndpoint);
+		if (idx != -1) {
+			cache.qvDirect[idx] = cache.qvDirect.last();
+			cache.qvDirect.pop_back();
+		}
+
+		if (! present)
+			continue;
+
+		if (! ChanACL::hasPermission(u, p->cChannel, ChanACL::Whisper, &acCache))
+			continue;
+
+		bool channel = false;
+		foreach(const QString &qsg, cache.qhChannels.value(chanid)) {
+			if (qsg.isEmpty() || Group::isMember(p->cChannel, p->cChannel, qsg, p)) {
+				channel = true;
+				break;
+			}
+		}
+
+		if (channel) {
+			cache.qvChannel.append(p->veEndpoint);
+			qhRecipientTargets[p].insert(tr);
+		} else if (cache.qlSessions.contains(p->uiSession)) {
+			cache.qvDirect.append(p->veEndpoint);
+			qhRecipientTargets[p].insert(tr);
+		}
 	}
 }
 
@@ -1779,41 +2856,22 @@ void Server::hashAssign(QByteArray &dest, QByteArray &hash, const QByteArray &sr
 		hash = QByteArray();
 }
 
-bool Server::isTextAllowed(QString &text, bool &changed) {
+bool Server::isTextAllowed(std::string &text, bool &changed) {
 	changed = false;
 
 	if (! bAllowHTML) {
-		if (! text.contains(QLatin1Char('<'))) {
-			text = text.simplified();
-		} else {
-			QXmlStreamReader qxsr(QString::fromLatin1("<document>%1</document>").arg(text));
-			QString qs;
-			while (! qxsr.atEnd()) {
-				switch (qxsr.readNext()) {
-					case QXmlStreamReader::Invalid:
-						return false;
-					case QXmlStreamReader::Characters:
-						qs += qxsr.text();
-						break;
-					case QXmlStreamReader::EndElement:
-						if ((qxsr.name() == QLatin1String("br")) || (qxsr.name() == QLatin1String("p")))
-							qs += "\n";
-						break;
-					default:
-						break;
-				}
-			}
-			text = qs.simplified();
-		}
+		int length;
+		if (! TextFilter::toPlainText(text, length))
+			return false;
 		changed = true;
-		return ((iMaxTextMessageLength == 0) || (text.length() <= iMaxTextMessageLength));
+		return ((iMaxTextMessageLength == 0) || (length <= iMaxTextMessageLength));
 	} else {
-		int length = text.length();
-
 		// No limits
 		if ((iMaxTextMessageLength == 0) && (iMaxImageMessageLength == 0))
 			return true;
 
+		int length = TextFilter::length(text);
+
 		// Over Image limit? (If so, always fail)
 		if ((iMaxImageMessageLength != 0) && (length > iMaxImageMessageLength))
 			return false;
@@ -1823,36 +2881,13 @@ bool Server::isTextAllowed(QString &text, bool &changed) {
 			return true;
 
 		// Over textlength, under imagelength. If no XML, this is a fail.
-		if (! text.contains(QLatin1Char('<')))
+		if (text.find('<') == std::string::npos)
 			return false;
 
-		// Strip value from <img>s src attributes to check text-length only -
+		// Leave out the value of <img>s src attributes to check text-length only -
 		// we already ensured the img-length requirement is met
-		QString qsOut;
-		QXmlStreamReader qxsr(QString::fromLatin1("<document>%1</document>").arg(text));
-		QXmlStreamWriter qxsw(&qsOut);
-		while (! qxsr.atEnd()) {
-			switch (qxsr.readNext()) {
-				case QXmlStreamReader::Invalid:
-					return false;
-				case QXmlStreamReader::StartElement: {
-						if (qxsr.name() == QLatin1String("img")) {
-							qxsw.writeStartElement(qxsr.namespaceUri().toString(), qxsr.name().toString());
-							foreach(const QXmlStreamAttribute &a, qxsr.attributes())
-								if (a.name() != QLatin1String("src"))
-									qxsw.writeAttribute(a);
-						} else {
-							qxsw.writeCurrentToken(qxsr);
-						}
-					}
-					break;
-				default:
-					qxsw.writeCurrentToken(qxsr);
-					break;
-			}
-		}
-
-		length = qsOut.length();
+		if (! TextFilter::textLength(text, length))
+			return false;
 
 		return (length <= iMaxTextMessageLength);
 	}
@@ -36,15 +36,18 @@
 # include <boost/function.hpp>
 #endif
 
+#include <QtCore/QAtomicPointer>
 #include <QtCore/QEvent>
 #include <QtCore/QMutex>
 #include <QtCore/QTimer>
 #include <QtCore/QQueue>
 #include <QtCore/QReadWriteLock>
+#include <QtCore/QSet>
 #include <QtCore/QStringList>
 #include <QtCore/QSocketNotifier>
 #include <QtCore/QThread>
 #include <QtCore/QUrl>
+#include <QtCore/QVector>
 #include <QtNetwork/QSslCertificate>
 #include <QtNetwork/QSslKey>
 #include <QtNetwork/QSslSocket>
@@ -54,15 +57,23 @@
 #endif
 
 #include "ACL.h"
+#include "BanIndex.h"
+#include "Connection.h"
+#include "JoinSnapshot.h"
+#include "LogWriter.h"
 #include "Message.h"
+#include "Metrics.h"
 #include "Mumble.pb.h"
 #include "Net.h"
 #include "User.h"
 #include "Timer.h"
+#include "VoiceRouter.h"
+#include "VoiceTrace.h"
 
 class BonjourServer;
 class Channel;
 class PacketDataStream;
+class Server;
 class ServerUser;
 class User;
 class QNetworkAccessManager;
@@ -74,17 +85,6 @@ struct TextMessage {
 	QString qsText;
 };
 
-class LogEmitter : public QObject {
-	private:
-		Q_OBJECT
-		Q_DISABLE_COPY(LogEmitter)
-	signals:
-		void newLogEntry(const QString &msg);
-	public:
-		LogEmitter(QObject *parent = NULL);
-		void addLogEntry(const QString &msg);
-};
-
 class SslServer : public QTcpServer {
 	private:
 		Q_OBJECT;
@@ -99,6 +99,13 @@ class SslServer : public QTcpServer {
 
 #define EXEC_QEVENT (QEvent::User + 959)
 
+// An Authenticate message waiting for an external authenticator.
+struct AuthRequest {
+	unsigned int uiSession;
+	MumbleProto::Authenticate mpaMessage;
+	Timer tStarted;
+};
+
 class ExecEvent : public QEvent {
 		Q_DISABLE_COPY(ExecEvent);
 	protected:
@@ -108,6 +115,60 @@ class ExecEvent : public QEvent {
 		void execute();
 };
 
+#ifdef USE_MMSG
+struct mmsghdr;
+struct iovec;
+
+// A fixed set of datagram slots. The voice thread uses one to receive
+// with recvmmsg() and another to queue outgoing voice packets, which are
+// then sent with a single sendmmsg() per socket.
+class UDPBatch {
+		Q_DISABLE_COPY(UDPBatch);
+	public:
+		int iSize;
+		int iUsed;
+		struct mmsghdr *mmsg;
+		struct iovec *iov;
+		struct sockaddr_storage *addr;
+		int *sock;
+		char *data;
+		unsigned char *control;
+
+		quint64 uiPackets;
+		quint64 uiCalls;
+
+		UDPBatch(int size);
+		~UDPBatch();
+		char *buffer(int idx) const;
+		unsigned char *controlData(int idx) const;
+		void prepareReceive();
+};
+#endif
+
+#ifdef Q_OS_LINUX
+// An additional voice thread for a virtual server. Each worker owns its own
+// set of UDP sockets bound with SO_REUSEPORT to the server's addresses, and
+// the kernel spreads clients over the sockets of all voice threads.
+class VoiceWorker : public QThread {
+	private:
+		Q_OBJECT;
+		Q_DISABLE_COPY(VoiceWorker);
+	protected:
+		Server *s;
+		void run();
+	public:
+		int aiNotify[2];
+		QList<int> qlUdpSocket;
+		QAtomicInt qaiEpoch;
+		VoiceMetrics vmMetrics;
+#ifdef USE_MMSG
+		UDPBatch *ubSend;
+#endif
+		VoiceWorker(Server *parent);
+		~VoiceWorker();
+};
+#endif
+
 class Server : public QThread {
 	private:
 		Q_OBJECT;
@@ -199,21 +260,31 @@ class Server : public QThread {
 		void newClient();
 		void connectionClosed(QAbstractSocket::SocketError, const QString &);
 		void sslError(const QList<QSslError> &);
-		void message(unsigned int, const QByteArray &, ServerUser *cCon = NULL);
+		void message(unsigned int, const QByteArray &, const ParsedMessage &);
 		void checkTimeout();
-		void tcpTransmitData(QByteArray, unsigned int);
+		void checkAuthTimeout();
+		void checkBanExpiry();
 		void doSync(unsigned int);
 		void encrypted();
 		void udpActivated(int);
 	signals:
 		void reqSync(unsigned int);
-		void tcpTransmit(QByteArray, unsigned int id);
 	public:
 		int iServerNum;
 		QQueue<int> qqIds;
 		QList<SslServer *> qlServer;
 		QTimer *qtTimeout;
 
+		// Authentications handed to an external authenticator, by request
+		// number. At most MetaParams::iAuthQueue at a time. Numbers are
+		// not reused by a restarted server, which a late answer for the
+		// old one could otherwise complete.
+		QHash<unsigned int, AuthRequest *> qhAuthRequests;
+		static unsigned int uiAuthSerial;
+		QTimer *qtAuthTimeout;
+		void authenticateDone(unsigned int request, int res, const QString &name, const QStringList &groups);
+		void finishAuthenticate(ServerUser *uSource, const MumbleProto::Authenticate &msg, int id);
+
 #ifdef Q_OS_UNIX
 		int aiNotify[2];
 		QList<int> qlUdpSocket;
@@ -231,13 +302,86 @@ class Server : public QThread {
 		QReadWriteLock qrwlUsers;
 		ChanACL::ACLCache acCache;
 		QMutex qmCache;
+		// Whisper target caches, indexed by the channels they resolve
+		// through, the sessions they name and the users they reach.
+		// Guarded by qrwlUsers.
+		typedef QPair<ServerUser *, int> TargetRef;
+		QHash<int, QSet<TargetRef> > qhChannelTargets;
+		QHash<unsigned int, QSet<TargetRef> > qhSessionTargets;
+		QHash<ServerUser *, QSet<TargetRef> > qhRecipientTargets;
+		unsigned int uiTargetChanges;
 		QHash<int, QString> qhUserNameCache;
 		QHash<QString, int> qhUserIDCache;
 
 		QList<Ban> qlBans;
 
-		void processMsg(ServerUser *u, const char *data, int len);
+		// Fed every broadcast by sendProtoExcept().
+		JoinSnapshot jsSnapshot;
+
+		// SHA1 of the texture and comment of registered users, to look
+		// them up in Meta::bcBlobs; empty if they have none.
+		QHash<int, QByteArray> qhTextureHashes;
+		QHash<int, QByteArray> qhCommentHashes;
+		// Rebuilt by getBans() and saveBans().
+		BanIndex biBans;
+		QTimer *qtBanExpiry;
+
+		// Lock free routing for the voice threads; see RoutingTable.
+		QAtomicPointer<RoutingTable> qapRoutes;
+		QAtomicInt qaiRoutesEpoch;
+		QAtomicInt qaiEpoch;
+		QMutex qmRetired;
+		QList<RoutingTable *> qlRetiredRoutes;
+		QList<ServerUser *> qlRemovedUsers;
+		bool bRoutesPending;
+		// Tunnelled voice for TCP-only users, coalesced per session until
+		// the main thread writes it out.
+		QMutex qmTunnel;
+		QHash<unsigned int, QByteArray> qhTunnel;
+		bool bTunnelPending;
+		// Voice counters of the server's own thread and of the main thread;
+		// voice workers keep theirs.
+		VoiceMetrics vmServer, vmMain;
+		VoiceMetrics *voiceMetrics();
+		// The "voicetrace" file the voice routing is recorded to, if any.
+		VoiceTrace *vtTrace;
+		void setVoiceTrace(const QString &name);
+		// Cache line aligned storage for the users' VoiceEndpoints.
+		QList<VoiceEndpoint *> qlEndpointChunks;
+		QList<VoiceEndpoint *> qlFreeEndpoints;
+		const RoutingTable *acquireRoutes(QAtomicInt &epoch);
+		void releaseRoutes(QAtomicInt &epoch);
+		const RoutingTable *currentRoutes();
+		void publishRoutes();
+		void scheduleRoutes();
+		void updateRoutes();
+		void reclaimRoutes();
+		VoiceEndpoint *allocEndpoint(ServerUser *u);
+		void freeEndpoint(VoiceEndpoint *ep);
+
+#ifdef Q_OS_LINUX
+		QList<VoiceWorker *> qlVoiceWorkers;
+		int cloneUdpSocket(int sock);
+#endif
+#ifdef USE_MMSG
+		UDPBatch *ubSend;
+		UDPBatch *sendBatch() const;
+		void flushUDPBatch(UDPBatch *ub, VoiceMetrics *vm);
+		void queueDatagram(UDPBatch *ub, VoiceEndpoint *ep, const char *data, int len, VoiceMetrics *vm);
+#endif
+#ifdef Q_OS_UNIX
+		void processDatagram(const RoutingTable *&rt, int sock, const sockaddr_storage &from, const char *encrypt, char *buffer, int len, quint64 now, VoiceMetrics *vm);
+#else
+		void processDatagram(const RoutingTable *&rt, SOCKET sock, const sockaddr_storage &from, const char *encrypt, char *buffer, int len, quint64 now, VoiceMetrics *vm);
+#endif
+		bool fillPingReply(const RoutingTable *rt, char *data, int len) const;
+		class RouteSink;
+		void processMsg(const RoutingTable *rt, ServerUser *u, const char *data, int len, quint64 now, VoiceMetrics *vm);
 		void sendMessage(ServerUser *u, const char *data, int len, QByteArray &cache, bool force = false);
+		void sendMessage(VoiceEndpoint *ep, const char *data, int len, QByteArray &cache, bool force = false);
+		void sendDatagram(VoiceEndpoint *ep, const char *data, int len, char *buffer, VoiceMetrics *vm);
+		void queueTunnel(VoiceEndpoint *ep, const char *data, int len, QByteArray &cache, VoiceMetrics *vm);
+		void flushTunnel();
 		void run();
 
 		bool validateChannelName(const QString &name);
@@ -250,10 +394,23 @@ class Server : public QThread {
 		void sendClientPermission(ServerUser *u, Channel *c, bool updatelast = false);
 		void flushClientPermissionCache(ServerUser *u, MumbleProto::PermissionQuery &mpqq);
 		void clearACLCache(User *p = NULL);
+		void clearACLCache(Channel *chan);
+		void indexTargetCache(ServerUser *u, int target);
+		void removeTargetCache(ServerUser *u, int target);
+		void removeTargetCaches(ServerUser *u);
+		void removeTargetCaches(const QSet<int> &ids);
+		void patchTargetCaches(ServerUser *p);
 
 		void sendProtoAll(const ::google::protobuf::Message &msg, unsigned int msgType, unsigned int minversion);
 		void sendProtoExcept(ServerUser *, const ::google::protobuf::Message &msg, unsigned int msgType, unsigned int minversion);
 		void sendProtoMessage(ServerUser *, const ::google::protobuf::Message &msg, unsigned int msgType);
+		void sendBlobMessage(ServerUser *, const ::google::protobuf::Message &head, unsigned int msgType, const QByteArray &key, const ::google::protobuf::Message &field);
+
+		void channelState(const Channel *c, bool hashes, MumbleProto::ChannelState &mpcs) const;
+		void userState(const ServerUser *u, bool hashes, bool texture, MumbleProto::UserState &mpus) const;
+		void snapshotChanged(const ::google::protobuf::Message &msg, unsigned int msgType);
+		const QByteArray &channelSnapshot();
+		QByteArray userSnapshot(const ServerUser *skip);
 
 		// sendAll sends a protobuf message to all users on the server whose version is either bigger than v or
 		// lower than ~v. If v == 0 the message is sent to everyone.
@@ -267,7 +424,7 @@ class Server : public QThread {
 
 		static void hashAssign(QString &destination, QByteArray &hash, const QString &str);
 		static void hashAssign(QByteArray &destination, QByteArray &hash, const QByteArray &source);
-		bool isTextAllowed(QString &str, bool &changed);
+		bool isTextAllowed(std::string &str, bool &changed);
 
 		void setLiveConf(const QString &key, const QString &value);
 
@@ -276,6 +433,8 @@ class Server : public QThread {
 		void log(const QString &) const;
 		void log(ServerUser *u, const QString &) const;
 
+		void getMetrics(VoiceMetrics &vm);
+
 		void removeChannel(int id);
 		void removeChannel(Channel *c, Channel *dest = NULL);
 		void userEnterChannel(User *u, Channel *c, MumbleProto::UserState &mpus);
@@ -299,6 +458,9 @@ class Server : public QThread {
 		void getRegisteredUsersSig(const QString &, QMap<int, QString > &);
 		void getRegistrationSig(int &, int, QMap<int, QString> &);
 		void authenticateSig(int &, QString &, int, const QList<QSslCertificate> &, const QString &, bool, const QString &);
+		// Like authenticateSig, but a receiver that takes the request sets
+		// the bool and answers later with authenticateDone().
+		void authenticateAsyncSig(bool &, unsigned int, const QString &, int, const QList<QSslCertificate> &, const QString &, bool, const QString &);
 		void setInfoSig(int &, int, const QMap<int, QString> &);
 		void setTextureSig(int &, int, const QByteArray &);
 		void idToNameSig(QString &, int);
@@ -322,6 +484,8 @@ class Server : public QThread {
 		// Database / DBus functions. Implementation in ServerDB.cpp
 		void initialize();
 		int authenticate(QString &name, const QString &pw, int sessionId = 0, const QStringList &emails = QStringList(), const QString &certhash = QString(), bool bStrongCert = false, const QList<QSslCertificate> & = QList<QSslCertificate>());
+		int authenticateLocal(QString &name, const QString &pw, const QStringList &emails, const QString &certhash, bool bStrongCert);
+		void externalAuthenticated(int id, const QString &name);
 		Channel *addChannel(Channel *c, const QString &name, bool temporary = false, int position = 0);
 		void removeChannelDB(const Channel *c);
 		void readChannels(Channel *p = NULL);
@@ -334,6 +498,7 @@ class Server : public QThread {
 		int getUserID(const QString &name);
 		QString getUserName(int id);
 		QByteArray getUserTexture(int id);
+		QString getUserComment(int id);
 		QMap<int, QString> getRegistration(int id);
 		int registerUser(const QMap<int, QString> &info);
 		bool unregisterUserDB(int id);
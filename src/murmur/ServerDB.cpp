@@ -35,8 +35,10 @@
 #include "ACL.h"
 #include "Channel.h"
 #include "Connection.h"
+#include "DBWriter.h"
 #include "DBus.h"
 #include "Group.h"
+#include "Message.h"
 #include "Meta.h"
 #include "Server.h"
 #include "ServerUser.h"
@@ -51,8 +53,11 @@
 
 class TransactionHolder {
 	public:
+		// Holders alive on the main connection.
+		static int iActive;
 		QSqlQuery *qsqQuery;
 		TransactionHolder() {
+			++iActive;
 			ServerDB::db->transaction();
 			qsqQuery = new QSqlQuery();
 		}
@@ -61,16 +66,21 @@ class TransactionHolder {
 			qsqQuery->clear();
 			delete qsqQuery;
 			ServerDB::db->commit();
+			--iActive;
 		}
 		TransactionHolder(const TransactionHolder & other) {
+			++iActive;
 			ServerDB::db->transaction();
 			qsqQuery = other.qsqQuery ? new QSqlQuery(*other.qsqQuery) : 0;
 		}
 };
 
+int TransactionHolder::iActive = 0;
+
 QSqlDatabase *ServerDB::db = NULL;
 Timer ServerDB::tLogClean;
 QString ServerDB::qsUpgradeSuffix;
+DBWriter *ServerDB::dbwWriter = NULL;
 
 ServerDB::ServerDB() {
 	if (! QSqlDatabase::isDriverAvailable(Meta::mp.qsDBDriver)) {
@@ -466,9 +476,14 @@ ServerDB::ServerDB() {
 		}
 	}
 	query.clear();
+
+	if (Meta::mp.iDBWriteDelay > 0)
+		dbwWriter = new DBWriter(*db, Meta::mp.qsDBPrefix, Meta::mp.iDBWriteDelay, Meta::mp.iLogDays);
 }
 
 ServerDB::~ServerDB() {
+	stopWriter();
+
 	db->close();
 	delete db;
 	db = NULL;
@@ -669,6 +684,9 @@ int Server::registerUser(const QMap<int, QString> &info) {
 	if (res == -1)
 		return res;
 
+	// setInfo() can't flush once the transaction below is open.
+	ServerDB::flushWrites();
+
 	TransactionHolder th;
 
 	QSqlQuery &query = *th.qsqQuery;
@@ -705,8 +723,12 @@ bool Server::unregisterUserDB(int id) {
 	if (info.isEmpty())
 		return false;
 
+	ServerDB::flushWrites();
+
 	qhUserIDCache.remove(info.value(ServerDB::User_Name));
 	qhUserNameCache.remove(id);
+	qhTextureHashes.remove(id);
+	qhCommentHashes.remove(id);
 
 	int res = -2;
 	emit unregisterUserSig(res, id);
@@ -816,6 +838,8 @@ QMap<int, QString> Server::getRegistration(int id) {
 	if (res >= 0)
 		return info;
 
+	ServerDB::flushWrites();
+
 	TransactionHolder th;
 
 	QSqlQuery &query = *th.qsqQuery;
@@ -850,27 +874,41 @@ int Server::authenticate(QString &name, const QString &pw, int sessionId, const
 
 	if (res != -2) {
 		// External authentication handled it. Ignore certificate completely.
-		if (res != -1) {
-			TransactionHolder th;
-			QSqlQuery &query = *th.qsqQuery;
+		externalAuthenticated(res, name);
+		return res;
+	}
 
-			int lchan=readLastChannel(res);
-			if (lchan < 0)
-				lchan = 0;
+	return authenticateLocal(name, pw, emails, certhash, bStrongCert);
+}
 
-			SQLPREP("REPLACE INTO `%1users` (`server_id`, `user_id`, `name`, `lastchannel`) VALUES (?,?,?,?)");
-			query.addBindValue(iServerNum);
-			query.addBindValue(res);
-			query.addBindValue(name);
-			query.addBindValue(lchan);
-			SQLEXEC();
-		}
-		if (res >= 0) {
-			qhUserNameCache.remove(res);
-			qhUserIDCache.remove(name);
-		}
-		return res;
+// Records the answer of an external authenticator.
+void Server::externalAuthenticated(int res, const QString &name) {
+	if (res != -1) {
+		TransactionHolder th;
+		QSqlQuery &query = *th.qsqQuery;
+
+		int lchan=readLastChannel(res);
+		if (lchan < 0)
+			lchan = 0;
+
+		SQLPREP("REPLACE INTO `%1users` (`server_id`, `user_id`, `name`, `lastchannel`) VALUES (?,?,?,?)");
+		query.addBindValue(iServerNum);
+		query.addBindValue(res);
+		query.addBindValue(name);
+		query.addBindValue(lchan);
+		SQLEXEC();
+	}
+	if (res >= 0) {
+		qhUserNameCache.remove(res);
+		qhUserIDCache.remove(name);
 	}
+}
+
+// Authentication against the database, for when no external authenticator
+// handled it.
+int Server::authenticateLocal(QString &name, const QString &pw, const QStringList &emails, const QString &certhash, bool bStrongCert) {
+	int res = -2;
+	bool hashmatch = false;
 
 	TransactionHolder th;
 	QSqlQuery &query = *th.qsqQuery;
@@ -901,6 +939,7 @@ int Server::authenticate(QString &name, const QString &pw, int sessionId, const
 		SQLEXEC();
 		if (query.next()) {
 			res = query.value(0).toInt();
+			hashmatch = true;
 		} else if (bStrongCert) {
 			foreach(const QString &email, emails) {
 				if (! email.isEmpty()) {
@@ -928,19 +967,27 @@ int Server::authenticate(QString &name, const QString &pw, int sessionId, const
 		}
 	}
 	if (! certhash.isEmpty() && (res > 0)) {
+		// Only write the hash if the user logged in some other way; it
+		// is what we just found them by otherwise.
 		SQLPREP("REPLACE INTO `%1user_info` (`server_id`, `user_id`, `key`, `value`) VALUES (?, ?, ?, ?)");
-		query.addBindValue(iServerNum);
-		query.addBindValue(res);
-		query.addBindValue(ServerDB::User_Hash);
-		query.addBindValue(certhash);
-		SQLEXEC();
-		if (! emails.isEmpty()) {
+		if (! hashmatch) {
 			query.addBindValue(iServerNum);
 			query.addBindValue(res);
-			query.addBindValue(ServerDB::User_Email);
-			query.addBindValue(emails.at(0));
+			query.addBindValue(ServerDB::User_Hash);
+			query.addBindValue(certhash);
 			SQLEXEC();
 		}
+		if (! emails.isEmpty()) {
+			if (ServerDB::dbwWriter) {
+				ServerDB::dbwWriter->setInfo(iServerNum, res, ServerDB::User_Email, emails.at(0));
+			} else {
+				query.addBindValue(iServerNum);
+				query.addBindValue(res);
+				query.addBindValue(ServerDB::User_Email);
+				query.addBindValue(emails.at(0));
+				SQLEXEC();
+			}
+		}
 	}
 	if (res >= 0) {
 		qhUserNameCache.remove(res);
@@ -966,10 +1013,15 @@ bool Server::setInfo(int id, const QMap<int, QString> &setinfo) {
 		qhUserIDCache.remove(info.value(ServerDB::User_Name));
 	}
 
+	qhCommentHashes.remove(id);
+
 	emit setInfoSig(res, id, info);
 	if (res >= 0)
 		return (res > 0);
 
+	// Don't let a queued certificate e-mail overwrite this later.
+	ServerDB::flushWrites();
+
 	TransactionHolder th;
 	QSqlQuery &query = *th.qsqQuery;
 
@@ -1034,6 +1086,8 @@ bool Server::setTexture(int id, const QByteArray &texture) {
 			hashAssign(u->qbaTexture, u->qbaTextureHash, tex);
 	}
 
+	qhTextureHashes.remove(id);
+
 	int res = -2;
 	emit setTextureSig(res, id, tex);
 	if (res >= 0)
@@ -1140,6 +1194,15 @@ QByteArray Server::getUserTexture(int id) {
 		return qba;
 	}
 
+	QHash<int, QByteArray>::const_iterator i = qhTextureHashes.constFind(id);
+	if (i != qhTextureHashes.constEnd()) {
+		if (i.value().isEmpty())
+			return QByteArray();
+		qba = meta->bcBlobs.find(i.value());
+		if (! qba.isNull())
+			return qba;
+	}
+
 	TransactionHolder th;
 
 	QSqlQuery &query = *th.qsqQuery;
@@ -1153,11 +1216,69 @@ QByteArray Server::getUserTexture(int id) {
 			if (qba.size() == 600 * 60 * 4)
 				qba = qCompress(qba);
 	}
+
+	if (qba.isEmpty()) {
+		qhTextureHashes.insert(id, QByteArray());
+	} else {
+		const QByteArray &hash = sha1(qba);
+		qhTextureHashes.insert(id, hash);
+		meta->bcBlobs.insert(hash, qba);
+	}
 	return qba;
 }
 
+// The comment of a registered user, or a null QString if they have none.
+QString Server::getUserComment(int id) {
+	{
+		QMap<int, QString> info;
+		int res = -2;
+		emit getRegistrationSig(res, id, info);
+		if (res >= 0)
+			return info.value(ServerDB::User_Comment);
+	}
+
+	QHash<int, QByteArray>::const_iterator i = qhCommentHashes.constFind(id);
+	if (i != qhCommentHashes.constEnd()) {
+		if (i.value().isEmpty())
+			return QString();
+		const QByteArray &qba = meta->bcBlobs.find(i.value());
+		if (! qba.isNull())
+			return QString::fromUtf8(qba.constData(), qba.size());
+	}
+
+	TransactionHolder th;
+
+	QSqlQuery &query = *th.qsqQuery;
+	SQLPREP("SELECT `value` FROM `%1user_info` WHERE `server_id` = ? AND `user_id` = ? AND `key` = ?");
+	query.addBindValue(iServerNum);
+	query.addBindValue(id);
+	query.addBindValue(ServerDB::User_Comment);
+	SQLEXEC();
+
+	QString comment;
+	if (query.next())
+		comment = query.value(0).toString();
+
+	if (comment.isNull()) {
+		qhCommentHashes.insert(id, QByteArray());
+	} else {
+		const QByteArray &hash = sha1(comment);
+		qhCommentHashes.insert(id, hash);
+		meta->bcBlobs.insert(hash, comment.toUtf8());
+	}
+	return comment;
+}
+
 void Server::addLink(Channel *c, Channel *l) {
 	c->link(l);
+	scheduleRoutes();
+
+	{
+		QSet<int> ids;
+		ids << c->iId << l->iId;
+		QWriteLocker wl(&qrwlUsers);
+		removeTargetCaches(ids);
+	}
 
 	if (c->bTemporary || l->bTemporary)
 		return;
@@ -1178,6 +1299,14 @@ void Server::addLink(Channel *c, Channel *l) {
 
 void Server::removeLink(Channel *c, Channel *l) {
 	c->unlink(l);
+	scheduleRoutes();
+
+	{
+		QSet<int> ids;
+		ids << c->iId << l->iId;
+		QWriteLocker wl(&qrwlUsers);
+		removeTargetCaches(ids);
+	}
 
 	if (c->bTemporary || l->bTemporary)
 		return;
@@ -1473,6 +1602,11 @@ void Server::setLastChannel(const User *p) {
 	if (p->cChannel->bTemporary)
 		return;
 
+	if (ServerDB::dbwWriter) {
+		ServerDB::dbwWriter->setLastChannel(iServerNum, p->iId, p->cChannel->iId);
+		return;
+	}
+
 	TransactionHolder th;
 	QSqlQuery &query = *th.qsqQuery;
 
@@ -1491,6 +1625,10 @@ int Server::readLastChannel(int id) {
 	if (id < 0)
 		return -1;
 
+	int cid;
+	if (ServerDB::dbwWriter && ServerDB::dbwWriter->lastChannel(iServerNum, id, cid))
+		return qhChannels.contains(cid) ? cid : -1;
+
 	TransactionHolder th;
 	QSqlQuery &query = *th.qsqQuery;
 
@@ -1562,6 +1700,8 @@ void Server::getBans() {
 		if (ban.isValid())
 			qlBans << ban;
 	}
+
+	biBans.rebuild(qlBans, QDateTime::currentDateTime().toUTC().toTime_t());
 }
 
 void Server::saveBans() {
@@ -1584,12 +1724,31 @@ void Server::saveBans() {
 		query.addBindValue(ban.iDuration);
 		SQLEXEC();
 	}
+
+	biBans.rebuild(qlBans, QDateTime::currentDateTime().toUTC().toTime_t());
 }
 
 QVariant Server::getConf(const QString &key, QVariant def) {
 	return ServerDB::getConf(iServerNum, key, def);
 }
 
+// Waits until everything queued for the DBWriter is in the database.
+// Must not wait while the main connection holds a transaction: on SQLite
+// the writer can't commit until it ends, so callers that open one flush
+// before doing so, and nested calls (setInfo() from registerUser()) are
+// skipped.
+void ServerDB::flushWrites() {
+	if (dbwWriter && (TransactionHolder::iActive == 0))
+		dbwWriter->flush();
+}
+
+// Writes what is still queued and stops the DBWriter; from then on,
+// everything is written as it happens.
+void ServerDB::stopWriter() {
+	delete dbwWriter;
+	dbwWriter = NULL;
+}
+
 QVariant ServerDB::getConf(int server_id, const QString &key, QVariant def) {
 	TransactionHolder th;
 
@@ -1624,13 +1783,18 @@ void Server::setConf(const QString &key, const QVariant &value) {
 }
 
 void Server::dblog(const QString &str) const {
-	TransactionHolder th;
-	QSqlQuery &query = *th.qsqQuery;
-
 	// Is logging disabled?
 	if (Meta::mp.iLogDays < 0)
 		return;
 
+	if (ServerDB::dbwWriter) {
+		ServerDB::dbwWriter->log(iServerNum, str);
+		return;
+	}
+
+	TransactionHolder th;
+	QSqlQuery &query = *th.qsqQuery;
+
 	// Once per hour
 	if (Meta::mp.iLogDays > 0) {
 		if (ServerDB::tLogClean.isElapsed(3600ULL * 1000000ULL)) {
@@ -1652,6 +1816,8 @@ void Server::dblog(const QString &str) const {
 }
 
 void ServerDB::wipeLogs() {
+	flushWrites();
+
 	TransactionHolder th;
 	QSqlQuery &query = *th.qsqQuery;
 
@@ -1659,6 +1825,8 @@ void ServerDB::wipeLogs() {
 }
 
 QList<QPair<unsigned int, QString> > ServerDB::getLog(int server_id, unsigned int offs_min, unsigned int offs_max) {
+	flushWrites();
+
 	TransactionHolder th;
 	QSqlQuery &query = *th.qsqQuery;
 
@@ -1678,6 +1846,8 @@ QList<QPair<unsigned int, QString> > ServerDB::getLog(int server_id, unsigned in
 }
 
 int ServerDB::getLogLen(int server_id) {
+	flushWrites();
+
 	TransactionHolder th;
 	QSqlQuery &query = *th.qsqQuery;
 
@@ -1768,6 +1938,8 @@ int ServerDB::addServer() {
 }
 
 void ServerDB::deleteServer(int server_id) {
+	flushWrites();
+
 	TransactionHolder th;
 	QSqlQuery &query = *th.qsqQuery;
 	SQLPREP("DELETE FROM `%1servers` WHERE `server_id` = ?");
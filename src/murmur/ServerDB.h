@@ -31,6 +31,8 @@
 #ifndef MUMBLE_MURMUR_DATABASE_H_
 #define MUMBLE_MURMUR_DATABASE_H_
 
+#include <QtCore/QHash>
+#include <QtCore/QMap>
 #include <QtCore/QVariant>
 
 #include "Timer.h"
@@ -40,6 +42,7 @@ class User;
 class Connection;
 class QSqlDatabase;
 class QSqlQuery;
+class DBWriter;
 
 class ServerDB {
 	public:
@@ -51,6 +54,9 @@ class ServerDB {
 		static Timer tLogClean;
 		static QSqlDatabase *db;
 		static QString qsUpgradeSuffix;
+		static DBWriter *dbwWriter;
+		static void flushWrites();
+		static void stopWriter();
 		static void setSUPW(int iServNum, const QString &pw);
 		static QList<int> getBootServers();
 		static QList<int> getAllServers();
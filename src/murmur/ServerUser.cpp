@@ -35,9 +35,10 @@
 #include "ServerUser.h"
 #include "Meta.h"
 
-ServerUser::ServerUser(Server *p, QSslSocket *socket) : Connection(p, socket), User(), s(NULL) {
+ServerUser::ServerUser(Server *p, SocketHandler *handler) : Connection(p, handler), User(), s(p),
+	veEndpoint(p->allocEndpoint(this)), bUdp(veEndpoint->bUdp), sUdpSocket(veEndpoint->sUdpSocket),
+	qmCrypt(veEndpoint->qmCrypt), csCrypt(veEndpoint->csCrypt) {
 	sState = ServerUser::Connected;
-	sUdpSocket = INVALID_SOCKET;
 
 	memset(&saiUdpAddress, 0, sizeof(saiUdpAddress));
 	memset(&saiTcpLocalAddress, 0, sizeof(saiTcpLocalAddress));
@@ -46,7 +47,6 @@ ServerUser::ServerUser(Server *p, QSslSocket *socket) : Connection(p, socket), U
 	dTCPPingAvg = dTCPPingVar = 0.0f;
 	uiUDPPackets = uiTCPPackets = 0;
 
-	bUdp = true;
 	uiVersion = 0;
 	bVerified = true;
 	iLastPermissionCheck = -1;
@@ -54,77 +54,83 @@ ServerUser::ServerUser(Server *p, QSslSocket *socket) : Connection(p, socket), U
 	bOpus = false;
 }
 
-
-ServerUser::operator const QString() const {
-	return QString::fromLatin1("%1:%2(%3)").arg(qsName).arg(uiSession).arg(iId);
+ServerUser::~ServerUser() {
+	s->freeEndpoint(veEndpoint);
 }
-BandwidthRecord::BandwidthRecord() {
-	iRecNum = 0;
-	iSum = 0;
-	for (int i=0;i<N_BANDWIDTH_SLOTS;i++)
-		a_iBW[i] = 0;
-}
-
-bool BandwidthRecord::addFrame(int size, int maxpersec) {
-	quint64 elapsed = a_qtWhen[iRecNum].elapsed();
-
-	if (elapsed == 0)
-		return false;
 
-	int nsum = iSum-a_iBW[iRecNum]+size;
-	int bw = static_cast<int>((nsum * 1000000LL) / elapsed);
-
-	if (bw > maxpersec)
-		return false;
-
-	a_iBW[iRecNum] = static_cast<unsigned short>(size);
-	a_qtWhen[iRecNum].restart();
-
-	iSum = nsum;
-
-	iRecNum++;
-	if (iRecNum == N_BANDWIDTH_SLOTS)
-		iRecNum = 0;
-
-	return true;
-}
-
-int BandwidthRecord::onlineSeconds() const {
-	return static_cast<int>(tFirst.elapsed() / 1000000LL);
-}
-
-int BandwidthRecord::idleSeconds() const {
-	quint64 iIdle = a_qtWhen[(iRecNum + N_BANDWIDTH_SLOTS - 1) % N_BANDWIDTH_SLOTS].elapsed();
-	if (tIdleControl.elapsed() < iIdle)
-		iIdle = tIdleControl.elapsed();
-
-	return static_cast<int>(iIdle / 1000000LL);
-}
-
-void BandwidthRecord::resetIdleSeconds() {
-	tIdleControl.restart();
+/* Copies the state VoiceRouter::add() checks for every recipient into
+ * veEndpoint. Call after changing uiSession, bDeaf, bSelfDeaf or ssContext.
+ */
+void ServerUser::syncEndpoint() {
+	veEndpoint->uiSession = uiSession;
+	veEndpoint->bDeaf = bDeaf || bSelfDeaf;
+	veEndpoint->uiContext = qHash(QByteArray::fromRawData(ssContext.data(), static_cast<int>(ssContext.size())));
+
+	if (s->vtTrace) {
+		VoiceTrace::User user;
+		user.uiSession = uiSession;
+		user.uiFlags = (veEndpoint->bDeaf ? VoiceTrace::UserDeaf : 0) | (veEndpoint->bUdp ? VoiceTrace::UserUdp : 0);
+		user.uiContext = veEndpoint->uiContext;
+		s->vtTrace->addEndpoint(Timer::now(), user);
+	}
 }
 
-int BandwidthRecord::bandwidth() const {
-	int sum = 0;
-	int records = 0;
-	quint64 elapsed = 0ULL;
 
-	for (int i=1;i<N_BANDWIDTH_SLOTS;++i) {
-		int idx = (iRecNum + N_BANDWIDTH_SLOTS - i) % N_BANDWIDTH_SLOTS;
-		quint64 e = a_qtWhen[idx].elapsed();
-		if (e > 1000000ULL) {
-			break;
+/* Records the address and socket the client's UDP traffic came from, and
+ * builds the destination length and source address control message used
+ * for every datagram sent back to it. Called with qrwlUsers held for writing;
+ * voice threads sending to the old address meanwhile read it under qmCrypt.
+ */
+#ifdef Q_OS_UNIX
+void ServerUser::setUdpAddress(int sock, const struct sockaddr_storage &addr) {
+#else
+void ServerUser::setUdpAddress(SOCKET sock, const struct sockaddr_storage &addr) {
+#endif
+	VoiceEndpoint *ve = veEndpoint;
+
+	memcpy(&saiUdpAddress, &addr, sizeof(saiUdpAddress));
+
+	{
+		QMutexLocker l(&ve->qmCrypt);
+
+		memcpy(&ve->saiUdpAddress, &addr, sizeof(ve->saiUdpAddress));
+		ve->iUdpAddressLen = (saiUdpAddress.ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+
+#ifdef Q_OS_LINUX
+		// Replies leave from the address the client connected to over TCP.
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		memset(ve->acUdpControl, 0, sizeof(ve->acUdpControl));
+		msg.msg_control = ve->acUdpControl;
+		msg.msg_controllen = sizeof(ve->acUdpControl);
+
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		HostAddress tcpha(saiTcpLocalAddress);
+		if (saiUdpAddress.ss_family == AF_INET6) {
+			cmsg->cmsg_level = IPPROTO_IPV6;
+			cmsg->cmsg_type = IPV6_PKTINFO;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
+			struct in6_pktinfo *pktinfo = reinterpret_cast<struct in6_pktinfo *>(CMSG_DATA(cmsg));
+			memcpy(&pktinfo->ipi6_addr.s6_addr[0], &tcpha.qip6.c[0], sizeof(pktinfo->ipi6_addr.s6_addr));
+			ve->szUdpControl = CMSG_SPACE(sizeof(struct in6_pktinfo));
+		} else if (tcpha.isV6()) {
+			ve->szUdpControl = 0;
 		} else {
-			++records;
-			sum += a_iBW[idx];
-			elapsed = e;
+			cmsg->cmsg_level = IPPROTO_IP;
+			cmsg->cmsg_type = IP_PKTINFO;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+			struct in_pktinfo *pktinfo = reinterpret_cast<struct in_pktinfo *>(CMSG_DATA(cmsg));
+			pktinfo->ipi_spec_dst.s_addr = tcpha.hash[3];
+			ve->szUdpControl = CMSG_SPACE(sizeof(struct in_pktinfo));
 		}
+#endif
+		ve->sUdpSocket = sock;
 	}
 
-	if (elapsed < 250000ULL)
-		return 0;
-
-	return static_cast<int>((sum * 1000000ULL) / elapsed);
+	// Only now may voice threads start sending to it.
+	ve->qaiUdpAddress.fetchAndStoreRelease(1);
 }
 
+ServerUser::operator const QString() const {
+	return QString::fromLatin1("%1:%2(%3)").arg(qsName).arg(uiSession).arg(iId);
+}
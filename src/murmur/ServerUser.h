@@ -32,40 +32,23 @@
 #ifndef MUMBLE_MURMUR_SERVERUSER_H_
 #define MUMBLE_MURMUR_SERVERUSER_H_
 
+#include <QtCore/QMutex>
 #include <QtCore/QStringList>
 
 #ifdef Q_OS_UNIX
 #include <sys/socket.h>
+#include <netinet/in.h>
 #else
 #include <winsock2.h>
 #endif
 
+#include "BandwidthRecord.h"
 #include "Connection.h"
+#include "CryptState.h"
 #include "Net.h"
 #include "Timer.h"
 #include "User.h"
-
-// Unfortunately, this needs to be "large enough" to hold
-// enough frames to account for both short-term and
-// long-term "maladjustments".
-
-#define N_BANDWIDTH_SLOTS 360
-
-struct BandwidthRecord {
-	int iRecNum;
-	int iSum;
-	Timer tFirst;
-	Timer tIdleControl;
-	unsigned short a_iBW[N_BANDWIDTH_SLOTS];
-	Timer a_qtWhen[N_BANDWIDTH_SLOTS];
-
-	BandwidthRecord();
-	bool addFrame(int size, int maxpersec);
-	int onlineSeconds() const;
-	int idleSeconds() const;
-	void resetIdleSeconds();
-	int bandwidth() const;
-};
+#include "VoiceRouter.h"
 
 struct WhisperTarget {
 	struct Channel {
@@ -79,6 +62,7 @@ struct WhisperTarget {
 };
 
 class Server;
+class ServerUser;
 
 class ServerUser : public Connection, public User {
 	private:
@@ -87,7 +71,7 @@ class ServerUser : public Connection, public User {
 	protected:
 		Server *s;
 	public:
-		enum State { Connected, Authenticated };
+		enum State { Connected, Authenticating, Authenticated };
 		State sState;
 		operator const QString() const;
 
@@ -107,7 +91,6 @@ class ServerUser : public Connection, public User {
 		QStringList qslEmail;
 
 		HostAddress haAddress;
-		bool bUdp;
 
 		QList<int> qlCodecs;
 		bool bOpus;
@@ -115,21 +98,48 @@ class ServerUser : public Connection, public User {
 		QStringList qslAccessTokens;
 
 		QMap<int, WhisperTarget> qmTargets;
-		typedef QPair<QSet<ServerUser *>, QSet<ServerUser *> > TargetCache;
+		struct TargetCache {
+			// Flat recipient lists the voice thread walks.
+			QVector<VoiceEndpoint *> qvChannel;
+			QVector<VoiceEndpoint *> qvDirect;
+			// Channels the channel recipients were resolved from, with
+			// the group each target for that channel filters on (empty
+			// for everyone). A user entering or leaving one of these
+			// is patched in or out without resolving everything again.
+			QHash<int, QStringList> qhChannels;
+			// Sessions named directly.
+			QList<unsigned int> qlSessions;
+		};
 		QMap<int, TargetCache> qmTargetCache;
 		QMap<QString, QString> qmWhisperRedirect;
 
 		int iLastPermissionCheck;
 		QMap<int, unsigned int> qmPermissionSent;
+
+		VoiceEndpoint *veEndpoint;
+		// These live in veEndpoint.
+		bool &bUdp;
 #ifdef Q_OS_UNIX
-		int sUdpSocket;
+		int &sUdpSocket;
 #else
-		SOCKET sUdpSocket;
+		SOCKET &sUdpSocket;
 #endif
+		QMutex &qmCrypt;
+		CryptState &csCrypt;
+
 		BandwidthRecord bwr;
 		struct sockaddr_storage saiUdpAddress;
 		struct sockaddr_storage saiTcpLocalAddress;
-		ServerUser(Server *parent, QSslSocket *socket);
+
+#ifdef Q_OS_UNIX
+		void setUdpAddress(int sock, const struct sockaddr_storage &addr);
+#else
+		void setUdpAddress(SOCKET sock, const struct sockaddr_storage &addr);
+#endif
+		void syncEndpoint();
+
+		ServerUser(Server *parent, SocketHandler *handler);
+		~ServerUser();
 };
 
 #endif
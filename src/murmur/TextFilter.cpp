@@ -0,0 +1,528 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "murmur_pch.h"
+
+#include "TextFilter.h"
+
+// Decodes one character the way QString::fromUtf8() does, where each byte
+// of an invalid sequence becomes U+FFFD. Returns its length in UTF-16 units.
+static inline int decode(const char *&p, const char *end, unsigned int &c) {
+	const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+	if (u[0] < 0x80) {
+		c = u[0];
+		++p;
+		return 1;
+	}
+
+	int n;
+	unsigned int min;
+	if ((u[0] & 0xe0) == 0xc0) {
+		n = 1;
+		c = u[0] & 0x1f;
+		min = 0x80;
+	} else if ((u[0] & 0xf0) == 0xe0) {
+		n = 2;
+		c = u[0] & 0x0f;
+		min = 0x800;
+	} else if ((u[0] & 0xf8) == 0xf0) {
+		n = 3;
+		c = u[0] & 0x07;
+		min = 0x10000;
+	} else {
+		n = 0;
+		min = 0;
+	}
+
+	bool ok = (n > 0) && (end - p > n);
+	for (int i=1;ok && (i<=n);++i) {
+		ok = ((u[i] & 0xc0) == 0x80);
+		c = (c << 6) | (u[i] & 0x3f);
+	}
+	if (! ok || (c < min) || (c > 0x10ffff) || ((c >= 0xd800) && (c <= 0xdfff))) {
+		c = 0xfffd;
+		++p;
+		return 1;
+	}
+	p += n + 1;
+	return (c >= 0x10000) ? 2 : 1;
+}
+
+static inline int encode(unsigned int c, char *buf) {
+	if (c < 0x80) {
+		buf[0] = static_cast<char>(c);
+		return 1;
+	} else if (c < 0x800) {
+		buf[0] = static_cast<char>(0xc0 | (c >> 6));
+		buf[1] = static_cast<char>(0x80 | (c & 0x3f));
+		return 2;
+	} else if (c < 0x10000) {
+		buf[0] = static_cast<char>(0xe0 | (c >> 12));
+		buf[1] = static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+		buf[2] = static_cast<char>(0x80 | (c & 0x3f));
+		return 3;
+	}
+	buf[0] = static_cast<char>(0xf0 | (c >> 18));
+	buf[1] = static_cast<char>(0x80 | ((c >> 12) & 0x3f));
+	buf[2] = static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+	buf[3] = static_cast<char>(0x80 | (c & 0x3f));
+	return 4;
+}
+
+static int utf16Length(const char *p, const char *end) {
+	int len = 0;
+	while (p < end) {
+		if (static_cast<unsigned char>(*p) < 0x80) {
+			++p;
+			++len;
+		} else {
+			unsigned int c;
+			len += decode(p, end, c);
+		}
+	}
+	return len;
+}
+
+// QChar::isSpace()
+static inline bool isSpace(unsigned int c) {
+	if ((c == 0x20) || ((c >= 0x09) && (c <= 0x0d)) || (c == 0x85) || (c == 0xa0))
+		return true;
+	if (c < 0x1680)
+		return false;
+	return (c == 0x1680) || ((c >= 0x2000) && (c <= 0x200a)) || (c == 0x2028) || (c == 0x2029) || (c == 0x202f) || (c == 0x205f) || (c == 0x3000);
+}
+
+static inline bool isXmlChar(unsigned int c) {
+	if (c >= 0x20)
+		return (c <= 0xd7ff) || ((c >= 0xe000) && (c <= 0xfffd)) || ((c >= 0x10000) && (c <= 0x10ffff));
+	return (c == 0x09) || (c == 0x0a) || (c == 0x0d);
+}
+
+static inline bool isXmlSpace(char c) {
+	return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r');
+}
+
+static inline bool isNameStart(char c) {
+	const unsigned char u = static_cast<unsigned char>(c);
+	return ((u >= 'a') && (u <= 'z')) || ((u >= 'A') && (u <= 'Z')) || (u == '_') || (u == ':') || (u >= 0x80);
+}
+
+static inline bool isNameChar(char c) {
+	return isNameStart(c) || ((c >= '0') && (c <= '9')) || (c == '-') || (c == '.');
+}
+
+static inline bool equals(const char *s, const char *end, const char *literal) {
+	const size_t len = strlen(literal);
+	return (static_cast<size_t>(end - s) == len) && (memcmp(s, literal, len) == 0);
+}
+
+static inline bool startsWith(const char *s, const char *end, const char *literal) {
+	const size_t len = strlen(literal);
+	return (static_cast<size_t>(end - s) >= len) && (memcmp(s, literal, len) == 0);
+}
+
+/* One pass over a message. If out is set, the plain text is written to it
+ * with its whitespace simplified; it never gets ahead of the input, so it
+ * can point into the text being read. Nothing is written while a tag is
+ * read, so names can be compared in place.
+ */
+class TextScanner {
+	protected:
+		const char *p;
+		const char *end;
+		char *out;
+		char *begin;
+		bool bSpace;
+		int iDepth;
+		unsigned int uiStack[TextFilter::iMaxDepth];
+
+		void put(unsigned int c, const char *raw, int len, int units);
+		void put(unsigned int c);
+		bool name();
+		bool skipSpace();
+		bool reference(unsigned int &c);
+		bool markup();
+		bool startTag();
+		bool endTag();
+		bool comment();
+		bool cdata();
+		bool processingInstruction();
+	public:
+		// UTF-16 units written to out.
+		int iLength;
+		// UTF-16 units in the src attributes of <img>s.
+		int iSources;
+
+		TextScanner(const char *data, const char *e, char *o);
+		char *written() const;
+		void simplify();
+		bool run();
+};
+
+TextScanner::TextScanner(const char *data, const char *e, char *o) : p(data), end(e), out(o), begin(o) {
+	bSpace = false;
+	iDepth = 0;
+	iLength = 0;
+	iSources = 0;
+}
+
+char *TextScanner::written() const {
+	return out;
+}
+
+void TextScanner::put(unsigned int c, const char *raw, int len, int units) {
+	if (! out)
+		return;
+	if (isSpace(c)) {
+		bSpace = true;
+		return;
+	}
+	if (bSpace && (out != begin)) {
+		*out++ = ' ';
+		++iLength;
+	}
+	bSpace = false;
+	for (int i=0;i<len;++i)
+		*out++ = raw[i];
+	iLength += units;
+}
+
+void TextScanner::put(unsigned int c) {
+	char buf[4];
+	put(c, buf, encode(c, buf), (c >= 0x10000) ? 2 : 1);
+}
+
+bool TextScanner::name() {
+	if ((p >= end) || ! isNameStart(*p))
+		return false;
+	do {
+		++p;
+	} while ((p < end) && isNameChar(*p));
+	return true;
+}
+
+bool TextScanner::skipSpace() {
+	const char *s = p;
+	while ((p < end) && isXmlSpace(*p))
+		++p;
+	return (p != s);
+}
+
+// Any whitespace, without entities, as QString::simplified() would.
+void TextScanner::simplify() {
+	while (p < end) {
+		const char *s = p;
+		unsigned int c;
+		const int units = decode(p, end, c);
+		put(c, s, static_cast<int>(p - s), units);
+	}
+}
+
+bool TextScanner::run() {
+	// Start of the character data being read, to catch "]]>" in it.
+	const char *text = p;
+	while (p < end) {
+		const char c = *p;
+		if (c == '<') {
+			if (! markup())
+				return false;
+			text = p;
+		} else if (c == '&') {
+			unsigned int v;
+			if (! reference(v))
+				return false;
+			put(v);
+			text = p;
+		} else {
+			if ((c == '>') && (p - text >= 2) && (p[-1] == ']') && (p[-2] == ']'))
+				return false;
+			const char *s = p;
+			unsigned int v;
+			const int units = decode(p, end, v);
+			if (! isXmlChar(v))
+				return false;
+			put(v, s, static_cast<int>(p - s), units);
+		}
+	}
+	return (iDepth == 0);
+}
+
+// Character references and the five predefined entities; anything else
+// is undeclared, as there is no DTD.
+bool TextScanner::reference(unsigned int &c) {
+	const char *s = ++p;
+	if ((p < end) && (*p == '#')) {
+		++p;
+		const bool hex = (p < end) && (*p == 'x');
+		if (hex)
+			++p;
+		const char *digits = p;
+		c = 0;
+		for (;(p < end) && (*p != ';');++p) {
+			const char d = *p;
+			if ((d >= '0') && (d <= '9'))
+				c = c * (hex ? 16 : 10) + static_cast<unsigned int>(d - '0');
+			else if (hex && (d >= 'a') && (d <= 'f'))
+				c = c * 16 + static_cast<unsigned int>(d - 'a' + 10);
+			else if (hex && (d >= 'A') && (d <= 'F'))
+				c = c * 16 + static_cast<unsigned int>(d - 'A' + 10);
+			else
+				return false;
+			if (c > 0x10ffff)
+				return false;
+		}
+		if ((p >= end) || (p == digits) || ! isXmlChar(c))
+			return false;
+		++p;
+		return true;
+	}
+
+	if (! name() || (p >= end) || (*p != ';'))
+		return false;
+	if (equals(s, p, "lt"))
+		c = '<';
+	else if (equals(s, p, "gt"))
+		c = '>';
+	else if (equals(s, p, "amp"))
+		c = '&';
+	else if (equals(s, p, "quot"))
+		c = '"';
+	else if (equals(s, p, "apos"))
+		c = '\'';
+	else
+		return false;
+	++p;
+	return true;
+}
+
+bool TextScanner::markup() {
+	if (end - p < 2)
+		return false;
+	switch (p[1]) {
+		case '/':
+			return endTag();
+		case '?':
+			return processingInstruction();
+		case '!':
+			if (startsWith(p, end, "<!--"))
+				return comment();
+			if (startsWith(p, end, "<![CDATA["))
+				return cdata();
+			return false;
+		default:
+			return startTag();
+	}
+}
+
+static inline unsigned int nameHash(const char *s, const char *end) {
+	unsigned int h = 2166136261U;
+	for (;s < end;++s)
+		h = (h ^ static_cast<unsigned char>(*s)) * 16777619U;
+	return h;
+}
+
+bool TextScanner::startTag() {
+	const char *n = ++p;
+	if (! name())
+		return false;
+	const char *nend = p;
+	const bool img = equals(n, nend, "img");
+
+	forever {
+		const bool space = skipSpace();
+		if (p >= end)
+			return false;
+		if (*p == '>') {
+			++p;
+			if (iDepth == TextFilter::iMaxDepth)
+				return false;
+			uiStack[iDepth++] = nameHash(n, nend);
+			return true;
+		}
+		if (*p == '/') {
+			if ((end - p < 2) || (p[1] != '>'))
+				return false;
+			p += 2;
+			if (equals(n, nend, "br") || equals(n, nend, "p"))
+				put('\n');
+			return true;
+		}
+		if (! space)
+			return false;
+
+		const char *a = p;
+		if (! name())
+			return false;
+		const bool src = img && equals(a, p, "src");
+		skipSpace();
+		if ((p >= end) || (*p != '='))
+			return false;
+		++p;
+		skipSpace();
+		if ((p >= end) || ((*p != '"') && (*p != '\'')))
+			return false;
+
+		const char quote = *p++;
+		const char *value = p;
+		forever {
+			if (p >= end)
+				return false;
+			const char c = *p;
+			if (c == quote)
+				break;
+			if (c == '<')
+				return false;
+			unsigned int v;
+			if (c == '&') {
+				if (! reference(v))
+					return false;
+			} else {
+				decode(p, end, v);
+				if (! isXmlChar(v))
+					return false;
+			}
+		}
+		if (src)
+			iSources += utf16Length(value, p);
+		++p;
+	}
+}
+
+bool TextScanner::endTag() {
+	p += 2;
+	const char *n = p;
+	if (! name())
+		return false;
+	const char *nend = p;
+	skipSpace();
+	if ((p >= end) || (*p != '>'))
+		return false;
+	++p;
+	if ((iDepth == 0) || (uiStack[--iDepth] != nameHash(n, nend)))
+		return false;
+	if (equals(n, nend, "br") || equals(n, nend, "p"))
+		put('\n');
+	return true;
+}
+
+bool TextScanner::comment() {
+	p += 4;
+	forever {
+		if (end - p < 3)
+			return false;
+		if ((p[0] == '-') && (p[1] == '-')) {
+			if (p[2] != '>')
+				return false;
+			p += 3;
+			return true;
+		}
+		++p;
+	}
+}
+
+bool TextScanner::cdata() {
+	p += 9;
+	forever {
+		if (end - p < 3)
+			return false;
+		if ((p[0] == ']') && (p[1] == ']') && (p[2] == '>')) {
+			p += 3;
+			return true;
+		}
+		const char *s = p;
+		unsigned int c;
+		const int units = decode(p, end, c);
+		if (! isXmlChar(c))
+			return false;
+		put(c, s, static_cast<int>(p - s), units);
+	}
+}
+
+bool TextScanner::processingInstruction() {
+	p += 2;
+	const char *n = p;
+	if (! name())
+		return false;
+	if ((p - n == 3) && (qstrnicmp(n, "xml", 3) == 0))
+		return false;
+	if (startsWith(p, end, "?>")) {
+		p += 2;
+		return true;
+	}
+	if (! skipSpace())
+		return false;
+	forever {
+		if (end - p < 2)
+			return false;
+		if ((p[0] == '?') && (p[1] == '>')) {
+			p += 2;
+			return true;
+		}
+		++p;
+	}
+}
+
+int TextFilter::length(const std::string &text) {
+	return utf16Length(text.data(), text.data() + text.size());
+}
+
+/* Replaces text with what is left without markup, simplified. Text
+ * without any '<' is only simplified; entities in it are left alone.
+ * Returns false if the markup isn't well-formed, in which case text is
+ * left half rewritten.
+ */
+bool TextFilter::toPlainText(std::string &text, int &length) {
+	length = 0;
+	if (text.empty())
+		return true;
+
+	char *data = &text[0];
+	TextScanner ts(data, data + text.size(), data);
+	if (memchr(data, '<', text.size()) == NULL)
+		ts.simplify();
+	else if (! ts.run())
+		return false;
+
+	text.resize(static_cast<size_t>(ts.written() - data));
+	length = ts.iLength;
+	return true;
+}
+
+/* The length of text without the src of <img>s, which are covered by
+ * the image message length instead. Returns false if the markup isn't
+ * well-formed.
+ */
+bool TextFilter::textLength(const std::string &text, int &length) {
+	TextScanner ts(text.data(), text.data() + text.size(), NULL);
+	if (! ts.run())
+		return false;
+	length = TextFilter::length(text) - ts.iSources;
+	return true;
+}
@@ -0,0 +1,55 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MURMUR_TEXTFILTER_H_
+#define MUMBLE_MURMUR_TEXTFILTER_H_
+
+#include <string>
+
+/* Checks and strips the markup of text messages, comments and channel
+ * descriptions in one pass over their UTF-8 bytes, as they come out of
+ * the protobuf message, without building a QString or a DOM. Messages
+ * are parsed as the content of an XML element, the way
+ * QXmlStreamReader would see "<document>text</document>". Open elements
+ * are remembered by a hash of their name in a fixed stack, so nesting
+ * deeper than iMaxDepth is refused.
+ *
+ * Lengths are counted in UTF-16 units, the same as QString::length().
+ */
+class TextFilter {
+	public:
+		static const int iMaxDepth = 256;
+
+		static int length(const std::string &text);
+		static bool toPlainText(std::string &text, int &length);
+		static bool textLength(const std::string &text, int &length);
+};
+
+#endif
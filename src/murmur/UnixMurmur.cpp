@@ -32,6 +32,7 @@
 
 #include "UnixMurmur.h"
 
+#include "LogWriter.h"
 #include "Meta.h"
 
 QMutex *LimitTest::qm;
@@ -107,6 +108,7 @@ void LimitTest::testLimits(QCoreApplication &a) {
 }
 
 extern QFile *qfLog;
+extern LogWriter *lwLog;
 
 int UnixMurmur::iHupFd[2];
 int UnixMurmur::iTermFd[2];
@@ -199,6 +201,8 @@ void UnixMurmur::handleSigHup() {
 			QFile *oldlog = qfLog;
 
 			newlog->setTextModeEnabled(true);
+			if (lwLog)
+				lwLog->setFile(newlog);
 			qfLog = newlog;
 			oldlog->close();
 			delete oldlog;
@@ -0,0 +1,169 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "murmur_pch.h"
+
+#include "VoiceRouter.h"
+
+#include "BandwidthRecord.h"
+#include "Message.h"
+#include "PacketDataStream.h"
+
+VoiceEndpoint::VoiceEndpoint(ServerUser *user, const std::string *context) : u(user), psContext(context) {
+	uiSession = 0;
+	uiContext = 0;
+	bDeaf = false;
+	bUdp = true;
+	sUdpSocket = INVALID_SOCKET;
+	iUdpAddressLen = 0;
+#ifdef Q_OS_LINUX
+	szUdpControl = 0;
+	memset(acUdpControl, 0, sizeof(acUdpControl));
+#endif
+	memset(&saiUdpAddress, 0, sizeof(saiUdpAddress));
+}
+
+// Checks the voice data rate limit for a packet of len bytes.
+bool VoiceRouter::admit(BandwidthRecord *bw, int len, int maxbandwidth, quint64 now) {
+	// IP + UDP + Crypt + Data
+	int packetsize = 20 + 8 + 4 + len;
+
+	return bw->addFrame(packetsize, maxbandwidth/8, now);
+}
+
+/* Sends one voice packet to every listed recipient. The plaintext is built
+ * once by the caller; each UDP recipient then only costs an encryption and
+ * a copy of its prepared addresses, and all TCP recipients share one
+ * tunnel message.
+ */
+void VoiceRouter::fanOut(VoiceSink *sink, VoiceEndpoint * const *recipients, int count, const char *data, int len) {
+	QByteArray cache;
+#if defined(__LP64__)
+	char ebuffer[UDP_PACKET_SIZE+4+16];
+	char *buffer = reinterpret_cast<char *>(((reinterpret_cast<quint64>(ebuffer) + 8) & ~7) + 4);
+#else
+	char buffer[UDP_PACKET_SIZE+4];
+#endif
+
+	for (int i=0;i<count;++i) {
+		VoiceEndpoint *ep = recipients[i];
+		if (ep->bUdp && ep->hasUdpAddress() && ep->csCrypt.isValid())
+			sink->datagram(ep, data, len, buffer);
+		else
+			sink->tunnel(ep, data, len, cache);
+	}
+}
+
+// Builds the UDPTunnel message for data into cache, unless already there.
+void VoiceRouter::tunnelMessage(QByteArray &cache, const char *data, int len) {
+	if (! cache.isEmpty())
+		return;
+
+	cache.resize(len + 6);
+	unsigned char *uc = reinterpret_cast<unsigned char *>(cache.data());
+	qToBigEndian<quint16>(MessageHandler::UDPTunnel, & uc[0]);
+	qToBigEndian<quint32>(len, & uc[2]);
+	memcpy(uc + 6, data, len);
+}
+
+/* Rewrites the packet self sent as it is relayed: the session id of the
+ * speaker goes in front of the voice and positional data. The target
+ * flags of the header are filled in by send().
+ */
+VoiceRouter::VoiceRouter(VoiceEndpoint *self, const char *data, int len) : veSelf(self) {
+	unsigned int counter;
+	PacketDataStream pdi(data + 1, len - 1);
+	PacketDataStream pds(cBuffer+1, UDP_PACKET_SIZE-1);
+	uiType = data[0] & 0xe0;
+	uiTarget = data[0] & 0x1f;
+
+	// Read the sequence number.
+	pdi >> counter;
+
+	// Skip to the end of the voice data.
+	if ((uiType >> 5) != MessageHandler::UDPVoiceOpus) {
+		do {
+			counter = pdi.next8();
+			pdi.skip(counter & 0x7f);
+		} while ((counter & 0x80) && pdi.isValid());
+	} else {
+		int size;
+		pdi >> size;
+		pdi.skip(size & 0x1fff);
+	}
+
+	// Save location of the positional audio data.
+	iPosLength = pdi.left();
+
+	// Append session id to the new output stream.
+	pds << self->uiSession;
+	// Copy all voice and positional audio data to the output stream.
+	pds.append(data + 1, len - 1);
+
+	iLength = pds.size() + 1;
+}
+
+/* Queues ep for the next send(), with the positional data if it shares the
+ * speaker's context. Deaf users and the speaker are skipped.
+ */
+void VoiceRouter::add(VoiceEndpoint *ep) {
+	if ((! ep->bDeaf) && (ep != veSelf)) {
+		if ((iPosLength > 0) && ep->sameContext(veSelf))
+			qvlPositional.append(ep);
+		else
+			qvlPlain.append(ep);
+	}
+}
+
+// Queues everyone in channel, from the routing table.
+void VoiceRouter::addListeners(const RoutingTable *rt, int channel) {
+	QHash<int, QVector<VoiceEndpoint *> >::const_iterator it = rt->qhListeners.constFind(channel);
+	if (it != rt->qhListeners.constEnd()) {
+		const QVector<VoiceEndpoint *> &listeners = it.value();
+		for (int i=0;i<listeners.count();++i)
+			add(listeners.at(i));
+	}
+}
+
+// Sends the packet to everyone queued, flagged with target (0 for normal
+// speech, 1 for a channel whisper, 2 for a direct one).
+void VoiceRouter::send(VoiceSink *sink, unsigned int target) {
+	cBuffer[0] = static_cast<char>(uiType | target);
+	fanOut(sink, qvlPositional.constData(), qvlPositional.count(), cBuffer, iLength);
+	fanOut(sink, qvlPlain.constData(), qvlPlain.count(), cBuffer, iLength - iPosLength);
+	qvlPositional.clear();
+	qvlPlain.clear();
+}
+
+// Sends the packet back to the speaker.
+void VoiceRouter::loopback(VoiceSink *sink) {
+	cBuffer[0] = static_cast<char>(uiType | 0);
+	fanOut(sink, &veSelf, 1, cBuffer, iLength);
+}
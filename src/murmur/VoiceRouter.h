@@ -0,0 +1,186 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MURMUR_VOICEROUTER_H_
+#define MUMBLE_MURMUR_VOICEROUTER_H_
+
+#include <string>
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QPair>
+#include <QtCore/QSet>
+#include <QtCore/QVarLengthArray>
+#include <QtCore/QVector>
+
+#ifdef Q_OS_UNIX
+#include <sys/socket.h>
+#include <netinet/in.h>
+#else
+#include <winsock2.h>
+#endif
+
+#include "CryptState.h"
+#include "Net.h"
+
+#define UDP_PACKET_SIZE 1024
+
+#ifdef Q_OS_LINUX
+// Room for one IP_PKTINFO or IPV6_PKTINFO control message.
+#define UDP_CONTROL_SIZE CMSG_SPACE(sizeof(struct in6_pktinfo))
+#endif
+
+class BandwidthRecord;
+class ServerUser;
+class VoiceTrace;
+
+// The part of a user every voice packet sent to it touches. These are kept
+// in cache line aligned slots owned by the Server, apart from the rest of
+// ServerUser, so fan-out to a large channel only walks this data.
+struct VoiceEndpoint {
+	ServerUser *u;
+	unsigned int uiSession;
+	// Hash of *psContext, so only matching contexts compare the strings.
+	uint uiContext;
+	const std::string *psContext;
+	// Deafened or self-deafened.
+	bool bDeaf;
+	bool bUdp;
+	// 1 once the address below has been set. Stored with release
+	// semantics after the address, so a voice thread that sees it set also
+	// sees a complete address.
+	QAtomicInt qaiUdpAddress;
+	// The address, written and read under qmCrypt, as it changes when
+	// the client's address does while other voice threads send to it.
+#ifdef Q_OS_UNIX
+	int sUdpSocket;
+#else
+	SOCKET sUdpSocket;
+#endif
+	int iUdpAddressLen;
+#ifdef Q_OS_LINUX
+	// 0 if no reply can be sent from the address the client connected to.
+	size_t szUdpControl;
+	unsigned char acUdpControl[UDP_CONTROL_SIZE];
+#endif
+	struct sockaddr_storage saiUdpAddress;
+	// Serializes csCrypt and the address between the voice threads and the
+	// main thread.
+	QMutex qmCrypt;
+	CryptState csCrypt;
+
+	VoiceEndpoint(ServerUser *user, const std::string *context);
+	bool sameContext(const VoiceEndpoint *other) const;
+	bool hasUdpAddress() const;
+};
+
+inline bool VoiceEndpoint::sameContext(const VoiceEndpoint *other) const {
+	return (uiContext == other->uiContext) && (*psContext == *other->psContext);
+}
+
+inline bool VoiceEndpoint::hasUdpAddress() const {
+#if QT_VERSION >= 0x050000
+	return qaiUdpAddress.loadAcquire() != 0;
+#else
+	return const_cast<QAtomicInt &>(qaiUdpAddress).fetchAndAddAcquire(0) != 0;
+#endif
+}
+
+// An immutable copy of the state the voice threads need to route a packet.
+// A new table is built and published whenever users connect, disconnect or
+// move, so the voice threads never have to take qrwlUsers for the common
+// case. Old tables (and the users removed with them) are only freed once no
+// voice thread can still be looking at them.
+struct RoutingTable {
+	// Epoch in which this table was replaced; 0 while it is current.
+	int iEpoch;
+	QHash<unsigned int, ServerUser *> qhUsers;
+	QHash<QPair<HostAddress, quint16>, ServerUser *> qhPeerUsers;
+	QHash<HostAddress, QSet<ServerUser *> > qhHostUsers;
+	// Channel of each session.
+	QHash<unsigned int, int> qhUserChannel;
+	QHash<int, QVector<VoiceEndpoint *> > qhListeners;
+	QSet<int> qsLinked;
+	// Users disconnected just before this table was replaced.
+	QList<ServerUser *> qlRemoved;
+	// Trace voice is recorded to, and the one to close with this table
+	// because the trace was changed while it was current.
+	VoiceTrace *vtTrace;
+	VoiceTrace *vtClose;
+
+	RoutingTable() : iEpoch(0), vtTrace(NULL), vtClose(NULL) {}
+};
+
+// Where VoiceRouter delivers packets: encrypted over UDP, or tunnelled
+// over the user's TCP connection.
+class VoiceSink {
+	public:
+		virtual ~VoiceSink() {}
+		// buffer has room for len + 4 bytes of ciphertext.
+		virtual void datagram(VoiceEndpoint *ep, const char *data, int len, char *buffer) = 0;
+		// cache holds the UDPTunnel message once tunnelMessage() built it.
+		virtual void tunnel(VoiceEndpoint *ep, const char *data, int len, QByteArray &cache) = 0;
+};
+
+/* Routes one voice packet: rewrites it as sent to the listeners, collects
+ * the recipients and hands them to a VoiceSink. Resolving who hears a link
+ * or whisper target is left to the caller, which adds those recipients
+ * with add(). Shared by Server::processMsg() and src/tests/VoiceReplay, so
+ * the benchmark measures the code murmur runs.
+ */
+class VoiceRouter {
+	private:
+		Q_DISABLE_COPY(VoiceRouter)
+	public:
+		VoiceEndpoint *veSelf;
+		unsigned int uiType;
+		unsigned int uiTarget;
+		// Length of the rewritten packet in cBuffer, and of the
+		// positional data at its end.
+		int iLength;
+		int iPosLength;
+		char cBuffer[UDP_PACKET_SIZE];
+		QVarLengthArray<VoiceEndpoint *, 64> qvlPositional, qvlPlain;
+
+		static bool admit(BandwidthRecord *bw, int len, int maxbandwidth, quint64 now);
+		static void fanOut(VoiceSink *sink, VoiceEndpoint * const *recipients, int count, const char *data, int len);
+		static void tunnelMessage(QByteArray &cache, const char *data, int len);
+
+		VoiceRouter(VoiceEndpoint *self, const char *data, int len);
+		void add(VoiceEndpoint *ep);
+		void addListeners(const RoutingTable *rt, int channel);
+		void send(VoiceSink *sink, unsigned int target);
+		void loopback(VoiceSink *sink);
+};
+
+#endif
@@ -0,0 +1,252 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "murmur_pch.h"
+
+#include "VoiceTrace.h"
+
+#include "PacketDataStream.h"
+
+const char VoiceTrace::cMagic[8] = { 'M', 'V', 'T', 'R', 'A', 'C', 'E', 1 };
+
+// Creates fname; a file that is already there is left alone.
+VoiceTrace::VoiceTrace(const QString &fname) : qfFile(fname) {
+	bStarted = false;
+	uiLast = 0;
+	uiDropped = 0;
+
+#if QT_VERSION >= 0x050B00
+	const bool ok = qfFile.open(QIODevice::WriteOnly | QIODevice::NewOnly);
+#else
+	// Not atomic like NewOnly, but nothing else creates files in the
+	// trace directory.
+	const bool ok = ! qfFile.exists() && qfFile.open(QIODevice::WriteOnly);
+#endif
+	if (ok) {
+		qfFile.write(cMagic, sizeof(cMagic));
+		connect(&qtFlush, SIGNAL(timeout()), this, SLOT(flush()));
+		qtFlush.start(1000);
+	}
+}
+
+VoiceTrace::~VoiceTrace() {
+	flush();
+}
+
+bool VoiceTrace::isOpen() const {
+	return qfFile.isOpen();
+}
+
+QString VoiceTrace::errorString() const {
+	if (! qfFile.isOpen() && qfFile.exists())
+		return QLatin1String("File exists");
+	return qfFile.errorString();
+}
+
+quint64 VoiceTrace::dropped() {
+	QMutexLocker l(&qmBuffer);
+	return uiDropped;
+}
+
+void VoiceTrace::append(int kind, quint64 now, const char *body, int len) {
+	char head[16];
+	char delta[16];
+
+	QMutexLocker l(&qmBuffer);
+
+	if (qbaBuffer.size() > iMaxBuffer) {
+		++uiDropped;
+		return;
+	}
+
+	// Records are ordered by when they got here, which voice threads that
+	// read the clock earlier can beat.
+	if (! bStarted) {
+		bStarted = true;
+		uiLast = now;
+	}
+	const quint64 dt = (now > uiLast) ? now - uiLast : 0;
+	uiLast = qMax(uiLast, now);
+
+	PacketDataStream dpds(delta, sizeof(delta));
+	dpds << dt;
+
+	PacketDataStream hpds(head, sizeof(head));
+	hpds << static_cast<unsigned int>(1 + dpds.size() + len);
+	hpds.append(static_cast<quint64>(kind));
+
+	qbaBuffer.append(head, hpds.size());
+	qbaBuffer.append(delta, dpds.size());
+	qbaBuffer.append(body, len);
+}
+
+void VoiceTrace::addVoice(quint64 now, unsigned int session, unsigned int header, int len, int poslen, const unsigned int *linked, int nlinked, const unsigned int *direct, int ndirect) {
+	QVarLengthArray<char, 512> body(32 + 5 * (nlinked + ndirect));
+	PacketDataStream pds(body.data(), body.size());
+
+	pds << session << header << len << poslen;
+	pds << nlinked;
+	for (int i=0;i<nlinked;++i)
+		pds << linked[i];
+	pds << ndirect;
+	for (int i=0;i<ndirect;++i)
+		pds << direct[i];
+
+	append(Voice, now, body.constData(), pds.size());
+}
+
+static void appendUser(QByteArray &out, const VoiceTrace::User &user) {
+	char buffer[16];
+	PacketDataStream pds(buffer, sizeof(buffer));
+	pds << user.uiSession << user.uiFlags << user.uiContext;
+	out.append(buffer, pds.size());
+}
+
+static void appendNumber(QByteArray &out, quint64 value) {
+	char buffer[10];
+	PacketDataStream pds(buffer, sizeof(buffer));
+	pds << value;
+	out.append(buffer, pds.size());
+}
+
+void VoiceTrace::addRoutes(quint64 now, const QHash<int, QVector<User> > &channels) {
+	QByteArray body;
+
+	appendNumber(body, channels.count());
+	QHash<int, QVector<User> >::const_iterator i;
+	for (i = channels.constBegin(); i != channels.constEnd(); ++i) {
+		appendNumber(body, static_cast<quint64>(i.key()));
+		appendNumber(body, i.value().count());
+		foreach(const User &user, i.value())
+			appendUser(body, user);
+	}
+
+	append(Routes, now, body.constData(), body.size());
+}
+
+void VoiceTrace::addEndpoint(quint64 now, const User &user) {
+	QByteArray body;
+	appendUser(body, user);
+	append(Endpoint, now, body.constData(), body.size());
+}
+
+void VoiceTrace::flush() {
+	QByteArray qba;
+	{
+		QMutexLocker l(&qmBuffer);
+		qSwap(qba, qbaBuffer);
+	}
+	if (! qba.isEmpty() && qfFile.isOpen()) {
+		qfFile.write(qba);
+		qfFile.flush();
+	}
+}
+
+VoiceTraceReader::VoiceTraceReader(const QString &fname) {
+	QFile f(fname);
+	bValid = f.open(QIODevice::ReadOnly);
+	if (bValid)
+		qbaData = f.readAll();
+	bValid = bValid && qbaData.startsWith(QByteArray(VoiceTrace::cMagic, sizeof(VoiceTrace::cMagic)));
+	rewind();
+}
+
+bool VoiceTraceReader::isValid() const {
+	return bValid;
+}
+
+void VoiceTraceReader::rewind() {
+	iOffset = sizeof(VoiceTrace::cMagic);
+	uiTime = 0;
+}
+
+static VoiceTrace::User readUser(PacketDataStream &pds) {
+	VoiceTrace::User user;
+	pds >> user.uiSession >> user.uiFlags >> user.uiContext;
+	return user;
+}
+
+// False at the end of the trace, or where it was cut off.
+bool VoiceTraceReader::next(VoiceTraceRecord &r) {
+	if (! bValid || (iOffset >= qbaData.size()))
+		return false;
+
+	PacketDataStream hpds(qbaData.constData() + iOffset, qbaData.size() - iOffset);
+	unsigned int len;
+	hpds >> len;
+	if (! hpds.isValid() || (hpds.left() < len) || (len == 0))
+		return false;
+
+	PacketDataStream pds(hpds.charPtr(), len);
+	iOffset += hpds.size() + len;
+
+	quint64 dt;
+	r.iKind = pds.next8();
+	pds >> dt;
+	uiTime += dt;
+	r.uiTime = uiTime;
+
+	switch (r.iKind) {
+		case VoiceTrace::Voice: {
+				int count;
+				pds >> r.uUser.uiSession >> r.uiHeader >> r.iLength >> r.iPosLength;
+				pds >> count;
+				r.qvLinked.resize(qMax(0, qMin(count, static_cast<int>(pds.left()))));
+				for (int i=0;i<r.qvLinked.count();++i)
+					pds >> r.qvLinked[i];
+				pds >> count;
+				r.qvDirect.resize(qMax(0, qMin(count, static_cast<int>(pds.left()))));
+				for (int i=0;i<r.qvDirect.count();++i)
+					pds >> r.qvDirect[i];
+				break;
+			}
+		case VoiceTrace::Routes: {
+				int channels;
+				pds >> channels;
+				r.qhChannels.clear();
+				for (int c=0;(c<channels) && pds.isValid();++c) {
+					int id, count;
+					pds >> id >> count;
+					QVector<VoiceTrace::User> &users = r.qhChannels[id];
+					for (int i=0;(i<count) && pds.isValid();++i)
+						users << readUser(pds);
+				}
+				break;
+			}
+		case VoiceTrace::Endpoint:
+			r.uUser = readUser(pds);
+			break;
+		default:
+			// From a newer murmur; skip it.
+			break;
+	}
+
+	return pds.isValid();
+}
@@ -0,0 +1,150 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MURMUR_VOICETRACE_H_
+#define MUMBLE_MURMUR_VOICETRACE_H_
+
+#include <QtCore/QByteArray>
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QObject>
+#include <QtCore/QTimer>
+#include <QtCore/QVarLengthArray>
+#include <QtCore/QVector>
+
+/* A capture of what the voice router saw, to replay a server's real
+ * traffic offline with src/tests/VoiceReplay. The file starts with the 8
+ * bytes "MVTRACE\1". Each record is its length and a body of the kind, the
+ * microseconds since the previous record, and then:
+ *
+ * Voice:    session, header byte (type and target), length, length of
+ *           the positional data, and two lists of sessions: those the
+ *           packet went to besides the speaker's channel (linked channels,
+ *           or a whisper's channel targets) and those whispered to
+ *           directly.
+ * Routes:   the members of every channel of a new routing table, as a
+ *           count of channels and for each its id and list of users.
+ * Endpoint: one user whose deafness or context changed.
+ *
+ * Users are a session, flags and the hash of their positional context.
+ * Numbers and lists (a count, then the items) are PacketDataStream
+ * varints. Payloads are not recorded.
+ */
+class VoiceTrace : public QObject {
+	private:
+		Q_OBJECT
+		Q_DISABLE_COPY(VoiceTrace)
+	public:
+		enum Kind { Voice = 1, Routes = 2, Endpoint = 3 };
+		enum Flags { UserDeaf = 0x1, UserUdp = 0x2 };
+
+		struct User {
+			unsigned int uiSession;
+			unsigned int uiFlags;
+			uint uiContext;
+		};
+
+		// Beyond this much waiting to be written, records are dropped.
+		static const int iMaxBuffer = 16 * 1024 * 1024;
+		static const char cMagic[8];
+	protected:
+		QFile qfFile;
+		QTimer qtFlush;
+		QMutex qmBuffer;
+		QByteArray qbaBuffer;
+		bool bStarted;
+		quint64 uiLast;
+		quint64 uiDropped;
+		void append(int kind, quint64 now, const char *body, int len);
+	public:
+		VoiceTrace(const QString &fname);
+		~VoiceTrace();
+		bool isOpen() const;
+		QString errorString() const;
+		quint64 dropped();
+
+		// Safe to call from any thread.
+		void addVoice(quint64 now, unsigned int session, unsigned int header, int len, int poslen, const unsigned int *linked, int nlinked, const unsigned int *direct, int ndirect);
+		void addRoutes(quint64 now, const QHash<int, QVector<User> > &channels);
+		void addEndpoint(quint64 now, const User &user);
+	public slots:
+		// Writes out what was recorded so far; main thread only.
+		void flush();
+};
+
+/* Collects the recipients of one voice packet in Server::processMsg() and
+ * records it when leaving scope, whichever way that is. Does nothing
+ * without a trace.
+ */
+class TracePacket {
+	private:
+		Q_DISABLE_COPY(TracePacket)
+	public:
+		VoiceTrace *vtTrace;
+		quint64 uiNow;
+		unsigned int uiSession;
+		unsigned int uiHeader;
+		int iLength, iPosLength;
+		QVarLengthArray<unsigned int, 32> qvlLinked, qvlDirect;
+
+		TracePacket(VoiceTrace *vt, quint64 now, unsigned int session, const char *data, int len) : vtTrace(vt), uiNow(now), uiSession(session), uiHeader(static_cast<unsigned char>(data[0])), iLength(len), iPosLength(0) {}
+		~TracePacket() {
+			if (vtTrace)
+				vtTrace->addVoice(uiNow, uiSession, uiHeader, iLength, iPosLength, qvlLinked.constData(), qvlLinked.count(), qvlDirect.constData(), qvlDirect.count());
+		}
+};
+
+struct VoiceTraceRecord {
+	int iKind;
+	// Microseconds since the first record.
+	quint64 uiTime;
+	VoiceTrace::User uUser;
+	unsigned int uiHeader;
+	int iLength, iPosLength;
+	QVector<unsigned int> qvLinked, qvDirect;
+	QHash<int, QVector<VoiceTrace::User> > qhChannels;
+};
+
+// Reads a whole trace into memory and walks its records.
+class VoiceTraceReader {
+	protected:
+		QByteArray qbaData;
+		int iOffset;
+		quint64 uiTime;
+		bool bValid;
+	public:
+		VoiceTraceReader(const QString &fname);
+		bool isValid() const;
+		bool next(VoiceTraceRecord &r);
+		void rewind();
+};
+
+#endif
@@ -37,6 +37,7 @@
 #include "Server.h"
 #include "ServerDB.h"
 #include "DBus.h"
+#include "LogWriter.h"
 #include "Meta.h"
 #include "Version.h"
 #include "SSL.h"
@@ -46,6 +47,7 @@
 #endif
 
 QFile *qfLog = NULL;
+LogWriter *lwLog = NULL;
 
 static bool bVerbose = false;
 #ifdef QT_NO_DEBUG
@@ -80,9 +82,26 @@ static void murmurMessageOutputQString(QtMsgType type, const QString &msg) {
 		default:
 			c='X';
 	}
-	QString m= QString::fromLatin1("<%1>%2 %3").arg(QChar::fromLatin1(c)).arg(QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss.zzz")).arg(msg);
 
-	if (! qfLog || ! qfLog->isOpen()) {
+	// The LogWriter's own messages can't go through it: it would wait on
+	// itself for room in a full ring, or for a fatal message to be flushed.
+	LogWriter *lw = lwLog;
+	if (lw && (QThread::currentThread() == lw))
+		lw = NULL;
+
+	if (lw) {
+		lw->add(c, msg);
+		if (type != QtFatalMsg)
+			return;
+		// Make sure it is written before we exit.
+		lw->flush();
+	}
+
+	QString m = LogWriter::format(c, QDateTime::currentMSecsSinceEpoch(), msg);
+
+	if (lw) {
+		// Already written and passed on by the LogWriter.
+	} else if (! qfLog || ! qfLog->isOpen()) {
 #ifdef Q_OS_UNIX
 		if (! detach)
 			fprintf(stderr, "%s\n", qPrintable(m));
@@ -106,7 +125,8 @@ static void murmurMessageOutputQString(QtMsgType type, const QString &msg) {
 		qfLog->write("\n");
 		qfLog->flush();
 	}
-	le.addLogEntry(m);
+	if (! lw)
+		le.addLogEntry(m);
 	if (type == QtFatalMsg) {
 #ifdef Q_OS_UNIX
 		if (detach) {
@@ -329,6 +349,16 @@ int main(int argc, char **argv) {
 				qFatal("can't change log file owner to %d %d:%d - %s", qfLog->handle(), Meta::mp.uiUid, Meta::mp.uiGid, strerror(errno));
 			}
 #endif
+			if (Meta::mp.iLogQueue > 0) {
+				foreach(const QString &e, qlErrors) {
+					qfLog->write(e.toUtf8());
+					qfLog->write("\n");
+				}
+				qlErrors.clear();
+
+				lwLog = new LogWriter(qfLog, &le, Meta::mp.iLogQueue, Meta::mp.bLogQueueDrop);
+				lwLog->start();
+			}
 		}
 	} else {
 		detach = false;
@@ -487,11 +517,21 @@ int main(int argc, char **argv) {
 	IceStop();
 #endif
 
+	delete meta;
+
+	// The network threads are gone with meta; the DB writer is the last
+	// thread besides this one that may log.
+	ServerDB::stopWriter();
+
+	if (lwLog) {
+		LogWriter *lw = lwLog;
+		lwLog = NULL;
+		delete lw;
+	}
+
 	delete qfLog;
 	qfLog = NULL;
 
-	delete meta;
-
 #if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
 	qInstallMessageHandler(NULL);
 #else
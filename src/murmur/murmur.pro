@@ -16,8 +16,8 @@ TARGET = murmur
 DBFILE  = murmur.db
 LANGUAGE	= C++
 FORMS =
-HEADERS *= Server.h ServerUser.h Meta.h
-SOURCES *= main.cpp Server.cpp ServerUser.cpp ServerDB.cpp Register.cpp Cert.cpp Messages.cpp Meta.cpp RPC.cpp
+HEADERS *= Server.h ServerUser.h BandwidthRecord.h ACLEngine.h BanIndex.h FloodLimiter.h BlobCache.h TextFilter.h JoinSnapshot.h LogWriter.h Metrics.h VoiceRouter.h VoiceTrace.h Meta.h NetworkThread.h DBWriter.h
+SOURCES *= main.cpp Server.cpp ServerUser.cpp BandwidthRecord.cpp ACLEngine.cpp BanIndex.cpp FloodLimiter.cpp BlobCache.cpp TextFilter.cpp JoinSnapshot.cpp LogWriter.cpp Metrics.cpp VoiceRouter.cpp VoiceTrace.cpp NetworkThread.cpp ServerDB.cpp DBWriter.cpp Register.cpp Cert.cpp Messages.cpp Meta.cpp RPC.cpp
 
 DIST = DBus.h ServerDB.h ../../icons/murmur.ico Murmur.ice MurmurI.h MurmurIceWrapper.cpp murmur.plist
 PRECOMPILED_HEADER = murmur_pch.h
@@ -50,6 +50,9 @@ win32 {
 unix {
   contains(UNAME, Linux) {
     LIBS *= -lcap
+    !CONFIG(no-mmsg) {
+      DEFINES *= USE_MMSG
+    }
   }
 
   HEADERS *= UnixMurmur.h
@@ -0,0 +1,179 @@
+/**
+ * Benchmark of the ban check Server::newClient() does for each accepted
+ * connection, with 100k bans. Compares the old path (copy the list, drop
+ * expired bans, then HostAddress::match() against every ban) with a
+ * BanIndex lookup. A quarter of the connections come from banned ranges,
+ * another quarter from ranges whose ban has already expired.
+ *
+ * Before timing, it checks that both give the same answer for each of the
+ * first CHECK_CONNECTS connections, and that BanIndex::expire() hands back
+ * exactly the bans that ran out.
+ */
+
+#include <QtCore>
+
+#include "BanIndex.h"
+#include "Timer.h"
+
+#define BANS 100000
+#define OLD_CONNECTS 100
+#define CHECK_CONNECTS 1000
+#define CONNECTS 200000
+
+static HostAddress randomV4(quint32 ip) {
+	HostAddress ha;
+	ha.shorts[5] = 0xffff;
+	ha.hash[3] = qToBigEndian(ip);
+	return ha;
+}
+
+static quint32 random32() {
+	return (static_cast<quint32>(qrand()) << 16) ^ static_cast<quint32>(qrand());
+}
+
+static HostAddress randomAddress() {
+	if ((qrand() % 4) != 0)
+		return randomV4(random32());
+
+	HostAddress ha;
+	for (int i=0;i<4;++i)
+		ha.hash[i] = random32();
+	ha.shorts[0] = qToBigEndian<quint16>(0x2001);
+	return ha;
+}
+
+// The old check without dropping expired bans from the list.
+static bool refCheck(const QList<Ban> &bans, const HostAddress &ha) {
+	foreach(const Ban &ban, bans) {
+		if (! ban.isExpired() && ban.haAddress.match(ha, ban.iMask))
+			return true;
+	}
+	return false;
+}
+
+static HostAddress fromBan(const Ban &b) {
+	HostAddress ha = b.haAddress;
+	const int host = 128 - qMax(b.iMask, 96);
+	if (host > 0)
+		ha.hash[3] ^= qToBigEndian<quint32>(random32() & ((host == 32) ? 0xffffffffU : ((1U << host) - 1)));
+	return ha;
+}
+
+static bool oldCheck(QList<Ban> &bans, const HostAddress &ha) {
+	QList<Ban> tmpBans = bans;
+	foreach(const Ban &ban, bans) {
+		if (ban.isExpired())
+			tmpBans.removeOne(ban);
+	}
+	if (bans.count() != tmpBans.count())
+		bans = tmpBans;
+
+	foreach(const Ban &ban, bans) {
+		if (ban.haAddress.match(ha, ban.iMask))
+			return true;
+	}
+	return false;
+}
+
+int main(int argc, char **argv) {
+	QCoreApplication a(argc, argv);
+
+	qsrand(1);
+
+	const QDateTime now = QDateTime::currentDateTime().toUTC();
+	QList<Ban> bans;
+	QList<int> expired;
+	int timed = 0;
+	for (int i=0;i<BANS;++i) {
+		Ban b;
+		const int kind = qrand() % 4;
+		b.haAddress = randomAddress();
+		if (b.haAddress.isV6())
+			b.iMask = (kind == 0) ? 48 : 128;
+		else
+			b.iMask = (kind == 0) ? 96 + 16 : ((kind == 1) ? 96 + 24 : 128);
+		b.haAddress = BanIndex::masked(b.haAddress, b.iMask);
+		b.qsReason = QLatin1String("Benchmark");
+		b.qdtStart = now;
+		b.iDuration = (kind == 3) ? 0 : 3600 + (qrand() % 86400);
+		// One in eight ran out an hour ago.
+		if ((qrand() % 8) == 0) {
+			b.qdtStart = now.addSecs(-7200);
+			b.iDuration = 3600;
+			expired << i;
+		} else if (b.iDuration) {
+			++timed;
+		}
+		bans << b;
+	}
+
+	QVector<HostAddress> clients;
+	for (int i=0;i<CONNECTS;++i) {
+		if ((i % 4) == 0)
+			clients << fromBan(bans.at(qrand() % BANS));
+		else if ((i % 4) == 1)
+			clients << fromBan(bans.at(expired.at(qrand() % expired.count())));
+		else
+			clients << randomAddress();
+	}
+
+	Timer t;
+	BanIndex bi;
+	bi.rebuild(bans, now.toTime_t());
+	const quint64 build = t.restart();
+
+	const quint32 secs = QDateTime::currentDateTime().toUTC().toTime_t();
+
+	int refhits = 0;
+	for (int i=0;i<CHECK_CONNECTS;++i) {
+		const HostAddress &ha = clients.at(i);
+		const bool ref = refCheck(bans, ha);
+		const int ban = bi.match(ha, secs);
+		if (ref != (ban >= 0))
+			qFatal("Connection %d: BanIndex says %s, the old check %s", i, (ban >= 0) ? "banned" : "not banned", ref ? "banned" : "not banned");
+		if (ban >= 0) {
+			const Ban &b = bans.at(ban);
+			if (b.isExpired() || ! b.haAddress.match(ha, b.iMask))
+				qFatal("Connection %d: BanIndex returned ban %d, which doesn't apply", i, ban);
+			++refhits;
+		}
+	}
+	if ((refhits == 0) || (refhits == CHECK_CONNECTS))
+		qFatal("%d of %d checked connections banned; the sample is useless", refhits, CHECK_CONNECTS);
+
+	// Bans already expired at rebuild() come out of the next expire(),
+	// the rest once their time is up, and no ban comes out twice.
+	QList<int> out = bi.expire(secs);
+	qSort(out);
+	if (out != expired)
+		qFatal("expire() returned %d bans, %d had expired", out.count(), expired.count());
+	if (! bi.expire(secs).isEmpty())
+		qFatal("expire() returned the same bans twice");
+	for (int i=0;i<CHECK_CONNECTS;++i) {
+		const int ban = bi.match(clients.at(i), secs + 2 * 86400);
+		if ((ban >= 0) && (bans.at(ban).iDuration != 0))
+			qFatal("Connection %d: matched ban %d after it ran out", i, ban);
+	}
+	out = bi.expire(secs + 2 * 86400);
+	if (out.count() != timed)
+		qFatal("expire() returned %d bans two days later, %d were left with a duration", out.count(), timed);
+
+	bi.rebuild(bans, now.toTime_t());
+	t.restart();
+
+	QList<Ban> oldbans = bans;
+	int oldhits = 0, hits = 0;
+	for (int i=0;i<OLD_CONNECTS;++i)
+		if (oldCheck(oldbans, clients.at(i)))
+			++oldhits;
+	const quint64 old = t.restart();
+
+	for (int i=0;i<CONNECTS;++i)
+		if (bi.match(clients.at(i), secs) >= 0)
+			++hits;
+	const quint64 trie = t.restart();
+
+	qWarning("%d bans (%d expired), index built in %.1f msec", BANS, expired.count(), static_cast<double>(build) / 1000.0);
+	qWarning("Old check: %8.0f connections/sec (%d of %d banned)", static_cast<double>(OLD_CONNECTS) * 1000000.0 / static_cast<double>(old), oldhits, OLD_CONNECTS);
+	qWarning("BanIndex:  %8.0f connections/sec (%d of %d banned)", static_cast<double>(CONNECTS) * 1000000.0 / static_cast<double>(trie), hits, CONNECTS);
+}
@@ -0,0 +1,10 @@
+TEMPLATE = app
+CONFIG += qt thread warn_on release
+CONFIG -= app_bundle
+QT *= network
+LANGUAGE = C++
+TARGET = BanMatch
+HEADERS = BanIndex.h Net.h Timer.h
+SOURCES = BanMatch.cpp BanIndex.cpp Net.cpp Timer.cpp
+VPATH += .. ../murmur
+INCLUDEPATH += .. ../murmur ../mumble
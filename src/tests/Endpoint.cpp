@@ -0,0 +1,172 @@
+/**
+ * Benchmark of the memory cost of voice fan-out to a channel of 10, 100 and
+ * 500 listeners. Routes a packet with positional data through
+ * VoiceRouter::add() and send() to VoiceEndpoints kept in cache line
+ * aligned slots, as Server::allocEndpoint() does, and to the same
+ * endpoints allocated one by one in between the rest of a user's state,
+ * as when they were part of ServerUser. Passes rotate over enough
+ * channels that the recipients are not in cache, as with a busy server;
+ * the sink only reads what Server::queueDatagram() would, nothing is
+ * encrypted or sent.
+ */
+
+#include <QtCore>
+
+#include <string>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "BandwidthRecord.h"
+#include "Message.h"
+#include "PacketDataStream.h"
+#include "Timer.h"
+#include "VoiceRouter.h"
+
+#define USERS 16384
+#define ITER 20000
+
+class ReadSink : public VoiceSink {
+	public:
+		quint64 uiSum;
+
+		ReadSink() : uiSum(0) {}
+		void datagram(VoiceEndpoint *ep, const char *, int len, char *) {
+			uiSum += len + ep->iUdpAddressLen + ep->saiUdpAddress.ss_family + ep->sUdpSocket;
+#ifdef Q_OS_LINUX
+			uiSum += ep->szUdpControl + ep->acUdpControl[0];
+#endif
+		}
+		void tunnel(VoiceEndpoint *ep, const char *, int len, QByteArray &) {
+			uiSum += len + ep->uiSession;
+		}
+};
+
+class Fixture {
+	public:
+		int iCount;
+		std::string ssContextA, ssContextB;
+		char *pcSlots;
+		QList<VoiceEndpoint *> qlSpread;
+		QList<BandwidthRecord *> qlRecords;
+		QList<char *> qlNoise;
+		QVector<QVector<VoiceEndpoint *> > qvSlotted, qvSpread;
+		QByteArray qbaPacket;
+
+		Fixture(int count);
+		~Fixture();
+		static void setup(VoiceEndpoint *ep, unsigned int session, uint context);
+		quint64 run(const QVector<QVector<VoiceEndpoint *> > &channels, ReadSink *sink);
+};
+
+void Fixture::setup(VoiceEndpoint *ep, unsigned int session, uint context) {
+	ep->uiSession = session;
+	ep->uiContext = context;
+	ep->bDeaf = (session % 17) == 0;
+	ep->sUdpSocket = 3;
+	ep->saiUdpAddress.ss_family = AF_INET;
+	ep->iUdpAddressLen = 16;
+#ifdef Q_OS_LINUX
+	ep->szUdpControl = 32;
+#endif
+	ep->csCrypt.genKey();
+	ep->qaiUdpAddress.fetchAndStoreRelease(1);
+}
+
+Fixture::Fixture(int count) : iCount(count), ssContextA("Game\0Server-a", 13), ssContextB("Game\0Server-b", 13) {
+	qsrand(1);
+
+	const size_t size = (sizeof(VoiceEndpoint) + 63) & ~static_cast<size_t>(63);
+	pcSlots = reinterpret_cast<char *>(qMallocAligned(size * USERS, 64));
+
+	QList<VoiceEndpoint *> slotted;
+	for (int i=0;i<USERS;++i) {
+		const std::string *context = ((i % 3) == 0) ? &ssContextA : &ssContextB;
+		const uint hash = qHash(QByteArray::fromRawData(context->data(), static_cast<int>(context->size())));
+
+		VoiceEndpoint *ep = new(pcSlots + i * size) VoiceEndpoint(NULL, context);
+		setup(ep, i + 1, hash);
+		slotted << ep;
+
+		// Users connect over time, in between other allocations, and
+		// bring their bandwidth record and other cold state along.
+		ep = new VoiceEndpoint(NULL, context);
+		setup(ep, i + 1, hash);
+		qlSpread << ep;
+		qlRecords << new BandwidthRecord();
+		qlNoise << new char[qrand() % 4096 + 1];
+	}
+
+	// Channels of count users each, picked at random like a long running
+	// server would have them.
+	QList<int> order;
+	for (int i=0;i<USERS;++i)
+		order << i;
+	for (int i=USERS-1;i>0;--i)
+		order.swap(i, qrand() % (i + 1));
+
+	for (int c=0;c<USERS/count;++c) {
+		QVector<VoiceEndpoint *> a, b;
+		for (int i=0;i<count;++i) {
+			int idx = order.at(c * count + i);
+			a << slotted.at(idx);
+			b << qlSpread.at(idx);
+		}
+		qvSlotted << a;
+		qvSpread << b;
+	}
+
+	// An Opus frame followed by positional data.
+	qbaPacket.resize(128);
+	char *data = qbaPacket.data();
+	data[0] = static_cast<char>(MessageHandler::UDPVoiceOpus << 5);
+	PacketDataStream pds(data + 1, qbaPacket.size() - 1);
+	pds << 1;
+	pds << 40;
+	for (int i=0;i<40+12;++i)
+		pds << i;
+	qbaPacket.truncate(pds.size() + 1);
+}
+
+Fixture::~Fixture() {
+	const size_t size = (sizeof(VoiceEndpoint) + 63) & ~static_cast<size_t>(63);
+	for (int i=0;i<USERS;++i)
+		reinterpret_cast<VoiceEndpoint *>(pcSlots + i * size)->~VoiceEndpoint();
+	qFreeAligned(pcSlots);
+	qDeleteAll(qlSpread);
+	qDeleteAll(qlRecords);
+	foreach(char *p, qlNoise)
+		delete [] p;
+}
+
+quint64 Fixture::run(const QVector<QVector<VoiceEndpoint *> > &channels, ReadSink *sink) {
+	Timer t;
+	for (int n=0;n<ITER;++n) {
+		const QVector<VoiceEndpoint *> &listeners = channels.at(n % channels.count());
+		VoiceRouter vr(listeners.at(0), qbaPacket.constData(), qbaPacket.size());
+		for (int i=0;i<listeners.count();++i)
+			vr.add(listeners.at(i));
+		vr.send(sink, 0);
+	}
+	return t.elapsed();
+}
+
+int main(int argc, char **argv) {
+	QCoreApplication a(argc, argv);
+
+	int sizes[] = { 10, 100, 500 };
+	for (unsigned int i=0;i<sizeof(sizes)/sizeof(sizes[0]);++i) {
+		Fixture f(sizes[i]);
+		ReadSink spread, slotted;
+
+		quint64 before = f.run(f.qvSpread, &spread);
+		quint64 after = f.run(f.qvSlotted, &slotted);
+		double recipients = static_cast<double>(ITER) * sizes[i];
+
+		if (spread.uiSum != slotted.uiSum)
+			qFatal("Layouts routed differently");
+
+		qWarning("%3d listeners: spread %6.2f nsec, slots %6.2f nsec per recipient (%llu)", sizes[i],
+		         static_cast<double>(before) * 1000.0 / recipients, static_cast<double>(after) * 1000.0 / recipients,
+		         static_cast<unsigned long long>(slotted.uiSum));
+	}
+}
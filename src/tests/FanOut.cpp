@@ -0,0 +1,272 @@
+/**
+ * Benchmark of voice fan-out to a channel of 10, 100 and 500 listeners.
+ * Each packet goes through VoiceRouter, as in Server::processMsg(), to
+ * real VoiceEndpoints with prepared addresses. The sinks do what the
+ * Server's does with a datagram:
+ *   route     only count the recipients, leaving the routing itself
+ *   sendmsg   encrypt and send each datagram on its own, like
+ *             Server::sendDatagram()
+ *   sendmmsg  encrypt into a batch sent with one call per packet, like
+ *             Server::queueDatagram() on a voice thread
+ * All datagrams go to a local UDP socket nobody reads from.
+ */
+
+#include <QtCore>
+
+#include <string>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "CryptState.h"
+#include "Message.h"
+#include "PacketDataStream.h"
+#include "Timer.h"
+#include "VoiceRouter.h"
+
+#define ITER 2000
+#define FRAME_SIZE 60
+#define SLOT_SIZE (UDP_PACKET_SIZE + 4)
+
+class CountSink : public VoiceSink {
+	public:
+		quint64 uiDatagrams, uiTunnelled;
+
+		CountSink() : uiDatagrams(0), uiTunnelled(0) {}
+		void datagram(VoiceEndpoint *, const char *, int, char *) {
+			++uiDatagrams;
+		}
+		void tunnel(VoiceEndpoint *, const char *, int, QByteArray &) {
+			++uiTunnelled;
+		}
+};
+
+class SendSink : public CountSink {
+	public:
+		void datagram(VoiceEndpoint *ep, const char *data, int len, char *buffer);
+};
+
+void SendSink::datagram(VoiceEndpoint *ep, const char *data, int len, char *buffer) {
+	struct sockaddr_storage addr;
+	int addrlen;
+	int sock;
+#ifdef Q_OS_LINUX
+	unsigned char control[UDP_CONTROL_SIZE];
+	size_t controllen;
+#endif
+	{
+		QMutexLocker l(&ep->qmCrypt);
+#ifdef Q_OS_LINUX
+		controllen = ep->szUdpControl;
+		memcpy(control, ep->acUdpControl, controllen);
+#endif
+		sock = ep->sUdpSocket;
+		addrlen = ep->iUdpAddressLen;
+		memcpy(&addr, &ep->saiUdpAddress, addrlen);
+		ep->csCrypt.encrypt(reinterpret_cast<const unsigned char *>(data), reinterpret_cast<unsigned char *>(buffer), len);
+	}
+#ifdef Q_OS_LINUX
+	struct msghdr msg;
+	struct iovec iov[1];
+
+	iov[0].iov_base = buffer;
+	iov[0].iov_len = len + 4;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &addr;
+	msg.msg_namelen = addrlen;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = controllen;
+	::sendmsg(sock, &msg, 0);
+#else
+	::sendto(sock, buffer, len + 4, 0, reinterpret_cast<struct sockaddr *>(&addr), addrlen);
+#endif
+	++uiDatagrams;
+}
+
+#ifdef Q_OS_LINUX
+class BatchSink : public CountSink {
+	public:
+		int sock;
+		int iUsed;
+		QVector<char> qvData;
+		QVector<struct sockaddr_storage> qvAddr;
+		QVector<unsigned char> qvControl;
+		QVector<struct iovec> qvIov;
+		QVector<struct mmsghdr> qvMsg;
+
+		BatchSink(int sock, int size);
+		void datagram(VoiceEndpoint *ep, const char *data, int len, char *buffer);
+		void flush();
+};
+
+BatchSink::BatchSink(int s, int size) : sock(s), iUsed(0) {
+	qvData.resize(size * SLOT_SIZE);
+	qvAddr.resize(size);
+	qvControl.resize(size * UDP_CONTROL_SIZE);
+	qvIov.resize(size);
+	qvMsg.resize(size);
+	memset(qvMsg.data(), 0, sizeof(struct mmsghdr) * size);
+	for (int i=0;i<size;++i) {
+		struct msghdr *msg = &qvMsg[i].msg_hdr;
+		qvIov[i].iov_base = qvData.data() + i * SLOT_SIZE;
+		msg->msg_name = &qvAddr[i];
+		msg->msg_iov = &qvIov[i];
+		msg->msg_iovlen = 1;
+		msg->msg_control = qvControl.data() + i * UDP_CONTROL_SIZE;
+	}
+}
+
+void BatchSink::datagram(VoiceEndpoint *ep, const char *data, int len, char *) {
+	if (iUsed == qvMsg.count())
+		flush();
+
+	struct msghdr *msg = &qvMsg[iUsed].msg_hdr;
+	{
+		QMutexLocker l(&ep->qmCrypt);
+		memcpy(&qvAddr[iUsed], &ep->saiUdpAddress, ep->iUdpAddressLen);
+		msg->msg_namelen = ep->iUdpAddressLen;
+		memcpy(msg->msg_control, ep->acUdpControl, ep->szUdpControl);
+		msg->msg_controllen = ep->szUdpControl;
+		ep->csCrypt.encrypt(reinterpret_cast<const unsigned char *>(data), reinterpret_cast<unsigned char *>(qvIov[iUsed].iov_base), len);
+	}
+	qvIov[iUsed].iov_len = len + 4;
+	++iUsed;
+	++uiDatagrams;
+}
+
+void BatchSink::flush() {
+	int sent = 0;
+	while (sent < iUsed) {
+		int ret = ::sendmmsg(sock, qvMsg.data() + sent, iUsed - sent, 0);
+		if (ret <= 0)
+			break;
+		sent += ret;
+	}
+	iUsed = 0;
+}
+#endif
+
+class FanOut {
+	public:
+		std::string ssContext;
+		QList<VoiceEndpoint *> qlEndpoints;
+		VoiceEndpoint *veSpeaker;
+		RoutingTable rtRoutes;
+		QByteArray qbaPacket;
+
+		FanOut(int sock, const struct sockaddr_in &sink, int count);
+		~FanOut();
+		quint64 run(VoiceSink *sink, bool batch);
+};
+
+FanOut::FanOut(int sock, const struct sockaddr_in &sink, int count) {
+	QVector<VoiceEndpoint *> &listeners = rtRoutes.qhListeners[1];
+
+	for (int i=0;i<=count;++i) {
+		VoiceEndpoint *ep = new VoiceEndpoint(NULL, &ssContext);
+		ep->uiSession = i + 1;
+		ep->sUdpSocket = sock;
+		ep->csCrypt.genKey();
+		memcpy(&ep->saiUdpAddress, &sink, sizeof(sink));
+		ep->iUdpAddressLen = sizeof(struct sockaddr_in);
+#ifdef Q_OS_LINUX
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = ep->acUdpControl;
+		msg.msg_controllen = sizeof(ep->acUdpControl);
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = IPPROTO_IP;
+		cmsg->cmsg_type = IP_PKTINFO;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+		struct in_pktinfo *pktinfo = reinterpret_cast<struct in_pktinfo *>(CMSG_DATA(cmsg));
+		pktinfo->ipi_spec_dst.s_addr = htonl(INADDR_LOOPBACK);
+		ep->szUdpControl = CMSG_SPACE(sizeof(struct in_pktinfo));
+#endif
+		ep->qaiUdpAddress.fetchAndStoreRelease(1);
+		qlEndpoints << ep;
+		listeners << ep;
+		rtRoutes.qhUserChannel.insert(ep->uiSession, 1);
+	}
+	veSpeaker = qlEndpoints.first();
+
+	// An Opus frame to the speaker's channel, without positional data.
+	qbaPacket.resize(UDP_PACKET_SIZE);
+	char *data = qbaPacket.data();
+	data[0] = static_cast<char>(MessageHandler::UDPVoiceOpus << 5);
+	PacketDataStream pds(data + 1, qbaPacket.size() - 1);
+	pds << 1;
+	pds << FRAME_SIZE;
+	for (int i=0;i<FRAME_SIZE;++i)
+		pds << i;
+	qbaPacket.truncate(pds.size() + 1);
+}
+
+FanOut::~FanOut() {
+	qDeleteAll(qlEndpoints);
+}
+
+quint64 FanOut::run(VoiceSink *sink, bool batch) {
+	Timer t;
+	for (int n=0;n<ITER;++n) {
+		VoiceRouter vr(veSpeaker, qbaPacket.constData(), qbaPacket.size());
+		vr.addListeners(&rtRoutes, rtRoutes.qhUserChannel.value(veSpeaker->uiSession, -1));
+		vr.send(sink, 0);
+#ifdef Q_OS_LINUX
+		if (batch)
+			static_cast<BatchSink *>(sink)->flush();
+#else
+		Q_UNUSED(batch);
+#endif
+	}
+	return t.elapsed();
+}
+
+int main(int argc, char **argv) {
+	QCoreApplication a(argc, argv);
+
+	int sink = ::socket(AF_INET, SOCK_DGRAM, 0);
+	int sock = ::socket(AF_INET, SOCK_DGRAM, 0);
+	if ((sink < 0) || (sock < 0))
+		qFatal("Failed to create sockets");
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	socklen_t addrlen = sizeof(addr);
+	if ((::bind(sink, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0) || (getsockname(sink, reinterpret_cast<struct sockaddr *>(&addr), &addrlen) != 0))
+		qFatal("Failed to bind sink socket: %s", strerror(errno));
+
+	int sizes[] = { 10, 100, 500 };
+	for (unsigned int i=0;i<sizeof(sizes)/sizeof(sizes[0]);++i) {
+		FanOut fo(sock, addr, sizes[i]);
+
+		CountSink count;
+		quint64 route = fo.run(&count, false);
+		SendSink single;
+		quint64 sendmsg = fo.run(&single, false);
+		double recipients = static_cast<double>(qMax(count.uiDatagrams, Q_UINT64_C(1)));
+#ifdef Q_OS_LINUX
+		BatchSink batch(sock, 128);
+		quint64 sendmmsg = fo.run(&batch, true);
+		if ((single.uiDatagrams != count.uiDatagrams) || (batch.uiDatagrams != count.uiDatagrams))
+			qFatal("Sinks saw different recipients");
+#else
+		quint64 sendmmsg = sendmsg;
+#endif
+
+		qWarning("%3d listeners: route %6.3f usec, sendmsg %6.3f usec, sendmmsg %6.3f usec per recipient", sizes[i],
+		         static_cast<double>(route) / recipients, static_cast<double>(sendmsg) / recipients,
+		         static_cast<double>(sendmmsg) / recipients);
+	}
+
+	close(sock);
+	close(sink);
+}
@@ -0,0 +1,185 @@
+/**
+ * Benchmark of sending the channel tree and the user list to a joining
+ * client, with 3000 channels and 1500 users. Compares serialising and
+ * queueing one message at a time (the old msgAuthenticate() path) with
+ * appending cached frames into one blob that is queued once. Both use
+ * JoinSnapshot, which Server builds the snapshot with. Time spent
+ * on the main thread is what stalls everyone else; the total includes the
+ * network thread taking the writes, which goes to a buffer here instead of
+ * a TLS socket.
+ */
+
+#include <QtCore>
+
+#include "Channel.h"
+#include "JoinSnapshot.h"
+#include "Message.h"
+#include "Mumble.pb.h"
+#include "Timer.h"
+#include "User.h"
+
+#define CHANNELS 3000
+#define USERS 1500
+#define JOINS 20
+
+// Stands in for a SocketHandler in its network thread.
+class Sink : public QObject {
+		Q_OBJECT
+	public:
+		QSemaphore qsDone;
+		qint64 iBytes;
+		int iWrites;
+		Sink() : iBytes(0), iWrites(0) { }
+	public slots:
+		void write(const QByteArray &data) {
+			++iWrites;
+			iBytes += data.size();
+		}
+		void done() {
+			qsDone.release();
+		}
+};
+
+int main(int argc, char **argv) {
+	QCoreApplication a(argc, argv);
+
+	qsrand(1);
+
+	QVector<Channel *> channels(CHANNELS);
+	for (int i=0;i<CHANNELS;++i) {
+		Channel *c = new Channel(i, QString::fromLatin1("Channel number %1").arg(i));
+		c->iPosition = i % 10;
+		if ((i % 3) == 0)
+			c->qbaDescHash = sha1(c->qsName);
+		if (i != 0)
+			channels.at(qrand() % i)->addChannel(c);
+		channels[i] = c;
+	}
+	for (int i=1;i<CHANNELS;i+=50) {
+		channels.at(i)->link(channels.at((i + 1 + qrand() % (CHANNELS - 1)) % CHANNELS));
+		channels.at(i)->link(channels.at((i + 1 + qrand() % (CHANNELS - 1)) % CHANNELS));
+	}
+
+	QVector<User *> users(USERS);
+	for (int i=0;i<USERS;++i) {
+		User *u = new User();
+		u->uiSession = i + 1;
+		u->iId = (i % 2) ? i : -1;
+		u->cChannel = channels.at(qrand() % CHANNELS);
+		u->qsName = QString::fromLatin1("User %1").arg(i);
+		u->qsHash = QString::fromLatin1(sha1(u->qsName).toHex());
+		if ((i % 4) == 0)
+			u->qbaCommentHash = sha1(u->qsHash);
+		u->bSelfMute = (i % 7) == 0;
+		users[i] = u;
+	}
+
+	QThread thread;
+	Sink sink;
+	sink.moveToThread(&thread);
+	thread.start();
+
+	Timer t;
+	quint64 busy = 0, total = 0;
+
+	for (int n=0;n<JOINS;++n) {
+		t.restart();
+
+		QQueue<Channel *> q;
+		QList<Channel *> linked;
+		q << channels.at(0);
+		MumbleProto::ChannelState mpcs;
+		while (! q.isEmpty()) {
+			Channel *c = q.dequeue();
+			if (! c->qhLinks.isEmpty())
+				linked << c;
+
+			mpcs.Clear();
+			JoinSnapshot::channelState(c, QString(), true, mpcs);
+			QByteArray frame;
+			messageToNetwork(mpcs, MessageHandler::ChannelState, frame);
+			QMetaObject::invokeMethod(&sink, "write", Qt::QueuedConnection, Q_ARG(QByteArray, frame));
+
+			foreach(Channel *sub, c->qlChannels)
+				q.enqueue(sub);
+		}
+		foreach(Channel *c, linked) {
+			mpcs.Clear();
+			mpcs.set_channel_id(c->iId);
+			foreach(Channel *l, c->qhLinks.keys())
+				mpcs.add_links(l->iId);
+			QByteArray frame;
+			messageToNetwork(mpcs, MessageHandler::ChannelState, frame);
+			QMetaObject::invokeMethod(&sink, "write", Qt::QueuedConnection, Q_ARG(QByteArray, frame));
+		}
+
+		MumbleProto::UserState mpus;
+		foreach(const User *u, users) {
+			mpus.Clear();
+			JoinSnapshot::userState(u, true, false, mpus);
+			QByteArray frame;
+			messageToNetwork(mpus, MessageHandler::UserState, frame);
+			QMetaObject::invokeMethod(&sink, "write", Qt::QueuedConnection, Q_ARG(QByteArray, frame));
+		}
+		busy += t.elapsed();
+
+		QMetaObject::invokeMethod(&sink, "done", Qt::QueuedConnection);
+		sink.qsDone.acquire();
+		total += t.elapsed();
+	}
+
+	qWarning("Per message: %7.2f msec on the main thread, %7.2f msec in all, %d writes of %lld bytes per join",
+	         static_cast<double>(busy) / JOINS / 1000.0, static_cast<double>(total) / JOINS / 1000.0, sink.iWrites / JOINS, sink.iBytes / JOINS);
+
+	// Everything serialised once, as Server keeps it between joins.
+	JoinSnapshot js;
+	t.restart();
+	js.channels(channels.at(0), QString());
+	{
+		QByteArray others;
+		foreach(const User *u, users)
+			js.appendUser(u, others);
+	}
+	const quint64 build = t.elapsed();
+
+	sink.iWrites = 0;
+	sink.iBytes = 0;
+	busy = total = 0;
+
+	for (int n=0;n<JOINS;++n) {
+		// A channel and a user changed since the last join, which is
+		// the worst case: the channel snapshot has to be put together
+		// again.
+		MumbleProto::ChannelState mpcs;
+		mpcs.set_channel_id(qrand() % CHANNELS);
+		js.changed(mpcs, MessageHandler::ChannelState);
+		MumbleProto::UserState mpus;
+		mpus.set_session(1 + qrand() % USERS);
+		js.changed(mpus, MessageHandler::UserState);
+
+		t.restart();
+
+		QMetaObject::invokeMethod(&sink, "write", Qt::QueuedConnection, Q_ARG(QByteArray, js.channels(channels.at(0), QString())));
+
+		QByteArray others;
+		foreach(const User *u, users)
+			js.appendUser(u, others);
+		QMetaObject::invokeMethod(&sink, "write", Qt::QueuedConnection, Q_ARG(QByteArray, others));
+		busy += t.elapsed();
+
+		QMetaObject::invokeMethod(&sink, "done", Qt::QueuedConnection);
+		sink.qsDone.acquire();
+		total += t.elapsed();
+	}
+
+	qWarning("Snapshot:    %7.2f msec on the main thread, %7.2f msec in all, %d writes of %lld bytes per join (%.2f msec to serialise everything once)",
+	         static_cast<double>(busy) / JOINS / 1000.0, static_cast<double>(total) / JOINS / 1000.0, sink.iWrites / JOINS, sink.iBytes / JOINS, static_cast<double>(build) / 1000.0);
+
+	thread.quit();
+	thread.wait();
+
+	qDeleteAll(users);
+	delete channels.at(0);
+}
+
+#include "JoinSync.moc"
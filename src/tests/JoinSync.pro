@@ -0,0 +1,18 @@
+TEMPLATE = app
+CONFIG += qt thread warn_on release
+CONFIG -= app_bundle
+LANGUAGE = C++
+TARGET = JoinSync
+HEADERS = ACL.h Channel.h Group.h JoinSnapshot.h Message.h Timer.h User.h
+PROTOS = Mumble.proto
+SOURCES = JoinSync.cpp JoinSnapshot.cpp ACL.cpp Channel.cpp Group.cpp User.cpp Timer.cpp Mumble.pb.cc
+VPATH += .. ../murmur
+INCLUDEPATH += .. ../murmur ../mumble
+LIBS += -lprotobuf
+
+protoc.output = ${QMAKE_FILE_BASE}.pb.cc ${QMAKE_FILE_BASE}.pb.h
+protoc.commands = protoc -I${QMAKE_FILE_PATH} ${QMAKE_FILE_NAME} --cpp_out=.
+protoc.input = PROTOS
+protoc.CONFIG *= no_link target_predeps
+
+QMAKE_EXTRA_COMPILERS *= protoc
@@ -0,0 +1,1095 @@
+/**
+ * Headless load generator. Where Benchmark runs a thread and a blocking
+ * handshake per client, this drives thousands of clients from one thread
+ * over epoll, with talk spurts, channel hopping, whispers, TCP-tunnelled
+ * voice and positional audio, and reports the latency and jitter the
+ * clients see. Given murmur's metricsport, it also shows the per-stage
+ * latency murmur measured over the same interval.
+ *
+ * Usage: LoadGen <host> <port> [option=value ...]
+ *
+ *   clients=100    Clients to connect.
+ *   rate=200       Clients to connect per second.
+ *   speakers=0.1   Fraction of clients that talk.
+ *   spurt=1000     Mean length of a talk spurt in ms.
+ *   pause=1500     Mean silence between talk spurts in ms.
+ *   frame=20       Audio per packet in ms (10, 20, 40 or 60).
+ *   bytes=60       Opus bytes per packet, at least 12.
+ *   whisper=0      Fraction of talk spurts whispered to other clients.
+ *   targets=3      Clients per whisper.
+ *   hop=0          Mean seconds between channel changes, 0 to stay.
+ *   tunnel=0       Fraction of clients without UDP, whose voice is tunnelled.
+ *   positional=0   Fraction of clients sending positional audio.
+ *   duration=60    Seconds to run once all clients are connected, 0 to run
+ *                  until interrupted.
+ *   report=5       Seconds between reports.
+ *   metrics=       host:port of murmur's metrics server.
+ *   seed=1         Random seed.
+ *
+ * To measure joins per second through an external authenticator, run
+ * scripts/server/ice/slowauth.py against the server and connect with a
+ * high rate; the join time covers the authenticator's round-trip.
+ *
+ * Clients spread over and hop between the channels that exist on the
+ * server, so create some first. All clients share one address; run the
+ * server under test with autobanTimeframe=0 and users raised to fit.
+ *
+ * Latency is from the sender stamping a packet to a receiver reading it,
+ * on the same clock. Jitter is the difference in latency of consecutive
+ * packets of one speaker. Gaps are packets missing from such a run. Lag
+ * is how late the generator itself sends frames; when that grows, the
+ * generator is the bottleneck, not the server.
+ */
+
+#include <QtCore>
+#include <QtNetwork>
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include "CryptState.h"
+#include "Message.h"
+#include "Metrics.h"
+#include "PacketDataStream.h"
+#include "Mumble.pb.h"
+
+static const quint64 NS_PER_MS = 1000000ULL;
+static const quint64 NS_PER_S = 1000000000ULL;
+
+// Voice from one speaker, as seen by one receiver.
+struct VoiceStream {
+	quint64 uiSeq;
+	quint64 uiLatency;
+	quint64 uiArrival;
+};
+
+class LoadClient {
+	public:
+		enum State { Connecting, Handshaking, Authenticating, Synced, Closed };
+
+		int iId;
+		State sState;
+		int iTcp, iUdp;
+		SSL *ssl;
+		CryptState csCrypt;
+		unsigned int uiSession;
+		int iChannel;
+		QByteArray qbaIn, qbaOut;
+
+		bool bSpeaker, bTunnel, bPositional;
+		bool bTalking;
+		int iTarget;
+		quint64 uiSeq;
+		float fPos[3];
+
+		quint64 uiWake, uiNextFrame, uiSpurtChange, uiNextHop, uiNextPing;
+		// When the TCP connect was started, for the join time.
+		quint64 uiSpawned;
+		QHash<unsigned int, VoiceStream> qhStreams;
+
+		LoadClient(int id);
+};
+
+LoadClient::LoadClient(int id) {
+	iId = id;
+	sState = Connecting;
+	iTcp = iUdp = -1;
+	ssl = NULL;
+	uiSession = 0;
+	iChannel = 0;
+	bSpeaker = bTunnel = bPositional = false;
+	bTalking = false;
+	iTarget = 0;
+	uiSeq = 0;
+	fPos[0] = fPos[1] = fPos[2] = 0.0f;
+	uiWake = uiNextFrame = uiSpurtChange = uiNextHop = uiNextPing = 0;
+	uiSpawned = 0;
+}
+
+class LoadStats {
+	public:
+		LatencyHistogram lhLatency, lhJitter, lhLag, lhTcpPing, lhUdpPing;
+		quint64 uiSent, uiReceived, uiGaps, uiDenied, uiBacklogged;
+
+		LoadStats();
+		void merge(const LoadStats &other);
+};
+
+LoadStats::LoadStats() {
+	uiSent = uiReceived = uiGaps = uiDenied = uiBacklogged = 0;
+}
+
+void LoadStats::merge(const LoadStats &o) {
+	lhLatency.merge(o.lhLatency);
+	lhJitter.merge(o.lhJitter);
+	lhLag.merge(o.lhLag);
+	lhTcpPing.merge(o.lhTcpPing);
+	lhUdpPing.merge(o.lhUdpPing);
+	uiSent += o.uiSent;
+	uiReceived += o.uiReceived;
+	uiGaps += o.uiGaps;
+	uiDenied += o.uiDenied;
+	uiBacklogged += o.uiBacklogged;
+}
+
+/* murmur's own view, from the stage histograms its metrics server exports.
+ * Those count since the server started, so each report shows the
+ * difference to the previous scrape.
+ */
+class ServerScrape {
+	public:
+		struct sockaddr_storage ssAddr;
+		socklen_t slAddr;
+		QMap<QByteArray, QMap<double, quint64> > qmBuckets;
+		QMap<QByteArray, quint64> qmDrops;
+
+		ServerScrape(const QHostAddress &host, unsigned short port);
+		bool fetch(QByteArray &out) const;
+		void report();
+};
+
+class LoadGen {
+	public:
+		// Options
+		int iClients, iRate, iFrame, iBytes, iTargets, iDuration, iReport;
+		double dSpeakers, dSpurt, dPause, dWhisper, dHop, dTunnel, dPositional;
+
+		struct sockaddr_storage ssServer;
+		socklen_t slServer;
+		SSL_CTX *ctx;
+		int iEpoll;
+		ServerScrape *ssScrape;
+
+		QList<LoadClient *> qlClients;
+		QMultiMap<quint64, LoadClient *> qmmWake;
+		QSet<int> qsChannels;
+		QList<int> qlChannels;
+		int iSynced, iClosed, iRejected;
+		// From connecting to ServerSync, which covers the authenticator.
+		LatencyHistogram lhJoin;
+
+		LoadStats lsInterval, lsTotal;
+		quint64 uiStart, uiLive, uiLastReport;
+
+		LoadGen(const QHostAddress &host, unsigned short port, const QMap<QByteArray, QByteArray> &opts);
+		~LoadGen();
+		void run();
+
+		void spawn(quint64 now);
+		void close(LoadClient *c, const QString &why);
+		void pump(LoadClient *c);
+		void readTcp(LoadClient *c);
+		void readUdp(LoadClient *c);
+		void flush(LoadClient *c);
+		void sendMessage(LoadClient *c, const ::google::protobuf::Message &msg, unsigned int msgType);
+		void sendTunnel(LoadClient *c, const char *data, int len);
+		void sendUdp(LoadClient *c, const char *data, int len);
+		void handleMessage(LoadClient *c, unsigned int msgType, const char *data, int len);
+		void handleVoice(LoadClient *c, const char *data, int len);
+		void synced(LoadClient *c, quint64 now);
+		void tick(LoadClient *c, quint64 now);
+		void ping(LoadClient *c, quint64 now);
+		void sendVoice(LoadClient *c, quint64 due, bool last);
+		void prepareSpurt(LoadClient *c);
+		void hop(LoadClient *c);
+		void report(quint64 now, bool final);
+};
+
+static volatile sig_atomic_t bStop = 0;
+
+static void stop(int) {
+	bStop = 1;
+}
+
+static double uniform() {
+	return (qrand() + 0.5) / (RAND_MAX + 1.0);
+}
+
+static quint64 exponential(double meanms) {
+	return static_cast<quint64>(- log(uniform()) * meanms * NS_PER_MS);
+}
+
+static QByteArray ms(quint64 ns) {
+	return QByteArray::number(static_cast<double>(ns) / NS_PER_MS, 'f', 2);
+}
+
+static QByteArray percentiles(const LatencyHistogram &lh) {
+	if (lh.uiCount == 0)
+		return QByteArray("-");
+	return ms(lh.percentile(0.5)) + " / " + ms(lh.percentile(0.99)) + " / " + ms(lh.percentile(0.999)) + " ms";
+}
+
+static void setAddress(const QHostAddress &qha, unsigned short port, struct sockaddr_storage &ss, socklen_t &len) {
+	memset(&ss, 0, sizeof(ss));
+	if (qha.protocol() == QAbstractSocket::IPv6Protocol) {
+		struct sockaddr_in6 *sin6 = reinterpret_cast<struct sockaddr_in6 *>(&ss);
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = htons(port);
+		Q_IPV6ADDR addr = qha.toIPv6Address();
+		memcpy(&sin6->sin6_addr, addr.c, 16);
+		len = sizeof(struct sockaddr_in6);
+	} else {
+		struct sockaddr_in *sin = reinterpret_cast<struct sockaddr_in *>(&ss);
+		sin->sin_family = AF_INET;
+		sin->sin_port = htons(port);
+		sin->sin_addr.s_addr = htonl(qha.toIPv4Address());
+		len = sizeof(struct sockaddr_in);
+	}
+}
+
+static QByteArray label(const QByteArray &line, const char *name) {
+	const QByteArray key = QByteArray(name) + "=\"";
+	int start = line.indexOf(key);
+	if (start < 0)
+		return QByteArray();
+	start += key.size();
+	const int end = line.indexOf('"', start);
+	return (end < 0) ? QByteArray() : line.mid(start, end - start);
+}
+
+ServerScrape::ServerScrape(const QHostAddress &host, unsigned short port) {
+	setAddress(host, port, ssAddr, slAddr);
+}
+
+// A blocking fetch; the metrics server is expected to be local and quick.
+bool ServerScrape::fetch(QByteArray &out) const {
+	int sock = ::socket(ssAddr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		return false;
+
+	struct timeval tv;
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	const char request[] = "GET /metrics HTTP/1.0\r\n\r\n";
+	if ((::connect(sock, reinterpret_cast<const struct sockaddr *>(&ssAddr), slAddr) != 0) || (::send(sock, request, sizeof(request) - 1, MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(request) - 1))) {
+		::close(sock);
+		return false;
+	}
+
+	char buffer[65536];
+	ssize_t len;
+	while ((len = ::recv(sock, buffer, sizeof(buffer), 0)) > 0)
+		out.append(buffer, static_cast<int>(len));
+	::close(sock);
+
+	const int body = out.indexOf("\r\n\r\n");
+	if (! out.startsWith("HTTP/1.0 200") || (body < 0))
+		return false;
+	out.remove(0, body + 4);
+	return true;
+}
+
+void ServerScrape::report() {
+	QByteArray text;
+	if (! fetch(text)) {
+		qWarning("  server: metrics unavailable");
+		return;
+	}
+
+	// Summed over all servers, by stage and bucket bound.
+	QMap<QByteArray, QMap<double, quint64> > buckets;
+	QMap<QByteArray, quint64> drops;
+	foreach(const QByteArray &line, text.split('\n')) {
+		const int space = line.lastIndexOf(' ');
+		if (line.startsWith('#') || (space < 0))
+			continue;
+		const quint64 value = line.mid(space + 1).toULongLong();
+		if (line.startsWith("murmur_voice_stage_seconds_bucket{")) {
+			const QByteArray le = label(line, "le");
+			const double bound = (le == "+Inf") ? HUGE_VAL : le.toDouble();
+			buckets[label(line, "stage")][bound] += value;
+		} else if (line.startsWith("murmur_voice_dropped_total{")) {
+			drops[label(line, "reason")] += value;
+		}
+	}
+
+	QByteArray stages;
+	QMap<QByteArray, QMap<double, quint64> >::const_iterator i;
+	for (i = buckets.constBegin(); i != buckets.constEnd(); ++i) {
+		const QMap<double, quint64> &now = i.value();
+		const QMap<double, quint64> &before = qmBuckets.value(i.key());
+		const quint64 total = now.value(HUGE_VAL) - before.value(HUGE_VAL);
+		stages += "  " + i.key() + " ";
+		if (total == 0) {
+			stages += "-";
+			continue;
+		}
+
+		// The bound of the first bucket holding each quantile, so an upper
+		// estimate to within a factor of two.
+		const double quantiles[] = { 0.5, 0.99 };
+		for (int q = 0; q < 2; ++q) {
+			const quint64 rank = qMax(Q_UINT64_C(1), static_cast<quint64>(quantiles[q] * total + 0.5));
+			QMap<double, quint64>::const_iterator j;
+			for (j = now.constBegin(); j != now.constEnd(); ++j) {
+				if (j.value() - before.value(j.key()) >= rank)
+					break;
+			}
+			if (q)
+				stages += "/";
+			if (j == now.constEnd() || (j.key() == HUGE_VAL))
+				stages += "inf";
+			else
+				stages += "<" + QByteArray::number(j.key() * 1e6, 'g', 3) + "us";
+		}
+	}
+
+	QByteArray dropped;
+	QMap<QByteArray, quint64>::const_iterator d;
+	for (d = drops.constBegin(); d != drops.constEnd(); ++d) {
+		const quint64 n = d.value() - qmDrops.value(d.key());
+		if (n)
+			dropped += "  " + d.key() + " " + QByteArray::number(n);
+	}
+
+	qWarning("  server p50/p99:%s", stages.constData());
+	qWarning("  server drops:%s", dropped.isEmpty() ? "  none" : dropped.constData());
+
+	qmBuckets = buckets;
+	qmDrops = drops;
+}
+
+static int intOption(const QMap<QByteArray, QByteArray> &opts, const char *name, int def, int min, int max) {
+	if (! opts.contains(name))
+		return def;
+	bool ok = false;
+	int v = opts.value(name).toInt(&ok);
+	if (! ok || (v < min) || (v > max))
+		qFatal("%s must be a number from %d to %d", name, min, max);
+	return v;
+}
+
+static double realOption(const QMap<QByteArray, QByteArray> &opts, const char *name, double def, double min, double max) {
+	if (! opts.contains(name))
+		return def;
+	bool ok = false;
+	double v = opts.value(name).toDouble(&ok);
+	if (! ok || (v < min) || (v > max))
+		qFatal("%s must be a number from %g to %g", name, min, max);
+	return v;
+}
+
+LoadGen::LoadGen(const QHostAddress &host, unsigned short port, const QMap<QByteArray, QByteArray> &opts) {
+	iClients = intOption(opts, "clients", 100, 1, 1000000);
+	iRate = intOption(opts, "rate", 200, 1, 100000);
+	iFrame = intOption(opts, "frame", 20, 10, 60);
+	if ((iFrame != 10) && (iFrame != 20) && (iFrame != 40) && (iFrame != 60))
+		qFatal("frame must be 10, 20, 40 or 60");
+	iBytes = intOption(opts, "bytes", 60, 12, 1000);
+	iTargets = intOption(opts, "targets", 3, 1, 100);
+	iDuration = intOption(opts, "duration", 60, 0, 1000000);
+	iReport = intOption(opts, "report", 5, 1, 3600);
+	dSpeakers = realOption(opts, "speakers", 0.1, 0.0, 1.0);
+	dSpurt = realOption(opts, "spurt", 1000.0, 10.0, 1e6);
+	dPause = realOption(opts, "pause", 1500.0, 10.0, 1e6);
+	dWhisper = realOption(opts, "whisper", 0.0, 0.0, 1.0);
+	dHop = realOption(opts, "hop", 0.0, 0.0, 1e6);
+	dTunnel = realOption(opts, "tunnel", 0.0, 0.0, 1.0);
+	dPositional = realOption(opts, "positional", 0.0, 0.0, 1.0);
+	qsrand(static_cast<uint>(intOption(opts, "seed", 1, 0, INT_MAX)));
+
+	ssScrape = NULL;
+	const QByteArray metrics = opts.value("metrics");
+	if (! metrics.isEmpty()) {
+		const int colon = metrics.lastIndexOf(':');
+		const QHostAddress qha(QString::fromLatin1(metrics.left(colon)));
+		const int mport = metrics.mid(colon + 1).toInt();
+		if ((colon < 0) || qha.isNull() || (mport <= 0) || (mport > 65535))
+			qFatal("metrics must be address:port");
+		ssScrape = new ServerScrape(qha, static_cast<unsigned short>(mport));
+	}
+
+	setAddress(host, port, ssServer, slServer);
+
+	SSL_library_init();
+	SSL_load_error_strings();
+	ctx = SSL_CTX_new(SSLv23_client_method());
+	SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+	SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+	iEpoll = epoll_create1(EPOLL_CLOEXEC);
+	if (iEpoll < 0)
+		qFatal("epoll_create1: %s", strerror(errno));
+
+	iSynced = iClosed = iRejected = 0;
+	uiStart = uiLive = uiLastReport = 0;
+}
+
+LoadGen::~LoadGen() {
+	foreach(LoadClient *c, qlClients) {
+		close(c, QString());
+		delete c;
+	}
+	::close(iEpoll);
+	SSL_CTX_free(ctx);
+	delete ssScrape;
+}
+
+void LoadGen::spawn(quint64 now) {
+	LoadClient *c = new LoadClient(qlClients.count());
+	qlClients << c;
+
+	c->bSpeaker = uniform() < dSpeakers;
+	c->bTunnel = uniform() < dTunnel;
+	c->bPositional = uniform() < dPositional;
+	c->uiSpawned = now;
+
+	c->iTcp = ::socket(ssServer.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (c->iTcp < 0) {
+		close(c, QString::fromLatin1("socket: %1").arg(QLatin1String(strerror(errno))));
+		return;
+	}
+	int one = 1;
+	setsockopt(c->iTcp, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	if ((::connect(c->iTcp, reinterpret_cast<struct sockaddr *>(&ssServer), slServer) != 0) && (errno != EINPROGRESS)) {
+		close(c, QString::fromLatin1("connect: %1").arg(QLatin1String(strerror(errno))));
+		return;
+	}
+
+	// Edge triggered; every handler reads and writes until it would block.
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+	ev.data.u64 = static_cast<quint64>(c->iId) << 1;
+	epoll_ctl(iEpoll, EPOLL_CTL_ADD, c->iTcp, &ev);
+
+	if (! c->bTunnel) {
+		c->iUdp = ::socket(ssServer.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if ((c->iUdp < 0) || (::connect(c->iUdp, reinterpret_cast<struct sockaddr *>(&ssServer), slServer) != 0)) {
+			close(c, QString::fromLatin1("udp: %1").arg(QLatin1String(strerror(errno))));
+			return;
+		}
+		ev.events = EPOLLIN | EPOLLET;
+		ev.data.u64 = (static_cast<quint64>(c->iId) << 1) | 1;
+		epoll_ctl(iEpoll, EPOLL_CTL_ADD, c->iUdp, &ev);
+	}
+
+	c->ssl = SSL_new(ctx);
+	SSL_set_fd(c->ssl, c->iTcp);
+	SSL_set_connect_state(c->ssl);
+
+	c->uiNextPing = now;
+}
+
+void LoadGen::close(LoadClient *c, const QString &why) {
+	if (c->sState == LoadClient::Closed)
+		return;
+
+	if (c->sState == LoadClient::Synced)
+		--iSynced;
+	c->sState = LoadClient::Closed;
+	c->bTalking = false;
+	++iClosed;
+
+	// A server that turns clients away would otherwise flood the terminal.
+	if (! why.isEmpty() && (iClosed <= 10))
+		qWarning("Client %d: %s", c->iId, qPrintable(why));
+
+	if (c->ssl)
+		SSL_free(c->ssl);
+	c->ssl = NULL;
+	if (c->iTcp >= 0)
+		::close(c->iTcp);
+	if (c->iUdp >= 0)
+		::close(c->iUdp);
+	c->iTcp = c->iUdp = -1;
+	c->qbaIn.clear();
+	c->qbaOut.clear();
+	c->qhStreams.clear();
+}
+
+void LoadGen::pump(LoadClient *c) {
+	if (c->sState == LoadClient::Connecting) {
+		int err = 0;
+		socklen_t len = sizeof(err);
+		getsockopt(c->iTcp, SOL_SOCKET, SO_ERROR, &err, &len);
+		if (err) {
+			close(c, QString::fromLatin1("connect: %1").arg(QLatin1String(strerror(err))));
+			return;
+		}
+		c->sState = LoadClient::Handshaking;
+	}
+
+	if (c->sState == LoadClient::Handshaking) {
+		int ret = SSL_do_handshake(c->ssl);
+		if (ret != 1) {
+			int err = SSL_get_error(c->ssl, ret);
+			if ((err != SSL_ERROR_WANT_READ) && (err != SSL_ERROR_WANT_WRITE))
+				close(c, QString::fromLatin1("TLS handshake failed: %1").arg(QLatin1String(ERR_error_string(ERR_get_error(), NULL))));
+			return;
+		}
+		c->sState = LoadClient::Authenticating;
+
+		MumbleProto::Version mpv;
+		mpv.set_release(u8(QLatin1String("1.2.5 LoadGen")));
+		mpv.set_version(0x010205);
+		sendMessage(c, mpv, MessageHandler::Version);
+
+		MumbleProto::Authenticate mpa;
+		mpa.set_username(u8(QString::fromLatin1("loadgen-%1-%2").arg(getpid()).arg(c->iId)));
+		mpa.set_opus(true);
+		sendMessage(c, mpa, MessageHandler::Authenticate);
+	}
+
+	readTcp(c);
+	flush(c);
+}
+
+void LoadGen::readTcp(LoadClient *c) {
+	char buffer[65536];
+
+	while (c->sState != LoadClient::Closed) {
+		int ret = SSL_read(c->ssl, buffer, sizeof(buffer));
+		if (ret <= 0) {
+			int err = SSL_get_error(c->ssl, ret);
+			if ((err != SSL_ERROR_WANT_READ) && (err != SSL_ERROR_WANT_WRITE))
+				close(c, QLatin1String("Disconnected"));
+			break;
+		}
+		c->qbaIn.append(buffer, ret);
+
+		int offset = 0;
+		while (c->qbaIn.size() - offset >= 6) {
+			const unsigned char *head = reinterpret_cast<const unsigned char *>(c->qbaIn.constData() + offset);
+			const unsigned int msgType = qFromBigEndian<quint16>(head);
+			const int len = static_cast<int>(qFromBigEndian<quint32>(head + 2));
+			if (c->qbaIn.size() - offset - 6 < len)
+				break;
+			handleMessage(c, msgType, c->qbaIn.constData() + offset + 6, len);
+			if (c->sState == LoadClient::Closed)
+				return;
+			offset += 6 + len;
+		}
+		c->qbaIn.remove(0, offset);
+	}
+}
+
+void LoadGen::readUdp(LoadClient *c) {
+	char buffer[2048];
+	char plain[2048];
+
+	while (c->sState != LoadClient::Closed) {
+		ssize_t len = ::recv(c->iUdp, buffer, sizeof(buffer), 0);
+		if (len < 0)
+			break;
+		if ((len < 5) || ! c->csCrypt.isValid())
+			continue;
+		if (c->csCrypt.decrypt(reinterpret_cast<const unsigned char *>(buffer), reinterpret_cast<unsigned char *>(plain), static_cast<unsigned int>(len)))
+			handleVoice(c, plain, static_cast<int>(len) - 4);
+	}
+}
+
+void LoadGen::flush(LoadClient *c) {
+	int offset = 0;
+	while ((c->sState >= LoadClient::Authenticating) && (c->sState != LoadClient::Closed) && (offset < c->qbaOut.size())) {
+		int ret = SSL_write(c->ssl, c->qbaOut.constData() + offset, c->qbaOut.size() - offset);
+		if (ret <= 0) {
+			int err = SSL_get_error(c->ssl, ret);
+			if ((err != SSL_ERROR_WANT_READ) && (err != SSL_ERROR_WANT_WRITE))
+				close(c, QLatin1String("Write failed"));
+			break;
+		}
+		offset += ret;
+	}
+	if (c->sState != LoadClient::Closed)
+		c->qbaOut.remove(0, offset);
+}
+
+void LoadGen::sendMessage(LoadClient *c, const ::google::protobuf::Message &msg, unsigned int msgType) {
+	if (c->sState == LoadClient::Closed)
+		return;
+
+	const int len = msg.ByteSize();
+	const int start = c->qbaOut.size();
+	c->qbaOut.resize(start + 6 + len);
+
+	unsigned char *uc = reinterpret_cast<unsigned char *>(c->qbaOut.data() + start);
+	qToBigEndian<quint16>(static_cast<quint16>(msgType), uc);
+	qToBigEndian<quint32>(static_cast<quint32>(len), uc + 2);
+	msg.SerializeToArray(uc + 6, len);
+
+	flush(c);
+}
+
+void LoadGen::sendTunnel(LoadClient *c, const char *data, int len) {
+	if (c->sState == LoadClient::Closed)
+		return;
+
+	// Like a real client, drop audio rather than queue it behind a stuck socket.
+	if (c->qbaOut.size() > 65536) {
+		++lsInterval.uiBacklogged;
+		return;
+	}
+
+	const int start = c->qbaOut.size();
+	c->qbaOut.resize(start + 6 + len);
+
+	unsigned char *uc = reinterpret_cast<unsigned char *>(c->qbaOut.data() + start);
+	qToBigEndian<quint16>(MessageHandler::UDPTunnel, uc);
+	qToBigEndian<quint32>(static_cast<quint32>(len), uc + 2);
+	memcpy(uc + 6, data, len);
+
+	flush(c);
+}
+
+void LoadGen::sendUdp(LoadClient *c, const char *data, int len) {
+	if ((c->sState == LoadClient::Closed) || ! c->csCrypt.isValid())
+		return;
+
+	unsigned char crypted[2048];
+	c->csCrypt.encrypt(reinterpret_cast<const unsigned char *>(data), crypted, len);
+	if (::send(c->iUdp, crypted, len + 4, 0) < 0)
+		++lsInterval.uiBacklogged;
+}
+
+void LoadGen::handleMessage(LoadClient *c, unsigned int msgType, const char *data, int len) {
+	switch (msgType) {
+		case MessageHandler::UDPTunnel:
+			handleVoice(c, data, len);
+			break;
+		case MessageHandler::CryptSetup: {
+				MumbleProto::CryptSetup msg;
+				if (! msg.ParseFromArray(data, len))
+					break;
+				if (msg.has_key() && msg.has_client_nonce() && msg.has_server_nonce()) {
+					const std::string &key = msg.key();
+					const std::string &client_nonce = msg.client_nonce();
+					const std::string &server_nonce = msg.server_nonce();
+					if (key.size() == AES_BLOCK_SIZE && client_nonce.size() == AES_BLOCK_SIZE && server_nonce.size() == AES_BLOCK_SIZE)
+						c->csCrypt.setKey(reinterpret_cast<const unsigned char *>(key.data()), reinterpret_cast<const unsigned char *>(client_nonce.data()), reinterpret_cast<const unsigned char *>(server_nonce.data()));
+				} else if (msg.has_server_nonce()) {
+					const std::string &server_nonce = msg.server_nonce();
+					if (server_nonce.size() == AES_BLOCK_SIZE) {
+						c->csCrypt.uiResync++;
+						memcpy(c->csCrypt.decrypt_iv, server_nonce.data(), AES_BLOCK_SIZE);
+					}
+				} else {
+					MumbleProto::CryptSetup mpcs;
+					mpcs.set_client_nonce(std::string(reinterpret_cast<const char *>(c->csCrypt.encrypt_iv), AES_BLOCK_SIZE));
+					sendMessage(c, mpcs, MessageHandler::CryptSetup);
+				}
+				break;
+			}
+		case MessageHandler::ServerSync: {
+				MumbleProto::ServerSync msg;
+				if (! msg.ParseFromArray(data, len))
+					break;
+				c->uiSession = msg.session();
+				synced(c, VoiceMetrics::ticks());
+				break;
+			}
+		case MessageHandler::Reject: {
+				MumbleProto::Reject msg;
+				msg.ParseFromArray(data, len);
+				++iRejected;
+				close(c, QString::fromLatin1("Rejected: %1").arg(u8(msg.reason())));
+				break;
+			}
+		case MessageHandler::ChannelState: {
+				MumbleProto::ChannelState msg;
+				if (msg.ParseFromArray(data, len) && msg.has_channel_id() && ! qsChannels.contains(msg.channel_id())) {
+					qsChannels.insert(msg.channel_id());
+					qlChannels = qsChannels.toList();
+				}
+				break;
+			}
+		case MessageHandler::ChannelRemove: {
+				MumbleProto::ChannelRemove msg;
+				if (msg.ParseFromArray(data, len) && qsChannels.remove(msg.channel_id()))
+					qlChannels = qsChannels.toList();
+				break;
+			}
+		case MessageHandler::UserState: {
+				MumbleProto::UserState msg;
+				if (msg.ParseFromArray(data, len) && c->uiSession && (msg.session() == c->uiSession) && msg.has_channel_id()) {
+					c->iChannel = msg.channel_id();
+					c->qhStreams.clear();
+				}
+				break;
+			}
+		case MessageHandler::UserRemove: {
+				MumbleProto::UserRemove msg;
+				if (msg.ParseFromArray(data, len) && c->uiSession && (msg.session() == c->uiSession))
+					close(c, QString::fromLatin1("Removed: %1").arg(u8(msg.reason())));
+				break;
+			}
+		case MessageHandler::Ping: {
+				MumbleProto::Ping msg;
+				const quint64 now = VoiceMetrics::ticks();
+				if (msg.ParseFromArray(data, len) && msg.has_timestamp() && (msg.timestamp() <= now))
+					lsInterval.lhTcpPing.add(now - msg.timestamp());
+				break;
+			}
+		case MessageHandler::PermissionDenied:
+			++lsInterval.uiDenied;
+			break;
+		default:
+			break;
+	}
+}
+
+/* Voice as murmur sends it: header, sender session, sequence, Opus size,
+ * then our payload of send time and sender id.
+ */
+void LoadGen::handleVoice(LoadClient *c, const char *data, int len) {
+	const quint64 now = VoiceMetrics::ticks();
+	const unsigned int msgUDPType = (static_cast<unsigned char>(data[0]) >> 5) & 0x7;
+	PacketDataStream pds(data + 1, len - 1);
+
+	if (msgUDPType == MessageHandler::UDPPing) {
+		quint64 ts;
+		pds >> ts;
+		if (pds.isValid() && (ts <= now))
+			lsInterval.lhUdpPing.add(now - ts);
+		return;
+	}
+	if (msgUDPType != MessageHandler::UDPVoiceOpus)
+		return;
+
+	unsigned int session;
+	quint64 seq;
+	int size;
+	pds >> session >> seq >> size;
+	if (! pds.isValid() || ((size & 0x1fff) < 12) || (pds.left() < 12))
+		return;
+
+	quint64 sent;
+	memcpy(&sent, pds.charPtr(), sizeof(sent));
+	if (sent > now)
+		return;
+
+	const quint64 latency = now - sent;
+	++lsInterval.uiReceived;
+	lsInterval.lhLatency.add(latency);
+
+	const quint64 step = static_cast<quint64>(iFrame / 10);
+	QHash<unsigned int, VoiceStream>::iterator i = c->qhStreams.find(session);
+	if (i == c->qhStreams.end()) {
+		VoiceStream vs;
+		vs.uiSeq = seq;
+		vs.uiLatency = latency;
+		vs.uiArrival = now;
+		c->qhStreams.insert(session, vs);
+		return;
+	}
+
+	// Only judge runs of voice that were heard without a break.
+	VoiceStream &vs = i.value();
+	if ((seq > vs.uiSeq) && (now - vs.uiArrival < NS_PER_S)) {
+		lsInterval.lhJitter.add((latency > vs.uiLatency) ? (latency - vs.uiLatency) : (vs.uiLatency - latency));
+		const quint64 missing = (seq - vs.uiSeq) / step - 1;
+		if (missing < 50)
+			lsInterval.uiGaps += missing;
+	}
+	vs.uiSeq = seq;
+	vs.uiLatency = latency;
+	vs.uiArrival = now;
+}
+
+void LoadGen::synced(LoadClient *c, quint64 now) {
+	c->sState = LoadClient::Synced;
+	++iSynced;
+	lhJoin.add(now - c->uiSpawned);
+
+	if (c->bPositional) {
+		MumbleProto::UserState mpus;
+		mpus.set_plugin_context(std::string("LoadGen"));
+		mpus.set_plugin_identity(std::string("LoadGen"));
+		sendMessage(c, mpus, MessageHandler::UserState);
+		c->fPos[0] = static_cast<float>(uniform() * 100.0);
+		c->fPos[2] = static_cast<float>(uniform() * 100.0);
+	}
+
+	hop(c);
+
+	if (c->bSpeaker) {
+		c->uiSpurtChange = now + exponential(dPause);
+		prepareSpurt(c);
+	}
+	if (dHop > 0.0)
+		c->uiNextHop = now + exponential(dHop * 1000.0);
+
+	tick(c, now);
+}
+
+void LoadGen::tick(LoadClient *c, quint64 now) {
+	if (now >= c->uiNextPing) {
+		ping(c, now);
+		c->uiNextPing = now + 5 * NS_PER_S;
+	}
+
+	if (c->bSpeaker && (now >= c->uiSpurtChange)) {
+		if (c->bTalking) {
+			sendVoice(c, c->uiNextFrame, true);
+			c->bTalking = false;
+			c->uiSpurtChange = now + exponential(dPause);
+			prepareSpurt(c);
+		} else {
+			c->bTalking = true;
+			c->uiNextFrame = now;
+			c->uiSpurtChange = now + exponential(dSpurt);
+		}
+	}
+
+	if (c->bTalking && (now >= c->uiNextFrame)) {
+		sendVoice(c, c->uiNextFrame, false);
+		c->uiNextFrame += iFrame * NS_PER_MS;
+		// Behind by more than a frame; skip ahead rather than burst.
+		if (c->uiNextFrame < now)
+			c->uiNextFrame = now;
+	}
+
+	if ((dHop > 0.0) && (now >= c->uiNextHop)) {
+		hop(c);
+		c->uiNextHop = now + exponential(dHop * 1000.0);
+	}
+
+	if (c->sState != LoadClient::Synced)
+		return;
+
+	quint64 wake = c->uiNextPing;
+	if (c->bSpeaker)
+		wake = qMin(wake, c->uiSpurtChange);
+	if (c->bTalking)
+		wake = qMin(wake, c->uiNextFrame);
+	if (dHop > 0.0)
+		wake = qMin(wake, c->uiNextHop);
+
+	// Superseded entries stay in the map and are skipped when they come up.
+	c->uiWake = wake;
+	qmmWake.insert(wake, c);
+}
+
+void LoadGen::ping(LoadClient *c, quint64 now) {
+	MumbleProto::Ping mpp;
+	mpp.set_timestamp(now);
+	sendMessage(c, mpp, MessageHandler::Ping);
+
+	// Also tells murmur that UDP works for this client.
+	if (! c->bTunnel) {
+		char buffer[32];
+		buffer[0] = static_cast<char>(MessageHandler::UDPPing << 5);
+		PacketDataStream pds(buffer + 1, sizeof(buffer) - 1);
+		pds << now;
+		sendUdp(c, buffer, pds.size() + 1);
+	}
+}
+
+void LoadGen::sendVoice(LoadClient *c, quint64 due, bool last) {
+	static const char acPadding[1024] = { 0 };
+	char buffer[1280];
+
+	buffer[0] = static_cast<char>((MessageHandler::UDPVoiceOpus << 5) | c->iTarget);
+	PacketDataStream pds(buffer + 1, sizeof(buffer) - 1);
+	pds << c->uiSeq;
+	c->uiSeq += static_cast<quint64>(iFrame / 10);
+	pds << (iBytes | (last ? 0x2000 : 0));
+
+	const quint64 now = VoiceMetrics::ticks();
+	const quint32 id = static_cast<quint32>(c->iId);
+	pds.append(reinterpret_cast<const char *>(&now), sizeof(now));
+	pds.append(reinterpret_cast<const char *>(&id), sizeof(id));
+	pds.append(acPadding, iBytes - 12);
+
+	if (c->bPositional) {
+		c->fPos[0] += static_cast<float>(uniform() - 0.5);
+		c->fPos[2] += static_cast<float>(uniform() - 0.5);
+		pds << c->fPos[0] << c->fPos[1] << c->fPos[2];
+	}
+
+	if (c->bTunnel)
+		sendTunnel(c, buffer, pds.size() + 1);
+	else
+		sendUdp(c, buffer, pds.size() + 1);
+
+	++lsInterval.uiSent;
+	lsInterval.lhLag.add(now - qMin(now, due));
+}
+
+// Picks whom the next talk spurt goes to, early so murmur knows by then.
+void LoadGen::prepareSpurt(LoadClient *c) {
+	const int oldTarget = c->iTarget;
+	c->iTarget = 0;
+
+	if ((dWhisper > 0.0) && (uniform() < dWhisper)) {
+		MumbleProto::VoiceTarget mpvt;
+		mpvt.set_id(1);
+		MumbleProto::VoiceTarget_Target *t = mpvt.add_targets();
+		for (int i = 0; (i < iTargets * 4) && (t->session_size() < iTargets); ++i) {
+			LoadClient *other = qlClients.at(qrand() % qlClients.count());
+			if ((other != c) && (other->sState == LoadClient::Synced))
+				t->add_session(other->uiSession);
+		}
+		if (t->session_size() > 0) {
+			sendMessage(c, mpvt, MessageHandler::VoiceTarget);
+			c->iTarget = 1;
+		}
+	}
+
+	if ((oldTarget != 0) && (c->iTarget == 0)) {
+		MumbleProto::VoiceTarget mpvt;
+		mpvt.set_id(1);
+		sendMessage(c, mpvt, MessageHandler::VoiceTarget);
+	}
+}
+
+void LoadGen::hop(LoadClient *c) {
+	if (qlChannels.count() < 2)
+		return;
+
+	int channel = qlChannels.at(qrand() % qlChannels.count());
+	if (channel == c->iChannel)
+		return;
+
+	MumbleProto::UserState mpus;
+	mpus.set_session(c->uiSession);
+	mpus.set_channel_id(channel);
+	sendMessage(c, mpus, MessageHandler::UserState);
+}
+
+void LoadGen::report(quint64 now, bool final) {
+	const LoadStats &ls = final ? lsTotal : lsInterval;
+	const double secs = qMax(1e-3, static_cast<double>(now - (final ? uiLive : uiLastReport)) / NS_PER_S);
+
+	int talking = 0;
+	foreach(LoadClient *c, qlClients)
+		if (c->bTalking)
+			++talking;
+
+	qWarning("%s %6.1fs  clients %d/%d synced, %d closed  talking %d  sent %.0f/s  received %.0f/s",
+	         final ? "Total" : "     ", static_cast<double>(now - uiStart) / NS_PER_S,
+	         iSynced, iClients, iClosed, talking, ls.uiSent / secs, ls.uiReceived / secs);
+	qWarning("  p50/p99/p99.9  latency %s  jitter %s  lag %s", percentiles(ls.lhLatency).constData(), percentiles(ls.lhJitter).constData(), percentiles(ls.lhLag).constData());
+	qWarning("  p50/p99/p99.9  tcp ping %s  udp ping %s", percentiles(ls.lhTcpPing).constData(), percentiles(ls.lhUdpPing).constData());
+	qWarning("  gaps %llu  denied %llu  backlogged %llu", ls.uiGaps, ls.uiDenied, ls.uiBacklogged);
+
+	if (ssScrape && ! final)
+		ssScrape->report();
+}
+
+void LoadGen::run() {
+	struct epoll_event events[1024];
+
+	uiStart = uiLastReport = VoiceMetrics::ticks();
+	if (ssScrape)
+		ssScrape->report();
+
+	qWarning("Connecting %d clients at %d per second", iClients, iRate);
+
+	while (! bStop) {
+		quint64 now = VoiceMetrics::ticks();
+
+		const quint64 due = qMin(static_cast<quint64>(iClients), (now - uiStart) * iRate / NS_PER_S + 1);
+		while (static_cast<quint64>(qlClients.count()) < due)
+			spawn(now);
+
+		// Go live once everyone is in, or a while after the last connect.
+		const quint64 spawned = uiStart + static_cast<quint64>(iClients) * NS_PER_S / iRate;
+		if (! uiLive && (qlClients.count() == iClients) && ((iSynced + iClosed == iClients) || (now > spawned + 10 * NS_PER_S))) {
+			uiLive = now;
+			const double secs = qMax(1e-3, static_cast<double>(now - uiStart) / NS_PER_S);
+			qWarning("Connected %d clients in %.1fs (%.1f joins/s), %d failed (%d rejected), %d pending", iSynced, secs, iSynced / secs, iClosed, iRejected, iClients - iSynced - iClosed);
+			qWarning("  p50/p99/p99.9  join %s", percentiles(lhJoin).constData());
+			lsInterval = LoadStats();
+			uiLastReport = now;
+		}
+
+		while (! qmmWake.isEmpty() && (qmmWake.begin().key() <= now)) {
+			QMultiMap<quint64, LoadClient *>::iterator i = qmmWake.begin();
+			const quint64 key = i.key();
+			LoadClient *c = i.value();
+			qmmWake.erase(i);
+			if ((c->uiWake == key) && (c->sState == LoadClient::Synced))
+				tick(c, now);
+		}
+
+		if (now - uiLastReport >= iReport * NS_PER_S) {
+			report(now, false);
+			if (uiLive)
+				lsTotal.merge(lsInterval);
+			lsInterval = LoadStats();
+			uiLastReport = now;
+		}
+
+		if (uiLive && iDuration && (now - uiLive >= iDuration * NS_PER_S))
+			break;
+
+		int timeout = 10;
+		if (! qmmWake.isEmpty())
+			timeout = static_cast<int>(qMin(static_cast<quint64>(timeout), (qmmWake.begin().key() - qMin(now, qmmWake.begin().key()) + NS_PER_MS - 1) / NS_PER_MS));
+
+		int n = epoll_wait(iEpoll, events, 1024, timeout);
+		for (int i = 0; i < n; ++i) {
+			LoadClient *c = qlClients.at(static_cast<int>(events[i].data.u64 >> 1));
+			if (c->sState == LoadClient::Closed)
+				continue;
+			if (events[i].data.u64 & 1)
+				readUdp(c);
+			else
+				pump(c);
+		}
+	}
+
+	const quint64 now = VoiceMetrics::ticks();
+	if (uiLive) {
+		lsTotal.merge(lsInterval);
+		report(now, true);
+	}
+}
+
+int main(int argc, char **argv) {
+	QCoreApplication a(argc, argv);
+
+	if (argc < 3)
+		qFatal("Usage: LoadGen <host address> <port> [option=value ...]; see LoadGen.cpp for the options");
+
+	QHostAddress qha = QHostAddress(QString::fromLatin1(argv[1]));
+	int port = atoi(argv[2]);
+	if (qha.isNull() || (port <= 0) || (port > 65535))
+		qFatal("Invalid address or port");
+
+	static const char *names[] = { "clients", "rate", "speakers", "spurt", "pause", "frame", "bytes", "whisper", "targets", "hop", "tunnel", "positional", "duration", "report", "metrics", "seed" };
+	QMap<QByteArray, QByteArray> opts;
+	for (int i = 3; i < argc; ++i) {
+		const QByteArray arg(argv[i]);
+		const int eq = arg.indexOf('=');
+		bool known = false;
+		for (unsigned int j = 0; j < sizeof(names) / sizeof(names[0]); ++j)
+			known = known || (arg.left(eq) == names[j]);
+		if ((eq < 0) || ! known)
+			qFatal("Unknown option %s", argv[i]);
+		opts.insert(arg.left(eq), arg.mid(eq + 1));
+	}
+
+	// Two sockets per client.
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+		qWarning("Maximum # sockets is %llu", static_cast<unsigned long long>(rl.rlim_cur));
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+
+	LoadGen lg(qha, static_cast<unsigned short>(port), opts);
+	lg.run();
+	return 0;
+}
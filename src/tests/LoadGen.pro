@@ -0,0 +1,18 @@
+include(../mumble.pri)
+
+TEMPLATE = app
+CONFIG *= qt thread warn_on network
+CONFIG -= app_bundle
+QT *= network
+QT -= gui
+LANGUAGE = C++
+TARGET = LoadGen
+SOURCES *= LoadGen.cpp Timer.cpp CryptState.cpp Metrics.cpp
+HEADERS *= Timer.h CryptState.h Metrics.h
+VPATH *= .. ../murmur
+INCLUDEPATH *= .. ../murmur ../mumble
+LIBS *= -lssl -lcrypto
+
+!linux {
+	error(LoadGen needs epoll)
+}
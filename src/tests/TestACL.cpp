@@ -0,0 +1,617 @@
+#include <QtCore>
+#include <QtTest>
+
+#include "ACL.h"
+#include "ACLEngine.h"
+#include "Channel.h"
+#include "Group.h"
+#include "User.h"
+
+#define DEFAULT (ChanACL::Traverse | ChanACL::Enter | ChanACL::Speak | ChanACL::Whisper | ChanACL::TextMessage)
+
+// What a client sees of its own user: User has no room for these.
+struct Identity {
+	bool bVerified;
+	QStringList qslTokens;
+};
+
+// ChanACL::effectivePermissions() and Group::isMember() as they were
+// before ACLEngine, working on the channel tree directly.
+static bool refIsMember(Channel *curChan, Channel *aclChan, QString name, const User *pl, const Identity &id) {
+	Channel *p;
+	Channel *c;
+	Group *g;
+
+	bool m = false;
+	bool invert = false;
+	bool token = false;
+	bool hash = false;
+	c = curChan;
+
+	while (true) {
+		if (name.isEmpty())
+			return false;
+
+		if (name.startsWith(QChar::fromLatin1('!'))) {
+			invert = true;
+			name = name.remove(0,1);
+			continue;
+		}
+
+		if (name.startsWith(QChar::fromLatin1('~'))) {
+			c = aclChan;
+			name = name.remove(0,1);
+			continue;
+		}
+
+		if (name.startsWith(QChar::fromLatin1('#'))) {
+			token = true;
+			name = name.remove(0,1);
+			continue;
+		}
+		if (name.startsWith(QChar::fromLatin1('$'))) {
+			hash = true;
+			name = name.remove(0,1);
+			continue;
+		}
+
+		break;
+	}
+
+	if (token)
+		m = id.qslTokens.contains(name, Qt::CaseInsensitive);
+	else if (hash)
+		m = pl->qsHash == name;
+	else if (name == QLatin1String("none"))
+		m = false;
+	else if (name == QLatin1String("all"))
+		m = true;
+	else if (name == QLatin1String("auth"))
+		m = (pl->iId >= 0);
+	else if (name == QLatin1String("strong"))
+		m = id.bVerified;
+	else if (name == QLatin1String("in"))
+		m = (pl->cChannel == c);
+	else if (name == QLatin1String("out"))
+		m = !(pl->cChannel == c);
+	else if (name.startsWith(QLatin1String("sub"))) {
+		name = name.remove(0,4);
+		int mindesc = 1;
+		int maxdesc = 1000;
+		int minpath = 0;
+		QStringList args = name.split(QLatin1String(","));
+		switch (args.count()) {
+			default:
+			case 3:
+				maxdesc = args[2].isEmpty() ? maxdesc : args[2].toInt();
+			case 2:
+				mindesc = args[1].isEmpty() ? mindesc : args[1].toInt();
+			case 1:
+				minpath = args[0].isEmpty() ? minpath : args[0].toInt();
+			case 0:
+				break;
+		}
+
+		Channel *home = pl->cChannel;
+		QList<Channel *> playerChain;
+		QList<Channel *> groupChain;
+
+		p = home;
+		while (p) {
+			playerChain.prepend(p);
+			p = p->cParent;
+		}
+
+		p = curChan;
+		while (p) {
+			groupChain.prepend(p);
+			p = p->cParent;
+		}
+
+		int cofs = groupChain.indexOf(c);
+		cofs += minpath;
+
+		if (cofs >= groupChain.count()) {
+			return invert;
+		} else if (cofs < 0) {
+			cofs = 0;
+		}
+
+		Channel *needed = groupChain[cofs];
+		if (playerChain.indexOf(needed) == -1) {
+			return invert;
+		}
+
+		int mindepth = cofs + mindesc;
+		int maxdepth = cofs + maxdesc;
+
+		int pdepth = playerChain.count() - 1;
+
+		m = (pdepth >= mindepth) && (pdepth <= maxdepth);
+	} else {
+		QStack<Group *> s;
+
+		p = c;
+
+		while (p) {
+			g = p->qhGroups.value(name);
+
+			if (g) {
+				if ((p != c) && ! g->bInheritable)
+					break;
+				s.push(g);
+				if (! g->bInherit)
+					break;
+			}
+
+			p = p->cParent;
+		}
+
+		while (! s.isEmpty()) {
+			g = s.pop();
+			if (g->qsAdd.contains(pl->iId) || g->qsTemporary.contains(pl->iId) || g->qsTemporary.contains(- static_cast<int>(pl->uiSession)))
+				m = true;
+			if (g->qsRemove.contains(pl->iId))
+				m = false;
+		}
+	}
+	return invert ? !m : m;
+}
+
+static ChanACL::Permissions refPermissions(const User *p, const Identity &id, Channel *chan) {
+	if (p->iId == 0)
+		return static_cast<ChanACL::Permissions>(ChanACL::All &~ (ChanACL::Speak|ChanACL::Whisper));
+
+	QStack<Channel *> chanstack;
+	Channel *ch = chan;
+
+	while (ch) {
+		chanstack.push(ch);
+		ch = ch->cParent;
+	}
+
+	ChanACL::Permissions def = DEFAULT;
+	ChanACL::Permissions granted = def;
+
+	bool traverse = true;
+	bool write = false;
+
+	while (! chanstack.isEmpty()) {
+		ch = chanstack.pop();
+		if (! ch->bInheritACL)
+			granted = def;
+
+		foreach(ChanACL *acl, ch->qlACL) {
+			bool matchUser = (acl->iUserId != -1) && (acl->iUserId == p->iId);
+			bool matchGroup = refIsMember(chan, ch, acl->qsGroup, p, id);
+			if (matchUser || matchGroup) {
+				if (acl->pAllow & ChanACL::Traverse)
+					traverse = true;
+				if (acl->pDeny & ChanACL::Traverse)
+					traverse = false;
+				if (acl->pAllow & ChanACL::Write)
+					write = true;
+				if (acl->pDeny & ChanACL::Write)
+					write = false;
+				if (ch->iId == 0 && chan == ch && acl->bApplyHere) {
+					if (acl->pAllow & ChanACL::Kick)
+						granted |= ChanACL::Kick;
+					if (acl->pAllow & ChanACL::Ban)
+						granted |= ChanACL::Ban;
+					if (acl->pAllow & ChanACL::Register)
+						granted |= ChanACL::Register;
+					if (acl->pAllow & ChanACL::SelfRegister)
+						granted |= ChanACL::SelfRegister;
+				}
+				if ((ch==chan && acl->bApplyHere) || (ch!=chan && acl->bApplySubs)) {
+					granted |= (acl->pAllow & ~(ChanACL::Kick|ChanACL::Ban|ChanACL::Register|ChanACL::SelfRegister|ChanACL::Cached));
+					granted &= ~acl->pDeny;
+				}
+			}
+		}
+		if (! traverse && ! write) {
+			granted = ChanACL::None;
+			break;
+		}
+	}
+
+	if (granted & ChanACL::Write) {
+		granted |= ChanACL::Traverse|ChanACL::Enter|ChanACL::MuteDeafen|ChanACL::Move|ChanACL::MakeChannel|ChanACL::LinkChannel|ChanACL::TextMessage|ChanACL::MakeTempChannel;
+		if (chan->iId == 0)
+			granted |= ChanACL::Kick|ChanACL::Ban|ChanACL::Register|ChanACL::SelfRegister;
+	}
+
+	return granted;
+}
+
+class TestACL : public QObject {
+		Q_OBJECT
+	private:
+		Channel *root, *a, *a1, *a1x, *b;
+		User *u;
+		Identity id;
+		ACLEngine *ae;
+
+		ChanACL *acl(Channel *c, const QString &group, ChanACL::Permissions allow, ChanACL::Permissions deny);
+		ChanACL::Permissions perm(Channel *c);
+		void compareAll(const QList<Channel *> &chans, const QList<User *> &users);
+	private slots:
+		void init();
+		void cleanup();
+		void defaults();
+		void superuser();
+		void allowDeny();
+		void applyHereSubs();
+		void inherit();
+		void traverse();
+		void write();
+		void rootOnly();
+		void builtinGroups();
+		void prefixes();
+		void sub();
+		void namedGroups();
+		void invalidate();
+		void random();
+};
+
+/* The tree used by the hand written cases:
+ *
+ *   root (0)
+ *    +- a (1)
+ *    |   +- a1 (2)
+ *    |       +- a1x (3)
+ *    +- b (4)
+ */
+void TestACL::init() {
+	root = new Channel(0, QLatin1String("Root"));
+	a = new Channel(1, QLatin1String("A"), root);
+	a1 = new Channel(2, QLatin1String("A1"), a);
+	a1x = new Channel(3, QLatin1String("A1X"), a1);
+	b = new Channel(4, QLatin1String("B"), root);
+
+	u = new User();
+	u->uiSession = 7;
+	u->iId = -1;
+	u->cChannel = root;
+
+	id.bVerified = false;
+	id.qslTokens.clear();
+
+	ae = new ACLEngine();
+}
+
+void TestACL::cleanup() {
+	delete ae;
+	delete u;
+	delete root;
+}
+
+ChanACL *TestACL::acl(Channel *c, const QString &group, ChanACL::Permissions allow, ChanACL::Permissions deny) {
+	ChanACL *acl = new ChanACL(c);
+	acl->qsGroup = group;
+	acl->pAllow = allow;
+	acl->pDeny = deny;
+	return acl;
+}
+
+// Checks the engine against the reference before handing out the result.
+ChanACL::Permissions TestACL::perm(Channel *c) {
+	ChanACL::Permissions ref = refPermissions(u, id, c);
+	ChanACL::Permissions p = ae->effectivePermissions(u, id.bVerified, id.qslTokens, c);
+	if (p != ref)
+		qWarning("TestACL: %s: engine 0x%x, reference 0x%x", qPrintable(c->qsName), static_cast<unsigned int>(p), static_cast<unsigned int>(ref));
+	return p;
+}
+
+void TestACL::defaults() {
+	QCOMPARE(perm(root), DEFAULT);
+	QCOMPARE(perm(a1x), DEFAULT);
+}
+
+void TestACL::superuser() {
+	u->iId = 0;
+	acl(root, QLatin1String("all"), ChanACL::None, ChanACL::Traverse);
+	QCOMPARE(perm(a1), static_cast<ChanACL::Permissions>(ChanACL::All &~ (ChanACL::Speak|ChanACL::Whisper)));
+}
+
+void TestACL::allowDeny() {
+	acl(root, QLatin1String("all"), ChanACL::MakeChannel, ChanACL::Speak);
+	acl(a, QLatin1String("all"), ChanACL::Speak, ChanACL::None);
+	QCOMPARE(perm(root), (DEFAULT | ChanACL::MakeChannel) & ~ChanACL::Speak);
+	QCOMPARE(perm(a), DEFAULT | ChanACL::MakeChannel);
+	QCOMPARE(perm(b), (DEFAULT | ChanACL::MakeChannel) & ~ChanACL::Speak);
+
+	// Later entries on the same channel win.
+	acl(a, QLatin1String("all"), ChanACL::None, ChanACL::MakeChannel);
+	ae->invalidate(a);
+	QCOMPARE(perm(a1), DEFAULT);
+}
+
+void TestACL::applyHereSubs() {
+	ChanACL *here = acl(a, QLatin1String("all"), ChanACL::Move, ChanACL::None);
+	here->bApplySubs = false;
+	ChanACL *subs = acl(a, QLatin1String("all"), ChanACL::MuteDeafen, ChanACL::None);
+	subs->bApplyHere = false;
+
+	QCOMPARE(perm(a), DEFAULT | ChanACL::Move);
+	QCOMPARE(perm(a1), DEFAULT | ChanACL::MuteDeafen);
+	QCOMPARE(perm(root), DEFAULT);
+}
+
+void TestACL::inherit() {
+	acl(root, QLatin1String("all"), ChanACL::Move, ChanACL::Enter);
+	a1->bInheritACL = false;
+	QCOMPARE(perm(a), (DEFAULT | ChanACL::Move) & ~ChanACL::Enter);
+	QCOMPARE(perm(a1), DEFAULT);
+	QCOMPARE(perm(a1x), DEFAULT);
+}
+
+void TestACL::traverse() {
+	acl(a, QLatin1String("all"), ChanACL::Enter, ChanACL::Traverse);
+	QCOMPARE(perm(a), ChanACL::Permissions(ChanACL::None));
+	QCOMPARE(perm(a1x), ChanACL::Permissions(ChanACL::None));
+	QCOMPARE(perm(b), DEFAULT);
+
+	// Traverse given back further down, but a already cut the walk short.
+	acl(a1, QLatin1String("all"), ChanACL::Traverse, ChanACL::None);
+	ae->invalidate(a1);
+	QCOMPARE(perm(a1x), ChanACL::Permissions(ChanACL::None));
+}
+
+void TestACL::write() {
+	u->iId = 3;
+	ChanACL *w = acl(root, QString(), ChanACL::Write, ChanACL::Speak);
+	w->iUserId = 3;
+	QCOMPARE(perm(root), static_cast<ChanACL::Permissions>(ChanACL::All &~ ChanACL::Speak));
+	QCOMPARE(perm(a), static_cast<ChanACL::Permissions>(ChanACL::All &~ (ChanACL::Speak|ChanACL::Kick|ChanACL::Ban|ChanACL::Register|ChanACL::SelfRegister)));
+
+	// Write keeps channels reachable even when Traverse is denied.
+	acl(a, QLatin1String("all"), ChanACL::None, ChanACL::Traverse);
+	ae->invalidate(a);
+	QVERIFY(perm(a1) & ChanACL::Traverse);
+}
+
+void TestACL::rootOnly() {
+	acl(root, QLatin1String("all"), ChanACL::Kick|ChanACL::Register, ChanACL::None);
+	acl(a, QLatin1String("all"), ChanACL::Ban, ChanACL::None);
+	QCOMPARE(perm(root), DEFAULT | ChanACL::Kick | ChanACL::Register);
+	QCOMPARE(perm(a), DEFAULT);
+}
+
+void TestACL::builtinGroups() {
+	acl(root, QLatin1String("auth"), ChanACL::Move, ChanACL::None);
+	acl(root, QLatin1String("strong"), ChanACL::MuteDeafen, ChanACL::None);
+	acl(root, QLatin1String("none"), ChanACL::LinkChannel, ChanACL::None);
+	acl(a, QLatin1String("in"), ChanACL::MakeChannel, ChanACL::None);
+	acl(a, QLatin1String("out"), ChanACL::MakeTempChannel, ChanACL::None);
+	acl(a, QString(), ChanACL::None, ChanACL::TextMessage);
+
+	QCOMPARE(perm(root), DEFAULT);
+	QCOMPARE(perm(a), DEFAULT | ChanACL::MakeTempChannel);
+
+	u->iId = 12;
+	id.bVerified = true;
+	u->cChannel = a;
+	QCOMPARE(perm(a), DEFAULT | ChanACL::Move | ChanACL::MuteDeafen | ChanACL::MakeChannel);
+	// "in" and "out" are about the channel asked for, not the one with the ACL.
+	QCOMPARE(perm(a1), DEFAULT | ChanACL::Move | ChanACL::MuteDeafen | ChanACL::MakeTempChannel);
+}
+
+void TestACL::prefixes() {
+	u->cChannel = a;
+	u->qsHash = QLatin1String("0123abcd");
+	id.qslTokens << QLatin1String("Secret");
+
+	acl(a, QLatin1String("~in"), ChanACL::Move, ChanACL::None);
+	acl(a, QLatin1String("!in"), ChanACL::MuteDeafen, ChanACL::None);
+	acl(a, QLatin1String("#secret"), ChanACL::MakeChannel, ChanACL::None);
+	acl(a, QLatin1String("$0123abcd"), ChanACL::LinkChannel, ChanACL::None);
+	acl(a, QLatin1String("!#other"), ChanACL::MakeTempChannel, ChanACL::None);
+	// Nothing left after the prefixes never matches, inverted or not.
+	acl(a, QLatin1String("!"), ChanACL::None, ChanACL::Speak);
+	acl(a, QLatin1String("!~#"), ChanACL::None, ChanACL::Enter);
+
+	const ChanACL::Permissions prefixed = ChanACL::Move | ChanACL::MakeChannel | ChanACL::LinkChannel | ChanACL::MakeTempChannel;
+	QCOMPARE(perm(a), DEFAULT | prefixed);
+	QCOMPARE(perm(a1), DEFAULT | prefixed | ChanACL::MuteDeafen);
+}
+
+void TestACL::sub() {
+	// Strictly below the channel asked for.
+	acl(root, QLatin1String("sub"), ChanACL::Move, ChanACL::None);
+	// Exactly one level below root.
+	acl(root, QLatin1String("~sub,0,1,1"), ChanACL::MuteDeafen, ChanACL::None);
+	// Not two levels below the parent of the channel asked for.
+	acl(root, QLatin1String("!sub,-1,2,2"), ChanACL::MakeChannel, ChanACL::None);
+
+	u->cChannel = a1;
+	QCOMPARE(perm(root), DEFAULT | ChanACL::Move);
+	QCOMPARE(perm(a), DEFAULT | ChanACL::Move);
+	QCOMPARE(perm(a1), DEFAULT | ChanACL::MakeChannel);
+	u->cChannel = a;
+	QCOMPARE(perm(root), DEFAULT | ChanACL::Move | ChanACL::MuteDeafen | ChanACL::MakeChannel);
+	u->cChannel = a1x;
+	QCOMPARE(perm(b), DEFAULT | ChanACL::MakeChannel);
+	QCOMPARE(perm(a), DEFAULT | ChanACL::Move | ChanACL::MakeChannel);
+	u->cChannel = NULL;
+	QCOMPARE(perm(a), DEFAULT | ChanACL::MakeChannel);
+}
+
+void TestACL::namedGroups() {
+	u->iId = 5;
+
+	Group *g = new Group(root, QLatin1String("admin"));
+	g->qsAdd << 5;
+	Group *ga = new Group(a1, QLatin1String("admin"));
+	ga->qsRemove << 5;
+	Group *gb = new Group(b, QLatin1String("admin"));
+	gb->bInherit = false;
+
+	Group *t = new Group(root, QLatin1String("temp"));
+	t->bInheritable = false;
+	t->qsTemporary << -7;
+
+	acl(root, QLatin1String("admin"), ChanACL::Move, ChanACL::None);
+	acl(root, QLatin1String("~admin"), ChanACL::MuteDeafen, ChanACL::None);
+	acl(root, QLatin1String("temp"), ChanACL::MakeChannel, ChanACL::None);
+	acl(a1, QLatin1String("~admin"), ChanACL::LinkChannel, ChanACL::None);
+	acl(a1, QLatin1String("missing"), ChanACL::None, ChanACL::Speak);
+
+	QCOMPARE(perm(root), DEFAULT | ChanACL::Move | ChanACL::MuteDeafen | ChanACL::MakeChannel);
+	QCOMPARE(perm(a), DEFAULT | ChanACL::Move | ChanACL::MuteDeafen);
+	QCOMPARE(perm(a1), DEFAULT | ChanACL::MuteDeafen);
+	QCOMPARE(perm(a1x), DEFAULT | ChanACL::MuteDeafen);
+	QCOMPARE(perm(b), DEFAULT | ChanACL::MuteDeafen);
+
+	// Memberships are read as they are now, without invalidating.
+	ga->qsRemove.clear();
+	gb->qsTemporary << 5;
+	QCOMPARE(perm(a1x), DEFAULT | ChanACL::Move | ChanACL::MuteDeafen | ChanACL::LinkChannel);
+	QCOMPARE(perm(b), DEFAULT | ChanACL::Move | ChanACL::MuteDeafen);
+}
+
+void TestACL::invalidate() {
+	QCOMPARE(perm(a1x), DEFAULT);
+
+	acl(a, QLatin1String("all"), ChanACL::Move, ChanACL::None);
+	QCOMPARE(ae->effectivePermissions(u, id.bVerified, id.qslTokens, a1x), DEFAULT);
+	ae->invalidate(a);
+	QCOMPARE(perm(a1x), DEFAULT | ChanACL::Move);
+
+	// Moving a1 under b.
+	a->removeChannel(a1);
+	b->addChannel(a1);
+	ae->invalidate(a1);
+	QCOMPARE(perm(a1x), DEFAULT);
+
+	Group *g = new Group(b, QLatin1String("late"));
+	g->qsTemporary << -7;
+	acl(a1, QLatin1String("late"), ChanACL::MakeChannel, ChanACL::None);
+	ae->invalidate(b);
+	QCOMPARE(perm(a1x), DEFAULT | ChanACL::MakeChannel);
+
+	ae->clear();
+	QCOMPARE(perm(a1x), DEFAULT | ChanACL::MakeChannel);
+}
+
+static const char *groupNames[] = {
+	"", "all", "auth", "strong", "in", "out", "none", "!in", "~in", "~out", "!~in",
+	"sub", "sub,1", "~sub,0,1", "sub,-1", "!sub,1,2,3", "~sub,,,1", "sub,5", "subway",
+	"#tok", "#TOK", "!#tok", "$hash", "!$hash", "!", "~", "#",
+	"admin", "~admin", "!admin", "mod", "~mod", "!~mod", "x",
+};
+
+static ChanACL::Permissions randomPerms() {
+	ChanACL::Permissions p = ChanACL::None;
+	for (int i=0;i<20;++i)
+		if ((ChanACL::All & (1 << i)) && ((qrand() % 6) == 0))
+			p |= static_cast<ChanACL::Perm>(1 << i);
+	return p;
+}
+
+void TestACL::compareAll(const QList<Channel *> &chans, const QList<User *> &users) {
+	foreach(User *user, users) {
+		Identity ident;
+		ident.bVerified = (user->uiSession % 2) == 0;
+		if (user->uiSession % 3)
+			ident.qslTokens << QLatin1String("Tok");
+
+		foreach(Channel *c, chans) {
+			ChanACL::Permissions ref = refPermissions(user, ident, c);
+			ChanACL::Permissions p = ae->effectivePermissions(user, ident.bVerified, ident.qslTokens, c);
+			if (p != ref)
+				qWarning("TestACL: user %d in %s asking for %s", user->iId, user->cChannel ? qPrintable(user->cChannel->qsName) : "nowhere", qPrintable(c->qsName));
+			QCOMPARE(p, ref);
+		}
+	}
+}
+
+void TestACL::random() {
+	qsrand(1);
+
+	const int ngroups = sizeof(groupNames) / sizeof(groupNames[0]);
+
+	for (int round=0;round<200;++round) {
+		QList<Channel *> chans;
+		Channel *top = new Channel(0, QLatin1String("Root"));
+		chans << top;
+
+		const int count = 2 + qrand() % 14;
+		for (int i=1;i<count;++i) {
+			Channel *parent = chans.at(qrand() % chans.count());
+			Channel *c = new Channel(i, QString::number(i), parent);
+			c->bInheritACL = (qrand() % 5) != 0;
+			chans << c;
+		}
+
+		foreach(Channel *c, chans) {
+			const char *names[] = { "admin", "mod", "x" };
+			for (int i=0;i<3;++i) {
+				if (qrand() % 3)
+					continue;
+				Group *g = new Group(c, QLatin1String(names[i]));
+				g->bInherit = (qrand() % 4) != 0;
+				g->bInheritable = (qrand() % 4) != 0;
+				for (int j=0;j<3;++j) {
+					if (qrand() % 2)
+						g->qsAdd << (qrand() % 6);
+					if (qrand() % 3 == 0)
+						g->qsRemove << (qrand() % 6);
+					if (qrand() % 3 == 0)
+						g->qsTemporary << -(qrand() % 6);
+				}
+			}
+
+			const int nacl = qrand() % 4;
+			for (int i=0;i<nacl;++i) {
+				ChanACL *entry = new ChanACL(c);
+				entry->bApplyHere = (qrand() % 4) != 0;
+				entry->bApplySubs = (qrand() % 4) != 0;
+				if (qrand() % 5 == 0)
+					entry->iUserId = qrand() % 6;
+				else
+					entry->qsGroup = QLatin1String(groupNames[qrand() % ngroups]);
+				entry->pAllow = randomPerms();
+				entry->pDeny = randomPerms();
+				// Keep most trees traversable so the deeper rules matter.
+				if (qrand() % 3)
+					entry->pDeny &= ~ChanACL::Traverse;
+			}
+		}
+
+		QList<User *> users;
+		for (int i=0;i<6;++i) {
+			User *user = new User();
+			user->uiSession = i + 1;
+			user->iId = (i == 0) ? -1 : i;
+			user->qsHash = (i % 2) ? QLatin1String("hash") : QLatin1String("other");
+			user->cChannel = (i == 5) ? NULL : chans.at(qrand() % chans.count());
+			users << user;
+		}
+
+		compareAll(chans, users);
+
+		// Move a subtree and check again with what the engine kept.
+		if (chans.count() > 3) {
+			Channel *c = chans.at(1 + qrand() % (chans.count() - 1));
+			Channel *p = chans.at(qrand() % chans.count());
+			bool loop = false;
+			for (Channel *q = p; q; q = q->cParent)
+				if (q == c)
+					loop = true;
+			if (! loop) {
+				c->cParent->removeChannel(c);
+				p->addChannel(c);
+				ae->invalidate(c);
+				compareAll(chans, users);
+			}
+		}
+
+		qDeleteAll(users);
+		ae->clear();
+		delete top;
+	}
+}
+
+QTEST_MAIN(TestACL)
+#include "TestACL.moc"
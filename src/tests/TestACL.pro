@@ -0,0 +1,9 @@
+TEMPLATE = app
+CONFIG += qt warn_on qtestlib
+CONFIG -= app_bundle
+LANGUAGE = C++
+TARGET = TestACL
+SOURCES = TestACL.cpp ACLEngine.cpp ACL.cpp Channel.cpp Group.cpp User.cpp
+HEADERS = ACLEngine.h ACL.h Channel.h Group.h User.h
+VPATH += .. ../murmur
+INCLUDEPATH += .. ../murmur ../mumble
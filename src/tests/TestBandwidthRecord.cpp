@@ -0,0 +1,171 @@
+#include <QtCore>
+#include <QtTest>
+
+#include "Timer.h"
+#include "BandwidthRecord.h"
+
+#define START 1000000000ULL
+#define MAXPERSEC 9000
+
+// The limiter BandwidthRecord replaced, with the clock passed in: a packet
+// is accepted if the last 360 accepted packets plus this one, divided by
+// the time since the oldest of them, stay within the limit.
+class RingRecord {
+	public:
+		int iRecNum;
+		int iSum;
+		int a_iBW[360];
+		quint64 a_uiWhen[360];
+
+		RingRecord(quint64 now);
+		bool addFrame(int size, int maxpersec, quint64 now);
+};
+
+RingRecord::RingRecord(quint64 now) {
+	iRecNum = 0;
+	iSum = 0;
+	for (int i=0;i<360;++i) {
+		a_iBW[i] = 0;
+		a_uiWhen[i] = now;
+	}
+}
+
+bool RingRecord::addFrame(int size, int maxpersec, quint64 now) {
+	quint64 elapsed = now - a_uiWhen[iRecNum];
+	if (elapsed == 0)
+		return false;
+
+	int nsum = iSum - a_iBW[iRecNum] + size;
+	if (static_cast<int>((nsum * 1000000LL) / elapsed) > maxpersec)
+		return false;
+
+	a_iBW[iRecNum] = size;
+	a_uiWhen[iRecNum] = now;
+	iSum = nsum;
+	iRecNum = (iRecNum + 1) % 360;
+	return true;
+}
+
+struct Packet {
+	quint64 uiWhen;
+	int iSize;
+};
+
+class TestBandwidthRecord : public QObject {
+		Q_OBJECT
+	private:
+		QVector<Packet> stream(quint64 start, quint64 interval, int size, int count);
+		void compare(const QVector<Packet> &packets, int &ring, int &bucket);
+	private slots:
+		void connectBurst();
+		void underLimit();
+		void overLimit();
+		void burstAfterSilence();
+		void mixed();
+		void sameTime();
+		void bandwidth();
+};
+
+QVector<Packet> TestBandwidthRecord::stream(quint64 start, quint64 interval, int size, int count) {
+	QVector<Packet> packets;
+	for (int i=0;i<count;++i) {
+		Packet p;
+		p.uiWhen = start + interval * (i + 1);
+		p.iSize = size;
+		packets << p;
+	}
+	return packets;
+}
+
+// Feeds packets to both limiters, returning the bytes each accepted.
+void TestBandwidthRecord::compare(const QVector<Packet> &packets, int &ring, int &bucket) {
+	RingRecord rr(START);
+	BandwidthRecord br(START);
+
+	ring = bucket = 0;
+	foreach(const Packet &p, packets) {
+		if (rr.addFrame(p.iSize, MAXPERSEC, p.uiWhen))
+			ring += p.iSize;
+		if (br.addFrame(p.iSize, MAXPERSEC, p.uiWhen))
+			bucket += p.iSize;
+	}
+}
+
+void TestBandwidthRecord::connectBurst() {
+	int ring, bucket;
+
+	// 180 bytes take 20ms at the limit.
+	compare(stream(START, 1000, 180, 1), ring, bucket);
+	QCOMPARE(ring, 0);
+	QCOMPARE(bucket, 0);
+
+	compare(stream(START, 40000, 180, 1), ring, bucket);
+	QCOMPARE(ring, 180);
+	QCOMPARE(bucket, 180);
+}
+
+void TestBandwidthRecord::underLimit() {
+	int ring, bucket;
+
+	// 7600 bytes per second.
+	compare(stream(START, 20000, 152, 3000), ring, bucket);
+	QCOMPARE(ring, 152 * 3000);
+	QCOMPARE(bucket, ring);
+}
+
+void TestBandwidthRecord::overLimit() {
+	int ring, bucket;
+
+	// 21200 bytes per second for a minute.
+	compare(stream(START, 10000, 212, 6000), ring, bucket);
+	QCOMPARE(bucket, ring);
+	QVERIFY(bucket <= MAXPERSEC * 60);
+	QVERIFY(bucket > MAXPERSEC * 59);
+}
+
+void TestBandwidthRecord::burstAfterSilence() {
+	int ring, bucket;
+
+	// A second at twice the limit after ten seconds of silence.
+	compare(stream(START + 10000000ULL, 10000, 180, 100), ring, bucket);
+	QCOMPARE(ring, 180 * 100);
+	QCOMPARE(bucket, ring);
+
+	// Credit is only saved up for BANDWIDTH_BURST_USEC.
+	compare(stream(START + 60000000ULL, 1000, 180, 1000), ring, bucket);
+	QVERIFY(bucket <= static_cast<int>((BANDWIDTH_BURST_USEC + 1000000ULL) * MAXPERSEC / 1000000ULL));
+}
+
+void TestBandwidthRecord::mixed() {
+	int ring, bucket;
+
+	// Half a minute under the limit, then half a minute over it. Credit left
+	// from the first half may differ by at most the saved up burst.
+	QVector<Packet> packets = stream(START, 20000, 152, 1500);
+	packets << stream(START + 30000000ULL, 10000, 212, 3000);
+	compare(packets, ring, bucket);
+	QVERIFY(qAbs(bucket - ring) <= static_cast<int>(BANDWIDTH_BURST_USEC * MAXPERSEC / 1000000ULL));
+}
+
+void TestBandwidthRecord::sameTime() {
+	BandwidthRecord br(START);
+
+	QVERIFY(br.addFrame(100, MAXPERSEC, START + 1000000ULL));
+	QVERIFY(br.addFrame(100, MAXPERSEC, START + 1000000ULL));
+	QVERIFY(! br.addFrame(100, 0, START + 2000000ULL));
+}
+
+void TestBandwidthRecord::bandwidth() {
+	BandwidthRecord br(START);
+
+	foreach(const Packet &p, stream(START, 20000, 152, 500))
+		QVERIFY(br.addFrame(p.iSize, MAXPERSEC, p.uiWhen));
+
+	const quint64 last = START + 20000ULL * 500;
+	QVERIFY(qAbs(br.bandwidth(last) - 7600) <= 7600 / 20);
+	QVERIFY(qAbs(br.bandwidth(last + 500000ULL) - 3800) <= 7600 / 20);
+	QCOMPARE(br.bandwidth(last + 3000000ULL), 0);
+}
+
+QTEST_MAIN(TestBandwidthRecord)
+#include "TestBandwidthRecord.moc"
@@ -0,0 +1,9 @@
+TEMPLATE = app
+CONFIG += qt warn_on qtestlib
+CONFIG -= app_bundle
+LANGUAGE = C++
+TARGET = TestBandwidthRecord
+SOURCES = TestBandwidthRecord.cpp BandwidthRecord.cpp Timer.cpp
+HEADERS = Timer.h BandwidthRecord.h
+VPATH += .. ../murmur
+INCLUDEPATH += .. ../murmur ../mumble
@@ -0,0 +1,58 @@
+#include <QtCore>
+#include <QtTest>
+
+#include "BlobCache.h"
+
+class TestBlobCache : public QObject {
+		Q_OBJECT
+	private slots:
+		void find();
+		void budget();
+		void shared();
+};
+
+void TestBlobCache::find() {
+	BlobCache bc(1024);
+
+	QVERIFY(bc.find("a").isNull());
+	bc.insert("a", QByteArray(100, 'a'));
+	QCOMPARE(bc.find("a"), QByteArray(100, 'a'));
+	QCOMPARE(bc.hits(), Q_UINT64_C(1));
+	QCOMPARE(bc.misses(), Q_UINT64_C(1));
+
+	bc.remove("a");
+	QVERIFY(bc.find("a").isNull());
+	QCOMPARE(bc.count(), 0);
+}
+
+void TestBlobCache::budget() {
+	BlobCache bc(1000);
+
+	bc.insert("a", QByteArray(400, 'a'));
+	bc.insert("b", QByteArray(400, 'b'));
+	QCOMPARE(bc.bytes(), 800);
+
+	// Using a makes b the least recently used.
+	QVERIFY(! bc.find("a").isNull());
+	bc.insert("c", QByteArray(400, 'c'));
+	QVERIFY(bc.find("b").isNull());
+	QVERIFY(! bc.find("a").isNull());
+	QVERIFY(! bc.find("c").isNull());
+	QCOMPARE(bc.bytes(), 800);
+
+	// Larger than the whole budget.
+	bc.insert("d", QByteArray(2000, 'd'));
+	QVERIFY(bc.find("d").isNull());
+	QCOMPARE(bc.count(), 2);
+}
+
+void TestBlobCache::shared() {
+	BlobCache bc(1024);
+
+	const QByteArray qba(500, 'x');
+	bc.insert("x", qba);
+	QCOMPARE(bc.find("x").constData(), qba.constData());
+}
+
+QTEST_MAIN(TestBlobCache)
+#include "TestBlobCache.moc"
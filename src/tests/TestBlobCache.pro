@@ -0,0 +1,9 @@
+TEMPLATE = app
+CONFIG += qt warn_on qtestlib
+CONFIG -= app_bundle
+LANGUAGE = C++
+TARGET = TestBlobCache
+SOURCES = TestBlobCache.cpp BlobCache.cpp
+HEADERS = BlobCache.h
+VPATH += .. ../murmur
+INCLUDEPATH += .. ../murmur ../mumble
@@ -12,6 +12,7 @@ class TestCrypt : public QObject {
 		void ivrecovery();
 		void reverserecovery();
 		void tamper();
+		void implementations();
 };
 
 void TestCrypt::reverserecovery() {
@@ -181,6 +182,43 @@ void TestCrypt::authcrypt() {
 	}
 }
 
+void TestCrypt::implementations() {
+	// The accelerated OCB (if the CPU has one) must match the portable one.
+	const unsigned char rawkey[AES_BLOCK_SIZE] = {0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f};
+	const unsigned char nonce[AES_BLOCK_SIZE] = {0xff, 0xee, 0xdd, 0xcc, 0xbb, 0xaa, 0x99, 0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11, 0x00};
+
+	CryptState fast, portable;
+	fast.setKey(rawkey, nonce, nonce);
+	portable.setKey(rawkey, nonce, nonce);
+	portable.bAESNI = false;
+
+	for (int len=0;len<256;len++) {
+		unsigned char src[256];
+		for (int i=0;i<len;i++)
+			src[i] = static_cast<unsigned char>(i * 7 + len);
+
+		unsigned char fasttag[AES_BLOCK_SIZE], portabletag[AES_BLOCK_SIZE];
+		unsigned char fastenc[256], portableenc[256];
+		unsigned char decrypted[256];
+
+		fast.ocb_encrypt(src, fastenc, len, nonce, fasttag);
+		portable.ocb_encrypt(src, portableenc, len, nonce, portabletag);
+
+		for (int i=0;i<AES_BLOCK_SIZE;i++)
+			QCOMPARE(fasttag[i], portabletag[i]);
+		for (int i=0;i<len;i++)
+			QCOMPARE(fastenc[i], portableenc[i]);
+
+		fast.ocb_decrypt(portableenc, decrypted, len, nonce, fasttag);
+		portable.ocb_decrypt(fastenc, src, len, nonce, portabletag);
+
+		for (int i=0;i<AES_BLOCK_SIZE;i++)
+			QCOMPARE(fasttag[i], portabletag[i]);
+		for (int i=0;i<len;i++)
+			QCOMPARE(decrypted[i], src[i]);
+	}
+}
+
 void TestCrypt::tamper() {
 	const unsigned char rawkey[AES_BLOCK_SIZE] = {0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f};
 	const unsigned char nonce[AES_BLOCK_SIZE] = {0xff, 0xee, 0xdd, 0xcc, 0xbb, 0xaa, 0x99, 0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11, 0x00};
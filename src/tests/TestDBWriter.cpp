@@ -0,0 +1,97 @@
+#include <QtCore>
+#include <QtSql>
+#include <QtTest>
+
+#include "DBWriter.h"
+#include "Timer.h"
+
+// ServerDB::User_Email
+#define USER_EMAIL 1
+
+class TestDBWriter : public QObject {
+		Q_OBJECT
+		QString qsFile;
+		QSqlDatabase db;
+		int count(const QString &sql);
+	private slots:
+		void init();
+		void cleanup();
+		void registerQueued();
+};
+
+void TestDBWriter::init() {
+	qsFile = QDir::temp().filePath(QString::fromLatin1("TestDBWriter-%1.sqlite").arg(QCoreApplication::applicationPid()));
+	QFile::remove(qsFile);
+
+	db = QSqlDatabase::addDatabase(QLatin1String("QSQLITE"));
+	db.setDatabaseName(qsFile);
+	QVERIFY(db.open());
+
+	QSqlQuery query(db);
+	QVERIFY(query.exec(QLatin1String("CREATE TABLE `users` (`server_id` INTEGER NOT NULL, `user_id` INTEGER NOT NULL, `name` TEXT NOT NULL, `lastchannel` INTEGER, PRIMARY KEY (`server_id`, `user_id`))")));
+	QVERIFY(query.exec(QLatin1String("CREATE TABLE `user_info` (`server_id` INTEGER NOT NULL, `user_id` INTEGER NOT NULL, `key` INTEGER, `value` TEXT, PRIMARY KEY (`server_id`, `user_id`, `key`))")));
+	QVERIFY(query.exec(QLatin1String("CREATE TABLE `slog` (`server_id` INTEGER NOT NULL, `msg` TEXT, `msgtime` DATE DEFAULT CURRENT_TIMESTAMP)")));
+	QVERIFY(query.exec(QLatin1String("INSERT INTO `users` (`server_id`, `user_id`, `name`) VALUES (1, 1, 'old')")));
+}
+
+void TestDBWriter::cleanup() {
+	db.close();
+	db = QSqlDatabase();
+	QSqlDatabase::removeDatabase(QLatin1String(QSqlDatabase::defaultConnection));
+	QFile::remove(qsFile);
+}
+
+int TestDBWriter::count(const QString &sql) {
+	QSqlQuery query(db);
+	if (! query.exec(sql) || ! query.next())
+		return -1;
+	return query.value(0).toInt();
+}
+
+/* What Server::registerUser() does while other users' writes are still
+ * queued: flush, then write the new user in one transaction on the main
+ * connection. The writer has to be idle by then; if it were still writing,
+ * SQLite would make one side wait out the busy timeout.
+ */
+void TestDBWriter::registerQueued() {
+	// Long enough that nothing is written unless flushed.
+	DBWriter dbw(db, QString(), 60000, 0);
+
+	dbw.setLastChannel(1, 1, 5);
+	dbw.setInfo(1, 1, USER_EMAIL, QLatin1String("old@example.com"));
+	dbw.log(1, QLatin1String("old joined"));
+
+	int cid = -1;
+	QVERIFY(dbw.lastChannel(1, 1, cid));
+	QCOMPARE(cid, 5);
+	QCOMPARE(count(QLatin1String("SELECT COUNT(*) FROM `slog`")), 0);
+
+	Timer t;
+	dbw.flush();
+	QVERIFY(t.elapsed() < 10000000ULL);
+
+	QVERIFY(! dbw.lastChannel(1, 1, cid));
+	QCOMPARE(count(QLatin1String("SELECT `lastchannel` FROM `users` WHERE `user_id` = 1")), 5);
+	QCOMPARE(count(QLatin1String("SELECT COUNT(*) FROM `user_info` WHERE `user_id` = 1")), 1);
+	QCOMPARE(count(QLatin1String("SELECT COUNT(*) FROM `slog`")), 1);
+
+	QVERIFY(db.transaction());
+	QSqlQuery query(db);
+	QVERIFY(query.exec(QLatin1String("REPLACE INTO `users` (`server_id`, `user_id`, `name`) VALUES (1, 2, 'new')")));
+	QVERIFY(query.exec(QLatin1String("REPLACE INTO `user_info` (`server_id`, `user_id`, `key`, `value`) VALUES (1, 2, 1, 'new@example.com')")));
+	// Queued meanwhile; stays queued until the transaction is committed.
+	dbw.log(1, QLatin1String("new registered"));
+	query.clear();
+	QVERIFY(db.commit());
+
+	t.restart();
+	dbw.flush();
+	QVERIFY(t.elapsed() < 10000000ULL);
+
+	QCOMPARE(count(QLatin1String("SELECT COUNT(*) FROM `users`")), 2);
+	QCOMPARE(count(QLatin1String("SELECT COUNT(*) FROM `user_info`")), 2);
+	QCOMPARE(count(QLatin1String("SELECT COUNT(*) FROM `slog`")), 2);
+}
+
+QTEST_MAIN(TestDBWriter)
+#include "TestDBWriter.moc"
@@ -0,0 +1,10 @@
+TEMPLATE = app
+CONFIG += qt warn_on qtestlib
+CONFIG -= app_bundle
+QT *= sql
+LANGUAGE = C++
+TARGET = TestDBWriter
+SOURCES = TestDBWriter.cpp DBWriter.cpp Timer.cpp
+HEADERS = DBWriter.h Timer.h
+VPATH += .. ../murmur
+INCLUDEPATH += .. ../murmur ../mumble
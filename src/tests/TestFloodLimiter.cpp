@@ -0,0 +1,98 @@
+#include <QtCore>
+#include <QtTest>
+
+#include "FloodLimiter.h"
+
+#define START 100000
+
+static HostAddress v4(quint32 ip) {
+	HostAddress ha;
+	ha.shorts[5] = 0xffff;
+	ha.hash[3] = qToBigEndian(ip);
+	return ha;
+}
+
+class TestFloodLimiter : public QObject {
+		Q_OBJECT
+	private slots:
+		void limit();
+		void window();
+		void subnet();
+		void flood();
+};
+
+// The defaults: 10 attempts in 120 seconds, banned for 300.
+void TestFloodLimiter::limit() {
+	FloodLimiter fl(1);
+	fl.configure(10, 0, 120, 300);
+
+	const HostAddress ha = v4(0x0a000001);
+	for (int i=0;i<10;++i)
+		QCOMPARE(fl.check(ha, START + i), FloodLimiter::Allowed);
+	QCOMPARE(fl.check(ha, START + 10), FloodLimiter::NewBan);
+	QCOMPARE(fl.check(ha, START + 11), FloodLimiter::Banned);
+	QCOMPARE(fl.check(ha, START + 309), FloodLimiter::Banned);
+
+	QCOMPARE(fl.check(v4(0x0a000002), START + 12), FloodLimiter::Allowed);
+
+	// The attempts made while banned don't count.
+	QCOMPARE(fl.check(ha, START + 310), FloodLimiter::Allowed);
+}
+
+void TestFloodLimiter::window() {
+	FloodLimiter fl(2);
+	fl.configure(10, 0, 120, 300);
+
+	// One attempt every 20 seconds is 6 per timeframe, forever.
+	const HostAddress ha = v4(0x0a000001);
+	for (int i=0;i<1000;++i)
+		QCOMPARE(fl.check(ha, START + i * 20), FloodLimiter::Allowed);
+
+	// One every 10 seconds is over the limit within two timeframes.
+	bool banned = false;
+	for (int i=0;(i<24) && ! banned;++i)
+		banned = (fl.check(ha, START + 20000 + i * 10) != FloodLimiter::Allowed);
+	QVERIFY(banned);
+}
+
+void TestFloodLimiter::subnet() {
+	FloodLimiter fl(3);
+	fl.configure(10, 50, 120, 300);
+
+	for (int i=0;i<50;++i)
+		QCOMPARE(fl.check(v4(0x0a000100 + i), START), FloodLimiter::Allowed);
+	QCOMPARE(fl.check(v4(0x0a000100 + 50), START), FloodLimiter::NewBan);
+	QCOMPARE(fl.check(v4(0x0a0001ff), START + 1), FloodLimiter::Banned);
+	QCOMPARE(fl.check(v4(0x0a000200), START + 1), FloodLimiter::Allowed);
+}
+
+/* A million addresses over 100 timeframes: the memory used stays the same,
+ * a repeat offender among them is still caught, and a user who connects a
+ * few times gets through.
+ */
+void TestFloodLimiter::flood() {
+	FloodLimiter fl(4);
+	fl.configure(10, 0, 120, 300);
+
+	const int memory = fl.memoryUsage();
+	const HostAddress user = v4(0xc0a80001);
+	const HostAddress bot = v4(0xc0a80002);
+	int botbanned = 0;
+
+	qsrand(4);
+	for (int i=0;i<1000000;++i) {
+		const quint32 now = START + i / 80;
+		fl.check(v4((static_cast<quint32>(qrand()) << 16) ^ static_cast<quint32>(qrand())), now);
+
+		if ((i % 10000) == 0)
+			QCOMPARE(fl.check(user, now), FloodLimiter::Allowed);
+		if (((i % 1000) == 0) && (fl.check(bot, now) != FloodLimiter::Allowed))
+			++botbanned;
+	}
+
+	QCOMPARE(fl.memoryUsage(), memory);
+	QVERIFY(botbanned > 0);
+}
+
+QTEST_MAIN(TestFloodLimiter)
+#include "TestFloodLimiter.moc"
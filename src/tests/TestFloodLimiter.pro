@@ -0,0 +1,10 @@
+TEMPLATE = app
+CONFIG += qt warn_on qtestlib
+CONFIG -= app_bundle
+QT *= network
+LANGUAGE = C++
+TARGET = TestFloodLimiter
+SOURCES = TestFloodLimiter.cpp FloodLimiter.cpp Net.cpp
+HEADERS = FloodLimiter.h Net.h
+VPATH += .. ../murmur
+INCLUDEPATH += .. ../murmur ../mumble
@@ -0,0 +1,198 @@
+#include <QtCore>
+#include <QtTest>
+
+#include "LogWriter.h"
+
+#define PRODUCERS 4
+#define PER_PRODUCER 200000
+
+// Pushes PER_PRODUCER entries numbered from 0, waiting whenever the ring
+// is full.
+class Producer : public QThread {
+	public:
+		LogRing *lrRing;
+		char cId;
+		Producer(LogRing *ring, char id) : lrRing(ring), cId(id) { }
+		void run() {
+			LogRing::Entry e;
+			e.cType = cId;
+			for (int i=0;i<PER_PRODUCER;++i) {
+				e.iTime = i;
+				e.qsMsg = QString::number(i);
+				while (! lrRing->push(e))
+					yieldCurrentThread();
+			}
+		}
+};
+
+// Adds lines to a LogWriter, and so may wait on it.
+class Adder : public QThread {
+	public:
+		LogWriter *lwLog;
+		int iLines;
+		Adder(LogWriter *lw, int lines) : lwLog(lw), iLines(lines) { }
+		void run() {
+			for (int i=0;i<iLines;++i)
+				lwLog->add('W', QString::fromLatin1("line %1").arg(i));
+		}
+};
+
+class TestLogWriter : public QObject {
+		Q_OBJECT
+		QString qsFile;
+		QStringList lines();
+	private slots:
+		void init();
+		void cleanup();
+		void ring();
+		void stress();
+		void drop();
+		void block();
+};
+
+void TestLogWriter::init() {
+	qsFile = QDir::temp().filePath(QString::fromLatin1("TestLogWriter-%1.log").arg(QCoreApplication::applicationPid()));
+	QFile::remove(qsFile);
+}
+
+void TestLogWriter::cleanup() {
+	QFile::remove(qsFile);
+}
+
+QStringList TestLogWriter::lines() {
+	QFile f(qsFile);
+	if (! f.open(QIODevice::ReadOnly | QIODevice::Text))
+		return QStringList();
+	QStringList l = QString::fromUtf8(f.readAll()).split(QLatin1Char('\n'));
+	if (! l.isEmpty() && l.last().isEmpty())
+		l.removeLast();
+	return l;
+}
+
+void TestLogWriter::ring() {
+	LogRing lr(3);
+	QCOMPARE(lr.size(), 4);
+	QVERIFY(lr.isEmpty());
+
+	LogRing::Entry e;
+	e.cType = 'W';
+	// Several laps, to get every slot handed back at least twice.
+	for (int lap=0;lap<3;++lap) {
+		for (int i=0;i<4;++i) {
+			e.iTime = lap * 4 + i;
+			QVERIFY(lr.push(e));
+		}
+		QVERIFY(! lr.push(e));
+
+		for (int i=0;i<4;++i) {
+			QVERIFY(lr.pop(e));
+			QCOMPARE(e.iTime, static_cast<qint64>(lap * 4 + i));
+		}
+		QVERIFY(lr.isEmpty());
+		QVERIFY(! lr.pop(e));
+	}
+}
+
+/* Several producers against one consumer on a ring far smaller than what
+ * goes through it, so it wraps thousands of times and is full much of
+ * the time. Every entry has to come out exactly once, and each producer's
+ * entries in the order they went in.
+ */
+void TestLogWriter::stress() {
+	LogRing lr(64);
+
+	QList<Producer *> producers;
+	for (int p=0;p<PRODUCERS;++p)
+		producers << new Producer(&lr, static_cast<char>(p));
+	foreach(Producer *p, producers)
+		p->start();
+
+	QVector<qint64> next(PRODUCERS, 0);
+	LogRing::Entry e;
+	int total = 0;
+	while (total < PRODUCERS * PER_PRODUCER) {
+		if (! lr.pop(e)) {
+			QThread::yieldCurrentThread();
+			continue;
+		}
+		const int p = e.cType;
+		QVERIFY(p >= 0 && p < PRODUCERS);
+		QCOMPARE(e.iTime, next.at(p));
+		QCOMPARE(e.qsMsg, QString::number(e.iTime));
+		++next[p];
+		++total;
+	}
+
+	foreach(Producer *p, producers)
+		QVERIFY(p->wait(10000));
+	qDeleteAll(producers);
+
+	QVERIFY(lr.isEmpty());
+	for (int p=0;p<PRODUCERS;++p)
+		QCOMPARE(next.at(p), static_cast<qint64>(PER_PRODUCER));
+}
+
+/* With logqueuedrop, lines that don't fit are counted and dropped, and
+ * the writer notes how many once it gets to run.
+ */
+void TestLogWriter::drop() {
+	QFile f(qsFile);
+	QVERIFY(f.open(QIODevice::WriteOnly | QIODevice::Text));
+
+	{
+		// Not started yet, so nothing leaves the ring.
+		LogWriter lw(&f, NULL, 2, true);
+		for (int i=0;i<10;++i)
+			lw.add('W', QString::fromLatin1("line %1").arg(i));
+		QCOMPARE(lw.dropped(), 8);
+		QCOMPARE(lw.blocked(), 0);
+		QVERIFY(lw.text().contains("\nmurmur_log_dropped_total 8\n"));
+		QVERIFY(lw.text().contains("\nmurmur_log_blocked_total 0\n"));
+
+		lw.start();
+		lw.flush();
+	}
+	f.close();
+
+	const QStringList l = lines();
+	QCOMPARE(l.count(), 3);
+	QVERIFY(l.at(0).endsWith(QLatin1String(" 8 log messages were dropped, the log file could not keep up")));
+	QVERIFY(l.at(1).endsWith(QLatin1String(" line 0")));
+	QVERIFY(l.at(2).endsWith(QLatin1String(" line 1")));
+}
+
+/* Without it, the caller waits for room; nothing is lost and the order
+ * is kept.
+ */
+void TestLogWriter::block() {
+	QFile f(qsFile);
+	QVERIFY(f.open(QIODevice::WriteOnly | QIODevice::Text));
+
+	{
+		LogWriter lw(&f, NULL, 2, false);
+		Adder a(&lw, 100);
+		a.start();
+
+		QTime t;
+		t.start();
+		while ((lw.blocked() == 0) && (t.elapsed() < 10000))
+			QTest::qSleep(1);
+		QCOMPARE(lw.blocked(), 1);
+		QVERIFY(! a.isFinished());
+
+		lw.start();
+		QVERIFY(a.wait(10000));
+		lw.flush();
+		QCOMPARE(lw.dropped(), 0);
+		QVERIFY(lw.blocked() >= 1);
+	}
+	f.close();
+
+	const QStringList l = lines();
+	QCOMPARE(l.count(), 100);
+	for (int i=0;i<100;++i)
+		QVERIFY(l.at(i).endsWith(QString::fromLatin1(" line %1").arg(i)));
+}
+
+QTEST_MAIN(TestLogWriter)
+#include "TestLogWriter.moc"
@@ -0,0 +1,9 @@
+TEMPLATE = app
+CONFIG += qt thread warn_on qtestlib
+CONFIG -= app_bundle
+LANGUAGE = C++
+TARGET = TestLogWriter
+SOURCES = TestLogWriter.cpp LogWriter.cpp
+HEADERS = LogWriter.h
+VPATH += .. ../murmur
+INCLUDEPATH += .. ../murmur ../mumble
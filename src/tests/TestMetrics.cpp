@@ -0,0 +1,74 @@
+#include <QtCore>
+#include <QtTest>
+
+#include "Metrics.h"
+
+class TestMetrics : public QObject {
+		Q_OBJECT
+	private slots:
+		void buckets();
+		void percentile();
+		void text();
+};
+
+void TestMetrics::buckets() {
+	int last = -1;
+	for (quint64 ns = 0; ns < Q_UINT64_C(1) << 40; ns = ns * 9 / 8 + 1) {
+		const int b = LatencyHistogram::bucket(ns);
+		QVERIFY(b >= last);
+		QVERIFY(ns < LatencyHistogram::upperBound(b));
+		if (b > 0)
+			QVERIFY(ns >= LatencyHistogram::upperBound(b - 1));
+		last = b;
+	}
+	QCOMPARE(LatencyHistogram::bucket(~Q_UINT64_C(0)), LatencyHistogram::iBuckets - 1);
+
+	// Powers of two are bucket bounds, so histogram buckets there are exact.
+	for (int bit = 2; bit <= 40; ++bit)
+		QCOMPARE(LatencyHistogram::upperBound(LatencyHistogram::bucket((Q_UINT64_C(1) << bit) - 1)), Q_UINT64_C(1) << bit);
+}
+
+void TestMetrics::percentile() {
+	LatencyHistogram lh;
+	QCOMPARE(lh.percentile(0.5), Q_UINT64_C(0));
+
+	for (quint64 i = 1; i <= 1000; ++i)
+		lh.add(i * 1000);
+	QCOMPARE(lh.uiCount, Q_UINT64_C(1000));
+	QCOMPARE(lh.uiSum, Q_UINT64_C(500500000));
+
+	const quint64 p50 = lh.percentile(0.5);
+	QVERIFY(p50 > 500000 && p50 <= 625000);
+	const quint64 p99 = lh.percentile(0.99);
+	QVERIFY(p99 > 990000 && p99 <= 1237500);
+
+	QCOMPARE(lh.countBelow(1024), Q_UINT64_C(1));
+	QCOMPARE(lh.countBelow(Q_UINT64_C(1) << 30), Q_UINT64_C(1000));
+
+	LatencyHistogram other;
+	other.add(5);
+	lh.merge(other);
+	QCOMPARE(lh.uiCount, Q_UINT64_C(1001));
+	QCOMPARE(lh.countBelow(1024), Q_UINT64_C(2));
+}
+
+void TestMetrics::text() {
+	QMap<int, VoiceMetrics> servers;
+	servers[1].uiPacketsIn = 10;
+	servers[1].uiDrops[VoiceMetrics::DropDecrypt] = 3;
+	servers[1].lhStages[VoiceMetrics::Decrypt].add(1000);
+	servers[2].uiPacketsIn = 20;
+
+	const QByteArray out = VoiceMetrics::text(servers);
+	QCOMPARE(out.count("# TYPE murmur_voice_packets_received_total counter\n"), 1);
+	QVERIFY(out.contains("murmur_voice_packets_received_total{server=\"1\"} 10\n"));
+	QVERIFY(out.contains("murmur_voice_packets_received_total{server=\"2\"} 20\n"));
+	QVERIFY(out.contains("murmur_voice_dropped_total{server=\"1\",reason=\"decrypt\"} 3\n"));
+	QVERIFY(out.contains("murmur_voice_stage_seconds_bucket{server=\"1\",stage=\"decrypt\",le=\"+Inf\"} 1\n"));
+	QVERIFY(out.contains("murmur_voice_stage_seconds_bucket{server=\"1\",stage=\"decrypt\",le=\"1.024e-06\"} 1\n"));
+	QVERIFY(out.contains("murmur_voice_stage_seconds_bucket{server=\"1\",stage=\"decrypt\",le=\"5.12e-07\"} 0\n"));
+	QVERIFY(out.contains("murmur_voice_stage_seconds_count{server=\"2\",stage=\"route\"} 0\n"));
+}
+
+QTEST_MAIN(TestMetrics)
+#include "TestMetrics.moc"
@@ -0,0 +1,143 @@
+#include <QtCore>
+#include <QtTest>
+
+#include "TextFilter.h"
+
+class TestTextFilter : public QObject {
+		Q_OBJECT
+	private slots:
+		void plainText_data();
+		void plainText();
+		void textLength();
+		void depth();
+		void fuzz();
+};
+
+// What Server::isTextAllowed() did with a QXmlStreamReader.
+static bool referencePlainText(QString &text) {
+	if (! text.contains(QLatin1Char('<'))) {
+		text = text.simplified();
+		return true;
+	}
+
+	QXmlStreamReader qxsr(QString::fromLatin1("<document>%1</document>").arg(text));
+	QString qs;
+	while (! qxsr.atEnd()) {
+		switch (qxsr.readNext()) {
+			case QXmlStreamReader::Invalid:
+				return false;
+			case QXmlStreamReader::Characters:
+				qs += qxsr.text();
+				break;
+			case QXmlStreamReader::EndElement:
+				if ((qxsr.name() == QLatin1String("br")) || (qxsr.name() == QLatin1String("p")))
+					qs += "\n";
+				break;
+			default:
+				break;
+		}
+	}
+	text = qs.simplified();
+	return true;
+}
+
+void TestTextFilter::plainText_data() {
+	QTest::addColumn<QString>("input");
+	QTest::addColumn<bool>("valid");
+	QTest::addColumn<QString>("output");
+
+	QTest::newRow("plain") << QString::fromLatin1("  a  b\tc\n") << true << QString::fromLatin1("a b c");
+	QTest::newRow("entity without markup") << QString::fromLatin1("a &amp; b") << true << QString::fromLatin1("a &amp; b");
+	QTest::newRow("markup") << QString::fromLatin1("<b>a</b><br/>b<p>c</p>d") << true << QString::fromLatin1("a b c d");
+	QTest::newRow("entities") << QString::fromLatin1("<i>&lt;&#65;&#x42;&amp;&quot;</i>") << true << QString::fromLatin1("<AB&\"");
+	QTest::newRow("cdata") << QString::fromLatin1("<![CDATA[<b>]]>") << true << QString::fromLatin1("<b>");
+	QTest::newRow("comment") << QString::fromLatin1("a<!-- b -->c") << true << QString::fromLatin1("ac");
+	QTest::newRow("unicode") << QString::fromUtf8("<b>\xc3\xa9\xe2\x80\x83\xf0\x9f\x98\x80</b>") << true << QString::fromUtf8("\xc3\xa9 \xf0\x9f\x98\x80");
+	QTest::newRow("unclosed") << QString::fromLatin1("<b>a") << false << QString();
+	QTest::newRow("mismatched") << QString::fromLatin1("<b>a</i>") << false << QString();
+	QTest::newRow("undeclared entity") << QString::fromLatin1("<b>&nbsp;</b>") << false << QString();
+	QTest::newRow("bad character") << QString::fromLatin1("<b>&#0;</b>") << false << QString();
+	QTest::newRow("escapes document") << QString::fromLatin1("</document><document>") << false << QString();
+	QTest::newRow("unquoted") << QString::fromLatin1("<a href=x>") << false << QString();
+}
+
+void TestTextFilter::plainText() {
+	QFETCH(QString, input);
+	QFETCH(bool, valid);
+	QFETCH(QString, output);
+
+	std::string text(input.toUtf8().constData());
+	int length;
+	QCOMPARE(TextFilter::toPlainText(text, length), valid);
+	if (valid) {
+		QCOMPARE(QString::fromUtf8(text.data(), static_cast<int>(text.size())), output);
+		QCOMPARE(length, output.length());
+	}
+}
+
+void TestTextFilter::textLength() {
+	const std::string text("<p>hi <img src=\"data:image/png;base64,QUJDRA==\" alt=\"x\"/></p>");
+	int length;
+	QVERIFY(TextFilter::textLength(text, length));
+	QCOMPARE(length, TextFilter::length(text) - 30);
+	QCOMPARE(TextFilter::length(std::string("\xf0\x9f\x98\x80\xc3\xa9")), 3);
+}
+
+void TestTextFilter::depth() {
+	std::string text;
+	for (int i=0;i<TextFilter::iMaxDepth;++i)
+		text += "<b>";
+	for (int i=0;i<TextFilter::iMaxDepth;++i)
+		text += "</b>";
+	int length;
+	QVERIFY(TextFilter::textLength(text, length));
+	QVERIFY(! TextFilter::textLength("<b>" + text + "</b>", length));
+}
+
+// Random fragments of markup, some of them broken by a stray character,
+// have to come out the same as they did through QXmlStreamReader.
+void TestTextFilter::fuzz() {
+	static const char *atoms[] = {
+		"hello", "w\xc3\xb6rld", " ", "  \n", "\t", "\xf0\x9f\x98\x80", "\xe3\x80\x80",
+		"&amp;", "&lt;", "&#65;", "&#x263a;", "&nbsp;",
+		"<br/>", "<br>", "</br>", "<p>", "</p>", "<b>", "</b>", "<i>", "</i>",
+		"<img src=\"data:image/png;base64,QUJD\" alt=\"x\"/>", "<img src='a&amp;b'>",
+		"<a href=\"http://example.com/?a=1&amp;b=2\">", "</a>",
+		"<!-- c -->", "<![CDATA[ <x> ]]>"
+	};
+	static const char mutations[] = "<>/&;\"'= ";
+	const int natoms = sizeof(atoms) / sizeof(atoms[0]);
+
+	qsrand(1);
+	for (int i=0;i<20000;++i) {
+		QByteArray qba;
+		const int n = qrand() % 9;
+		for (int j=0;j<n;++j)
+			qba += atoms[qrand() % natoms];
+		const int m = qrand() % 4;
+		for (int j=0;(j<m) && ! qba.isEmpty();++j) {
+			const int pos = qrand() % qba.size();
+			if (qrand() % 2)
+				qba.remove(pos, 1);
+			else
+				qba.insert(pos, mutations[qrand() % (sizeof(mutations) - 1)]);
+		}
+		// Keep it valid UTF-8; the reference would see U+FFFD instead.
+		if (QString::fromUtf8(qba).toUtf8() != qba)
+			continue;
+
+		QString expected = QString::fromUtf8(qba);
+		const bool valid = referencePlainText(expected);
+
+		std::string text(qba.constData(), qba.size());
+		int length;
+		QCOMPARE(TextFilter::toPlainText(text, length), valid);
+		if (valid) {
+			QCOMPARE(QString::fromUtf8(text.data(), static_cast<int>(text.size())), expected);
+			QCOMPARE(length, expected.length());
+		}
+	}
+}
+
+QTEST_MAIN(TestTextFilter)
+#include "TestTextFilter.moc"
@@ -0,0 +1,9 @@
+TEMPLATE = app
+CONFIG += qt warn_on qtestlib
+CONFIG -= app_bundle
+LANGUAGE = C++
+TARGET = TestTextFilter
+SOURCES = TestTextFilter.cpp TextFilter.cpp
+HEADERS = TextFilter.h
+VPATH += .. ../murmur
+INCLUDEPATH += .. ../murmur ../mumble
@@ -1,6 +1,8 @@
 #include <QtCore>
 #include <QtTest>
 
+#include "BandwidthRecord.h"
+#include "CryptState.h"
 #include "Timer.h"
 
 class TestTimer : public QObject {
@@ -10,8 +12,64 @@ class TestTimer : public QObject {
 		void accuracy();
 		void atomicity();
 		void order();
+		void monotonic();
+		void cache();
+		void packets();
 };
 
+// Waits for the clock to pass t, giving up after a second.
+static void waitPast(quint64 t) {
+	for (int i=0;(i<1000) && (Timer::now() <= t);++i)
+		QTest::qSleep(1);
+}
+
+class CacheThread : public QThread {
+	public:
+		quint64 uiBefore, uiUpdated, uiAfter, uiReads;
+		void run();
+};
+
+void CacheThread::run() {
+	uiBefore = Timer::cached();
+	uiUpdated = Timer::update();
+	const quint64 reads = Timer::reads();
+	uiAfter = Timer::cached();
+	uiReads = Timer::reads() - reads;
+}
+
+/* Handles 10 batches of 10 voice packets like a voice thread, decrypting
+ * and rate limiting each. With bUpdate the clock is read once per batch
+ * and passed down, as Server::run() does; without it every packet reads
+ * the clock, as before the cache.
+ */
+class PacketThread : public QThread {
+	public:
+		bool bUpdate;
+		quint64 uiReads;
+		PacketThread(bool update) : bUpdate(update), uiReads(0) {}
+		void run();
+};
+
+void PacketThread::run() {
+	CryptState enc, dec;
+	enc.genKey();
+	dec.setKey(enc.raw_key, enc.decrypt_iv, enc.encrypt_iv);
+	BandwidthRecord bw;
+	unsigned char plain[64], crypted[68], decrypted[64];
+	memset(plain, 0, sizeof(plain));
+
+	const quint64 start = Timer::reads();
+	for (int i=0;i<10;++i) {
+		const quint64 now = bUpdate ? Timer::update() : 0;
+		for (int j=0;j<10;++j) {
+			enc.encrypt(plain, crypted, sizeof(plain));
+			if (dec.decrypt(crypted, decrypted, sizeof(crypted)))
+				bw.addFrame(sizeof(crypted), 1000000000, bUpdate ? now : Timer::now());
+		}
+	}
+	uiReads = Timer::reads() - start;
+}
+
 void TestTimer::accuracy() {
 	QTime a;
 	Timer t;
@@ -81,5 +139,62 @@ void TestTimer::order() {
 	QVERIFY(b < a);
 }
 
+void TestTimer::monotonic() {
+	QTime t;
+	quint64 last = Timer::now();
+
+	t.restart();
+	do {
+		quint64 n = Timer::now();
+		QVERIFY(n >= last);
+		last = n;
+	} while (t.elapsed() < 100);
+}
+
+void TestTimer::cache() {
+	// Until this thread calls update(), cached() reads the clock.
+	quint64 r = Timer::reads();
+	quint64 a = Timer::cached();
+	QCOMPARE(Timer::reads(), r + 1);
+
+	// After it, the clock is not read again.
+	quint64 n = Timer::update();
+	QVERIFY(n >= a);
+	r = Timer::reads();
+	QCOMPARE(Timer::cached(), n);
+	QCOMPARE(Timer::cached(), n);
+	QCOMPARE(Timer::reads(), r);
+
+	// Timers started from the cached time behave as before.
+	Timer t;
+	t.restart(Timer::cached());
+	waitPast(n);
+	QVERIFY(t.elapsed() > 0);
+	QVERIFY(!(t < Timer()));
+
+	// Every thread has its own cached time.
+	CacheThread ct;
+	ct.start();
+	ct.wait();
+	QVERIFY(ct.uiBefore > n);
+	QVERIFY(ct.uiUpdated >= ct.uiBefore);
+	QCOMPARE(ct.uiAfter, ct.uiUpdated);
+	QCOMPARE(ct.uiReads, Q_UINT64_C(0));
+	QCOMPARE(Timer::cached(), n);
+}
+
+void TestTimer::packets() {
+	PacketThread live(false), cached(true);
+	live.start();
+	live.wait();
+	cached.start();
+	cached.wait();
+
+	// Two reads per packet, for tLastGood and the bandwidth limit, against
+	// one per batch.
+	QCOMPARE(live.uiReads, Q_UINT64_C(200));
+	QCOMPARE(cached.uiReads, Q_UINT64_C(10));
+}
+
 QTEST_MAIN(TestTimer)
 #include "TestTimer.moc"
@@ -3,8 +3,9 @@ CONFIG += qt warn_on qtestlib
 CONFIG -= app_bundle
 LANGUAGE = C++
 TARGET = TestTimer
-SOURCES = TestTimer.cpp Timer.cpp
-HEADERS = Timer.h
-VPATH += ..
+DEFINES += TIMER_COUNT_READS
+SOURCES = TestTimer.cpp Timer.cpp CryptState.cpp BandwidthRecord.cpp
+HEADERS = Timer.h CryptState.h BandwidthRecord.h
+VPATH += .. ../murmur
 INCLUDEPATH += .. ../murmur ../mumble
-
+LIBS	+= -lcrypto
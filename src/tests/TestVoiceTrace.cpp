@@ -0,0 +1,153 @@
+#include <QtCore>
+#include <QtTest>
+
+#include "VoiceTrace.h"
+
+class TestVoiceTrace : public QObject {
+		Q_OBJECT
+		QString qsFile;
+		void record();
+	private slots:
+		void init();
+		void cleanup();
+		void roundtrip();
+		void truncated();
+		void invalid();
+		void existing();
+};
+
+void TestVoiceTrace::init() {
+	qsFile = QDir::temp().filePath(QString::fromLatin1("TestVoiceTrace-%1.trace").arg(QCoreApplication::applicationPid()));
+}
+
+void TestVoiceTrace::cleanup() {
+	QFile::remove(qsFile);
+}
+
+void TestVoiceTrace::record() {
+	VoiceTrace vt(qsFile);
+	QVERIFY(vt.isOpen());
+
+	QHash<int, QVector<VoiceTrace::User> > channels;
+	VoiceTrace::User a = { 1, VoiceTrace::UserUdp, 0xdeadbeef };
+	VoiceTrace::User b = { 2, VoiceTrace::UserDeaf, 0 };
+	VoiceTrace::User c = { 300, VoiceTrace::UserUdp, 17 };
+	channels[0] << a << b;
+	channels[42] << c;
+	vt.addRoutes(1000000, channels);
+
+	const unsigned int linked[] = { 300 };
+	vt.addVoice(1020000, 1, 0x80, 120, 0, linked, 1, NULL, 0);
+
+	const unsigned int direct[] = { 2, 300 };
+	vt.addVoice(1040000, 300, 0x83, 60, 12, NULL, 0, direct, 2);
+
+	// Out of order by a few microseconds; counts as no time passing.
+	c.uiFlags |= VoiceTrace::UserDeaf;
+	vt.addEndpoint(1039990, c);
+
+	QCOMPARE(vt.dropped(), Q_UINT64_C(0));
+}
+
+void TestVoiceTrace::roundtrip() {
+	record();
+
+	VoiceTraceReader vtr(qsFile);
+	QVERIFY(vtr.isValid());
+
+	for (int pass = 0; pass < 2; ++pass) {
+		VoiceTraceRecord r;
+
+		QVERIFY(vtr.next(r));
+		QCOMPARE(r.iKind, static_cast<int>(VoiceTrace::Routes));
+		QCOMPARE(r.uiTime, Q_UINT64_C(0));
+		QCOMPARE(r.qhChannels.count(), 2);
+		QCOMPARE(r.qhChannels.value(0).count(), 2);
+		QCOMPARE(r.qhChannels.value(0).at(0).uiSession, 1U);
+		QCOMPARE(r.qhChannels.value(0).at(0).uiContext, 0xdeadbeefU);
+		QCOMPARE(r.qhChannels.value(0).at(1).uiFlags, static_cast<unsigned int>(VoiceTrace::UserDeaf));
+		QCOMPARE(r.qhChannels.value(42).count(), 1);
+		QCOMPARE(r.qhChannels.value(42).at(0).uiSession, 300U);
+
+		QVERIFY(vtr.next(r));
+		QCOMPARE(r.iKind, static_cast<int>(VoiceTrace::Voice));
+		QCOMPARE(r.uiTime, Q_UINT64_C(20000));
+		QCOMPARE(r.uUser.uiSession, 1U);
+		QCOMPARE(r.uiHeader, 0x80U);
+		QCOMPARE(r.iLength, 120);
+		QCOMPARE(r.iPosLength, 0);
+		QCOMPARE(r.qvLinked, QVector<unsigned int>() << 300);
+		QVERIFY(r.qvDirect.isEmpty());
+
+		QVERIFY(vtr.next(r));
+		QCOMPARE(r.iKind, static_cast<int>(VoiceTrace::Voice));
+		QCOMPARE(r.uiTime, Q_UINT64_C(40000));
+		QCOMPARE(r.uiHeader, 0x83U);
+		QCOMPARE(r.iPosLength, 12);
+		QVERIFY(r.qvLinked.isEmpty());
+		QCOMPARE(r.qvDirect, QVector<unsigned int>() << 2 << 300);
+
+		QVERIFY(vtr.next(r));
+		QCOMPARE(r.iKind, static_cast<int>(VoiceTrace::Endpoint));
+		QCOMPARE(r.uiTime, Q_UINT64_C(40000));
+		QCOMPARE(r.uUser.uiSession, 300U);
+		QCOMPARE(r.uUser.uiFlags, static_cast<unsigned int>(VoiceTrace::UserUdp | VoiceTrace::UserDeaf));
+		QCOMPARE(r.uUser.uiContext, 17U);
+
+		QVERIFY(! vtr.next(r));
+		vtr.rewind();
+	}
+}
+
+void TestVoiceTrace::truncated() {
+	record();
+
+	QFile f(qsFile);
+	QVERIFY(f.open(QIODevice::ReadWrite));
+	QVERIFY(f.resize(f.size() - 3));
+	f.close();
+
+	VoiceTraceReader vtr(qsFile);
+	QVERIFY(vtr.isValid());
+
+	VoiceTraceRecord r;
+	int records = 0;
+	while (vtr.next(r))
+		++records;
+	QCOMPARE(records, 3);
+}
+
+void TestVoiceTrace::invalid() {
+	QFile f(qsFile);
+	QVERIFY(f.open(QIODevice::WriteOnly));
+	f.write("MVTRACE\2");
+	f.close();
+
+	VoiceTraceReader vtr(qsFile);
+	QVERIFY(! vtr.isValid());
+	VoiceTraceRecord r;
+	QVERIFY(! vtr.next(r));
+
+	VoiceTraceReader missing(qsFile + QLatin1String(".missing"));
+	QVERIFY(! missing.isValid());
+}
+
+// A trace never replaces a file that is already there.
+void TestVoiceTrace::existing() {
+	QFile f(qsFile);
+	QVERIFY(f.open(QIODevice::WriteOnly));
+	f.write("keep");
+	f.close();
+
+	{
+		VoiceTrace vt(qsFile);
+		QVERIFY(! vt.isOpen());
+		QVERIFY(! vt.errorString().isEmpty());
+	}
+
+	QVERIFY(f.open(QIODevice::ReadOnly));
+	QCOMPARE(f.readAll(), QByteArray("keep"));
+}
+
+QTEST_MAIN(TestVoiceTrace)
+#include "TestVoiceTrace.moc"
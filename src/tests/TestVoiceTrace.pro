@@ -0,0 +1,9 @@
+TEMPLATE = app
+CONFIG += qt warn_on qtestlib
+CONFIG -= app_bundle
+LANGUAGE = C++
+TARGET = TestVoiceTrace
+SOURCES = TestVoiceTrace.cpp VoiceTrace.cpp
+HEADERS = VoiceTrace.h
+VPATH += .. ../murmur
+INCLUDEPATH += .. ../murmur ../mumble
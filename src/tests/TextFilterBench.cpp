@@ -0,0 +1,105 @@
+#include <QtCore>
+
+#include "TextFilter.h"
+#include "Timer.h"
+
+#define MESSAGES 2000
+#define IMAGE_BYTES 131072
+
+static int oldTextLength(const QString &text) {
+	QString qsOut;
+	QXmlStreamReader qxsr(QString::fromLatin1("<document>%1</document>").arg(text));
+	QXmlStreamWriter qxsw(&qsOut);
+	while (! qxsr.atEnd()) {
+		switch (qxsr.readNext()) {
+			case QXmlStreamReader::Invalid:
+				return -1;
+			case QXmlStreamReader::StartElement: {
+					if (qxsr.name() == QLatin1String("img")) {
+						qxsw.writeStartElement(qxsr.namespaceUri().toString(), qxsr.name().toString());
+						foreach(const QXmlStreamAttribute &a, qxsr.attributes())
+							if (a.name() != QLatin1String("src"))
+								qxsw.writeAttribute(a);
+					} else {
+						qxsw.writeCurrentToken(qxsr);
+					}
+				}
+				break;
+			default:
+				qxsw.writeCurrentToken(qxsr);
+				break;
+		}
+	}
+	return qsOut.length();
+}
+
+static bool oldPlainText(QString &text) {
+	QXmlStreamReader qxsr(QString::fromLatin1("<document>%1</document>").arg(text));
+	QString qs;
+	while (! qxsr.atEnd()) {
+		switch (qxsr.readNext()) {
+			case QXmlStreamReader::Invalid:
+				return false;
+			case QXmlStreamReader::Characters:
+				qs += qxsr.text();
+				break;
+			case QXmlStreamReader::EndElement:
+				if ((qxsr.name() == QLatin1String("br")) || (qxsr.name() == QLatin1String("p")))
+					qs += "\n";
+				break;
+			default:
+				break;
+		}
+	}
+	text = qs.simplified();
+	return true;
+}
+
+int main(int argc, char **argv) {
+	QCoreApplication a(argc, argv);
+
+	qsrand(1);
+
+	QByteArray image;
+	image.resize(IMAGE_BYTES * 3 / 4);
+	for (int i=0;i<image.size();++i)
+		image[i] = static_cast<char>(qrand());
+	const QByteArray msg = "<p>Look at <b>this</b>:<br/><img src=\"data:image/png;base64," + image.toBase64() + "\" alt=\"screenshot\"/></p>";
+	const std::string utf8(msg.constData(), msg.size());
+
+	Timer t;
+	quint64 sum = 0;
+
+	t.restart();
+	for (int i=0;i<MESSAGES;++i)
+		sum += oldTextLength(QString::fromUtf8(utf8.data(), static_cast<int>(utf8.size())));
+	const quint64 oldlength = t.restart();
+
+	for (int i=0;i<MESSAGES;++i) {
+		int length;
+		if (TextFilter::textLength(utf8, length))
+			sum += length;
+	}
+	const quint64 newlength = t.restart();
+
+	for (int i=0;i<MESSAGES;++i) {
+		QString text = QString::fromUtf8(utf8.data(), static_cast<int>(utf8.size()));
+		if (oldPlainText(text))
+			sum += text.length();
+	}
+	const quint64 oldplain = t.restart();
+
+	for (int i=0;i<MESSAGES;++i) {
+		std::string text(utf8);
+		int length;
+		if (TextFilter::toPlainText(text, length))
+			sum += length;
+	}
+	const quint64 newplain = t.restart();
+
+	qWarning("%d messages of %d bytes (%llu)", MESSAGES, msg.size(), sum);
+	qWarning("text length:  QXmlStreamReader/Writer %8.2f ms, TextFilter %8.2f ms", oldlength / 1000.0, newlength / 1000.0);
+	qWarning("plain text:   QXmlStreamReader        %8.2f ms, TextFilter %8.2f ms", oldplain / 1000.0, newplain / 1000.0);
+
+	return 0;
+}
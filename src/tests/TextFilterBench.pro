@@ -0,0 +1,9 @@
+TEMPLATE = app
+CONFIG += qt thread warn_on release
+CONFIG -= app_bundle
+LANGUAGE = C++
+TARGET = TextFilterBench
+SOURCES = TextFilterBench.cpp TextFilter.cpp Timer.cpp
+HEADERS = TextFilter.h Timer.h
+VPATH += .. ../murmur
+INCLUDEPATH += .. ../murmur ../mumble
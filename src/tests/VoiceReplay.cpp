@@ -0,0 +1,370 @@
+/**
+ * Replays a voice trace recorded by murmur (see "voicetrace" in
+ * murmur.ini) through VoiceRouter, the routing core of
+ * Server::processMsg(): the bandwidth limit, walking the voice frames,
+ * routing to the speaker's channel, links and whisper targets, the deaf
+ * and positional checks, and the fan-out with encryption and sendmmsg()
+ * for UDP users or UDPTunnel frames for TCP users. UDP datagrams go to a
+ * local socket nobody reads from.
+ *
+ * The trace holds each packet's size and the recipients murmur resolved
+ * for it, so the same trace gives the same work on every run and machine.
+ * Reports the per-packet cost, which is what to compare between builds.
+ *
+ * Usage: VoiceReplay <trace> [option=value ...]
+ *   iterations  passes over the trace (1)
+ *   bandwidth   the server's "bandwidth" setting in bits/s (72000)
+ *   send        0 to encrypt without sending (1)
+ *   crypt       0 to also skip encryption, leaving routing only (1)
+ */
+
+#include <QtCore>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "BandwidthRecord.h"
+#include "CryptState.h"
+#include "Message.h"
+#include "PacketDataStream.h"
+#include "Timer.h"
+#include "VoiceRouter.h"
+#include "VoiceTrace.h"
+
+// Datagrams queued before a sendmmsg(), like Server::ubSend.
+#define BATCH 128
+#define SLOT_SIZE (UDP_PACKET_SIZE + 4)
+
+struct Peer {
+	VoiceEndpoint veEndpoint;
+	// Stands in for ServerUser::ssContext. The trace only has its hash, so
+	// equal hashes are taken as the same context.
+	std::string ssContext;
+	BandwidthRecord bwr;
+
+	Peer(unsigned int session, int sock, quint64 now) : veEndpoint(NULL, &ssContext), bwr(now) {
+		veEndpoint.uiSession = session;
+		veEndpoint.bUdp = false;
+		veEndpoint.sUdpSocket = sock;
+		veEndpoint.qaiUdpAddress.fetchAndStoreRelease(1);
+		veEndpoint.csCrypt.genKey();
+	}
+};
+
+class VoiceReplay : public VoiceSink {
+	public:
+		int sock;
+		struct sockaddr_in saiSink;
+		int iMaxBandwidth;
+		bool bSend, bCrypt;
+
+		QVector<VoiceTraceRecord> qvRecords;
+		// Voice packets as clients would have sent them, one per record.
+		QVector<QByteArray> qvPackets;
+
+		QHash<unsigned int, Peer *> qhPeers;
+		// What Server::publishRoutes() would have built.
+		RoutingTable rtRoutes;
+		// Stands in for the TCP connections of users without UDP.
+		QHash<unsigned int, QByteArray> qhTunnel;
+
+		QVector<char> qvBatch;
+		int iBatchUsed;
+#ifdef Q_OS_LINUX
+		QVector<struct mmsghdr> qvMsg;
+		QVector<struct iovec> qvIov;
+#endif
+
+		quint64 uiVoice, uiDropped, uiDatagrams, uiTunnelled, uiSends;
+
+		VoiceReplay(int sock, const struct sockaddr_in &sink, int bandwidth, bool send, bool crypt);
+		~VoiceReplay();
+		bool load(const QString &fname);
+		quint64 duration() const;
+		void replay(quint64 offset);
+		void datagram(VoiceEndpoint *ep, const char *data, int len, char *buffer);
+		void tunnel(VoiceEndpoint *ep, const char *data, int len, QByteArray &cache);
+	protected:
+		Peer *peer(unsigned int session, quint64 now);
+		void updatePeer(const VoiceTrace::User &user, quint64 now);
+		void routes(const VoiceTraceRecord &r, quint64 now);
+		void add(VoiceRouter &vr, const QVector<unsigned int> &sessions);
+		void processMsg(const VoiceTraceRecord &r, const QByteArray &packet, quint64 now);
+		void flush();
+};
+
+/* Builds a packet of the recorded length and type, with an Opus frame or a
+ * chain of CELT/Speex frames followed by the positional data, so
+ * processMsg() walks it like the original.
+ */
+static QByteArray synthesize(const VoiceTraceRecord &r, unsigned int sequence) {
+	QByteArray qba(qMax(r.iLength, 1), 0);
+	char *data = qba.data();
+	data[0] = static_cast<char>(r.uiHeader);
+
+	PacketDataStream pds(data + 1, qba.size() - 1);
+	pds << sequence;
+
+	int left = qba.size() - 1 - static_cast<int>(pds.size()) - r.iPosLength;
+	if (((r.uiHeader >> 5) & 0x7) == MessageHandler::UDPVoiceOpus) {
+		int size = qMax(left - 1, 0);
+		if (size >= 0x80)
+			size = left - 2;
+		pds << size;
+		pds.skip(size);
+	} else {
+		while (left > 0) {
+			const int size = qMin(left - 1, 0x7f);
+			left -= size + 1;
+			pds.append(static_cast<quint64>(size | ((left > 0) ? 0x80 : 0)));
+			pds.skip(size);
+		}
+	}
+	for (int i = pds.size() + 1; i < qba.size(); ++i)
+		data[i] = static_cast<char>(i);
+	return qba;
+}
+
+VoiceReplay::VoiceReplay(int s, const struct sockaddr_in &sink, int bandwidth, bool send, bool crypt) : sock(s), saiSink(sink), iMaxBandwidth(bandwidth), bSend(send), bCrypt(crypt) {
+	qvBatch.resize(BATCH * SLOT_SIZE);
+	iBatchUsed = 0;
+#ifdef Q_OS_LINUX
+	qvMsg.resize(BATCH);
+	qvIov.resize(BATCH);
+	memset(qvMsg.data(), 0, sizeof(struct mmsghdr) * BATCH);
+#endif
+	uiVoice = uiDropped = uiDatagrams = uiTunnelled = uiSends = 0;
+}
+
+VoiceReplay::~VoiceReplay() {
+	qDeleteAll(qhPeers);
+}
+
+bool VoiceReplay::load(const QString &fname) {
+	VoiceTraceReader vtr(fname);
+	if (! vtr.isValid())
+		return false;
+
+	VoiceTraceRecord r;
+	unsigned int sequence = 0;
+	while (vtr.next(r)) {
+		qvRecords << r;
+		qvPackets << ((r.iKind == VoiceTrace::Voice) ? synthesize(r, ++sequence) : QByteArray());
+	}
+	return true;
+}
+
+quint64 VoiceReplay::duration() const {
+	return qvRecords.isEmpty() ? 0 : qvRecords.last().uiTime;
+}
+
+Peer *VoiceReplay::peer(unsigned int session, quint64 now) {
+	Peer *p = qhPeers.value(session);
+	if (! p) {
+		p = new Peer(session, sock, now);
+		qhPeers.insert(session, p);
+	}
+	return p;
+}
+
+void VoiceReplay::updatePeer(const VoiceTrace::User &user, quint64 now) {
+	Peer *p = peer(user.uiSession, now);
+	p->veEndpoint.bDeaf = user.uiFlags & VoiceTrace::UserDeaf;
+	p->veEndpoint.bUdp = user.uiFlags & VoiceTrace::UserUdp;
+	p->veEndpoint.uiContext = user.uiContext;
+	p->ssContext = QByteArray::number(user.uiContext).constData();
+}
+
+void VoiceReplay::routes(const VoiceTraceRecord &r, quint64 now) {
+	rtRoutes.qhListeners.clear();
+	rtRoutes.qhUserChannel.clear();
+
+	QHash<int, QVector<VoiceTrace::User> >::const_iterator i;
+	for (i = r.qhChannels.constBegin(); i != r.qhChannels.constEnd(); ++i) {
+		QVector<VoiceEndpoint *> &listeners = rtRoutes.qhListeners[i.key()];
+		foreach(const VoiceTrace::User &user, i.value()) {
+			updatePeer(user, now);
+			listeners << & qhPeers.value(user.uiSession)->veEndpoint;
+			rtRoutes.qhUserChannel.insert(user.uiSession, i.key());
+		}
+	}
+}
+
+void VoiceReplay::replay(quint64 offset) {
+	for (int i = 0; i < qvRecords.count(); ++i) {
+		const VoiceTraceRecord &r = qvRecords.at(i);
+		const quint64 now = offset + r.uiTime;
+		switch (r.iKind) {
+			case VoiceTrace::Voice:
+				processMsg(r, qvPackets.at(i), now);
+				break;
+			case VoiceTrace::Routes:
+				routes(r, now);
+				break;
+			case VoiceTrace::Endpoint:
+				updatePeer(r.uUser, now);
+				break;
+		}
+	}
+	flush();
+}
+
+// Adds the recorded recipients that are still connected.
+void VoiceReplay::add(VoiceRouter &vr, const QVector<unsigned int> &sessions) {
+	foreach(unsigned int session, sessions) {
+		Peer *p = qhPeers.value(session);
+		if (p)
+			vr.add(&p->veEndpoint);
+	}
+}
+
+void VoiceReplay::processMsg(const VoiceTraceRecord &r, const QByteArray &packet, quint64 now) {
+	Peer *self = peer(r.uUser.uiSession, now);
+
+	++uiVoice;
+
+	if (! VoiceRouter::admit(&self->bwr, packet.size(), iMaxBandwidth, now)) {
+		++uiDropped;
+		return;
+	}
+
+	VoiceRouter vr(&self->veEndpoint, packet.constData(), packet.size());
+
+	if (vr.uiTarget == 0x1f) {
+		vr.loopback(this);
+	} else if (vr.uiTarget == 0) {
+		vr.addListeners(&rtRoutes, rtRoutes.qhUserChannel.value(r.uUser.uiSession, -1));
+		// The recorded members of linked channels the speaker could talk to.
+		add(vr, r.qvLinked);
+		vr.send(this, 0);
+	} else {
+		if (! r.qvLinked.isEmpty()) {
+			add(vr, r.qvLinked);
+			vr.send(this, 1);
+		}
+		if (! r.qvDirect.isEmpty()) {
+			add(vr, r.qvDirect);
+			vr.send(this, 2);
+		}
+	}
+}
+
+void VoiceReplay::datagram(VoiceEndpoint *ep, const char *data, int len, char *buffer) {
+#ifdef Q_OS_LINUX
+	buffer = qvBatch.data() + iBatchUsed * SLOT_SIZE;
+#endif
+	if (bCrypt)
+		ep->csCrypt.encrypt(reinterpret_cast<const unsigned char *>(data), reinterpret_cast<unsigned char *>(buffer), len);
+#ifdef Q_OS_LINUX
+	qvIov[iBatchUsed].iov_base = buffer;
+	qvIov[iBatchUsed].iov_len = len + 4;
+	struct msghdr *msg = &qvMsg[iBatchUsed].msg_hdr;
+	msg->msg_name = &saiSink;
+	msg->msg_namelen = sizeof(saiSink);
+	msg->msg_iov = &qvIov[iBatchUsed];
+	msg->msg_iovlen = 1;
+	if (++iBatchUsed == BATCH)
+		flush();
+#else
+	if (bSend) {
+		::sendto(sock, buffer, len + 4, 0, reinterpret_cast<struct sockaddr *>(&saiSink), sizeof(saiSink));
+		++uiSends;
+	}
+#endif
+	++uiDatagrams;
+}
+
+void VoiceReplay::tunnel(VoiceEndpoint *ep, const char *data, int len, QByteArray &cache) {
+	VoiceRouter::tunnelMessage(cache, data, len);
+
+	// Written out by the main thread in murmur; here just dropped once
+	// there is enough of it.
+	QByteArray &pending = qhTunnel[ep->uiSession];
+	if (pending.size() > 65536)
+		pending.clear();
+	pending.append(cache);
+	++uiTunnelled;
+}
+
+void VoiceReplay::flush() {
+#ifdef Q_OS_LINUX
+	int sent = 0;
+	while (bSend && (sent < iBatchUsed)) {
+		int ret = ::sendmmsg(sock, qvMsg.data() + sent, iBatchUsed - sent, 0);
+		++uiSends;
+		if (ret <= 0)
+			break;
+		sent += ret;
+	}
+#endif
+	iBatchUsed = 0;
+}
+
+int main(int argc, char **argv) {
+	QCoreApplication a(argc, argv);
+
+	if (argc < 2)
+		qFatal("Usage: VoiceReplay <trace> [option=value ...]; see VoiceReplay.cpp for the options");
+
+	static const char *names[] = { "iterations", "bandwidth", "send", "crypt" };
+	QMap<QByteArray, QByteArray> opts;
+	for (int i = 2; i < argc; ++i) {
+		const QByteArray arg(argv[i]);
+		const int eq = arg.indexOf('=');
+		bool known = false;
+		for (unsigned int j = 0; j < sizeof(names) / sizeof(names[0]); ++j)
+			known = known || (arg.left(eq) == names[j]);
+		if ((eq < 0) || ! known)
+			qFatal("Unknown option %s", argv[i]);
+		opts.insert(arg.left(eq), arg.mid(eq + 1));
+	}
+	const int iterations = qMax(opts.value("iterations", "1").toInt(), 1);
+	const int bandwidth = opts.value("bandwidth", "72000").toInt();
+	const bool crypt = opts.value("crypt", "1").toInt() != 0;
+	const bool send = crypt && (opts.value("send", "1").toInt() != 0);
+
+	int sink = ::socket(AF_INET, SOCK_DGRAM, 0);
+	int sock = ::socket(AF_INET, SOCK_DGRAM, 0);
+	if ((sink < 0) || (sock < 0))
+		qFatal("Failed to create sockets");
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	socklen_t addrlen = sizeof(addr);
+	if ((::bind(sink, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0) || (getsockname(sink, reinterpret_cast<struct sockaddr *>(&addr), &addrlen) != 0))
+		qFatal("Failed to bind sink socket: %s", strerror(errno));
+
+	VoiceReplay vr(sock, addr, bandwidth, send, crypt);
+	if (! vr.load(QString::fromLocal8Bit(argv[1])))
+		qFatal("Failed to read trace %s", argv[1]);
+	qWarning("%d records over %.1f seconds", vr.qvRecords.count(), static_cast<double>(vr.duration()) / 1000000.0);
+
+	// Each pass starts a second after the last ended, so bandwidth
+	// limits see the same gaps every time.
+	Timer t;
+	for (int i = 0; i < iterations; ++i)
+		vr.replay(i * (vr.duration() + 1000000));
+	const quint64 elapsed = qMax(t.elapsed(), Q_UINT64_C(1));
+
+	const double packets = static_cast<double>(qMax(vr.uiVoice, Q_UINT64_C(1)));
+	qWarning("%llu voice packets, %llu over bandwidth, %llu datagrams in %llu sends, %llu tunnelled",
+	         static_cast<unsigned long long>(vr.uiVoice), static_cast<unsigned long long>(vr.uiDropped),
+	         static_cast<unsigned long long>(vr.uiDatagrams), static_cast<unsigned long long>(vr.uiSends),
+	         static_cast<unsigned long long>(vr.uiTunnelled));
+	qWarning("%.0f packets/s, %.0f nsec/packet, %.0f nsec/recipient, %.1fx real time",
+	         packets * 1000000.0 / static_cast<double>(elapsed),
+	         static_cast<double>(elapsed) * 1000.0 / packets,
+	         static_cast<double>(elapsed) * 1000.0 / static_cast<double>(qMax(vr.uiDatagrams + vr.uiTunnelled, Q_UINT64_C(1))),
+	         static_cast<double>(vr.duration()) * iterations / static_cast<double>(elapsed));
+
+	close(sock);
+	close(sink);
+	return 0;
+}
@@ -0,0 +1,10 @@
+TEMPLATE = app
+CONFIG += qt thread warn_on release
+CONFIG -= app_bundle
+LANGUAGE = C++
+TARGET = VoiceReplay
+HEADERS = Timer.h CryptState.h BandwidthRecord.h Message.h VoiceRouter.h VoiceTrace.h
+SOURCES = VoiceReplay.cpp VoiceRouter.cpp VoiceTrace.cpp BandwidthRecord.cpp CryptState.cpp Timer.cpp
+VPATH += .. ../murmur
+INCLUDEPATH += .. ../murmur ../mumble
+LIBS	+= -lcrypto